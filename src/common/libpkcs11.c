@@ -61,6 +61,20 @@ failed:
 	return NULL;
 }
 
+/*
+ * Look up a function the module exports besides C_GetFunctionList,
+ * such as a vendor extension
+ */
+void *
+C_GetModuleSymbol(void *module, const char *name)
+{
+	sc_pkcs11_module_t *mod = (sc_pkcs11_module_t *) module;
+
+	if (!mod || mod->_magic != MAGIC || mod->handle == NULL || name == NULL)
+		return NULL;
+	return sc_dlsym(mod->handle, name);
+}
+
 /*
  * Unload a pkcs11 module.
  * The calling application is responsible for cleaning up
@@ -0,0 +1,395 @@
+/*
+ * pkcs11-agent-proto.c: Message encoding for the opensc-agent wire protocol
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef __linux__
+/* struct ucred */
+#define _GNU_SOURCE
+#endif
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "common/pkcs11-agent-proto.h"
+
+void p11_agent_buf_init(p11_agent_buf_t *buf)
+{
+	memset(buf, 0, sizeof(*buf));
+}
+
+void p11_agent_buf_reset(p11_agent_buf_t *buf)
+{
+	if (buf->data)
+		memset(buf->data, 0, buf->len);
+	buf->len = 0;
+	buf->pos = 0;
+	buf->error = 0;
+	buf->hdr_len = 0;
+}
+
+void p11_agent_buf_free(p11_agent_buf_t *buf)
+{
+	if (buf->data) {
+		/* messages carry PINs and plain text */
+		memset(buf->data, 0, buf->size);
+		free(buf->data);
+	}
+	memset(buf, 0, sizeof(*buf));
+}
+
+static int buf_reserve(p11_agent_buf_t *buf, size_t len)
+{
+	unsigned char *p;
+	size_t size;
+
+	if (buf->error)
+		return -1;
+	if (len > P11_AGENT_MAX_MESSAGE || buf->len + len > P11_AGENT_MAX_MESSAGE) {
+		buf->error = 1;
+		return -1;
+	}
+	if (buf->len + len <= buf->size)
+		return 0;
+	for (size = buf->size ? buf->size : 256; size < buf->len + len; size *= 2)
+		;
+	p = malloc(size);
+	if (!p) {
+		buf->error = 1;
+		return -1;
+	}
+	if (buf->data) {
+		memcpy(p, buf->data, buf->len);
+		memset(buf->data, 0, buf->size);
+		free(buf->data);
+	}
+	buf->data = p;
+	buf->size = size;
+	return 0;
+}
+
+void p11_agent_put_ulong(p11_agent_buf_t *buf, CK_ULONG value)
+{
+	unsigned long long v = value;
+	int i;
+
+	if (buf_reserve(buf, 8) < 0)
+		return;
+	for (i = 7; i >= 0; i--, v >>= 8)
+		buf->data[buf->len + i] = v & 0xFF;
+	buf->len += 8;
+}
+
+void p11_agent_put_bytes(p11_agent_buf_t *buf, const void *data, CK_ULONG len)
+{
+	if (!data) {
+		p11_agent_put_ulong(buf, P11_AGENT_NULL_PTR);
+		return;
+	}
+	p11_agent_put_ulong(buf, len);
+	if (buf_reserve(buf, len) < 0)
+		return;
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+void p11_agent_put_mechanism(p11_agent_buf_t *buf, const CK_MECHANISM *mech)
+{
+	p11_agent_put_ulong(buf, mech->mechanism);
+	p11_agent_put_bytes(buf, mech->pParameter, mech->ulParameterLen);
+}
+
+void p11_agent_put_template(p11_agent_buf_t *buf, const CK_ATTRIBUTE *templ, CK_ULONG count)
+{
+	CK_ULONG i;
+
+	p11_agent_put_ulong(buf, count);
+	for (i = 0; i < count; i++) {
+		p11_agent_put_ulong(buf, templ[i].type);
+		p11_agent_put_bytes(buf, templ[i].pValue, templ[i].ulValueLen);
+	}
+}
+
+CK_ULONG p11_agent_get_ulong(p11_agent_buf_t *buf)
+{
+	unsigned long long v = 0;
+	int i;
+
+	if (buf->error || buf->len - buf->pos < 8) {
+		buf->error = 1;
+		return 0;
+	}
+	for (i = 0; i < 8; i++)
+		v = (v << 8) | buf->data[buf->pos + i];
+	buf->pos += 8;
+	return (CK_ULONG) v;
+}
+
+void p11_agent_get_bytes(p11_agent_buf_t *buf, const unsigned char **data, CK_ULONG *len)
+{
+	CK_ULONG l = p11_agent_get_ulong(buf);
+
+	*data = NULL;
+	*len = 0;
+	if (buf->error || l == P11_AGENT_NULL_PTR)
+		return;
+	if (buf->len - buf->pos < l) {
+		buf->error = 1;
+		return;
+	}
+	*data = buf->data + buf->pos;
+	*len = l;
+	buf->pos += l;
+}
+
+void p11_agent_get_fixed(p11_agent_buf_t *buf, void *out, size_t len)
+{
+	const unsigned char *data;
+	CK_ULONG l;
+
+	p11_agent_get_bytes(buf, &data, &l);
+	if (buf->error || !data || l != len) {
+		buf->error = 1;
+		memset(out, 0, len);
+		return;
+	}
+	memcpy(out, data, len);
+}
+
+void p11_agent_get_mechanism(p11_agent_buf_t *buf, CK_MECHANISM *mech)
+{
+	const unsigned char *param;
+	CK_ULONG len;
+
+	mech->mechanism = p11_agent_get_ulong(buf);
+	p11_agent_get_bytes(buf, &param, &len);
+	mech->pParameter = (CK_VOID_PTR) param;
+	mech->ulParameterLen = len;
+}
+
+CK_ATTRIBUTE_PTR p11_agent_get_template(p11_agent_buf_t *buf, CK_ULONG *count)
+{
+	CK_ATTRIBUTE_PTR templ;
+	const unsigned char *value;
+	CK_ULONG i, n, len;
+
+	*count = 0;
+	n = p11_agent_get_ulong(buf);
+	/* every attribute takes at least 16 bytes on the wire */
+	if (buf->error || n > (buf->len - buf->pos) / 16) {
+		buf->error = 1;
+		return NULL;
+	}
+	templ = calloc(n + 1, sizeof(CK_ATTRIBUTE));
+	if (!templ) {
+		buf->error = 1;
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		templ[i].type = p11_agent_get_ulong(buf);
+		p11_agent_get_bytes(buf, &value, &len);
+		templ[i].pValue = (CK_VOID_PTR) value;
+		templ[i].ulValueLen = value ? len : 0;
+	}
+	if (buf->error) {
+		free(templ);
+		return NULL;
+	}
+	*count = n;
+	return templ;
+}
+
+static int write_all(int fd, const unsigned char *data, size_t len)
+{
+	struct pollfd pfd;
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, data, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* a non-blocking peer that does not read is given up */
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			if (poll(&pfd, 1, P11_AGENT_IO_TIMEOUT) <= 0)
+				return -1;
+			continue;
+		}
+		if (r <= 0)
+			return -1;
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static int read_all(int fd, unsigned char *data, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = read(fd, data, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+int p11_agent_send(int fd, const p11_agent_buf_t *buf)
+{
+	unsigned char hdr[4];
+
+	if (buf->error)
+		return -1;
+	hdr[0] = (buf->len >> 24) & 0xFF;
+	hdr[1] = (buf->len >> 16) & 0xFF;
+	hdr[2] = (buf->len >> 8) & 0xFF;
+	hdr[3] = buf->len & 0xFF;
+	if (write_all(fd, hdr, sizeof(hdr)) < 0)
+		return -1;
+	return write_all(fd, buf->data, buf->len);
+}
+
+int p11_agent_recv(int fd, p11_agent_buf_t *buf)
+{
+	unsigned char hdr[4];
+	size_t len;
+
+	p11_agent_buf_reset(buf);
+	if (read_all(fd, hdr, sizeof(hdr)) < 0)
+		return -1;
+	len = ((size_t) hdr[0] << 24) | ((size_t) hdr[1] << 16) | ((size_t) hdr[2] << 8) | hdr[3];
+	if (len == 0 || buf_reserve(buf, len) < 0)
+		return -1;
+	if (read_all(fd, buf->data, len) < 0)
+		return -1;
+	buf->len = len;
+	return 0;
+}
+
+static size_t frame_len(const unsigned char *hdr)
+{
+	return ((size_t) hdr[0] << 24) | ((size_t) hdr[1] << 16) | ((size_t) hdr[2] << 8) | hdr[3];
+}
+
+int p11_agent_recv_some(int fd, p11_agent_buf_t *buf)
+{
+	size_t len;
+	ssize_t r;
+
+	for (;;) {
+		if (buf->hdr_len < sizeof(buf->hdr)) {
+			r = read(fd, buf->hdr + buf->hdr_len, sizeof(buf->hdr) - buf->hdr_len);
+		}
+		else {
+			len = frame_len(buf->hdr);
+			if (buf->len == len)
+				return 1;
+			r = read(fd, buf->data + buf->len, len - buf->len);
+		}
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (r <= 0)
+			return -1;
+
+		if (buf->hdr_len < sizeof(buf->hdr)) {
+			buf->hdr_len += r;
+			if (buf->hdr_len < sizeof(buf->hdr))
+				continue;
+			len = frame_len(buf->hdr);
+			if (len == 0 || buf_reserve(buf, len) < 0)
+				return -1;
+		}
+		else {
+			buf->len += r;
+		}
+	}
+}
+
+int p11_agent_socket_path(char *path, size_t size)
+{
+	const char *env, *dir;
+	int r;
+
+	env = getenv(P11_AGENT_SOCKET_ENV);
+	if (env && *env)
+		r = snprintf(path, size, "%s", env);
+	else if ((dir = getenv("XDG_RUNTIME_DIR")) != NULL && *dir)
+		r = snprintf(path, size, "%s/%s", dir, P11_AGENT_SOCKET_NAME);
+	else
+		r = snprintf(path, size, "/tmp/opensc-agent-%lu/%s",
+				(unsigned long) getuid(), P11_AGENT_SOCKET_NAME);
+	if (r < 0 || (size_t) r >= size)
+		return -1;
+	return 0;
+}
+
+int p11_agent_check_dir(const char *path)
+{
+	char dir[1024], *p;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(dir))
+		return -1;
+	strcpy(dir, path);
+	p = strrchr(dir, '/');
+	if (p == NULL)
+		strcpy(dir, ".");
+	else if (p == dir)
+		p[1] = '\0';
+	else
+		*p = '\0';
+
+	/* anybody who can write to the directory can put a socket of their own there */
+	if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode)
+			|| st.st_uid != getuid() || (st.st_mode & 077) != 0)
+		return -1;
+	return 0;
+}
+
+int p11_agent_peer_uid(int fd, uid_t *uid)
+{
+#if defined(SO_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || len != sizeof(cred))
+		return -1;
+	*uid = cred.uid;
+	return 0;
+#elif defined(HAVE_GETPEEREID)
+	gid_t gid;
+
+	return getpeereid(fd, uid, &gid) < 0 ? -1 : 0;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,146 @@
+/*
+ * pkcs11-agent-proto.h: Wire protocol between opensc-agent and its PKCS#11 client module
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __PKCS11_AGENT_PROTO_H__
+#define __PKCS11_AGENT_PROTO_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "pkcs11/pkcs11.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every message is a 32 bit big endian body length followed by the body.
+ * A request body starts with the operation code, a response body with the
+ * CK_RV of the call. Arguments follow in the order of the C_* prototype.
+ * Both ends run on the same host, fixed size Cryptoki structures
+ * (CK_INFO, CK_TOKEN_INFO, ...) are sent in native layout; the HELLO
+ * exchange makes sure both ends agree on it.
+ */
+#define P11_AGENT_PROTOCOL_VERSION	1
+#define P11_AGENT_MAX_MESSAGE		(1024 * 1024)
+#define P11_AGENT_SOCKET_ENV		"OPENSC_AGENT_SOCKET"
+#define P11_AGENT_SOCKET_NAME		"opensc-agent.sock"
+/* milliseconds a peer may keep a partial message waiting */
+#define P11_AGENT_IO_TIMEOUT		10000
+
+/* length marker for a NULL buffer pointer */
+#define P11_AGENT_NULL_PTR		((CK_ULONG) -1)
+
+enum p11_agent_op {
+	P11A_HELLO = 1,
+	P11A_GET_INFO,
+	P11A_GET_SLOT_LIST,
+	P11A_GET_SLOT_INFO,
+	P11A_GET_TOKEN_INFO,
+	P11A_GET_MECHANISM_LIST,
+	P11A_GET_MECHANISM_INFO,
+	P11A_INIT_PIN,
+	P11A_SET_PIN,
+	P11A_OPEN_SESSION,
+	P11A_CLOSE_SESSION,
+	P11A_CLOSE_ALL_SESSIONS,
+	P11A_GET_SESSION_INFO,
+	P11A_LOGIN,
+	P11A_LOGOUT,
+	P11A_CREATE_OBJECT,
+	P11A_DESTROY_OBJECT,
+	P11A_GET_ATTRIBUTE_VALUE,
+	P11A_SET_ATTRIBUTE_VALUE,
+	P11A_FIND_OBJECTS_INIT,
+	P11A_FIND_OBJECTS,
+	P11A_FIND_OBJECTS_FINAL,
+	P11A_ENCRYPT_INIT,
+	P11A_ENCRYPT,
+	P11A_DECRYPT_INIT,
+	P11A_DECRYPT,
+	P11A_DIGEST_INIT,
+	P11A_DIGEST,
+	P11A_DIGEST_UPDATE,
+	P11A_DIGEST_FINAL,
+	P11A_SIGN_INIT,
+	P11A_SIGN,
+	P11A_SIGN_UPDATE,
+	P11A_SIGN_FINAL,
+	P11A_VERIFY_INIT,
+	P11A_VERIFY,
+	P11A_VERIFY_UPDATE,
+	P11A_VERIFY_FINAL,
+	P11A_GENERATE_KEY_PAIR,
+	P11A_SEED_RANDOM,
+	P11A_GENERATE_RANDOM,
+	P11A_OP_MAX
+};
+
+typedef struct p11_agent_buf {
+	unsigned char *data;
+	size_t len;		/* bytes used */
+	size_t size;		/* bytes allocated */
+	size_t pos;		/* read position */
+	int error;		/* set on overrun or allocation failure */
+	/* state of a message received in pieces, see p11_agent_recv_some() */
+	unsigned char hdr[4];
+	size_t hdr_len;
+} p11_agent_buf_t;
+
+void p11_agent_buf_init(p11_agent_buf_t *buf);
+void p11_agent_buf_reset(p11_agent_buf_t *buf);
+void p11_agent_buf_free(p11_agent_buf_t *buf);
+
+void p11_agent_put_ulong(p11_agent_buf_t *buf, CK_ULONG value);
+/* data may be NULL, then P11_AGENT_NULL_PTR is sent as length */
+void p11_agent_put_bytes(p11_agent_buf_t *buf, const void *data, CK_ULONG len);
+void p11_agent_put_mechanism(p11_agent_buf_t *buf, const CK_MECHANISM *mech);
+/* attribute types and values */
+void p11_agent_put_template(p11_agent_buf_t *buf, const CK_ATTRIBUTE *templ, CK_ULONG count);
+
+CK_ULONG p11_agent_get_ulong(p11_agent_buf_t *buf);
+/* returns a pointer into the buffer, *data is NULL for a NULL buffer */
+void p11_agent_get_bytes(p11_agent_buf_t *buf, const unsigned char **data, CK_ULONG *len);
+/* copy exactly len bytes into out */
+void p11_agent_get_fixed(p11_agent_buf_t *buf, void *out, size_t len);
+/* mechanism parameter points into the buffer */
+void p11_agent_get_mechanism(p11_agent_buf_t *buf, CK_MECHANISM *mech);
+/* allocated template, attribute values point into the buffer */
+CK_ATTRIBUTE_PTR p11_agent_get_template(p11_agent_buf_t *buf, CK_ULONG *count);
+
+/* Send or receive one message, returns 0 on success, -1 on I/O error */
+int p11_agent_send(int fd, const p11_agent_buf_t *buf);
+int p11_agent_recv(int fd, p11_agent_buf_t *buf);
+/* Read what a non-blocking descriptor has of the next message. Returns 1
+ * when buf holds a whole message, 0 when more is to come and -1 on I/O
+ * error or end of file. Reset buf before receiving the next message. */
+int p11_agent_recv_some(int fd, p11_agent_buf_t *buf);
+
+/* Default socket path, from the environment or the runtime directory */
+int p11_agent_socket_path(char *path, size_t size);
+/* Returns 0 if the directory of the socket path belongs to this user and
+ * nobody else has access to it, -1 otherwise */
+int p11_agent_check_dir(const char *path);
+/* User at the other end of a connected socket, returns 0 on success */
+int p11_agent_peer_uid(int fd, uid_t *uid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
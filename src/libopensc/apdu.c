@@ -203,14 +203,36 @@ int sc_apdu_get_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 **buf,
 	if (nbuf == NULL)
 		return SC_ERROR_OUT_OF_MEMORY;
 	/* encode the APDU in the buffer */
-	if (sc_apdu2bytes(ctx, apdu, proto, nbuf, nlen) != SC_SUCCESS)
+	if (sc_apdu2bytes(ctx, apdu, proto, nbuf, nlen) != SC_SUCCESS) {
+		free(nbuf);
 		return SC_ERROR_INTERNAL;
+	}
 	*buf = nbuf;
 	*len = nlen;
 
 	return SC_SUCCESS;
 }
 
+int sc_apdu_put_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 *buf,
+	size_t buflen, size_t *len, unsigned int proto)
+{
+	size_t	nlen;
+
+	if (apdu == NULL || buf == NULL || len == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	nlen = sc_apdu_get_length(apdu, proto);
+	if (nlen == 0)
+		return SC_ERROR_INTERNAL;
+	if (nlen > buflen)
+		return SC_ERROR_BUFFER_TOO_SMALL;
+	if (sc_apdu2bytes(ctx, apdu, proto, buf, buflen) != SC_SUCCESS)
+		return SC_ERROR_INTERNAL;
+	*len = nlen;
+
+	return SC_SUCCESS;
+}
+
 int sc_apdu_set_resp(sc_context_t *ctx, sc_apdu_t *apdu, const u8 *buf,
 	size_t len)
 {
@@ -389,7 +411,7 @@ sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 #endif
 
 	/* send APDU to the reader driver */
-	rv = card->reader->ops->transmit(card->reader, apdu);
+	rv = _sc_trace_transmit(card, apdu);
 	LOG_TEST_RET(ctx, rv, "unable to transmit APDU");
 
 	LOG_FUNC_RETURN(ctx, rv);
@@ -463,12 +485,18 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 	minlen = le;
 
 	do {
-		unsigned char resp[256];
+		unsigned char bounce[256], *resp = bounce;
 		size_t resp_len = le;
 
+		/* read straight into the caller's buffer when the whole
+		 * answer fits, otherwise go through the bounce buffer */
+		if (le <= buflen)
+			resp = buf;
+		else
+			memset(bounce, 0, sizeof(bounce));
+
 		/* call GET RESPONSE to get more date from the card;
 		 * note: GET RESPONSE returns the left amount of data (== SW2) */
-		memset(resp, 0, sizeof(resp));
 		rv = card->ops->get_response(card, &resp_len, resp);
 		if (rv < 0)   {
 #ifdef ENABLE_SM
@@ -477,6 +505,8 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 				sc_sm_update_apdu_response(card, resp, resp_len, rv, apdu);
 			}
 #endif
+			if (resp == bounce)
+				sc_mem_clear(bounce, sizeof(bounce));
 			LOG_TEST_RET(ctx, rv, "GET RESPONSE error");
 		}
 
@@ -485,7 +515,10 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 		if (buflen < le)
 			le = buflen;
 
-		memcpy(buf, resp, le);
+		if (resp == bounce)   {
+			memcpy(buf, bounce, le);
+			sc_mem_clear(bounce, sizeof(bounce));
+		}
 		buf    += le;
 		buflen -= le;
 
@@ -572,6 +605,11 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 		return r;
 	}
 
+	/* a MANAGE SECURITY ENVIRONMENT from anywhere but
+	 * sc_set_security_env() replaces the remembered environment */
+	if (apdu->ins == 0x22 && !card->cache.sec_env_setting)
+		card->cache.sec_env_valid = 0;
+
 	if ((apdu->flags & SC_APDU_FLAGS_CHAINING) != 0) {
 		/* divide et impera: transmit APDU in chunks with Lc <= max_send_size
 		 * bytes using command chaining */
@@ -0,0 +1,306 @@
+/*
+ * async.c: Asynchronous card I/O
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "internal.h"
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * One worker per card takes operations from the submission queue and
+ * runs them; finished operations are moved to the completion queue and
+ * one byte is written to a pipe, whose read end the application polls.
+ * A pipe rather than an eventfd keeps this portable to the BSDs and
+ * Mac OS X; the byte count is meaningless, sc_async_dispatch() empties
+ * both the pipe and the completion queue.
+ */
+struct sc_async {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	struct sc_async_op *pending, *pending_tail;
+	struct sc_async_op *done, *done_tail;
+
+	int fds[2];
+	int stopping;
+};
+
+static void async_append(struct sc_async_op **head, struct sc_async_op **tail,
+		struct sc_async_op *op)
+{
+	op->next = NULL;
+	if (*tail)
+		(*tail)->next = op;
+	else
+		*head = op;
+	*tail = op;
+}
+
+static void *async_worker(void *arg)
+{
+	struct sc_card *card = (struct sc_card *) arg;
+	struct sc_async *async = card->async;
+	struct sc_async_op *op;
+	char c = 0;
+
+	pthread_mutex_lock(&async->mutex);
+	for (;;) {
+		while (async->pending == NULL && !async->stopping)
+			pthread_cond_wait(&async->cond, &async->mutex);
+		op = async->pending;
+		if (op == NULL)
+			break;
+		async->pending = op->next;
+		if (async->pending == NULL)
+			async->pending_tail = NULL;
+		pthread_mutex_unlock(&async->mutex);
+
+		op->result = op->func(card, op);
+
+		pthread_mutex_lock(&async->mutex);
+		async_append(&async->done, &async->done_tail, op);
+		/* a full pipe is readable already */
+		while (write(async->fds[1], &c, 1) < 0 && errno == EINTR)
+			;
+	}
+	pthread_mutex_unlock(&async->mutex);
+
+	return NULL;
+}
+
+static int async_pipe(int fds[2])
+{
+	int i;
+
+	if (pipe(fds) != 0)
+		return SC_ERROR_INTERNAL;
+	for (i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	return SC_SUCCESS;
+}
+
+int sc_async_start(struct sc_card *card)
+{
+	struct sc_async *async;
+	int r;
+
+	if (card == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	LOG_FUNC_CALLED(card->ctx);
+	if (card->async != NULL)
+		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+
+	async = calloc(1, sizeof(*async));
+	if (async == NULL)
+		LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
+	r = async_pipe(async->fds);
+	if (r != SC_SUCCESS) {
+		free(async);
+		LOG_TEST_RET(card->ctx, r, "Cannot create completion pipe");
+	}
+	pthread_mutex_init(&async->mutex, NULL);
+	pthread_cond_init(&async->cond, NULL);
+
+	card->async = async;
+	if (pthread_create(&async->thread, NULL, async_worker, card) != 0) {
+		card->async = NULL;
+		pthread_cond_destroy(&async->cond);
+		pthread_mutex_destroy(&async->mutex);
+		close(async->fds[0]);
+		close(async->fds[1]);
+		free(async);
+		LOG_TEST_RET(card->ctx, SC_ERROR_INTERNAL, "Cannot start worker thread");
+	}
+
+	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+}
+
+int sc_async_stop(struct sc_card *card)
+{
+	struct sc_async *async;
+	int r;
+
+	if (card == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	async = card->async;
+	if (async == NULL)
+		return SC_SUCCESS;
+	LOG_FUNC_CALLED(card->ctx);
+
+	pthread_mutex_lock(&async->mutex);
+	async->stopping = 1;
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+	pthread_join(async->thread, NULL);
+
+	r = sc_async_dispatch(card);
+	sc_log(card->ctx, "%d operation(s) completed while stopping", r);
+
+	card->async = NULL;
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->mutex);
+	close(async->fds[0]);
+	close(async->fds[1]);
+	free(async);
+
+	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+}
+
+int sc_async_get_fd(struct sc_card *card)
+{
+	if (card == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	if (card->async == NULL)
+		return SC_ERROR_NOT_ALLOWED;
+	return card->async->fds[0];
+}
+
+int sc_async_submit(struct sc_card *card, struct sc_async_op *op)
+{
+	struct sc_async *async;
+
+	if (card == NULL || op == NULL || op->func == NULL || op->callback == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	async = card->async;
+	if (async == NULL)
+		return SC_ERROR_NOT_ALLOWED;
+
+	pthread_mutex_lock(&async->mutex);
+	if (async->stopping) {
+		pthread_mutex_unlock(&async->mutex);
+		return SC_ERROR_NOT_ALLOWED;
+	}
+	op->result = SC_ERROR_INTERNAL;
+	async_append(&async->pending, &async->pending_tail, op);
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+
+	return SC_SUCCESS;
+}
+
+int sc_async_dispatch(struct sc_card *card)
+{
+	struct sc_async *async;
+	struct sc_async_op *op, *next;
+	char buf[64];
+	int n = 0;
+
+	if (card == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	async = card->async;
+	if (async == NULL)
+		return SC_ERROR_NOT_ALLOWED;
+
+	pthread_mutex_lock(&async->mutex);
+	while (read(async->fds[0], buf, sizeof(buf)) > 0)
+		;
+	op = async->done;
+	async->done = async->done_tail = NULL;
+	pthread_mutex_unlock(&async->mutex);
+
+	/* the callback may reuse or free the operation */
+	for (; op != NULL; op = next) {
+		next = op->next;
+		op->next = NULL;
+		op->callback(card, op);
+		n++;
+	}
+
+	return n;
+}
+
+#else
+
+int sc_async_start(struct sc_card *card)
+{
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+int sc_async_stop(struct sc_card *card)
+{
+	return card ? SC_SUCCESS : SC_ERROR_INVALID_ARGUMENTS;
+}
+
+int sc_async_get_fd(struct sc_card *card)
+{
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+int sc_async_submit(struct sc_card *card, struct sc_async_op *op)
+{
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+int sc_async_dispatch(struct sc_card *card)
+{
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+#endif
+
+static int async_transmit(struct sc_card *card, struct sc_async_op *op)
+{
+	return sc_transmit_apdu(card, op->u.transmit.apdu);
+}
+
+int sc_async_transmit_apdu(struct sc_card *card, struct sc_async_op *op,
+		struct sc_apdu *apdu, sc_async_callback_t callback, void *arg)
+{
+	if (op == NULL || apdu == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	memset(op, 0, sizeof(*op));
+	op->func = async_transmit;
+	op->callback = callback;
+	op->arg = arg;
+	op->u.transmit.apdu = apdu;
+	return sc_async_submit(card, op);
+}
+
+static int async_read_binary(struct sc_card *card, struct sc_async_op *op)
+{
+	return sc_read_binary(card, op->u.read_binary.idx, op->u.read_binary.buf,
+			op->u.read_binary.count, op->u.read_binary.flags);
+}
+
+int sc_async_read_binary(struct sc_card *card, struct sc_async_op *op,
+		unsigned int idx, u8 *buf, size_t count, unsigned long flags,
+		sc_async_callback_t callback, void *arg)
+{
+	if (op == NULL || buf == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	memset(op, 0, sizeof(*op));
+	op->func = async_read_binary;
+	op->callback = callback;
+	op->arg = arg;
+	op->u.read_binary.idx = idx;
+	op->u.read_binary.buf = buf;
+	op->u.read_binary.count = count;
+	op->u.read_binary.flags = flags;
+	return sc_async_submit(card, op);
+}
@@ -0,0 +1,454 @@
+/*
+ * binlog.c: Binary debug log
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "binlog.h"
+
+/*
+ * Every thread that logs gets its own ring buffer with a single producer,
+ * the thread, and a single consumer, the writer thread, so logging takes
+ * no lock: the message is formatted straight into the ring and the head
+ * index is advanced. When the ring is full the message is dropped and
+ * counted. The writer wakes up every BINLOG_INTERVAL_MS, or when a ring
+ * gets half full, turns the file and function names into string ids and
+ * appends the records to the file.
+ */
+#define BINLOG_RING_SIZE	(256 * 1024)
+#define BINLOG_MAX_MESSAGE	4096
+#define BINLOG_INTERVAL_MS	50
+
+#define BINLOG_BARRIER()	__sync_synchronize()
+
+#define ENTRY_MESSAGE		1
+#define ENTRY_PAD		2
+
+/* in-memory record; on disk the names are replaced by string ids */
+struct binlog_entry {
+	uint32_t type;
+	uint32_t len;
+	uint32_t level;
+	uint32_t line;
+	int64_t sec;
+	uint32_t usec;
+	uint32_t reserved;
+	const char *file;
+	const char *func;
+};
+
+#define ENTRY_SIZE		SC_BINLOG_ALIGN(sizeof(struct binlog_entry))
+
+struct binlog_ring {
+	unsigned char *buf;
+	volatile size_t head;		/* advanced by the logging thread */
+	volatile size_t tail;		/* advanced by the writer */
+	volatile unsigned long dropped;
+	unsigned long reported;
+	unsigned long thread;
+	volatile int exited;
+	struct binlog_ring *next;
+};
+
+struct binlog_string {
+	const char *ptr;
+	uint32_t id;
+};
+
+struct sc_binlog {
+	FILE *file;
+	pthread_key_t key;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int stop;
+
+	struct binlog_ring *rings;
+
+	/* owned by the writer */
+	struct binlog_string *strings;
+	size_t strings_size, strings_count;
+	uint32_t next_id;
+};
+
+static const unsigned char zeros[8];
+
+static void binlog_put(struct sc_binlog *log, const void *rec, size_t len,
+		const char *str)
+{
+	size_t slen = str ? strlen(str) + 1 : 0;
+
+	fwrite(rec, len, 1, log->file);
+	if (slen) {
+		fwrite(str, slen, 1, log->file);
+		fwrite(zeros, SC_BINLOG_ALIGN(len + slen) - len - slen, 1, log->file);
+	}
+}
+
+static size_t binlog_hash(const char *ptr, size_t size)
+{
+	return (size_t) (((unsigned long) ptr >> 3) * 2654435761UL) & (size - 1);
+}
+
+static int binlog_grow_strings(struct sc_binlog *log)
+{
+	struct binlog_string *old = log->strings;
+	size_t old_size = log->strings_size, i, h;
+	size_t size = old_size ? old_size * 2 : 256;
+
+	log->strings = calloc(size, sizeof(*log->strings));
+	if (log->strings == NULL) {
+		log->strings = old;
+		return -1;
+	}
+	log->strings_size = size;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].ptr == NULL)
+			continue;
+		for (h = binlog_hash(old[i].ptr, size); log->strings[h].ptr; h = (h + 1) & (size - 1))
+			;
+		log->strings[h] = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/* File and function names are string literals, so their addresses
+ * identify them */
+static uint32_t binlog_string_id(struct sc_binlog *log, const char *str)
+{
+	struct sc_binlog_string rec;
+	size_t h;
+
+	if (str == NULL)
+		return 0;
+	if (log->strings_count * 2 >= log->strings_size && binlog_grow_strings(log) < 0)
+		return 0;
+	for (h = binlog_hash(str, log->strings_size); log->strings[h].ptr;
+			h = (h + 1) & (log->strings_size - 1))
+		if (log->strings[h].ptr == str)
+			return log->strings[h].id;
+
+	log->strings[h].ptr = str;
+	log->strings[h].id = log->next_id++;
+	log->strings_count++;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.type = SC_BINLOG_REC_STRING;
+	rec.hdr.len = SC_BINLOG_ALIGN(sizeof(rec) + strlen(str) + 1);
+	rec.id = log->strings[h].id;
+	binlog_put(log, &rec, sizeof(rec), str);
+	return rec.id;
+}
+
+static void binlog_drain(struct sc_binlog *log, struct binlog_ring *ring)
+{
+	struct sc_binlog_message rec;
+	struct binlog_entry *e;
+	size_t head, tail;
+	unsigned long dropped;
+	const char *msg;
+
+	head = ring->head;
+	BINLOG_BARRIER();
+	for (tail = ring->tail; tail != head; tail += e->len) {
+		e = (struct binlog_entry *) (ring->buf + tail % BINLOG_RING_SIZE);
+		if (e->type != ENTRY_MESSAGE)
+			continue;
+		msg = (const char *) e + ENTRY_SIZE;
+		memset(&rec, 0, sizeof(rec));
+		rec.hdr.type = SC_BINLOG_REC_MESSAGE;
+		rec.hdr.len = SC_BINLOG_ALIGN(sizeof(rec) + strlen(msg) + 1);
+		rec.thread = ring->thread;
+		rec.sec = e->sec;
+		rec.usec = e->usec;
+		rec.level = e->level;
+		rec.file_id = binlog_string_id(log, e->file);
+		rec.func_id = binlog_string_id(log, e->func);
+		rec.line = e->line;
+		binlog_put(log, &rec, sizeof(rec), msg);
+	}
+	BINLOG_BARRIER();
+	ring->tail = tail;
+
+	dropped = ring->dropped;
+	if (dropped != ring->reported) {
+		struct sc_binlog_dropped drec;
+
+		memset(&drec, 0, sizeof(drec));
+		drec.hdr.type = SC_BINLOG_REC_DROPPED;
+		drec.hdr.len = sizeof(drec);
+		drec.thread = ring->thread;
+		drec.count = dropped - ring->reported;
+		binlog_put(log, &drec, sizeof(drec), NULL);
+		ring->reported = dropped;
+	}
+}
+
+/* called with log->mutex held */
+static void binlog_drain_all(struct sc_binlog *log)
+{
+	struct binlog_ring **pp, *ring;
+
+	for (pp = &log->rings; (ring = *pp) != NULL; ) {
+		binlog_drain(log, ring);
+		if (ring->exited && ring->head == ring->tail) {
+			*pp = ring->next;
+			free(ring->buf);
+			free(ring);
+		} else {
+			pp = &ring->next;
+		}
+	}
+	fflush(log->file);
+}
+
+static void *binlog_writer(void *arg)
+{
+	struct sc_binlog *log = (struct sc_binlog *) arg;
+	struct timeval tv;
+	struct timespec ts;
+
+	pthread_mutex_lock(&log->mutex);
+	while (!log->stop) {
+		gettimeofday(&tv, NULL);
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = (tv.tv_usec + BINLOG_INTERVAL_MS * 1000L) * 1000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&log->cond, &log->mutex, &ts);
+		binlog_drain_all(log);
+	}
+	pthread_mutex_unlock(&log->mutex);
+	return NULL;
+}
+
+static void binlog_thread_exit(void *arg)
+{
+	struct binlog_ring *ring = (struct binlog_ring *) arg;
+
+	BINLOG_BARRIER();
+	ring->exited = 1;
+}
+
+static struct binlog_ring *binlog_ring_new(struct sc_binlog *log)
+{
+	struct binlog_ring *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+	ring->buf = malloc(BINLOG_RING_SIZE);
+	if (ring->buf == NULL) {
+		free(ring);
+		return NULL;
+	}
+	ring->thread = (unsigned long) pthread_self();
+	if (pthread_setspecific(log->key, ring) != 0) {
+		free(ring->buf);
+		free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&log->mutex);
+	ring->next = log->rings;
+	log->rings = ring;
+	pthread_mutex_unlock(&log->mutex);
+	return ring;
+}
+
+void _sc_binlog_write(struct sc_context *ctx, int level, const char *file,
+		int line, const char *func, const char *format, va_list args)
+{
+	struct sc_binlog *log = ctx->binlog;
+	struct binlog_ring *ring;
+	struct binlog_entry *e;
+	struct timeval tv;
+	size_t head, used, off, contig, room, len;
+	va_list ap;
+	int wrapped, n;
+
+	ring = (struct binlog_ring *) pthread_getspecific(log->key);
+	if (ring == NULL && (ring = binlog_ring_new(log)) == NULL)
+		return;
+	gettimeofday(&tv, NULL);
+
+	for (wrapped = 0; ; wrapped = 1) {
+		head = ring->head;
+		used = head - ring->tail;
+		off = head % BINLOG_RING_SIZE;
+		contig = BINLOG_RING_SIZE - off;
+		room = MIN(contig, BINLOG_RING_SIZE - used);
+		room = MIN(room, ENTRY_SIZE + BINLOG_MAX_MESSAGE);
+
+		e = (struct binlog_entry *) (ring->buf + off);
+		if (room > ENTRY_SIZE) {
+			va_copy(ap, args);
+			n = vsnprintf((char *) e + ENTRY_SIZE, room - ENTRY_SIZE, format, ap);
+			va_end(ap);
+			if (n < 0)
+				return;
+			/* messages longer than BINLOG_MAX_MESSAGE are truncated,
+			 * like in the text log */
+			if ((size_t) n >= room - ENTRY_SIZE
+					&& room == ENTRY_SIZE + BINLOG_MAX_MESSAGE)
+				n = room - ENTRY_SIZE - 1;
+			if ((size_t) n < room - ENTRY_SIZE) {
+				len = SC_BINLOG_ALIGN(ENTRY_SIZE + n + 1);
+				e->type = ENTRY_MESSAGE;
+				e->len = len;
+				e->level = level;
+				e->line = line;
+				e->sec = tv.tv_sec;
+				e->usec = tv.tv_usec;
+				e->file = file;
+				e->func = func;
+				BINLOG_BARRIER();
+				ring->head = head + len;
+				/* wake the writer early in bursts; a wakeup lost
+				 * without the mutex only delays it to the next tick */
+				if (used < BINLOG_RING_SIZE / 2 && used + len >= BINLOG_RING_SIZE / 2)
+					pthread_cond_signal(&log->cond);
+				return;
+			}
+		}
+		/* skip the end of the buffer if there is room at its start */
+		if (wrapped || contig >= BINLOG_RING_SIZE - used
+				|| BINLOG_RING_SIZE - used - contig <= ENTRY_SIZE)
+			break;
+		e->type = ENTRY_PAD;
+		e->len = contig;
+		BINLOG_BARRIER();
+		ring->head = head + contig;
+	}
+	ring->dropped++;
+}
+
+int _sc_binlog_open(struct sc_context *ctx, const char *filename)
+{
+	struct sc_binlog *log;
+	struct sc_binlog_session rec;
+	struct timeval tv;
+
+	if (ctx->binlog != NULL)
+		return SC_SUCCESS;
+	if (!strcmp(filename, "stdout") || !strcmp(filename, "stderr"))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	log = calloc(1, sizeof(*log));
+	if (log == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	log->next_id = 1;
+	log->file = fopen(filename, "ab");
+	if (log->file == NULL) {
+		free(log);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+	if (pthread_key_create(&log->key, binlog_thread_exit) != 0) {
+		fclose(log->file);
+		free(log);
+		return SC_ERROR_INTERNAL;
+	}
+	pthread_mutex_init(&log->mutex, NULL);
+	pthread_cond_init(&log->cond, NULL);
+
+	gettimeofday(&tv, NULL);
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.type = SC_BINLOG_REC_SESSION;
+	rec.hdr.len = SC_BINLOG_ALIGN(sizeof(rec) + strlen(ctx->app_name) + 1);
+	rec.magic = SC_BINLOG_MAGIC;
+	rec.version = SC_BINLOG_VERSION;
+	rec.sec = tv.tv_sec;
+	rec.usec = tv.tv_usec;
+	rec.pid = getpid();
+	binlog_put(log, &rec, sizeof(rec), ctx->app_name);
+	fflush(log->file);
+
+	if (pthread_create(&log->thread, NULL, binlog_writer, log) != 0) {
+		pthread_key_delete(log->key);
+		pthread_cond_destroy(&log->cond);
+		pthread_mutex_destroy(&log->mutex);
+		fclose(log->file);
+		free(log);
+		return SC_ERROR_INTERNAL;
+	}
+
+	ctx->binlog = log;
+	return SC_SUCCESS;
+}
+
+void _sc_binlog_close(struct sc_context *ctx)
+{
+	struct sc_binlog *log = ctx->binlog;
+	struct binlog_ring *ring;
+
+	if (log == NULL)
+		return;
+
+	pthread_mutex_lock(&log->mutex);
+	log->stop = 1;
+	pthread_cond_signal(&log->cond);
+	pthread_mutex_unlock(&log->mutex);
+	pthread_join(log->thread, NULL);
+	ctx->binlog = NULL;
+
+	binlog_drain_all(log);
+	pthread_key_delete(log->key);
+	while ((ring = log->rings) != NULL) {
+		log->rings = ring->next;
+		free(ring->buf);
+		free(ring);
+	}
+	pthread_cond_destroy(&log->cond);
+	pthread_mutex_destroy(&log->mutex);
+	fclose(log->file);
+	free(log->strings);
+	free(log);
+}
+
+#else
+
+void _sc_binlog_write(struct sc_context *ctx, int level, const char *file,
+		int line, const char *func, const char *format, va_list args)
+{
+}
+
+int _sc_binlog_open(struct sc_context *ctx, const char *filename)
+{
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+void _sc_binlog_close(struct sc_context *ctx)
+{
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * binlog.h: Binary debug log format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _OPENSC_BINLOG_H
+#define _OPENSC_BINLOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * With debug_format = binary the log file is a sequence of records in
+ * host byte order, each starting with a struct sc_binlog_hdr. len is the
+ * size of the whole record, a multiple of 8. Every process appending to
+ * the file starts with a SESSION record; the string ids of FILE records
+ * are valid until the next SESSION record. opensc-logdump renders the
+ * records in the text format of the log.
+ */
+#define SC_BINLOG_MAGIC			0x4F53424CU	/* "OSBL" */
+#define SC_BINLOG_VERSION		1
+
+#define SC_BINLOG_REC_SESSION		1
+#define SC_BINLOG_REC_STRING		2
+#define SC_BINLOG_REC_MESSAGE		3
+#define SC_BINLOG_REC_DROPPED		4
+
+struct sc_binlog_hdr {
+	uint32_t type;
+	uint32_t len;
+};
+
+/* followed by the NUL terminated application name */
+struct sc_binlog_session {
+	struct sc_binlog_hdr hdr;
+	uint32_t magic;
+	uint32_t version;
+	int64_t sec;
+	uint32_t usec;
+	uint32_t pid;
+};
+
+/* followed by the NUL terminated source file or function name */
+struct sc_binlog_string {
+	struct sc_binlog_hdr hdr;
+	uint32_t id;
+	uint32_t reserved;
+};
+
+/* followed by the NUL terminated message; file_id 0 for messages
+ * logged without a source location */
+struct sc_binlog_message {
+	struct sc_binlog_hdr hdr;
+	uint64_t thread;
+	int64_t sec;
+	uint32_t usec;
+	uint32_t level;
+	uint32_t file_id;
+	uint32_t func_id;
+	uint32_t line;
+	uint32_t reserved;
+};
+
+/* messages of a thread that did not fit into its buffer */
+struct sc_binlog_dropped {
+	struct sc_binlog_hdr hdr;
+	uint64_t thread;
+	uint64_t count;
+};
+
+#define SC_BINLOG_ALIGN(n)		(((n) + 7) & ~(size_t) 7)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -201,6 +201,10 @@ gpk_init(sc_card_t *card)
 	/* State that we have an RNG */
 	card->caps |= SC_CARD_CAP_RNG;
 
+	/* set_security_env selects the key file itself, which the
+	 * select of the DF before every operation undoes */
+	card->caps |= SC_CARD_CAP_NO_SEC_ENV_CACHE;
+
 	/* Make sure max send/receive size is 4 byte aligned and <256. */
 	card->max_recv_size = 252;
 
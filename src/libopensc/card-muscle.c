@@ -138,6 +138,21 @@ static void muscle_parse_acls(const sc_file_t* file, unsigned short* read_perm,
 	*delete_perm =  muscle_parse_singleAcl(sc_file_get_acl_entry(file, SC_AC_OP_DELETE));
 }
 
+/* Record a created object instead of listing all objects again */
+static void muscle_cache_new_object(mscfs_t *fs, msc_id objectId, size_t objectSize,
+	unsigned short read_perm, unsigned short write_perm, unsigned short delete_perm, int ef)
+{
+	mscfs_file_t file_data;
+	file_data.objectId = objectId;
+	file_data.size = objectSize;
+	file_data.read = read_perm;
+	file_data.write = write_perm;
+	file_data.delete = delete_perm;
+	file_data.ef = ef;
+	if(mscfs_add_file(fs, &file_data) < 0)
+		mscfs_clear_cache(fs);
+}
+
 static int muscle_create_directory(sc_card_t *card, sc_file_t *file)
 {
 	mscfs_t *fs = MUSCLE_FS(card);
@@ -161,8 +176,16 @@ static int muscle_create_directory(sc_card_t *card, sc_file_t *file)
 	
 	muscle_parse_acls(file, &read_perm, &write_perm, &delete_perm);
 	r = msc_create_object(card, objectId, objectSize, read_perm, write_perm, delete_perm);
+	if(r >= 0) {
+		/* Directories are kept as 3F00xxxx in the cache */
+		oid[2] = oid[0];
+		oid[3] = oid[1];
+		oid[0] = 0x3F;
+		oid[1] = 0x00;
+		muscle_cache_new_object(fs, objectId, objectSize, read_perm, write_perm, delete_perm, 0);
+		return 0;
+	}
 	mscfs_clear_cache(fs);
-	if(r >= 0) return 0;
 	return r;
 }
 
@@ -185,8 +208,11 @@ static int muscle_create_file(sc_card_t *card, sc_file_t *file)
 	
 	mscfs_lookup_local(fs, file->id, &objectId);
 	r = msc_create_object(card, objectId, objectSize, read_perm, write_perm, delete_perm);
+	if(r >= 0) {
+		muscle_cache_new_object(fs, objectId, objectSize, read_perm, write_perm, delete_perm, 1);
+		return 0;
+	}
 	mscfs_clear_cache(fs);
-	if(r >= 0) return 0;
 	return r;
 }
 
@@ -244,6 +270,8 @@ static int muscle_update_binary(sc_card_t *card, unsigned int idx, const u8* buf
 		r = msc_create_object(card, objectId, newFileSize, 0,0,0);
 		if(r < 0) goto update_bin_free_buffer;
 		memcpy(buffer + idx, buf, count);
+		/* Recreated without ACLs, keep the cache in line */
+		file->read = file->write = file->delete = 0;
 		r = msc_update_object(card, objectId, 0, buffer, newFileSize);
 		if(r < 0) goto update_bin_free_buffer;
 		file->size = newFileSize;
@@ -315,12 +343,21 @@ static int muscle_delete_file(sc_card_t *card, const sc_path_t *path_in)
 {
 	mscfs_t *fs = MUSCLE_FS(card);
 	mscfs_file_t *file_data = NULL;
+	msc_id objectId;
+	int isDirectory;
 	int r = 0;
 
 	r = mscfs_loadFileInfo(fs, path_in->value, path_in->len, &file_data, NULL);
 	if(r < 0) SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE,r);
+	objectId = file_data->objectId;
+	isDirectory = !file_data->ef;
 	r = muscle_delete_mscfs_file(card, file_data);
-	mscfs_clear_cache(fs);
+	if(r < 0 || (isDirectory && 0 == memcmp(objectId.id + 2, "\x3F\x00", 2))) {
+		/* Partly done or the root, list the objects again */
+		mscfs_clear_cache(fs);
+	} else {
+		mscfs_remove_file(fs, &objectId, isDirectory);
+	}
 	if(r < 0) SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE,r);
 	return 0;
 }
@@ -27,10 +27,19 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 #include "internal.h"
 #include "asn1.h"
@@ -118,6 +127,7 @@ struct blob {
 	sc_file_t *	file;
 	unsigned int	id;
 	int		status;
+	int		fetched;	/* contents known, no need to ask the card */
 
 	unsigned char *	data;
 	unsigned int	len;
@@ -150,6 +160,11 @@ static int		pgp_get_pubkey(sc_card_t *, unsigned int,
 				u8 *, size_t);
 static int		pgp_get_pubkey_pem(sc_card_t *, unsigned int,
 				u8 *, size_t);
+static int		pgp_snapshot_blob(sc_card_t *card, struct blob *blob);
+static void		pgp_prefetch_blobs(sc_card_t *card);
+static int		pgp_load_snapshot(sc_card_t *card);
+static int		pgp_store_snapshot(sc_card_t *card);
+static void		pgp_drop_snapshot(sc_card_t *card);
 
 static struct do_info		pgp1_objects[] = {	/* OpenPGP card spec 1.1 */
 	{ 0x004f, SIMPLE,      READ_ALWAYS | WRITE_NEVER, NULL,               NULL        },
@@ -279,6 +294,9 @@ struct pgp_priv_data {
 	size_t			max_cert_size;
 
 	sc_security_env_t	sec_env;
+
+	char			*cache_file;	/* snapshot of the DO tree */
+	int			cache_dirty;
 };
 
 /* ABI: check if card's ATR matches one of driver's */
@@ -306,6 +324,7 @@ pgp_init(sc_card_t *card)
 	struct do_info	*info;
 	int		r;
 	struct blob 	*child = NULL;
+	scconf_block	*conf_block;
 
 	priv = calloc (1, sizeof *priv);
 	if (!priv)
@@ -366,6 +385,12 @@ pgp_init(sc_card_t *card)
 		}
 	}
 
+	/* with a valid snapshot of the DO tree only 6E is read from the card */
+	conf_block = sc_get_conf_block(card->ctx, "card_driver", "openpgp", 1);
+	if (conf_block == NULL || !scconf_get_bool(conf_block, "persistent_cache", 0)
+			|| pgp_load_snapshot(card) <= 0)
+		pgp_prefetch_blobs(card);
+
 	/* get card_features from ATR & DOs */
 	pgp_get_card_features(card);
 
@@ -502,6 +527,13 @@ pgp_finish(sc_card_t *card)
 		struct pgp_priv_data *priv = DRVDATA (card);
 
 		if (priv != NULL) {
+			/* save the DO tree for the next process */
+			if (priv->cache_file != NULL) {
+				if (priv->cache_dirty)
+					pgp_store_snapshot(card);
+				free(priv->cache_file);
+			}
+
 			/* delete fake file hierarchy */
 			pgp_iterate_blobs(priv->mf, 99, pgp_free_blob);
 
@@ -523,6 +555,7 @@ pgp_set_blob(struct blob *blob, const u8 *data, size_t len)
 	blob->data = NULL;
 	blob->len    = 0;
 	blob->status = 0;
+	blob->fetched = 1;
 
 	if (len > 0) {
 		void *tmp = calloc(len, 1);
@@ -717,12 +750,13 @@ pgp_iterate_blobs(struct blob *blob, int level, void (*func)())
 static int
 pgp_read_blob(sc_card_t *card, struct blob *blob)
 {
-	if (blob->data != NULL)
-		return SC_SUCCESS;
+	if (blob->fetched)
+		return blob->status;
 	if (blob->info == NULL)
 		return blob->status;
 
 	if (blob->info->get_fn) {	/* readable, top-level DO */
+		struct pgp_priv_data *priv = DRVDATA(card);
 		u8 	buffer[2048];
 		size_t	buf_len = (card->caps & SC_CARD_CAP_APDU_EXT)
 				  ? sizeof(buffer) : 256;
@@ -730,9 +764,15 @@ pgp_read_blob(sc_card_t *card, struct blob *blob)
 
 		if (r < 0) {	/* an error occurred */
 			blob->status = r;
+			/* DOs missing on the card are not asked for again */
+			if (r == SC_ERROR_FILE_NOT_FOUND || r == SC_ERROR_DATA_OBJECT_NOT_FOUND) {
+				blob->fetched = 1;
+				priv->cache_dirty |= pgp_snapshot_blob(card, blob);
+			}
 			return r;
 		}
 
+		priv->cache_dirty |= pgp_snapshot_blob(card, blob);
 		return pgp_set_blob(blob, buffer, r);
 	}
 	else {		/* un-readable DO or part of a constructed DO */
@@ -860,6 +900,295 @@ pgp_find_blob(sc_card_t *card, unsigned int tag)
 	return blob;
 }
 
+/* internal: read the constructed DOs most other DOs are part of, each
+ * with a single GET DATA, and split them into their children right away */
+static void
+pgp_prefetch_blobs(sc_card_t *card)
+{
+	static const unsigned int tags[] = { 0x006e, 0x0065, 0x007a };
+	struct pgp_priv_data *priv = DRVDATA(card);
+	struct blob	*blob;
+	size_t		i;
+
+	for (i = 0; i < sizeof(tags) / sizeof(tags[0]); i++)
+		if (pgp_get_blob(card, priv->mf, tags[i], &blob) >= 0)
+			(void) pgp_enumerate_blob(card, blob);
+}
+
+
+/*
+ * Snapshot of the DO tree
+ *
+ * With "persistent_cache" set in the openpgp card_driver block, the
+ * top-level DOs read while the card was in use are saved in the OpenSC
+ * cache directory, in a file named after the AID (and so the serial
+ * number) of the card. The snapshot holds the application related
+ * data (6E) as it was read from the card. pgp_init reads 6E and takes
+ * all other DOs from the snapshot if it is unchanged, which is the
+ * only APDU the card sees. 6E covers the key fingerprints, generation
+ * times and PIN status bytes, so new keys and PIN changes invalidate
+ * the snapshot. DOs that need a PIN to be read are never part of the
+ * tree; 7A is left out as its signature counter changes with every
+ * signature. Children of constructed DOs are derived from their
+ * parent's data again.
+ */
+
+#define PGP_SNAPSHOT_MAGIC	"PGPS"
+#define PGP_SNAPSHOT_VERSION	1
+#define PGP_SNAPSHOT_MAX_LEN	0x10000
+#define PGP_SNAPSHOT_MAX_DOS	64
+
+/* internal: whether a blob is saved in the snapshot */
+static int
+pgp_snapshot_blob(sc_card_t *card, struct blob *blob)
+{
+	struct pgp_priv_data *priv = DRVDATA(card);
+
+	return priv->cache_file != NULL && blob->parent == priv->mf
+		&& blob->info != NULL && blob->info->get_fn != NULL
+		&& blob->id != 0x006e && blob->id != 0x007a;
+}
+
+static int
+pgp_snapshot_put_u32(FILE *f, size_t v)
+{
+	u8 b[4];
+
+	b[0] = (v >> 24) & 0xFF;
+	b[1] = (v >> 16) & 0xFF;
+	b[2] = (v >> 8) & 0xFF;
+	b[3] = v & 0xFF;
+	return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static int
+pgp_snapshot_get_u32(FILE *f, size_t *v)
+{
+	u8 b[4];
+
+	if (fread(b, 1, 4, f) != 4)
+		return -1;
+	*v = ((size_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	return 0;
+}
+
+static int
+pgp_snapshot_put_data(FILE *f, const u8 *data, size_t len)
+{
+	if (pgp_snapshot_put_u32(f, len) < 0)
+		return -1;
+	return len == 0 || fwrite(data, 1, len, f) == len ? 0 : -1;
+}
+
+static int
+pgp_snapshot_get_data(FILE *f, u8 **data, size_t *len)
+{
+	*data = NULL;
+	if (pgp_snapshot_get_u32(f, len) < 0 || *len > PGP_SNAPSHOT_MAX_LEN)
+		return -1;
+	if (*len == 0)
+		return 0;
+	*data = malloc(*len);
+	if (*data == NULL)
+		return -1;
+	if (fread(*data, 1, *len, f) != *len) {
+		free(*data);
+		*data = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* internal: load the snapshot, returns 1 if the tree was taken from it */
+static int
+pgp_load_snapshot(sc_card_t *card)
+{
+	struct pgp_priv_data *priv = DRVDATA(card);
+	sc_file_t	*mf_file = priv->mf->file;
+	struct {
+		struct blob	*blob;
+		int		status;
+		u8		*data;
+		size_t		len;
+	} loaded[PGP_SNAPSHOT_MAX_DOS];
+	struct blob	*blob6e, *blob;
+	char		filename[PATH_MAX];
+	char		hex[2 * SC_MAX_AID_SIZE + 2];
+	char		magic[sizeof(PGP_SNAPSHOT_MAGIC) - 1];
+	u8		*stored = NULL;
+	size_t		storedlen, count = 0, id, status, i;
+	int		r;
+	FILE		*f;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	if (mf_file->namelen != 16
+			|| sc_bin_to_hex(mf_file->name, mf_file->namelen, hex, sizeof(hex), 0) != SC_SUCCESS
+			|| sc_get_cache_dir(card->ctx, filename, sizeof(filename)) != SC_SUCCESS
+			|| strlen(filename) + strlen(hex) + 10 >= sizeof(filename))
+		LOG_FUNC_RETURN(card->ctx, 0);
+#ifdef _WIN32
+	strcat(filename, "\\openpgp-");
+#else
+	strcat(filename, "/openpgp-");
+#endif
+	strcat(filename, hex);
+	priv->cache_file = strdup(filename);
+	if (priv->cache_file == NULL)
+		LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
+	priv->cache_dirty = 1;
+
+	/* the validation APDU */
+	if (pgp_get_blob(card, priv->mf, 0x006e, &blob6e) < 0 || blob6e->data == NULL)
+		LOG_FUNC_RETURN(card->ctx, 0);
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+		LOG_FUNC_RETURN(card->ctx, 0);
+
+	memset(loaded, 0, sizeof(loaded));
+	r = SC_ERROR_CORRUPTED_DATA;
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)
+			|| memcmp(magic, PGP_SNAPSHOT_MAGIC, sizeof(magic))
+			|| fgetc(f) != PGP_SNAPSHOT_VERSION
+			|| pgp_snapshot_get_data(f, &stored, &storedlen) < 0)
+		goto out;
+	if (storedlen != blob6e->len || memcmp(stored, blob6e->data, storedlen)) {
+		sc_log(card->ctx, "Application related data changed, %s is stale", filename);
+		r = SC_ERROR_OBJECT_NOT_VALID;
+		goto out;
+	}
+	if (pgp_snapshot_get_u32(f, &count) < 0 || count > PGP_SNAPSHOT_MAX_DOS)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		if (pgp_snapshot_get_u32(f, &id) < 0
+				|| pgp_snapshot_get_u32(f, &status) < 0
+				|| pgp_snapshot_get_data(f, &loaded[i].data, &loaded[i].len) < 0)
+			goto out;
+		for (blob = priv->mf->files; blob != NULL; blob = blob->next)
+			if (blob->id == id)
+				break;
+		/* only "not found" is kept for DOs missing on the card */
+		if (blob == NULL || blob->fetched || !pgp_snapshot_blob(card, blob)
+				|| (status != 0 && status != (size_t) -SC_ERROR_FILE_NOT_FOUND
+					&& status != (size_t) -SC_ERROR_DATA_OBJECT_NOT_FOUND)
+				|| (status != 0 && loaded[i].len != 0))
+			goto out;
+		loaded[i].blob = blob;
+		loaded[i].status = -(int) status;
+		/* guard against the same DO listed twice */
+		blob->fetched = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		blob = loaded[i].blob;
+		blob->fetched = 0;
+		if (pgp_set_blob(blob, loaded[i].data, loaded[i].len) < 0) {
+			r = SC_ERROR_OUT_OF_MEMORY;
+			goto out;
+		}
+		blob->status = loaded[i].status;
+	}
+	priv->cache_dirty = 0;
+	r = SC_SUCCESS;
+	sc_log(card->ctx, "Loaded %d DOs from %s", (int) count, filename);
+
+out:
+	fclose(f);
+	if (stored)
+		free(stored);
+	for (i = 0; i < count && i < PGP_SNAPSHOT_MAX_DOS; i++) {
+		if (loaded[i].data)
+			free(loaded[i].data);
+		/* undo the partial restore of a damaged snapshot */
+		if (r != SC_SUCCESS && loaded[i].blob) {
+			pgp_set_blob(loaded[i].blob, NULL, 0);
+			loaded[i].blob->fetched = 0;
+		}
+	}
+	if (r == SC_ERROR_CORRUPTED_DATA)
+		sc_log(card->ctx, "Ignoring damaged %s", filename);
+	LOG_FUNC_RETURN(card->ctx, r == SC_SUCCESS ? 1 : 0);
+}
+
+/* internal: save the snapshot, replacing the file atomically */
+static int
+pgp_store_snapshot(sc_card_t *card)
+{
+	struct pgp_priv_data *priv = DRVDATA(card);
+	struct blob	*blob6e = NULL, *blob;
+	char		tmpname[PATH_MAX];
+	size_t		count = 0;
+	FILE		*f;
+	int		r = SC_SUCCESS;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	for (blob = priv->mf->files; blob != NULL; blob = blob->next) {
+		if (blob->id == 0x006e)
+			blob6e = blob;
+		else if (blob->fetched && pgp_snapshot_blob(card, blob))
+			count++;
+	}
+	if (blob6e == NULL || blob6e->data == NULL)
+		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+	if (snprintf(tmpname, sizeof(tmpname), "%s.%lu", priv->cache_file,
+			(unsigned long) getpid()) >= (int) sizeof(tmpname))
+		LOG_FUNC_RETURN(card->ctx, SC_ERROR_BUFFER_TOO_SMALL);
+
+	f = fopen(tmpname, "wb");
+	if (f == NULL && errno == ENOENT) {
+		if ((r = sc_make_cache_dir(card->ctx)) < 0)
+			LOG_FUNC_RETURN(card->ctx, r);
+		f = fopen(tmpname, "wb");
+	}
+	if (f == NULL)
+		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+
+	if (fwrite(PGP_SNAPSHOT_MAGIC, 1, sizeof(PGP_SNAPSHOT_MAGIC) - 1, f) != sizeof(PGP_SNAPSHOT_MAGIC) - 1
+			|| fputc(PGP_SNAPSHOT_VERSION, f) == EOF
+			|| pgp_snapshot_put_data(f, blob6e->data, blob6e->len) < 0
+			|| pgp_snapshot_put_u32(f, count) < 0)
+		r = SC_ERROR_INTERNAL;
+	for (blob = priv->mf->files; r == SC_SUCCESS && blob != NULL; blob = blob->next) {
+		if (blob->id == 0x006e || !blob->fetched || !pgp_snapshot_blob(card, blob))
+			continue;
+		if (pgp_snapshot_put_u32(f, blob->id) < 0
+				|| pgp_snapshot_put_u32(f, (size_t) -blob->status) < 0
+				|| pgp_snapshot_put_data(f, blob->data, blob->len) < 0)
+			r = SC_ERROR_INTERNAL;
+	}
+	if (fclose(f) != 0)
+		r = SC_ERROR_INTERNAL;
+	if (r == SC_SUCCESS) {
+#ifdef _WIN32
+		remove(priv->cache_file);
+#endif
+		if (rename(tmpname, priv->cache_file) != 0)
+			r = SC_ERROR_INTERNAL;
+	}
+	if (r != SC_SUCCESS)
+		remove(tmpname);
+	else
+		sc_log(card->ctx, "Saved %d DOs to %s", (int) count, priv->cache_file);
+	LOG_FUNC_RETURN(card->ctx, r);
+}
+
+/* internal: DOs on the card are modified, forget about the snapshot */
+static void
+pgp_drop_snapshot(sc_card_t *card)
+{
+	struct pgp_priv_data *priv = DRVDATA(card);
+
+	if (priv->cache_file == NULL)
+		return;
+	remove(priv->cache_file);
+	free(priv->cache_file);
+	priv->cache_file = NULL;
+}
+
+
 /* Internal: get info for a specific tag */
 static struct do_info *
 pgp_get_info_by_tag(sc_card_t *card, unsigned int tag)
@@ -1209,6 +1538,8 @@ pgp_put_data(sc_card_t *card, unsigned int tag, const u8 *buf, size_t buf_len)
 		sc_format_apdu(card, &apdu, SC_APDU_CASE_1, ins, p1, p2);
 	}
 
+	pgp_drop_snapshot(card);
+
 	/* Send APDU to card */
 	r = sc_transmit_apdu(card, &apdu);
 	LOG_TEST_RET(card->ctx, r, "APDU transmit failed");
@@ -1827,6 +2158,7 @@ static int pgp_gen_key(sc_card_t *card, sc_cardctl_openpgp_keygen_info_t *key_in
 	apdu.resplen = apdu.le;
 
 	/* Send */
+	pgp_drop_snapshot(card);
 	sc_log(card->ctx, "Waiting for the card to generate key...");
 	r = sc_transmit_apdu(card, &apdu);
 	sc_log(card->ctx, "Card has done key generation.");
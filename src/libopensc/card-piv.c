@@ -25,10 +25,18 @@
 #include "config.h"
 
 #include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 #ifdef ENABLE_OPENSSL
 	/* openssl only needed for card administration */
 #include <openssl/evp.h>
@@ -148,6 +156,8 @@ typedef struct piv_private_data {
 	int keysWithOffCardCerts;
 	char * offCardCertURL;
 	int pin_preference; /* set from Discovery object */
+	char *cache_file; /* persistent object cache, NULL if not used */
+	int cache_dirty; /* objects read from the card since the cache was loaded */
 } piv_private_data_t;
 
 #define PIV_DATA(card) ((piv_private_data_t*)card->drv_data)
@@ -989,6 +999,7 @@ static int piv_get_cached_data(sc_card_t * card, int enumtag,
 		priv->obj_cache[enumtag].obj_data = rbuf;
 		*buf = rbuf;
 		*buf_len = r;
+		priv->cache_dirty = 1;
 
 		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL,"added #%d  %p:%d %p:%d",
 				enumtag,
@@ -1001,6 +1012,7 @@ static int piv_get_cached_data(sc_card_t * card, int enumtag,
 		r = SC_ERROR_FILE_NOT_FOUND;
 		priv->obj_cache[enumtag].flags |= PIV_OBJ_CACHE_VALID;
 		priv->obj_cache[enumtag].obj_len = 0;
+		priv->cache_dirty = 1;
 	} else if ( r < 0) {
 		goto err;
 	}
@@ -1092,6 +1104,7 @@ static int piv_cache_internal_data(sc_card_t *card, int enumtag)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_INTERNAL);
 	}
 
+	priv->cache_dirty = 1;
 	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL,"added #%d internal %p:%d", enumtag,
 		priv->obj_cache[enumtag].internal_obj_data,
 		priv->obj_cache[enumtag].internal_obj_len);
@@ -1100,6 +1113,323 @@ static int piv_cache_internal_data(sc_card_t *card, int enumtag)
 }
 
 
+/*
+ * Persistent object cache
+ *
+ * The objects read from the card, including the decompressed
+ * certificates, are saved in the OpenSC cache directory when the card
+ * is released, so that the next process does not need to read them
+ * again. The file is named after the GUID or FASC-N of the CHUID.
+ * It holds the complete CHUID, which is compared with the CHUID read
+ * from the card in piv_init. The CCC is read from the card as well and
+ * compared with the copy in the file. These two GET DATA are all the
+ * card sees when the cache is used. Other objects replaced on the card
+ * while the CHUID and the CCC stay the same are not noticed.
+ */
+
+#define PIV_CACHE_MAGIC		"PIVC"
+#define PIV_CACHE_VERSION	2
+#define PIV_CACHE_MAX_LEN	0x100000
+
+static int piv_cache_put_u32(FILE *f, size_t v)
+{
+	u8 b[4];
+
+	b[0] = (v >> 24) & 0xFF;
+	b[1] = (v >> 16) & 0xFF;
+	b[2] = (v >> 8) & 0xFF;
+	b[3] = v & 0xFF;
+	return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static int piv_cache_get_u32(FILE *f, size_t *v)
+{
+	u8 b[4];
+
+	if (fread(b, 1, 4, f) != 4)
+		return -1;
+	*v = ((size_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	return 0;
+}
+
+static int piv_cache_put_blob(FILE *f, const u8 *data, size_t len)
+{
+	if (piv_cache_put_u32(f, len) < 0)
+		return -1;
+	return len == 0 || fwrite(data, 1, len, f) == len ? 0 : -1;
+}
+
+static int piv_cache_get_blob(FILE *f, u8 **data, size_t *len)
+{
+	*data = NULL;
+	if (piv_cache_get_u32(f, len) < 0 || *len > PIV_CACHE_MAX_LEN)
+		return -1;
+	if (*len == 0)
+		return 0;
+	*data = malloc(*len);
+	if (*data == NULL)
+		return -1;
+	if (fread(*data, 1, *len, f) != *len) {
+		free(*data);
+		*data = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* The cache file name is derived from the GUID, or the FASC-N if there
+ * is no GUID, of the CHUID */
+static int piv_cache_filename(sc_card_t *card, const u8 *chuid, size_t chuidlen,
+		char *filename, size_t filename_len)
+{
+	const u8 *body, *id;
+	size_t bodylen, idlen, len, i;
+	char hex[2 * 25 + 2];
+	u8 gbits = 0;
+	int r;
+
+	body = sc_asn1_find_tag(card->ctx, chuid, chuidlen, 0x53, &bodylen);
+	if (body == NULL || bodylen == 0)
+		return SC_ERROR_OBJECT_NOT_VALID;
+
+	id = sc_asn1_find_tag(card->ctx, body, bodylen, 0x34, &idlen);
+	if (id && idlen == 16)
+		for (i = 0; i < idlen; i++)
+			gbits |= id[i];
+	if (!gbits) {
+		id = sc_asn1_find_tag(card->ctx, body, bodylen, 0x30, &idlen);
+		if (id == NULL || idlen != 25)
+			return SC_ERROR_OBJECT_NOT_VALID;
+	}
+	r = sc_bin_to_hex(id, idlen, hex, sizeof(hex), 0);
+	if (r != SC_SUCCESS)
+		return r;
+
+	r = sc_get_cache_dir(card->ctx, filename, filename_len);
+	if (r != SC_SUCCESS)
+		return r;
+	len = strlen(filename);
+	if (len + strlen(hex) + 6 >= filename_len)
+		return SC_ERROR_BUFFER_TOO_SMALL;
+#ifdef _WIN32
+	strcat(filename, "\\piv-");
+#else
+	strcat(filename, "/piv-");
+#endif
+	strcat(filename, hex);
+	return SC_SUCCESS;
+}
+
+static int piv_load_persistent_cache(sc_card_t *card)
+{
+	piv_private_data_t * priv = PIV_DATA(card);
+	piv_obj_cache_t loaded[PIV_OBJ_LAST_ENUM];
+	char filename[PATH_MAX];
+	char magic[sizeof(PIV_CACHE_MAGIC) - 1];
+	u8 *chuid = NULL, *ccc = NULL, *stored = NULL;
+	size_t chuidlen = 0, ccclen = 0, storedlen, count, v;
+	int version, r, i, n = 0;
+	FILE *f;
+
+	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
+
+	/*
+	 * Without a length given, piv_get_data reads the object with a
+	 * single GET DATA into the 4K buffer of piv_general_io, which
+	 * is large enough for any CHUID. The CHUID is kept in obj_cache
+	 * and used for the serial number.
+	 */
+	r = piv_get_data(card, PIV_OBJ_CHUI, &chuid, &chuidlen);
+	if (r <= 0 || chuid == NULL) {
+		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "no CHUID, no persistent cache");
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+	}
+	priv->obj_cache[PIV_OBJ_CHUI].flags |= PIV_OBJ_CACHE_VALID;
+	priv->obj_cache[PIV_OBJ_CHUI].obj_data = chuid;
+	priv->obj_cache[PIV_OBJ_CHUI].obj_len = chuidlen;
+	priv->cache_dirty = 1;
+	r = piv_cache_filename(card, chuid, chuidlen, filename, sizeof(filename));
+	if (r != SC_SUCCESS) {
+		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "CHUID without card identifier, no persistent cache");
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+	}
+
+	/* The CCC, or the fact that there is none, is kept in the file
+	 * too, and has to match the card */
+	r = piv_get_data(card, PIV_OBJ_CCC, &ccc, &ccclen);
+	if (r == 0 || r == SC_ERROR_FILE_NOT_FOUND) {
+		ccclen = 0;
+	}
+	else if (r < 0) {
+		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "cannot read CCC, no persistent cache");
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+	}
+	else {
+		ccclen = r;
+	}
+	priv->obj_cache[PIV_OBJ_CCC].flags |= PIV_OBJ_CACHE_VALID;
+	priv->obj_cache[PIV_OBJ_CCC].obj_data = ccclen ? ccc : NULL;
+	priv->obj_cache[PIV_OBJ_CCC].obj_len = ccclen;
+	if (!ccclen && ccc)
+		free(ccc);
+
+	priv->cache_file = strdup(filename);
+	if (priv->cache_file == NULL)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_OUT_OF_MEMORY);
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+
+	memset(loaded, 0, sizeof(loaded));
+	r = SC_ERROR_CORRUPTED_DATA;
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)
+			|| memcmp(magic, PIV_CACHE_MAGIC, sizeof(magic))
+			|| (version = fgetc(f)) != PIV_CACHE_VERSION)
+		goto out;
+	if (piv_cache_get_blob(f, &stored, &storedlen) < 0)
+		goto out;
+	if (storedlen != chuidlen || memcmp(stored, chuid, chuidlen)) {
+		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "CHUID changed, %s is stale", filename);
+		r = SC_ERROR_OBJECT_NOT_VALID;
+		goto out;
+	}
+	if (piv_cache_get_u32(f, &count) < 0
+			|| count >= PIV_OBJ_LAST_ENUM)
+		goto out;
+
+	while (count--) {
+		if ((i = fgetc(f)) == EOF || i >= PIV_OBJ_LAST_ENUM - 1 || i == PIV_OBJ_CHUI
+				|| loaded[i].flags & PIV_OBJ_CACHE_VALID)
+			goto out;
+		if (piv_cache_get_blob(f, &loaded[i].obj_data, &loaded[i].obj_len) < 0
+				|| piv_cache_get_blob(f, &loaded[i].internal_obj_data, &v) < 0)
+			goto out;
+		loaded[i].internal_obj_len = v;
+		loaded[i].flags = PIV_OBJ_CACHE_VALID;
+	}
+	if (!(loaded[PIV_OBJ_CCC].flags & PIV_OBJ_CACHE_VALID))
+		goto out;
+	if (loaded[PIV_OBJ_CCC].obj_len != ccclen
+			|| (ccclen && memcmp(loaded[PIV_OBJ_CCC].obj_data, ccc, ccclen))) {
+		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "CCC changed, %s is stale", filename);
+		r = SC_ERROR_OBJECT_NOT_VALID;
+		goto out;
+	}
+
+	for (i = 0; i < PIV_OBJ_LAST_ENUM - 1; i++) {
+		if (!(loaded[i].flags & PIV_OBJ_CACHE_VALID))
+			continue;
+		if (i == PIV_OBJ_CCC) {
+			/* the copy from the card is already there */
+			if (loaded[i].obj_data)
+				free(loaded[i].obj_data);
+			if (loaded[i].internal_obj_data)
+				free(loaded[i].internal_obj_data);
+			continue;
+		}
+		priv->obj_cache[i].obj_data = loaded[i].obj_data;
+		priv->obj_cache[i].obj_len = loaded[i].obj_len;
+		priv->obj_cache[i].internal_obj_data = loaded[i].internal_obj_data;
+		priv->obj_cache[i].internal_obj_len = loaded[i].internal_obj_len;
+		priv->obj_cache[i].flags |= PIV_OBJ_CACHE_VALID;
+		n++;
+	}
+	priv->cache_dirty = 0;
+	r = SC_SUCCESS;
+	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "loaded %d objects from %s", n, filename);
+
+out:
+	fclose(f);
+	if (stored)
+		free(stored);
+	if (r != SC_SUCCESS) {
+		if (r == SC_ERROR_CORRUPTED_DATA)
+			sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "ignoring damaged %s", filename);
+		for (i = 0; i < PIV_OBJ_LAST_ENUM; i++) {
+			if (loaded[i].obj_data)
+				free(loaded[i].obj_data);
+			if (loaded[i].internal_obj_data)
+				free(loaded[i].internal_obj_data);
+		}
+	}
+	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+}
+
+static int piv_store_persistent_cache(sc_card_t *card)
+{
+	piv_private_data_t * priv = PIV_DATA(card);
+	piv_obj_cache_t *chuid = &priv->obj_cache[PIV_OBJ_CHUI];
+	char tmpname[PATH_MAX];
+	size_t count = 0;
+	FILE *f;
+	int i, r = SC_SUCCESS;
+
+	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
+
+	if (!(chuid->flags & PIV_OBJ_CACHE_VALID) || chuid->obj_len == 0)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+	if (snprintf(tmpname, sizeof(tmpname), "%s.%lu", priv->cache_file,
+			(unsigned long) getpid()) >= (int) sizeof(tmpname))
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_BUFFER_TOO_SMALL);
+
+	f = fopen(tmpname, "wb");
+	if (f == NULL && errno == ENOENT) {
+		if ((r = sc_make_cache_dir(card->ctx)) < 0)
+			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
+		f = fopen(tmpname, "wb");
+	}
+	if (f == NULL)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+
+	for (i = 0; i < PIV_OBJ_LAST_ENUM - 1; i++)
+		if (i != PIV_OBJ_CHUI && priv->obj_cache[i].flags & PIV_OBJ_CACHE_VALID)
+			count++;
+
+	if (fwrite(PIV_CACHE_MAGIC, 1, sizeof(PIV_CACHE_MAGIC) - 1, f) != sizeof(PIV_CACHE_MAGIC) - 1
+			|| fputc(PIV_CACHE_VERSION, f) == EOF
+			|| piv_cache_put_blob(f, chuid->obj_data, chuid->obj_len) < 0
+			|| piv_cache_put_u32(f, count) < 0)
+		r = SC_ERROR_INTERNAL;
+	for (i = 0; r == SC_SUCCESS && i < PIV_OBJ_LAST_ENUM - 1; i++) {
+		if (i == PIV_OBJ_CHUI || !(priv->obj_cache[i].flags & PIV_OBJ_CACHE_VALID))
+			continue;
+		if (fputc(i, f) == EOF
+				|| piv_cache_put_blob(f, priv->obj_cache[i].obj_data,
+					priv->obj_cache[i].obj_len) < 0
+				|| piv_cache_put_blob(f, priv->obj_cache[i].internal_obj_data,
+					priv->obj_cache[i].internal_obj_len) < 0)
+			r = SC_ERROR_INTERNAL;
+	}
+	if (fclose(f) != 0)
+		r = SC_ERROR_INTERNAL;
+	if (r == SC_SUCCESS) {
+#ifdef _WIN32
+		remove(priv->cache_file);
+#endif
+		/* replace atomically, other processes see either version */
+		if (rename(tmpname, priv->cache_file) != 0)
+			r = SC_ERROR_INTERNAL;
+	}
+	if (r != SC_SUCCESS)
+		remove(tmpname);
+	else
+		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "saved %d objects to %s", (int) count, priv->cache_file);
+	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
+}
+
+/* Objects on the card are modified, forget about the saved copy */
+static void piv_drop_persistent_cache(sc_card_t *card)
+{
+	piv_private_data_t * priv = PIV_DATA(card);
+
+	if (priv->cache_file == NULL)
+		return;
+	remove(priv->cache_file);
+	free(priv->cache_file);
+	priv->cache_file = NULL;
+}
+
 /*
  * Callers of this may be expecting a certificate,
  * select file will have saved the object type for us
@@ -1312,6 +1642,7 @@ static int piv_write_binary(sc_card_t *card, unsigned int idx,
 				priv->obj_cache[enumtag].internal_obj_len = 0;
 			}
 		}
+		piv_drop_persistent_cache(card);
 
 		if (idx != 0)
 			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_NO_CARD_SUPPORT);
@@ -2454,6 +2785,14 @@ static int piv_process_history(sc_card_t *card)
 			*cp++ = 0x00;
 			put_tag_and_len(0xFE, 0, &cp);
 
+			/* may already be there from the persistent cache */
+			if (priv->obj_cache[enumtag].obj_data)
+				free(priv->obj_cache[enumtag].obj_data);
+			if (priv->obj_cache[enumtag].internal_obj_data) {
+				free(priv->obj_cache[enumtag].internal_obj_data);
+				priv->obj_cache[enumtag].internal_obj_data = NULL;
+				priv->obj_cache[enumtag].internal_obj_len = 0;
+			}
 			priv->obj_cache[enumtag].obj_data = certobj;
 			priv->obj_cache[enumtag].obj_len = certobjlen;
 			priv->obj_cache[enumtag].flags |= PIV_OBJ_CACHE_VALID;
@@ -2488,6 +2827,11 @@ static int piv_finish(sc_card_t *card)
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
 	if (priv) {
+		if (priv->cache_file) {
+			if (priv->cache_dirty)
+				piv_store_persistent_cache(card);
+			free(priv->cache_file);
+		}
 		if (priv->aid_file)
 			sc_file_free(priv->aid_file);
 		if (priv->w_buf)
@@ -2531,6 +2875,7 @@ static int piv_init(sc_card_t *card)
 	unsigned long flags;
 	unsigned long ext_flags;
 	piv_private_data_t *priv;
+	scconf_block *conf_block;
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
 	priv = calloc(1, sizeof(piv_private_data_t));
@@ -2579,6 +2924,15 @@ static int piv_init(sc_card_t *card)
 	_sc_card_add_ec_alg(card, 384, flags, ext_flags);
 
 	card->caps |= SC_CARD_CAP_RNG;
+	/* SP 800-73-3 part 2, 3.2.1: VERIFY without data gives the PIN status */
+	card->caps |= SC_CARD_CAP_ISO7816_PIN_INFO;
+
+	conf_block = sc_get_conf_block(card->ctx, "card_driver", "piv", 1);
+	if (conf_block && scconf_get_bool(conf_block, "persistent_cache", 0)) {
+		r = piv_load_persistent_cache(card);
+		if (r < 0)
+			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
+	}
 
 	/*
 	 * 800-73-3 cards may have a history object and/or a discovery object
@@ -150,10 +150,14 @@ static int sc_hsm_pin_info(sc_card_t *card, struct sc_pin_cmd_data *data,
 
 	if (r == SC_ERROR_PIN_CODE_INCORRECT) {
 		data->pin1.tries_left = apdu.sw2 & 0xF;
+		data->pin1.logged_in = SC_PIN_STATE_LOGGED_OUT;
 		r = SC_SUCCESS;
 	} else if (r == SC_ERROR_AUTH_METHOD_BLOCKED) {
 		data->pin1.tries_left = 0;
+		data->pin1.logged_in = SC_PIN_STATE_LOGGED_OUT;
 		r = SC_SUCCESS;
+	} else if (r == SC_SUCCESS) {
+		data->pin1.logged_in = SC_PIN_STATE_LOGGED_IN;
 	}
 	LOG_TEST_RET(card->ctx, r, "Check SW error");
 
@@ -418,7 +422,7 @@ static int sc_hsm_set_security_env(sc_card_t *card,
 {
 	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) card->drv_data;
 
-	priv->env = env;
+	priv->env = *env;
 
 	switch(env->algorithm) {
 	case SC_ALGORITHM_RSA:
@@ -542,11 +546,11 @@ static int sc_hsm_compute_signature(sc_card_t *card,
 
 	assert(card != NULL && data != NULL && out != NULL);
 
-	if (priv->env == NULL) {
+	if (!(priv->env.flags & SC_SEC_ENV_KEY_REF_PRESENT)) {
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_OBJECT_NOT_FOUND);
 	}
 
-	sc_format_apdu(card, &apdu, SC_APDU_CASE_4, 0x68, priv->env->key_ref[0], priv->algorithm);
+	sc_format_apdu(card, &apdu, SC_APDU_CASE_4, 0x68, priv->env.key_ref[0], priv->algorithm);
 	apdu.cla = 0x80;
 	apdu.resp = rbuf;
 	apdu.resplen = sizeof(rbuf);
@@ -588,7 +592,11 @@ static int sc_hsm_decipher(sc_card_t *card, const u8 * crgram, size_t crgram_len
 	assert(card != NULL && crgram != NULL && out != NULL);
 	LOG_FUNC_CALLED(card->ctx);
 
-	sc_format_apdu(card, &apdu, SC_APDU_CASE_4, 0x62, priv->env->key_ref[0], priv->algorithm);
+	if (!(priv->env.flags & SC_SEC_ENV_KEY_REF_PRESENT)) {
+		LOG_FUNC_RETURN(card->ctx, SC_ERROR_OBJECT_NOT_FOUND);
+	}
+
+	sc_format_apdu(card, &apdu, SC_APDU_CASE_4, 0x62, priv->env.key_ref[0], priv->algorithm);
 	apdu.cla = 0x80;
 	apdu.resp = rbuf;
 	apdu.resplen = sizeof(rbuf);
@@ -52,7 +52,7 @@
 
 /* Information the driver maintains between calls */
 typedef struct sc_hsm_private_data {
-	const sc_security_env_t *env;
+	sc_security_env_t env;
 	u8 algorithm;
 	int noExtLength;
 	char *serialno;
@@ -21,7 +21,10 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -29,6 +32,7 @@
 
 #include "internal.h"
 #include "asn1.h"
+#include "cardctl.h"
 
 /*
 #define INVALIDATE_CARD_CACHE_IN_UNLOCK
@@ -90,6 +94,355 @@ static sc_card_t * sc_card_new(sc_context_t *ctx)
 	return card;
 }
 
+/*
+ * FCIs of the files selected by absolute path or DF name, so that callers
+ * who only want to know the size, structure or ACLs of a file get them
+ * with sc_get_file_info() and without a SELECT.
+ *
+ * Paths the card answered "not found" (6A82, 6A88) for are remembered as
+ * well, binding probes for a lot of files and AIDs that are not there.
+ */
+#define SC_FCI_CACHE_SIZE	32
+
+struct sc_absent_file {
+	struct sc_path path;
+	int error;
+	int added;	/* found by this process, not in the on-disk copy yet */
+};
+
+struct sc_fci_cache {
+	struct sc_file *files[SC_FCI_CACHE_SIZE];
+	size_t next;	/* slot replaced when the cache is full */
+	struct sc_absent_file absent[SC_FCI_CACHE_SIZE];
+	size_t absent_count, absent_next;
+	/* on-disk copy of the absent paths, with use_file_caching; it is
+	 * stale once this process has created or deleted files */
+	int absent_loaded, absent_stale;
+	char *absent_file;
+};
+
+/* Relative paths depend on the current DF and are never cached */
+static int fci_cacheable(const sc_path_t *path)
+{
+	if (path->len == 0 || path->index != 0 || path->count > 0)
+		return 0;
+	if (path->type == SC_PATH_TYPE_DF_NAME)
+		return 1;
+	return path->type == SC_PATH_TYPE_PATH
+		&& (path->aid.len > 0 || (path->len >= 2 && !memcmp(path->value, "\x3F\x00", 2)));
+}
+
+static int fci_path_equal(const sc_path_t *a, const sc_path_t *b)
+{
+	return a->type == b->type && a->len == b->len
+		&& !memcmp(a->value, b->value, a->len)
+		&& a->aid.len == b->aid.len
+		&& !memcmp(a->aid.value, b->aid.value, a->aid.len);
+}
+
+/* Whether a change of 'path' may affect 'cached': it is the same file, one
+ * below it or a DF above it. Anything may be affected by a NULL path. */
+static int fci_path_affects(const sc_path_t *path, const sc_path_t *cached)
+{
+	size_t len;
+
+	if (path == NULL || path->type != SC_PATH_TYPE_PATH
+			|| cached->type != SC_PATH_TYPE_PATH
+			|| path->aid.len != cached->aid.len
+			|| memcmp(path->aid.value, cached->aid.value, path->aid.len))
+		return 1;
+	len = path->len < cached->len ? path->len : cached->len;
+	return !memcmp(path->value, cached->value, len);
+}
+
+static struct sc_fci_cache *fci_cache_get(sc_card_t *card)
+{
+	if (card->fci_cache == NULL)
+		card->fci_cache = calloc(1, sizeof(*card->fci_cache));
+	return card->fci_cache;
+}
+
+static struct sc_file *fci_cache_find(sc_card_t *card, const sc_path_t *path)
+{
+	size_t i;
+
+	if (card->fci_cache == NULL || !fci_cacheable(path))
+		return NULL;
+	for (i = 0; i < SC_FCI_CACHE_SIZE; i++)
+		if (card->fci_cache->files[i]
+				&& fci_path_equal(&card->fci_cache->files[i]->path, path))
+			return card->fci_cache->files[i];
+	return NULL;
+}
+
+static void fci_cache_add(sc_card_t *card, const sc_file_t *file)
+{
+	struct sc_fci_cache *cache;
+	struct sc_file **slot = NULL;
+	size_t i;
+
+	if (!fci_cacheable(&file->path) || (cache = fci_cache_get(card)) == NULL)
+		return;
+
+	for (i = 0; i < SC_FCI_CACHE_SIZE && slot == NULL; i++)
+		if (cache->files[i] && fci_path_equal(&cache->files[i]->path, &file->path))
+			slot = &cache->files[i];
+	for (i = 0; i < SC_FCI_CACHE_SIZE && slot == NULL; i++)
+		if (cache->files[i] == NULL)
+			slot = &cache->files[i];
+	if (slot == NULL) {
+		slot = &cache->files[cache->next];
+		cache->next = (cache->next + 1) % SC_FCI_CACHE_SIZE;
+	}
+
+	if (*slot)
+		sc_file_free(*slot);
+	*slot = NULL;
+	sc_file_dup(slot, file);
+}
+
+static void fci_absent_add(sc_card_t *card, const sc_path_t *path, int error, int added);
+
+/* The on-disk file is named after the ATR and the serial number of the card.
+ * Called once the card is connected: drivers select files from their
+ * match_card() and init(), before they can tell the serial number. */
+static char *fci_absent_file_name(sc_card_t *card)
+{
+	scconf_block *conf_block;
+	sc_serial_number_t serial;
+	char dir[PATH_MAX], atr[SC_MAX_ATR_SIZE * 2 + 1], sn[SC_MAX_SERIALNR * 2 + 1];
+	char *name;
+	size_t len;
+
+	conf_block = sc_get_conf_block(card->ctx, "framework", "pkcs15", 1);
+	if (!scconf_get_bool(conf_block, "use_file_caching", 0))
+		return NULL;
+
+	serial = card->serialnr;
+	if (serial.len == 0 && sc_card_ctl(card, SC_CARDCTL_GET_SERIALNR, &serial) != SC_SUCCESS)
+		return NULL;
+	if (serial.len == 0 || serial.len > SC_MAX_SERIALNR
+			|| sc_bin_to_hex(serial.value, serial.len, sn, sizeof(sn), 0) != SC_SUCCESS
+			|| sc_bin_to_hex(card->reader->atr.value, card->reader->atr.len, atr, sizeof(atr), 0) != SC_SUCCESS
+			|| sc_get_cache_dir(card->ctx, dir, sizeof(dir)) != SC_SUCCESS)
+		return NULL;
+
+	len = strlen(dir) + strlen(atr) + strlen(sn) + 10;
+	name = malloc(len);
+	if (name == NULL)
+		return NULL;
+#ifdef _WIN32
+	snprintf(name, len, "%s\\absent-%s-%s", dir, atr, sn);
+#else
+	snprintf(name, len, "%s/absent-%s-%s", dir, atr, sn);
+#endif
+	return name;
+}
+
+/* One line per path: type, path and AID in hex ("-" if empty), error */
+static size_t fci_absent_read(FILE *f, struct sc_absent_file *list, size_t max)
+{
+	char line[128], value[SC_MAX_PATH_SIZE * 2 + 2], aid[SC_MAX_AID_SIZE * 2 + 2];
+	sc_path_t *path;
+	size_t len, n = 0;
+	int type, error;
+
+	while (n < max && fgets(line, sizeof(line), f) != NULL) {
+		path = &list[n].path;
+		memset(path, 0, sizeof(*path));
+		if (sscanf(line, "%d %33s %33s %d", &type, value, aid, &error) != 4)
+			break;
+		path->type = type;
+		len = sizeof(path->value);
+		if (sc_hex_to_bin(value, path->value, &len) != SC_SUCCESS)
+			break;
+		path->len = len;
+		len = sizeof(path->aid.value);
+		if (strcmp(aid, "-") && sc_hex_to_bin(aid, path->aid.value, &len) != SC_SUCCESS)
+			break;
+		path->aid.len = strcmp(aid, "-") ? len : 0;
+		if ((error != SC_ERROR_FILE_NOT_FOUND && error != SC_ERROR_DATA_OBJECT_NOT_FOUND)
+				|| !fci_cacheable(path))
+			break;
+		list[n].error = error;
+		list[n].added = 0;
+		n++;
+	}
+	return n;
+}
+
+static void fci_absent_load(sc_card_t *card)
+{
+	struct sc_fci_cache *cache = card->fci_cache;
+	struct sc_absent_file list[SC_FCI_CACHE_SIZE];
+	size_t i, n;
+	FILE *f;
+
+	cache->absent_loaded = 1;
+	if (cache->absent_file == NULL || cache->absent_stale)
+		return;
+	f = fopen(cache->absent_file, "r");
+	if (f == NULL)
+		return;
+	n = fci_absent_read(f, list, SC_FCI_CACHE_SIZE);
+	fclose(f);
+
+	for (i = 0; i < n; i++)
+		if (fci_cache_find(card, &list[i].path) == NULL)
+			fci_absent_add(card, &list[i].path, list[i].error, 0);
+	sc_log(card->ctx, "%lu absent paths from %s",
+			(unsigned long) cache->absent_count, cache->absent_file);
+}
+
+/* Writes the paths this process found absent, merged with what is on disk
+ * now. If this process changed files, what is on disk is dropped. */
+static void fci_absent_save(sc_card_t *card)
+{
+	struct sc_fci_cache *cache = card->fci_cache;
+	struct sc_absent_file list[SC_FCI_CACHE_SIZE], disk[SC_FCI_CACHE_SIZE];
+	char value[SC_MAX_PATH_SIZE * 2 + 1], aid[SC_MAX_AID_SIZE * 2 + 1];
+	const sc_path_t *path;
+	size_t i, j, n = 0, ndisk = 0;
+	FILE *f;
+
+	if (cache == NULL || cache->absent_file == NULL)
+		return;
+	for (i = 0; i < cache->absent_count; i++)
+		if (cache->absent[i].added)
+			list[n++] = cache->absent[i];
+	if (n == 0 && !cache->absent_stale)
+		return;
+
+	if (!cache->absent_stale && (f = fopen(cache->absent_file, "r")) != NULL) {
+		ndisk = fci_absent_read(f, disk, SC_FCI_CACHE_SIZE);
+		fclose(f);
+	}
+	for (i = 0; i < ndisk && n < SC_FCI_CACHE_SIZE; i++) {
+		for (j = 0; j < n; j++)
+			if (fci_path_equal(&list[j].path, &disk[i].path))
+				break;
+		if (j == n)
+			list[n++] = disk[i];
+	}
+	for (i = 0; i < cache->absent_count; i++)
+		cache->absent[i].added = 0;
+	cache->absent_stale = 0;
+
+	if (n == 0) {
+		unlink(cache->absent_file);
+		return;
+	}
+	f = fopen(cache->absent_file, "w");
+	if (f == NULL && errno == ENOENT && sc_make_cache_dir(card->ctx) == SC_SUCCESS)
+		f = fopen(cache->absent_file, "w");
+	if (f == NULL)
+		return;
+	for (i = 0; i < n; i++) {
+		path = &list[i].path;
+		sc_bin_to_hex(path->value, path->len, value, sizeof(value), 0);
+		if (path->aid.len)
+			sc_bin_to_hex(path->aid.value, path->aid.len, aid, sizeof(aid), 0);
+		else
+			strcpy(aid, "-");
+		fprintf(f, "%d %s %s %d\n", path->type, value, aid, list[i].error);
+	}
+	if (fclose(f) != 0)
+		unlink(cache->absent_file);
+}
+
+static const struct sc_absent_file *fci_absent_find(sc_card_t *card, const sc_path_t *path)
+{
+	size_t i;
+
+	if (!fci_cacheable(path) || fci_cache_get(card) == NULL)
+		return NULL;
+	if (!card->fci_cache->absent_loaded)
+		fci_absent_load(card);
+	for (i = 0; i < card->fci_cache->absent_count; i++)
+		if (fci_path_equal(&card->fci_cache->absent[i].path, path))
+			return &card->fci_cache->absent[i];
+	return NULL;
+}
+
+static void fci_absent_add(sc_card_t *card, const sc_path_t *path, int error, int added)
+{
+	struct sc_fci_cache *cache;
+	struct sc_absent_file *entry;
+	size_t i;
+
+	if (!fci_cacheable(path) || (cache = fci_cache_get(card)) == NULL)
+		return;
+	for (i = 0; i < cache->absent_count; i++)
+		if (fci_path_equal(&cache->absent[i].path, path))
+			return;
+
+	if (cache->absent_count < SC_FCI_CACHE_SIZE) {
+		entry = &cache->absent[cache->absent_count++];
+	} else {
+		entry = &cache->absent[cache->absent_next];
+		cache->absent_next = (cache->absent_next + 1) % SC_FCI_CACHE_SIZE;
+	}
+	entry->path = *path;
+	entry->error = error;
+	entry->added = added;
+}
+
+/* Another process may have had the card in between: what was found absent
+ * is looked up on disk again */
+static void fci_absent_reset(sc_card_t *card)
+{
+	struct sc_fci_cache *cache = card->fci_cache;
+
+	if (cache == NULL)
+		return;
+	cache->absent_count = 0;
+	cache->absent_next = 0;
+	cache->absent_loaded = 0;
+}
+
+/* Drops what is known about a file, the files below it and the DFs above
+ * it. Relative paths can mean any file, everything is dropped then. */
+static void fci_cache_invalidate(sc_card_t *card, const sc_path_t *path)
+{
+	struct sc_fci_cache *cache = card->fci_cache;
+	size_t i;
+
+	if (cache == NULL)
+		return;
+	for (i = 0; i < SC_FCI_CACHE_SIZE; i++) {
+		if (cache->files[i] == NULL || !fci_path_affects(path, &cache->files[i]->path))
+			continue;
+		sc_file_free(cache->files[i]);
+		cache->files[i] = NULL;
+	}
+	for (i = 0; i < cache->absent_count; ) {
+		if (!fci_path_affects(path, &cache->absent[i].path)) {
+			i++;
+			continue;
+		}
+		cache->absent[i] = cache->absent[--cache->absent_count];
+	}
+	cache->absent_next = 0;
+	cache->absent_stale = 1;
+}
+
+/* After a reset: nothing is known any longer, the on-disk copy is kept
+ * and looked up again */
+static void fci_cache_reset(sc_card_t *card)
+{
+	struct sc_fci_cache *cache = card->fci_cache;
+	size_t i;
+
+	if (cache == NULL)
+		return;
+	for (i = 0; i < SC_FCI_CACHE_SIZE; i++) {
+		if (cache->files[i] != NULL)
+			sc_file_free(cache->files[i]);
+		cache->files[i] = NULL;
+	}
+	fci_absent_reset(card);
+}
+
 static void sc_card_free(sc_card_t *card)
 {
 	sc_free_apps(card);
@@ -103,6 +456,11 @@ static void sc_card_free(sc_card_t *card)
 		sc_file_free(card->cache.current_ef);
 	if (card->cache.current_df)
 		sc_file_free(card->cache.current_df);
+	if (card->fci_cache != NULL) {
+		fci_cache_reset(card);
+		free(card->fci_cache->absent_file);
+		free(card->fci_cache);
+	}
 	if (card->mutex != NULL) {
 		int r = sc_mutex_destroy(card->ctx, card->mutex);
 		if (r != SC_SUCCESS)
@@ -224,6 +582,11 @@ int sc_connect_card(sc_reader_t *reader, sc_card_t **card_out)
 		card->name = card->driver->name;
 	*card_out = card;
 
+	if (fci_cache_get(card) != NULL) {
+		card->fci_cache->absent_file = fci_absent_file_name(card);
+		card->fci_cache->absent_loaded = 0;
+	}
+
         /*  Override card limitations with reader limitations.
          *  Note that zero means no limitations at all.
 	 */
@@ -266,6 +629,7 @@ int sc_disconnect_card(sc_card_t *card)
 	ctx = card->ctx;
 	LOG_FUNC_CALLED(ctx);
 
+	sc_async_stop(card);
 	assert(card->lock_count == 0);
 	if (card->ops->finish) {
 		int r = card->ops->finish(card);
@@ -284,6 +648,7 @@ int sc_disconnect_card(sc_card_t *card)
 	sc_card_sm_unload(card);
 #endif
 
+	fci_absent_save(card);
 	sc_card_free(card);
 	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
 }
@@ -303,6 +668,7 @@ int sc_reset(sc_card_t *card, int do_cold_reset)
 
 	r = card->reader->ops->reset(card->reader, do_cold_reset);
 	/* invalidate cache */
+	fci_cache_reset(card);
 	memset(&card->cache, 0, sizeof(card->cache));
 	card->cache.valid = 0;
 
@@ -332,13 +698,26 @@ int sc_lock(sc_card_t *card)
 			r = card->reader->ops->lock(card->reader);
 			if (r == SC_ERROR_CARD_RESET || r == SC_ERROR_READER_REATTACHED) {
 				/* invalidate cache */
+				fci_cache_reset(card);
+				if (r == SC_ERROR_READER_REATTACHED && card->fci_cache != NULL) {
+					/* maybe another card, keep its absent files to itself */
+					free(card->fci_cache->absent_file);
+					card->fci_cache->absent_file = NULL;
+				}
 				memset(&card->cache, 0, sizeof(card->cache));
 				card->cache.valid = 0;
 				r = card->reader->ops->lock(card->reader);
 			}
 		}
-		if (r == 0)
+		if (r == 0) {
+			/* somebody else may have had the card in between */
+			if (!(card->reader->flags & SC_READER_TRANSACTION_KEPT)) {
+				card->cache.pin_state_count = 0;
+				card->cache.sec_env_valid = 0;
+				fci_cache_reset(card);
+			}
 			card->cache.valid = 1;
+		}
 	}
 	if (r == 0)
 		card->lock_count++;
@@ -372,6 +751,8 @@ int sc_unlock(sc_card_t *card)
 		card->cache.valid = 0;
 		sc_log(card->ctx, "cache invalidated");
 #endif
+		/* keep what was found absent in this transaction */
+		fci_absent_save(card);
 		/* release reader lock */
 		if (card->reader->ops->unlock != NULL)
 			r = card->reader->ops->unlock(card->reader);
@@ -421,6 +802,7 @@ int sc_create_file(sc_card_t *card, sc_file_t *file)
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_NOT_SUPPORTED);
 
 	r = card->ops->create_file(card, file);
+	fci_cache_invalidate(card, in_path);
 	LOG_FUNC_RETURN(card->ctx, r);
 }
 
@@ -439,6 +821,7 @@ int sc_delete_file(sc_card_t *card, const sc_path_t *path)
 	if (card->ops->delete_file == NULL)
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_NOT_SUPPORTED);
 	r = card->ops->delete_file(card, path);
+	fci_cache_invalidate(card, path);
 
 	LOG_FUNC_RETURN(card->ctx, r);
 }
@@ -606,6 +989,7 @@ int sc_erase_binary(struct sc_card *card, unsigned int offs, size_t count,  unsi
 
 int sc_select_file(sc_card_t *card, const sc_path_t *in_path,  sc_file_t **file)
 {
+	const struct sc_absent_file *absent;
 	int r;
 	char pbuf[SC_MAX_PATH_STRING_SIZE];
 
@@ -636,16 +1020,52 @@ int sc_select_file(sc_card_t *card, const sc_path_t *in_path,  sc_file_t **file)
 	}
 	if (card->ops->select_file == NULL)
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_NOT_SUPPORTED);
+
+	absent = fci_absent_find(card, in_path);
+	if (absent != NULL) {
+		sc_log(card->ctx, "%s is known to be absent", pbuf);
+		LOG_FUNC_RETURN(card->ctx, absent->error);
+	}
+
 	r = card->ops->select_file(card, in_path, file);
+	if (r == SC_ERROR_FILE_NOT_FOUND || r == SC_ERROR_DATA_OBJECT_NOT_FOUND)
+		fci_absent_add(card, in_path, r, 1);
 	LOG_TEST_RET(card->ctx, r, "'SELECT' error");
 
+	/* selecting another file or application may change the
+	 * security environment */
+	if (!sc_compare_path(&card->cache.selected_path, in_path)) {
+		card->cache.selected_path = *in_path;
+		card->cache.sec_env_valid = 0;
+	}
+
 	/* Remember file path */
-	if (file && *file)
+	if (file && *file) {
 		(*file)->path = *in_path;
+		fci_cache_add(card, *file);
+	}
 
 	LOG_FUNC_RETURN(card->ctx, r);
 }
 
+int sc_get_file_info(sc_card_t *card, const sc_path_t *path, sc_file_t **file)
+{
+	sc_file_t *cached;
+
+	assert(card != NULL && path != NULL && file != NULL);
+	LOG_FUNC_CALLED(card->ctx);
+
+	cached = fci_cache_find(card, path);
+	if (cached == NULL)
+		return sc_select_file(card, path, file);
+
+	sc_log(card->ctx, "FCI of %s from cache", sc_print_path(path));
+	sc_file_dup(file, cached);
+	if (*file == NULL)
+		LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
+	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+}
+
 
 int sc_get_data(sc_card_t *card, unsigned int tag, u8 *buf, size_t len)
 {
@@ -771,6 +1191,19 @@ sc_card_ctl(sc_card_t *card, unsigned long cmd, void *args)
 	if (card->ops->card_ctl != NULL)
 		r = card->ops->card_ctl(card, cmd, args);
 
+	/* drivers create, resize and erase files behind these */
+	switch (cmd) {
+	case SC_CARDCTL_GET_DEFAULT_KEY:
+	case SC_CARDCTL_LIFECYCLE_GET:
+	case SC_CARDCTL_GET_SERIALNR:
+	case SC_CARDCTL_GET_SE_INFO:
+	case SC_CARDCTL_GET_CHV_REFERENCE_IN_SE:
+		break;
+	default:
+		if (r != SC_ERROR_NOT_SUPPORTED)
+			fci_cache_invalidate(card, NULL);
+	}
+
 	/* suppress "not supported" error messages */
 	if (r == SC_ERROR_NOT_SUPPORTED) {
 		sc_log(card->ctx, "card_ctl(%lu) not supported", cmd);
@@ -1041,13 +1474,7 @@ scconf_block *sc_get_conf_block(sc_context_t *ctx, const char *name1, const char
 	scconf_block *conf_block = NULL;
 
 	for (i = 0; ctx->conf_blocks[i] != NULL; i++) {
-		scconf_block **blocks;
-
-		blocks = scconf_find_blocks(ctx->conf, ctx->conf_blocks[i], name1, name2);
-		if (blocks != NULL) {
-			conf_block = blocks[0];
-			free(blocks);
-		}
+		conf_block = (scconf_block *) scconf_find_block_by_key(ctx->conf, ctx->conf_blocks[i], name1, name2);
 		if (conf_block != NULL && priority)
 			break;
 	}
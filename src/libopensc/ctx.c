@@ -51,11 +51,27 @@ int _sc_delete_reader(sc_context_t *ctx, sc_reader_t *reader)
 			reader->ops->release(reader);
 	if (reader->name)
 		free(reader->name);
+	sc_mem_free_secure(reader->sbuf, SC_READER_IO_BUFFER_SIZE);
+	sc_mem_free_secure(reader->rbuf, SC_READER_IO_BUFFER_SIZE);
 	list_delete(&ctx->readers, reader);
 	free(reader);
 	return SC_SUCCESS;
 }
 
+int _sc_reader_io_buffers(sc_reader_t *reader, u8 **sbuf, u8 **rbuf)
+{
+	assert(reader != NULL && sbuf != NULL && rbuf != NULL);
+	if (reader->sbuf == NULL)
+		reader->sbuf = sc_mem_alloc_secure(reader->ctx, SC_READER_IO_BUFFER_SIZE);
+	if (reader->rbuf == NULL)
+		reader->rbuf = sc_mem_alloc_secure(reader->ctx, SC_READER_IO_BUFFER_SIZE);
+	if (reader->sbuf == NULL || reader->rbuf == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	*sbuf = reader->sbuf;
+	*rbuf = reader->rbuf;
+	return SC_SUCCESS;
+}
+
 struct _sc_driver_entry {
 	const char *name;
 	void *(*func)(void);
@@ -306,14 +322,10 @@ static const char *find_library(sc_context_t *ctx, const char *name)
 {
 	int          i;
 	const char   *libname = NULL;
-	scconf_block **blocks, *blk;
+	const scconf_block *blk;
 
 	for (i = 0; ctx->conf_blocks[i]; i++) {
-		blocks = scconf_find_blocks(ctx->conf, ctx->conf_blocks[i], "card_driver", name);
-		if (!blocks)
-			continue;
-		blk = blocks[0];
-		free(blocks);
+		blk = scconf_find_block_by_key(ctx->conf, ctx->conf_blocks[i], "card_driver", name);
 		if (blk == NULL)
 			continue;
 		libname = scconf_get_str(blk, "module", name);
@@ -383,17 +395,12 @@ static void *load_dynamic_driver(sc_context_t *ctx, void **dll, const char *name
 static int load_card_driver_options(sc_context_t *ctx,
 				    struct sc_card_driver *driver)
 {
-	scconf_block **blocks, *blk;
+	const scconf_block *blk;
 	int i;
 
 	for (i = 0; ctx->conf_blocks[i]; i++) {
-		blocks = scconf_find_blocks(ctx->conf, ctx->conf_blocks[i],
+		blk = scconf_find_block_by_key(ctx->conf, ctx->conf_blocks[i],
 				"card_driver", driver->short_name);
-		if (!blocks)
-			continue;
-		blk = blocks[0];
-		free(blocks);
-
 		if (blk == NULL)
 			continue;
 
@@ -530,10 +537,34 @@ static int load_card_atrs(sc_context_t *ctx)
 	return SC_SUCCESS;
 }
 
+/**
+ * binary snapshot of the parsed configuration file in the cache directory,
+ * named after the configuration file so that several files can be cached
+ */
+static int get_config_snapshot_path(sc_context_t *ctx, const char *conf_path, char *buf, size_t bufsize)
+{
+	char dirname[PATH_MAX];
+	unsigned int h = 2166136261U;
+	const char *p;
+	int r;
+
+	r = sc_get_cache_dir(ctx, dirname, sizeof(dirname));
+	if (r < 0)
+		return r;
+	for (p = conf_path; *p; p++)
+		h = (h ^ (unsigned char) *p) * 16777619U;
+	r = snprintf(buf, bufsize, "%s/opensc-conf-%08x.bin", dirname, h);
+	if (r < 0 || (size_t) r >= bufsize)
+		return SC_ERROR_BUFFER_TOO_SMALL;
+	return SC_SUCCESS;
+}
+
 static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
 {
 	int i, r, count = 0;
-	scconf_block **blocks;
+	const scconf_block *block;
+	char snapshot[PATH_MAX];
+	int have_snapshot, from_snapshot = 0;
 	const char *conf_path = NULL;
 	const char *debug = NULL;
 #ifdef _WIN32
@@ -586,7 +617,10 @@ static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
 	ctx->conf = scconf_new(conf_path);
 	if (ctx->conf == NULL)
 		return;
-	r = scconf_parse(ctx->conf);
+	have_snapshot = get_config_snapshot_path(ctx, conf_path, snapshot, sizeof(snapshot)) == SC_SUCCESS;
+	if (have_snapshot && scconf_snapshot_read(ctx->conf, snapshot) == 1)
+		from_snapshot = 1;
+	r = from_snapshot ? 1 : scconf_parse(ctx->conf);
 #ifdef OPENSC_CONFIG_STRING
 	/* Parse the string if config file didn't exist */
 	if (r < 0)
@@ -604,20 +638,66 @@ static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
 		ctx->conf = NULL;
 		return;
 	}
-	blocks = scconf_find_blocks(ctx->conf, NULL, "app", ctx->app_name);
-	if (blocks[0])
-		ctx->conf_blocks[count++] = blocks[0];
-	free(blocks);
+	if (!scconf_index_build(ctx->conf))
+		sc_log(ctx, "cannot build configuration index, using linear lookups");
+
+	block = scconf_find_block_by_key(ctx->conf, NULL, "app", ctx->app_name);
+	if (block)
+		ctx->conf_blocks[count++] = (scconf_block *) block;
 	if (strcmp(ctx->app_name, "default") != 0) {
-		blocks = scconf_find_blocks(ctx->conf, NULL, "app", "default");
-		if (blocks[0])
-			ctx->conf_blocks[count] = blocks[0];
-		free(blocks);
+		block = scconf_find_block_by_key(ctx->conf, NULL, "app", "default");
+		if (block)
+			ctx->conf_blocks[count] = (scconf_block *) block;
 	}
 	/* Above we add 2 blocks at most, but conf_blocks has 3 elements,
 	 * so at least one is NULL */
 	for (i = 0; ctx->conf_blocks[i]; i++)
 		load_parameters(ctx, ctx->conf_blocks[i], opts);
+
+	if (ctx->debug) {
+		const char *format = "text", *file = NULL;
+
+		for (i = 0; ctx->conf_blocks[i]; i++) {
+			format = scconf_get_str(ctx->conf_blocks[i], "debug_format", format);
+			file = scconf_get_str(ctx->conf_blocks[i], "debug_file", file);
+		}
+		if (!strcmp(format, "binary")) {
+			r = file ? _sc_binlog_open(ctx, file) : SC_ERROR_NOT_SUPPORTED;
+			if (r != SC_SUCCESS) {
+				sc_log(ctx, "cannot write binary debug log: %s", sc_strerror(r));
+			} else if (ctx->debug_file && ctx->debug_file != stdout && ctx->debug_file != stderr) {
+				/* the text stream is open on the same file */
+				fclose(ctx->debug_file);
+				ctx->debug_file = NULL;
+			}
+		}
+	}
+
+	for (i = 0; ctx->conf_blocks[i]; i++) {
+		const char *trace_file = scconf_get_str(ctx->conf_blocks[i], "apdu_trace_file", NULL);
+
+		if (trace_file != NULL) {
+			r = _sc_trace_open(ctx, trace_file);
+			if (r != SC_SUCCESS)
+				sc_log(ctx, "cannot write APDU trace %s: %s", trace_file, sc_strerror(r));
+			break;
+		}
+	}
+
+	if (from_snapshot) {
+		sc_log(ctx, "configuration loaded from snapshot %s", snapshot);
+	}
+	else if (have_snapshot) {
+		int enable = 0;
+
+		for (i = 0; ctx->conf_blocks[i]; i++)
+			enable = scconf_get_bool(ctx->conf_blocks[i], "config_snapshot", enable);
+		if (enable && sc_make_cache_dir(ctx) == SC_SUCCESS) {
+			r = scconf_snapshot_write(ctx->conf, snapshot);
+			if (r)
+				sc_log(ctx, "cannot write configuration snapshot %s: %s", snapshot, strerror(r));
+		}
+	}
 }
 
 int sc_ctx_detect_readers(sc_context_t *ctx)
@@ -687,7 +767,7 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 {
 	sc_context_t		*ctx;
 	struct _sc_ctx_options	opts;
-	int			r;
+	int			r, i;
 
 	if (ctx_out == NULL || parm == NULL)
 		return SC_ERROR_INVALID_ARGUMENTS;
@@ -736,6 +816,11 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 	ctx->reader_driver = sc_get_openct_driver();
 #endif
 
+	/* a recorded APDU trace stands in for the readers */
+	for (i = 0; ctx->conf_blocks[i]; i++)
+		if (scconf_get_str(ctx->conf_blocks[i], "apdu_replay_file", NULL) != NULL)
+			ctx->reader_driver = sc_get_replay_driver();
+
 	load_reader_driver_options(ctx);
 	r = ctx->reader_driver->ops->init(ctx);
 	if (r != SC_SUCCESS)   {
@@ -821,6 +906,8 @@ int sc_release_context(sc_context_t *ctx)
 	}
 	if (ctx->conf != NULL)
 		scconf_free(ctx->conf);
+	_sc_trace_close(ctx);
+	_sc_binlog_close(ctx);
 	if (ctx->debug_file && (ctx->debug_file != stdout && ctx->debug_file != stderr))
 		fclose(ctx->debug_file);
 	if (ctx->debug_filename != NULL)
@@ -828,6 +915,7 @@ int sc_release_context(sc_context_t *ctx)
 	if (ctx->app_name != NULL)
 		free(ctx->app_name);
 	list_destroy(&ctx->readers);
+	_sc_free_secure_pool(ctx);
 	sc_mem_clear(ctx, sizeof(*ctx));
 	free(ctx);
 	return SC_SUCCESS;
@@ -595,11 +595,11 @@ static int cwa_prepare_external_auth(sc_card_t * card,
 	/* check received arguments */
 	if (!icc_pubkey || !ifd_privkey || !sn_icc || !sm)
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
-	buf1 = calloc(128, sizeof(u8));
-	buf2 = calloc(128, sizeof(u8));
-	buf3 = calloc(128, sizeof(u8));
-	sha_buf = calloc(74 + 32 + 8 + 8, sizeof(u8));
-	sha_data = calloc(SHA_DIGEST_LENGTH, sizeof(u8));
+	buf1 = sc_mem_alloc_secure(ctx, 128);
+	buf2 = sc_mem_alloc_secure(ctx, 128);
+	buf3 = sc_mem_alloc_secure(ctx, 128);
+	sha_buf = sc_mem_alloc_secure(ctx, 74 + 32 + 8 + 8);
+	sha_data = sc_mem_alloc_secure(ctx, SHA_DIGEST_LENGTH);
 	/* alloc() resources */
 	if (!buf1 || !buf2 || !buf3 || !sha_buf || !sha_data) {
 		msg = "prepare external auth: calloc error";
@@ -675,26 +675,11 @@ static int cwa_prepare_external_auth(sc_card_t * card,
 		BN_free(bn);
 	if (bnsub)
 		BN_free(bnsub);
-	if (buf1) {
-		memset(buf1, 0, 128);
-		free(buf1);
-	}
-	if (buf2) {
-		memset(buf2, 0, 128);
-		free(buf2);
-	}
-	if (buf3) {
-		memset(buf3, 0, 128);
-		free(buf3);
-	}
-	if (sha_buf) {
-		memset(sha_buf, 0, 74 + 32 + 8 + 1 + 7);
-		free(sha_buf);
-	}
-	if (sha_data) {
-		memset(sha_data, 0, SHA_DIGEST_LENGTH);
-		free(sha_data);
-	}
+	sc_mem_free_secure(buf1, 128);
+	sc_mem_free_secure(buf2, 128);
+	sc_mem_free_secure(buf3, 128);
+	sc_mem_free_secure(sha_buf, 74 + 32 + 8 + 8);
+	sc_mem_free_secure(sha_data, SHA_DIGEST_LENGTH);
 
 	if (res != SC_SUCCESS)
 		sc_log(ctx, msg);
@@ -767,9 +752,9 @@ static int cwa_compute_session_keys(sc_card_t * card, cwa_sm_status_t * sm)
 	ctx = card->ctx;
 	LOG_FUNC_CALLED(ctx);
 	/* Just a literal transcription of cwa14890-1 sections 8.7.2 to 8.9 */
-	kseed = calloc(32, sizeof(u8));
-	data = calloc(32 + 4, sizeof(u8));
-	sha_data = calloc(SHA_DIGEST_LENGTH, sizeof(u8));
+	kseed = sc_mem_alloc_secure(ctx, 32);
+	data = sc_mem_alloc_secure(ctx, 32 + 4);
+	sha_data = sc_mem_alloc_secure(ctx, SHA_DIGEST_LENGTH);
 	if (!kseed || !data || !sha_data) {
 		msg = "Compute Session Keys: calloc() failed";
 		res = SC_ERROR_OUT_OF_MEMORY;
@@ -802,18 +787,9 @@ static int cwa_compute_session_keys(sc_card_t * card, cwa_sm_status_t * sm)
 	res = SC_SUCCESS;
 
  compute_session_keys_end:
-	if (kseed) {
-		memset(kseed, 0, 32);
-		free(kseed);
-	}
-	if (data) {
-		memset(data, 0, 32 + 4);
-		free(data);
-	}
-	if (sha_data) {
-		memset(sha_data, 0, SHA_DIGEST_LENGTH);
-		free(sha_data);
-	}
+	sc_mem_free_secure(kseed, 32);
+	sc_mem_free_secure(data, 32 + 4);
+	sc_mem_free_secure(sha_data, SHA_DIGEST_LENGTH);
 	if (res != SC_SUCCESS)
 		sc_log(ctx, msg);
 	else {
@@ -1434,10 +1410,6 @@ int cwa_encode_apdu(sc_card_t * card,
 	u8 *msgbuf = NULL;	/* to encrypt apdu data */
 	u8 *cryptbuf = NULL;
 
-	/* reserve extra bytes for padding and tlv header */
-	msgbuf = calloc(12 + from->lc, sizeof(u8));	/* to encrypt apdu data */
-	cryptbuf = calloc(12 + from->lc, sizeof(u8));
-
 	/* mandatory check */
 	if (!card || !card->ctx || !provider)
 		return SC_ERROR_INVALID_ARGUMENTS;
@@ -1450,8 +1422,6 @@ int cwa_encode_apdu(sc_card_t * card,
 		LOG_FUNC_RETURN(ctx, SC_ERROR_SM_NOT_INITIALIZED);
 	if (sm_session->state != CWA_SM_ACTIVE)
 		LOG_FUNC_RETURN(ctx, SC_ERROR_SM_INVALID_LEVEL);
-	if (!msgbuf || !cryptbuf)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 
 	/* check if APDU is already encoded */
 	if ((from->cla & 0x0C) != 0) {
@@ -1527,6 +1497,16 @@ int cwa_encode_apdu(sc_card_t * card,
 		DES_set_key_unchecked((const_DES_cblock *) & (sm_session->kenc[8]),
 				      &k2);
 
+		/* reserve extra bytes for padding and tlv header; plain
+		 * data is kept in locked memory */
+		msgbuf = sc_mem_alloc_secure(ctx, 12 + from->lc);
+		cryptbuf = sc_mem_alloc_secure(ctx, 12 + from->lc);
+		if (!msgbuf || !cryptbuf) {
+			msg = "Encode APDU: out of memory";
+			res = SC_ERROR_OUT_OF_MEMORY;
+			goto encode_end;
+		}
+
 		/* pad message */
 		memcpy(msgbuf, from->data, dlen);
 		cwa_iso7816_padding(msgbuf, &dlen);
@@ -1610,6 +1590,8 @@ int cwa_encode_apdu(sc_card_t * card,
 	res = SC_SUCCESS;
 
  encode_end:
+	sc_mem_free_secure(msgbuf, 12 + from->lc);
+	sc_mem_free_secure(cryptbuf, 12 + from->lc);
 	if (msg)
 		sc_log(ctx, msg);
 	LOG_FUNC_RETURN(ctx, res);
@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #include <assert.h>
+#include <stdarg.h>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -75,6 +76,25 @@ struct sc_atr_table {
 /* Internal use only */
 int _sc_add_reader(struct sc_context *ctx, struct sc_reader *reader);
 int _sc_delete_reader(struct sc_context *ctx, struct sc_reader *reader);
+/* Size of each of the reader's preallocated APDU buffers; large enough
+ * for an extended length command as well as for its response */
+#define SC_READER_IO_BUFFER_SIZE	(SC_MAX_EXT_APDU_BUFFER_SIZE + 8)
+/* Get the reader's locked APDU send and receive buffers, allocated on first use */
+int _sc_reader_io_buffers(struct sc_reader *reader, u8 **sbuf, u8 **rbuf);
+/* Release the context's locked memory pool */
+void _sc_free_secure_pool(struct sc_context *ctx);
+/* Binary debug log written by a background thread, see binlog.h */
+int _sc_binlog_open(struct sc_context *ctx, const char *filename);
+void _sc_binlog_close(struct sc_context *ctx);
+void _sc_binlog_write(struct sc_context *ctx, int level, const char *file,
+		int line, const char *func, const char *format, va_list args);
+/* APDU trace written with apdu_trace_file, see trace.h */
+int _sc_trace_open(struct sc_context *ctx, const char *filename);
+void _sc_trace_close(struct sc_context *ctx);
+/* Send the APDU to the card's reader, recording it in the APDU trace */
+int _sc_trace_transmit(struct sc_card *card, struct sc_apdu *apdu);
+/* Zero the PIN in the encoded command of a PIN command, returns 1 if it did */
+int _sc_trace_mask(const struct sc_apdu *apdu, unsigned int proto, u8 *cmd, size_t len);
 int _sc_parse_atr(struct sc_reader *reader);
 
 /* Add an ATR to the card driver's struct sc_atr_table */
@@ -221,6 +241,18 @@ unsigned long sc_thread_id(const sc_context_t *ctx);
  */
 int sc_apdu_get_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 **buf,
 	size_t *len, unsigned int proto);
+/**
+ * Encodes the APDU into a caller supplied buffer.
+ * @param  ctx     sc_context_t object
+ * @param  apdu    sc_apdu_t object with the APDU to encode
+ * @param  buf     output buffer
+ * @param  buflen  size of the output buffer
+ * @param  len     length of the encoded APDU
+ * @param  proto   protocol to be used
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_apdu_put_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 *buf,
+	size_t buflen, size_t *len, unsigned int proto);
 /**
  * Sets the status bytes and return data in the APDU
  * @param  ctx     sc_context_t object
@@ -246,6 +278,7 @@ extern struct sc_reader_driver *sc_get_pcsc_driver(void);
 extern struct sc_reader_driver *sc_get_ctapi_driver(void);
 extern struct sc_reader_driver *sc_get_openct_driver(void);
 extern struct sc_reader_driver *sc_get_cardmod_driver(void);
+extern struct sc_reader_driver *sc_get_replay_driver(void);
 
 #ifdef __cplusplus
 }
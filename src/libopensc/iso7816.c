@@ -986,6 +986,12 @@ iso7816_build_pin_apdu(struct sc_card *card, struct sc_apdu *apdu,
 			p1 |= 0x01;
 		}
 		break;
+	case SC_PIN_CMD_GET_INFO:
+		/* VERIFY without data, not all cards know it */
+		if (!(card->caps & SC_CARD_CAP_ISO7816_PIN_INFO))
+			return SC_ERROR_NOT_SUPPORTED;
+		sc_format_apdu(card, apdu, SC_APDU_CASE_1, 0x20, 0, data->pin_reference);
+		return 0;
 	default:
 		return SC_ERROR_NOT_SUPPORTED;
 	}
@@ -1000,12 +1006,39 @@ iso7816_build_pin_apdu(struct sc_card *card, struct sc_apdu *apdu,
 }
 
 
+/* 9000 if the PIN is verified, 63Cx with the tries left if not */
+static int
+iso7816_pin_info(struct sc_card *card, struct sc_pin_cmd_data *data,
+		const struct sc_apdu *apdu, int *tries_left)
+{
+	int r;
+
+	data->pin1.tries_left = -1;
+	r = sc_check_sw(card, apdu->sw1, apdu->sw2);
+	if (r == SC_SUCCESS) {
+		data->pin1.logged_in = SC_PIN_STATE_LOGGED_IN;
+	} else if (apdu->sw1 == 0x63) {
+		if ((apdu->sw2 & 0xF0) == 0xC0)
+			data->pin1.tries_left = apdu->sw2 & 0x0F;
+		data->pin1.logged_in = SC_PIN_STATE_LOGGED_OUT;
+		r = SC_SUCCESS;
+	} else if (r == SC_ERROR_AUTH_METHOD_BLOCKED) {
+		data->pin1.tries_left = 0;
+		data->pin1.logged_in = SC_PIN_STATE_LOGGED_OUT;
+		r = SC_SUCCESS;
+	}
+	if (r == SC_SUCCESS && tries_left != NULL)
+		*tries_left = data->pin1.tries_left;
+	return r;
+}
+
+
 static int
 iso7816_pin_cmd(struct sc_card *card, struct sc_pin_cmd_data *data, int *tries_left)
 {
 	struct sc_apdu local_apdu, *apdu;
 	int r;
-	u8  sbuf[SC_MAX_APDU_BUFFER_SIZE];
+	u8  *sbuf = NULL;
 
 	if (tries_left)
 		*tries_left = -1;
@@ -1016,19 +1049,22 @@ iso7816_pin_cmd(struct sc_card *card, struct sc_pin_cmd_data *data, int *tries_l
 	 * special circumstances.
 	 */
 	if (data->apdu == NULL) {
-		r = iso7816_build_pin_apdu(card, &local_apdu, data, sbuf, sizeof(sbuf));
-		if (r < 0)
+		/* the buffer may contain pins, keep it in locked memory */
+		sbuf = sc_mem_alloc_secure(card->ctx, SC_MAX_APDU_BUFFER_SIZE);
+		if (sbuf == NULL)
+			return SC_ERROR_OUT_OF_MEMORY;
+		r = iso7816_build_pin_apdu(card, &local_apdu, data, sbuf, SC_MAX_APDU_BUFFER_SIZE);
+		if (r < 0) {
+			sc_mem_free_secure(sbuf, SC_MAX_APDU_BUFFER_SIZE);
 			return r;
+		}
 		data->apdu = &local_apdu;
 	}
 	apdu = data->apdu;
 
-	if (!(data->flags & SC_PIN_CMD_USE_PINPAD)) {
+	if (!(data->flags & SC_PIN_CMD_USE_PINPAD) || data->cmd == SC_PIN_CMD_GET_INFO) {
 		/* Transmit the APDU to the card */
 		r = sc_transmit_apdu(card, apdu);
-
-		/* Clear the buffer - it may contain pins */
-		sc_mem_clear(sbuf, sizeof(sbuf));
 	}
 	else {
 		/* Call the reader driver to collect
@@ -1051,8 +1087,12 @@ iso7816_pin_cmd(struct sc_card *card, struct sc_pin_cmd_data *data, int *tries_l
 	/* Don't pass references to local variables up to the caller. */
 	if (data->apdu == &local_apdu)
 		data->apdu = NULL;
+	/* wipes the pins */
+	sc_mem_free_secure(sbuf, SC_MAX_APDU_BUFFER_SIZE);
 
 	LOG_TEST_RET(card->ctx, r, "APDU transmit failed");
+	if (data->cmd == SC_PIN_CMD_GET_INFO)
+		return iso7816_pin_info(card, data, apdu, tries_left);
 	if (apdu->sw1 == 0x63) {
 		if ((apdu->sw2 & 0xF0) == 0xC0 && tries_left != NULL)
 			*tries_left = apdu->sw2 & 0x0F;
@@ -78,6 +78,11 @@ static void sc_do_log_va(sc_context_t *ctx, int level, const char *file, int lin
 	if (ctx->debug < level)
 		return;
 
+	if (ctx->binlog != NULL) {
+		_sc_binlog_write(ctx, level, file, line, func, format, args);
+		return;
+	}
+
 	p = buf;
 	left = sizeof(buf);
 
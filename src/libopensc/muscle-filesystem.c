@@ -52,6 +52,11 @@ void mscfs_free(mscfs_t *fs) {
 }
 
 void mscfs_clear_cache(mscfs_t* fs) {
+	if(fs->cache.index) {
+		free(fs->cache.index);
+		fs->cache.index = NULL;
+		fs->cache.indexSize = 0;
+	}
 	if(!fs->cache.array) {
 		return;
 	}
@@ -73,24 +78,71 @@ static int mscfs_is_ignored(mscfs_t* fs, msc_id objectId)
 	return ignored;
 }
 
+static unsigned int mscfs_hash(const msc_id *objectId)
+{
+	const u8* oid = objectId->id;
+	unsigned int h = (oid[0] << 24) | (oid[1] << 16) | (oid[2] << 8) | oid[3];
+	h ^= h >> 16;
+	h *= 0x45D9F3B;
+	h ^= h >> 16;
+	return h;
+}
+
+static void mscfs_index_insert(mscfs_cache_t *cache, int x)
+{
+	unsigned int mask = cache->indexSize - 1;
+	unsigned int h = mscfs_hash(&cache->array[x].objectId) & mask;
+	while(cache->index[h])
+		h = (h + 1) & mask;
+	cache->index[h] = x + 1;
+}
+
+/* The table is kept at most half full. Without it, lookups fall back
+ * to a linear search of the array */
+static void mscfs_index_rebuild(mscfs_cache_t *cache)
+{
+	int length = 16;
+	int x;
+	while(length < 2 * cache->totalSize)
+		length <<= 1;
+	if(cache->indexSize != length) {
+		free(cache->index);
+		cache->index = malloc(sizeof(int) * length);
+		cache->indexSize = cache->index ? length : 0;
+		if(!cache->index)
+			return;
+	}
+	memset(cache->index, 0, sizeof(int) * length);
+	for(x = 0; x < cache->size; x++)
+		mscfs_index_insert(cache, x);
+}
+
 int mscfs_push_file(mscfs_t* fs, mscfs_file_t *file)
 {
 	mscfs_cache_t *cache = &fs->cache;
 	if(!cache->array || cache->size == cache->totalSize) {
 		int length = cache->totalSize + MSCFS_CACHE_INCREMENT;
 		mscfs_file_t *oldArray;
-		cache->totalSize = length;
 		oldArray = cache->array;
 		cache->array = malloc(sizeof(mscfs_file_t) * length);
-		if(!cache->array)
+		if(!cache->array) {
+			cache->array = oldArray;
 			return MSCFS_NO_MEMORY;
+		}
+		cache->totalSize = length;
 		if(oldArray) {
 			memcpy(cache->array, oldArray, sizeof(mscfs_file_t) * cache->size);
 			free(oldArray);
 		}
+		cache->array[cache->size] = *file;
+		cache->size++;
+		mscfs_index_rebuild(cache);
+		return 0;
 	}
 	cache->array[cache->size] = *file;
 	cache->size++;
+	if(cache->index)
+		mscfs_index_insert(cache, cache->size - 1);
 	return 0;
 }
 
@@ -98,11 +150,17 @@ int mscfs_update_cache(mscfs_t* fs) {
 	mscfs_file_t file;
 	int r;
 	mscfs_clear_cache(fs);
+	/* An empty array still marks the listing as done */
+	fs->cache.array = malloc(sizeof(mscfs_file_t) * MSCFS_CACHE_INCREMENT);
+	if(!fs->cache.array)
+		return MSCFS_NO_MEMORY;
+	fs->cache.totalSize = MSCFS_CACHE_INCREMENT;
+	mscfs_index_rebuild(&fs->cache);
 	r = fs->listFile(&file, 1, fs->udata);
 	if(r == 0)
 		return 0;
 	else if(r < 0)
-		return r;
+		goto failed;
 	while(1) {
 		if(!mscfs_is_ignored(fs, file.objectId)) {
 			/* Check if its a directory in the root */
@@ -117,15 +175,90 @@ int mscfs_update_cache(mscfs_t* fs) {
 				file.ef = 1; /* File is a working elementary file */
 			}
 			
-			mscfs_push_file(fs, &file);
+			r = mscfs_push_file(fs, &file);
+			if(r < 0)
+				goto failed;
 		}
 		r = fs->listFile(&file, 0, fs->udata);
 		if(r == 0)
 			break;
 		else if(r < 0)
-			return r;
+			goto failed;
 	}
 	return fs->cache.size;
+failed:
+	/* Do not keep a partial listing */
+	mscfs_clear_cache(fs);
+	return r;
+}
+
+int mscfs_find_file(mscfs_t* fs, const msc_id *objectId)
+{
+	mscfs_cache_t *cache = &fs->cache;
+	int x;
+	if(!cache->array)
+		return -1;
+	if(cache->index) {
+		unsigned int mask = cache->indexSize - 1;
+		unsigned int h = mscfs_hash(objectId) & mask;
+		while((x = cache->index[h]) != 0) {
+			if(0 == memcmp(cache->array[x - 1].objectId.id, objectId->id, 4))
+				return x - 1;
+			h = (h + 1) & mask;
+		}
+		return -1;
+	}
+	for(x = 0; x < cache->size; x++) {
+		if(0 == memcmp(cache->array[x].objectId.id, objectId->id, 4))
+			return x;
+	}
+	return -1;
+}
+
+/* The file must be in cache form, i.e. directories as 3F00xxxx.
+ * Nothing to do if the cache was not loaded yet */
+int mscfs_add_file(mscfs_t* fs, mscfs_file_t *file)
+{
+	int x;
+	if(!fs->cache.array || mscfs_is_ignored(fs, file->objectId))
+		return 0;
+	x = mscfs_find_file(fs, &file->objectId);
+	if(x >= 0) {
+		fs->cache.array[x] = *file;
+		return 0;
+	}
+	return mscfs_push_file(fs, file);
+}
+
+/* Drop an object, and for a directory the objects in it, keeping the
+ * order of the others and the index of the selected file */
+void mscfs_remove_file(mscfs_t* fs, const msc_id *objectId, int withChildren)
+{
+	mscfs_cache_t *cache = &fs->cache;
+	int x, y = 0;
+	if(!cache->array)
+		return;
+	for(x = 0; x < cache->size; x++) {
+		const u8* oid = cache->array[x].objectId.id;
+		if(0 == memcmp(oid, objectId->id, 4)
+		|| (withChildren && 0 == memcmp(oid, objectId->id + 2, 2))) {
+			if(fs->currentFileIndex == x) {
+				fs->currentFileIndex = -1;
+				fs->currentFile[0] = fs->currentFile[1] = 0;
+			}
+			continue;
+		}
+		if(fs->currentFileIndex == x)
+			fs->currentFileIndex = y;
+		if(x != y)
+			cache->array[y] = cache->array[x];
+		y++;
+	}
+	if(y != cache->size) {
+		cache->size = y;
+		if(cache->index)
+			mscfs_index_rebuild(cache);
+	}
 }
 
 void mscfs_check_cache(mscfs_t* fs)
@@ -210,15 +343,11 @@ int mscfs_loadFileInfo(mscfs_t* fs, const u8 *path, int pathlen, mscfs_file_t **
 	/* Obtain file information while checking if it exists */
 	mscfs_check_cache(fs);
 	if(idx) *idx = -1;
-	for(x = 0; x < fs->cache.size; x++) {
-		msc_id objectId;
+	*file_data = NULL;
+	x = mscfs_find_file(fs, &fullPath);
+	if(x >= 0) {
 		*file_data = &fs->cache.array[x];
-		objectId = (*file_data)->objectId;
-		if(0 == memcmp(objectId.id, fullPath.id, 4)) {
-			if(idx) *idx = x;
-			break;
-		}
-		*file_data = NULL;
+		if(idx) *idx = x;
 	}
 	if(*file_data == NULL && (0 == memcmp("\x3F\x00\x00\x00", fullPath.id, 4) || 0 == memcmp("\x3F\x00\x3F\x00", fullPath.id, 4 ))) {
 		static mscfs_file_t ROOT_FILE;
@@ -40,6 +40,9 @@ typedef struct mscfs_cache {
 	int size;
 	int totalSize;
 	mscfs_file_t *array;
+	/* Hash table of array index + 1 by objectId, 0 is a free slot */
+	int *index;
+	int indexSize;
 } mscfs_cache_t;
 
 typedef struct mscsfs {
@@ -57,6 +60,11 @@ void mscfs_clear_cache(mscfs_t* fs);
 int mscfs_push_file(mscfs_t* fs, mscfs_file_t *file);
 int mscfs_update_cache(mscfs_t* fs);
 
+/* Keep a loaded cache in line with objects created or deleted on the card */
+int mscfs_find_file(mscfs_t* fs, const msc_id *objectId);
+int mscfs_add_file(mscfs_t* fs, mscfs_file_t *file);
+void mscfs_remove_file(mscfs_t* fs, const msc_id *objectId, int withChildren);
+
 void mscfs_check_cache(mscfs_t* fs);
 
 int mscfs_lookup_path(mscfs_t* fs, const u8 *path, int pathlen, msc_id* objectId, int isDirectory);
@@ -242,6 +242,16 @@ struct sc_ef_atr {
 	unsigned status;
 };
 
+/* Authentication state of a PIN as last seen on the card, valid as long
+ * as the card is not reset and nobody else had a transaction on it */
+#define SC_MAX_CARD_PIN_STATES	8
+struct sc_card_pin_state {
+	unsigned int type;
+	int reference;
+	struct sc_path path;	/* current path when the state was seen */
+	int logged_in;	/* SC_PIN_STATE_* */
+};
+
 struct sc_card_cache {
 	struct sc_path current_path;
 
@@ -249,6 +259,17 @@ struct sc_card_cache {
         struct sc_file *current_df;
 
 	int valid;
+
+	struct sc_card_pin_state pin_state[SC_MAX_CARD_PIN_STATES];
+	size_t pin_state_count;
+
+	/* last environment applied with sc_set_security_env(), valid
+	 * while no other file is selected and no other MSE is sent */
+	struct sc_security_env sec_env;
+	int sec_env_num;
+	int sec_env_valid;
+	int sec_env_setting;
+	struct sc_path selected_path;	/* last path given to sc_select_file() */
 };
 
 #define SC_PROTO_T0		0x00000001
@@ -272,6 +293,10 @@ struct sc_reader_driver {
 #define SC_READER_CARD_INUSE		0x00000004
 #define SC_READER_CARD_EXCLUSIVE	0x00000008
 #define SC_READER_HAS_WAITING_AREA	0x00000010
+/* set by the reader lock when it took back the previous transaction */
+#define SC_READER_TRANSACTION_KEPT	0x00000020
+/* the reader went away, the object stays valid until the context is released */
+#define SC_READER_REMOVED		0x00000040
 
 /* reader capabilities */
 #define SC_READER_CAP_DISPLAY	0x00000001
@@ -298,6 +323,9 @@ typedef struct sc_reader {
 		int Fi, f, Di, N;
 		u8 FI, DI;
 	} atr_info;
+
+	/* APDU buffers reused by the transmit functions */
+	u8 *sbuf, *rbuf;
 } sc_reader_t;
 
 /* This will be the new interface for handling PIN commands.
@@ -317,6 +345,10 @@ typedef struct sc_reader {
 #define SC_PIN_ENCODING_BCD	1
 #define SC_PIN_ENCODING_GLP	2 /* Global Platform - Card Specification v2.0.1 */
 
+#define SC_PIN_STATE_UNKNOWN	-1
+#define SC_PIN_STATE_LOGGED_OUT	0
+#define SC_PIN_STATE_LOGGED_IN	1
+
 struct sc_pin_cmd_pin {
 	const char *prompt;	/* Prompt to display */
 
@@ -333,6 +365,7 @@ struct sc_pin_cmd_pin {
 
 	int max_tries;	/* Used for signaling back from SC_PIN_CMD_GET_INFO */
 	int tries_left;	/* Used for signaling back from SC_PIN_CMD_GET_INFO */
+	int logged_in;	/* Used for signaling back from SC_PIN_CMD_GET_INFO */
 
 	struct sc_acl_entry acls[SC_MAX_SDO_ACLS];
 };
@@ -495,6 +528,14 @@ struct sc_reader_operations {
 #define SC_CARD_CAP_ONLY_RAW_HASH		0x00000040
 #define SC_CARD_CAP_ONLY_RAW_HASH_STRIPPED	0x00000080
 
+/* Card tells the verification state of a PIN in reply to an
+ * ISO 7816-4 VERIFY without data (9000 or 63Cx) */
+#define SC_CARD_CAP_ISO7816_PIN_INFO	0x00000100
+
+/* The security environment does not persist between operations,
+ * sc_set_security_env() always calls the driver */
+#define SC_CARD_CAP_NO_SEC_ENV_CACHE	0x00000200
+
 typedef struct sc_card {
 	struct sc_context *ctx;
 	struct sc_reader *reader;
@@ -525,6 +566,9 @@ typedef struct sc_card {
 	int max_pin_len;
 
 	struct sc_card_cache cache;
+	struct sc_fci_cache *fci_cache;
+	/* see sc_async_start() */
+	struct sc_async *async;
 
 	struct sc_serial_number serialnr;
 	struct sc_version version;
@@ -697,6 +741,10 @@ typedef struct sc_context {
 
 	FILE *debug_file;
 	char *debug_filename;
+	/* set with debug_format = binary, see binlog.c */
+	struct sc_binlog *binlog;
+	/* set with apdu_trace_file, see trace.c */
+	struct sc_trace *trace;
 	char *preferred_language;
 
 	list_t readers;
@@ -710,6 +758,9 @@ typedef struct sc_context {
 	sc_thread_context_t	*thread_ctx;
 	void *mutex;
 
+	/* locked memory for sensitive data, see sc_mem_alloc_secure() */
+	struct sc_secure_pool *secure_pool;
+
 	unsigned int magic;
 } sc_context_t;
 
@@ -945,6 +996,119 @@ int sc_lock(struct sc_card *card);
 int sc_unlock(struct sc_card *card);
 
 
+/********************************************************************/
+/*                asynchronous card I/O                             */
+/********************************************************************/
+
+struct sc_async_op;
+struct sc_pkcs15_card;
+struct sc_pkcs15_object;
+
+/* Performs the operation; runs in the card's worker thread */
+typedef int (*sc_async_func_t)(struct sc_card *card, struct sc_async_op *op);
+/* Reports the completion; runs in the thread calling sc_async_dispatch() */
+typedef void (*sc_async_callback_t)(struct sc_card *card, struct sc_async_op *op);
+
+/* A queued operation. The caller owns the structure as well as all buffers
+ * it refers to and must keep them valid until the callback has been run. */
+typedef struct sc_async_op {
+	sc_async_func_t func;
+	sc_async_callback_t callback;
+	void *arg;
+	union {
+		struct {
+			struct sc_apdu *apdu;
+		} transmit;
+		struct {
+			unsigned int idx;
+			u8 *buf;
+			size_t count;
+			unsigned long flags;
+		} read_binary;
+		struct {
+			struct sc_pkcs15_card *p15card;
+			const struct sc_pkcs15_object *obj;
+			unsigned long flags;
+			const u8 *in;
+			size_t inlen;
+			u8 *out;
+			size_t outlen;
+		} crypto;
+	} u;
+	/* return value of func, valid in the callback */
+	int result;
+
+	/* for internal use only */
+	struct sc_async_op *next;
+} sc_async_op_t;
+
+/**
+ * Starts a worker thread for the card which performs the operations
+ * queued with sc_async_submit() one after the other. While the worker
+ * is running the card must only be used through the queue, unless
+ * thread locking callbacks have been set in the context parameters.
+ * Note that pcsc-lite serializes all calls made through one PC/SC
+ * context, cards that should work in parallel need their own sc_context.
+ * @param  card  struct sc_card object
+ * @return SC_SUCCESS on success, SC_ERROR_NOT_SUPPORTED if the library
+ *         was built without thread support and an error code otherwise
+ */
+int sc_async_start(struct sc_card *card);
+/**
+ * Stops the card's worker thread. Operations still queued are performed
+ * first and their callbacks are run before this function returns.
+ * Called by sc_disconnect_card().
+ * @param  card  struct sc_card object
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_async_stop(struct sc_card *card);
+/**
+ * Returns a descriptor that becomes readable whenever an operation has
+ * completed, to be waited on with poll(), epoll or an event loop. When
+ * it is readable call sc_async_dispatch().
+ * @param  card  struct sc_card object
+ * @return the descriptor, or an error code if the worker is not running
+ */
+int sc_async_get_fd(struct sc_card *card);
+/**
+ * Queues an operation. op->func and op->callback must be set.
+ * @param  card  struct sc_card object
+ * @param  op    the operation
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_async_submit(struct sc_card *card, struct sc_async_op *op);
+/**
+ * Runs the callbacks of all completed operations in the calling thread,
+ * in the order in which the operations completed. Never blocks.
+ * @param  card  struct sc_card object
+ * @return number of callbacks run, or an error code
+ */
+int sc_async_dispatch(struct sc_card *card);
+/**
+ * Queues sc_transmit_apdu(card, apdu).
+ * @param  card      struct sc_card object
+ * @param  op        operation structure to use
+ * @param  apdu      the APDU, response fields are set on completion
+ * @param  callback  completion callback
+ * @param  arg       stored in op->arg
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_async_transmit_apdu(struct sc_card *card, struct sc_async_op *op,
+		struct sc_apdu *apdu, sc_async_callback_t callback, void *arg);
+/**
+ * Queues sc_read_binary(card, idx, buf, count, flags); op->result is
+ * the number of bytes read or an error code.
+ * @param  card      struct sc_card object
+ * @param  op        operation structure to use
+ * @param  callback  completion callback
+ * @param  arg       stored in op->arg
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_async_read_binary(struct sc_card *card, struct sc_async_op *op,
+		unsigned int idx, u8 *buf, size_t count, unsigned long flags,
+		sc_async_callback_t callback, void *arg);
+
+
 /********************************************************************/
 /*                ISO 7816-4 related functions                      */
 /********************************************************************/
@@ -958,6 +1122,18 @@ int sc_unlock(struct sc_card *card);
  */
 int sc_select_file(struct sc_card *card, const sc_path_t *path,
 		   sc_file_t **file);
+/**
+ * Gets the FCI of a file without selecting it, if possible. Files selected
+ * by absolute path or DF name before are remembered until the card is reset
+ * or files are created or deleted, otherwise this does a SELECT FILE.
+ * The file is not necessarily the current one afterwards.
+ * @param  card  struct sc_card object
+ * @param  path  The path or name of the file
+ * @param  file  Receives a pointer to a new structure
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_get_file_info(struct sc_card *card, const sc_path_t *path,
+		   struct sc_file **file);
 /**
  * List file ids within a DF
  * @param  card    struct sc_card object on which to issue the command
@@ -1102,6 +1278,17 @@ int sc_verify(struct sc_card *card, unsigned int type, int ref, const u8 *buf,
  */
 int sc_logout(struct sc_card *card);
 int sc_pin_cmd(struct sc_card *card, struct sc_pin_cmd_data *, int *tries_left);
+/**
+ * Tells whether a PIN is verified without presenting it. The state seen
+ * since the card was locked is used if there is one, otherwise the card
+ * is asked with SC_PIN_CMD_GET_INFO.
+ * @param  card       struct sc_card object
+ * @param  type       type of the PIN (SC_AC_CHV etc.)
+ * @param  reference  reference of the PIN
+ * @return SC_PIN_STATE_LOGGED_IN, SC_PIN_STATE_LOGGED_OUT or
+ *         SC_PIN_STATE_UNKNOWN if neither can tell
+ */
+int sc_pin_get_state(struct sc_card *card, unsigned int type, int reference);
 int sc_change_reference_data(struct sc_card *card, unsigned int type,
 			     int ref, const u8 *old, size_t oldlen,
 			     const u8 *newref, size_t newlen,
@@ -1263,9 +1450,55 @@ int sc_base64_decode(const char *in, u8 *out, size_t outlen);
  * @param  len  length of the memory buffer
  */
 void sc_mem_clear(void *ptr, size_t len);
+/**
+ * Allocates zeroed memory that is kept out of swap, from a locked pool
+ * of the context. Allocation fails if the memory cannot be locked and
+ * 'paranoid-memory' is set.
+ * @param  ctx  sc_context_t object
+ * @param  len  number of bytes
+ * @return pointer to the memory or NULL on failure
+ */
 void *sc_mem_alloc_secure(sc_context_t *ctx, size_t len);
+/**
+ * Wipes and releases memory from sc_mem_alloc_secure(). Other heap
+ * memory is wiped and passed to free(), so buffers of either origin
+ * may be given back this way.
+ * @param  ptr  pointer to the memory buffer
+ * @param  len  length of the memory buffer
+ */
+void sc_mem_free_secure(void *ptr, size_t len);
 int sc_mem_reverse(unsigned char *buf, size_t len);
 
+/**
+ * Region allocator. Blocks are carved from large chunks and are only
+ * released all at once, for data that lives as long as its owner
+ * (e.g. the objects of a bound PKCS#15 card).
+ */
+typedef struct sc_arena sc_arena_t;
+
+/**
+ * Creates an empty arena.
+ * @param  chunk_size  size of the chunks to carve from, 0 for the default
+ * @return the new arena or NULL if out of memory
+ */
+sc_arena_t *sc_arena_new(size_t chunk_size);
+/**
+ * Allocates zeroed memory from the arena. The block must not be
+ * passed to free().
+ * @param  arena  arena to allocate from
+ * @param  size   number of bytes
+ * @return pointer to the memory or NULL if out of memory
+ */
+void *sc_arena_alloc(sc_arena_t *arena, size_t size);
+/**
+ * Releases all blocks allocated from the arena, the arena can be reused.
+ */
+void sc_arena_reset(sc_arena_t *arena);
+/**
+ * Releases all blocks and the arena itself.
+ */
+void sc_arena_free(sc_arena_t *arena);
+
 int sc_get_cache_dir(sc_context_t *ctx, char *buf, size_t bufsize);
 int sc_make_cache_dir(sc_context_t *ctx);
 
@@ -33,14 +33,137 @@
 #include "asn1.h"
 #include "pkcs15.h"
 
+/* Location of a decoded element inside the certificate */
+struct x509_span {
+	const u8 *value;
+	size_t len;
+};
+
+struct x509_spki {
+	struct sc_pkcs15_pubkey *pubkey;
+	struct sc_pkcs15_buf *buf;
+};
+
+
+static int
+x509_get_span(sc_context_t *ctx, void *arg, const u8 *obj, size_t objlen, int depth)
+{
+	struct x509_span *span = (struct x509_span *) arg;
+
+	span->value = obj;
+	span->len = objlen;
+	return 0;
+}
+
+
+/*
+ * Point 'out' to the complete TLV whose contents are 'span' when it lies in
+ * the certificate buffer, otherwise store a re-encoded copy.
+ */
+static int
+x509_set_tlv(sc_context_t *ctx, struct sc_pkcs15_buf *buf, const struct x509_span *span,
+		u8 tag, struct sc_asn1_entry *asn1_tlv, u8 **out, size_t *outlen)
+{
+	const u8 *start, *p;
+	unsigned int cla, tag_out;
+	size_t offs, hlen, taglen, len = span->len;
+
+	if (span->value == NULL || span->len == 0)
+		return SC_SUCCESS;
+
+	if (sc_pkcs15_buf_contains(buf, span->value))   {
+		offs = span->value - buf->value;
+		for (hlen = 2; hlen <= 6 && hlen <= offs; hlen++)   {
+			start = p = span->value - hlen;
+			if (*start != tag)
+				continue;
+			if (sc_asn1_read_tag(&p, buf->len - offs + hlen, &cla, &tag_out, &taglen) == SC_SUCCESS
+					&& p == span->value && taglen == span->len)   {
+				*out = (u8 *) start;
+				*outlen = hlen + span->len;
+				return SC_SUCCESS;
+			}
+		}
+	}
+
+	sc_format_asn1_entry(asn1_tlv + 0, (u8 *) span->value, &len, 1);
+	return sc_asn1_encode(ctx, asn1_tlv, out, outlen);
+}
+
+
+/* Let the RSA modulus and exponent point into the certificate buffer */
+static void
+x509_rsa_view(sc_context_t *ctx, struct sc_pkcs15_buf *buf, struct sc_pkcs15_pubkey *key,
+		const u8 *spki, size_t spki_len)
+{
+	const u8 *p = spki, *bits, *seq, *modulus, *exponent;
+	size_t left = spki_len, len, bits_len, seq_len, modulus_len, exponent_len;
+
+	if (sc_asn1_skip_tag(ctx, &p, &left, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, &len) == NULL)
+		return;
+	bits = sc_asn1_skip_tag(ctx, &p, &left, SC_ASN1_TAG_BIT_STRING, &bits_len);
+	/* only a BIT STRING without unused bits holds the key unchanged */
+	if (bits == NULL || bits_len < 2 || bits[0] != 0)
+		return;
+	bits++;
+	bits_len--;
+	seq = sc_asn1_skip_tag(ctx, &bits, &bits_len, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, &seq_len);
+	if (seq == NULL)
+		return;
+	modulus = sc_asn1_skip_tag(ctx, &seq, &seq_len, SC_ASN1_TAG_INTEGER, &modulus_len);
+	exponent = sc_asn1_skip_tag(ctx, &seq, &seq_len, SC_ASN1_TAG_INTEGER, &exponent_len);
+	if (modulus == NULL || exponent == NULL)
+		return;
+
+	/* same padding rules as the SC_ASN1_UNSIGNED decoder */
+	if (modulus_len > 1 && modulus[0] == 0x00)   {
+		modulus++;
+		modulus_len--;
+	}
+	if (exponent_len > 1 && exponent[0] == 0x00)   {
+		exponent++;
+		exponent_len--;
+	}
+	if (modulus_len != key->u.rsa.modulus.len || exponent_len != key->u.rsa.exponent.len
+			|| memcmp(modulus, key->u.rsa.modulus.data, modulus_len)
+			|| memcmp(exponent, key->u.rsa.exponent.data, exponent_len))
+		return;
+
+	free(key->u.rsa.modulus.data);
+	free(key->u.rsa.exponent.data);
+	key->u.rsa.modulus.data = (u8 *) modulus;
+	key->u.rsa.exponent.data = (u8 *) exponent;
+	key->buf = sc_pkcs15_buf_ref(buf);
+}
+
+
 static int
-parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_cert *cert)
+x509_get_spki(sc_context_t *ctx, void *arg, const u8 *obj, size_t objlen, int depth)
+{
+	struct x509_spki *spki = (struct x509_spki *) arg;
+	int r;
+
+	r = sc_pkcs15_pubkey_from_spki_fields(ctx, &spki->pubkey, (u8 *) obj, objlen, depth);
+	if (r == SC_SUCCESS && spki->buf && spki->pubkey && spki->pubkey->algorithm == SC_ALGORITHM_RSA)
+		x509_rsa_view(ctx, spki->buf, spki->pubkey, obj, objlen);
+	return r;
+}
+
+
+/*
+ * When 'fbuf' holds the certificate, the raw certificate, serial, issuer,
+ * subject and RSA key values point into it instead of being copied.
+ */
+static int
+parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_buf *fbuf,
+		struct sc_pkcs15_cert *cert)
 {
 	int r;
 	struct sc_algorithm_id sig_alg;
-	struct sc_pkcs15_pubkey *pubkey = NULL;
-	unsigned char *serial = NULL, *issuer = NULL, *subject = NULL, *buf =  der->value;
-	size_t serial_len = 0, issuer_len = 0, subject_len = 0, data_len = 0, buflen = der->len;
+	struct x509_spki spki = { NULL, NULL };
+	struct x509_span serial = { NULL, 0 }, issuer = { NULL, 0 }, subject = { NULL, 0 };
+	unsigned char *buf =  der->value;
+	size_t data_len = 0, buflen = der->len;
 	struct sc_asn1_entry asn1_version[] = {
 		{ "version", SC_ASN1_INTEGER, SC_ASN1_TAG_INTEGER, 0, &cert->version, NULL },
 		{ NULL, 0, 0, 0, NULL, NULL }
@@ -59,13 +182,13 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 	};
 	struct sc_asn1_entry asn1_tbscert[] = {
 		{ "version",		SC_ASN1_STRUCT,    SC_ASN1_CTX | 0 | SC_ASN1_CONS, SC_ASN1_OPTIONAL, asn1_version, NULL },
-		{ "serialNumber",	SC_ASN1_OCTET_STRING, SC_ASN1_TAG_INTEGER, SC_ASN1_ALLOC, &serial, &serial_len },
+		{ "serialNumber",	SC_ASN1_CALLBACK, SC_ASN1_TAG_INTEGER, 0, x509_get_span, &serial },
 		{ "signature",		SC_ASN1_STRUCT,    SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
-		{ "issuer",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, SC_ASN1_ALLOC, &issuer, &issuer_len },
+		{ "issuer",		SC_ASN1_CALLBACK, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, x509_get_span, &issuer },
 		{ "validity",		SC_ASN1_STRUCT,    SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
-		{ "subject",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, SC_ASN1_ALLOC, &subject, &subject_len },
+		{ "subject",		SC_ASN1_CALLBACK, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, x509_get_span, &subject },
 		/* Use a callback to get the algorithm, parameters and pubkey into sc_pkcs15_pubkey */
-		{ "subjectPublicKeyInfo",SC_ASN1_CALLBACK, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, sc_pkcs15_pubkey_from_spki_fields,  &pubkey },
+		{ "subjectPublicKeyInfo",SC_ASN1_CALLBACK, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, x509_get_spki,  &spki },
 		{ "extensions",		SC_ASN1_STRUCT,    SC_ASN1_CTX | 3 | SC_ASN1_CONS, SC_ASN1_OPTIONAL, asn1_extensions, NULL },
 		{ NULL, 0, 0, 0, NULL, NULL }
 	};
@@ -97,43 +220,41 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ASN1_OBJECT, "X.509 certificate not found");
 
 	data_len = objlen + (obj - buf);
-	cert->data.value = malloc(data_len);
-	if (!cert->data.value)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
-	memcpy(cert->data.value, buf, data_len);
+	if (sc_pkcs15_buf_contains(fbuf, buf) && data_len <= fbuf->len - (buf - fbuf->value))   {
+		cert->buf = sc_pkcs15_buf_ref(fbuf);
+		cert->data.value = buf;
+		spki.buf = fbuf;
+	}
+	else   {
+		cert->data.value = malloc(data_len);
+		if (!cert->data.value)
+			LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+		memcpy(cert->data.value, buf, data_len);
+	}
 	cert->data.len = data_len;
 
 	r = sc_asn1_decode(ctx, asn1_cert, obj, objlen, NULL, NULL);
+	cert->key = spki.pubkey;
 	LOG_TEST_RET(ctx, r, "ASN.1 parsing of certificate failed");
 
 	cert->version++;
 
-	if (!pubkey)
+	if (!cert->key)
 		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ASN1_OBJECT, "Unable to decode subjectPublicKeyInfo from cert");
-	cert->key = pubkey;
 
 	sc_asn1_clear_algorithm_id(&sig_alg);
 
-	if (serial && serial_len)   {
-		sc_format_asn1_entry(asn1_serial_number + 0, serial, &serial_len, 1);
-		r = sc_asn1_encode(ctx, asn1_serial_number, &cert->serial, &cert->serial_len);
-		free(serial);
-		LOG_TEST_RET(ctx, r, "ASN.1 encoding of serial failed");
-	}
+	r = x509_set_tlv(ctx, cert->buf, &serial, SC_ASN1_TAG_INTEGER, asn1_serial_number,
+			&cert->serial, &cert->serial_len);
+	LOG_TEST_RET(ctx, r, "ASN.1 encoding of serial failed");
 
-	if (subject && subject_len)   {
-		sc_format_asn1_entry(asn1_subject + 0, subject, &subject_len, 1);
-		r = sc_asn1_encode(ctx, asn1_subject, &cert->subject, &cert->subject_len);
-		free(subject);
-		LOG_TEST_RET(ctx, r, "ASN.1 encoding of subject");
-	}
+	r = x509_set_tlv(ctx, cert->buf, &subject, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, asn1_subject,
+			&cert->subject, &cert->subject_len);
+	LOG_TEST_RET(ctx, r, "ASN.1 encoding of subject");
 
-	if (issuer && issuer_len)   {
-		sc_format_asn1_entry(asn1_issuer + 0, issuer, &issuer_len, 1);
-		r = sc_asn1_encode(ctx, asn1_issuer, &cert->issuer, &cert->issuer_len);
-		free(issuer);
-		LOG_TEST_RET(ctx, r, "ASN.1 encoding of issuer");
-	}
+	r = x509_set_tlv(ctx, cert->buf, &issuer, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, asn1_issuer,
+			&cert->issuer, &cert->issuer_len);
+	LOG_TEST_RET(ctx, r, "ASN.1 encoding of issuer");
 
 	return SC_SUCCESS;
 }
@@ -150,7 +271,7 @@ sc_pkcs15_pubkey_from_cert(struct sc_context *ctx,
 	if (cert == NULL)
 		return SC_ERROR_OUT_OF_MEMORY;
 
-	rv = parse_x509_cert(ctx, cert_blob, cert);
+	rv = parse_x509_cert(ctx, cert_blob, NULL, cert);
 
 	*out = cert->key;
 	cert->key = NULL;
@@ -166,6 +287,7 @@ sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs1
 {
 	struct sc_context *ctx = NULL;
 	struct sc_pkcs15_cert *cert = NULL;
+	struct sc_pkcs15_buf *fbuf = NULL;
 	struct sc_pkcs15_der der;
 	int r;
 
@@ -184,18 +306,24 @@ sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs1
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OBJECT_NOT_FOUND);
 	}
 
-	cert = malloc(sizeof(struct sc_pkcs15_cert));
-	if (cert == NULL) {
+	/* the certificate keeps pointing into the file data, no further copies */
+	fbuf = sc_pkcs15_buf_new(der.value, der.len);
+	if (fbuf == NULL) {
 		free(der.value);
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 	}
-	memset(cert, 0, sizeof(struct sc_pkcs15_cert));
-	if (parse_x509_cert(ctx, &der, cert)) {
-		free(der.value);
+
+	cert = calloc(1, sizeof(struct sc_pkcs15_cert));
+	if (cert == NULL) {
+		sc_pkcs15_buf_unref(fbuf);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	}
+	r = parse_x509_cert(ctx, &der, fbuf, cert);
+	sc_pkcs15_buf_unref(fbuf);
+	if (r) {
 		sc_pkcs15_free_certificate(cert);
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ASN1_OBJECT);
 	}
-	free(der.value);
 
 	*cert_out = cert;
 	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
@@ -250,6 +378,18 @@ sc_pkcs15_decode_cdf_entry(struct sc_pkcs15_card *p15card, struct sc_pkcs15_obje
 	size_t id_value_len = sizeof(id_value);
 	int r;
 
+        /* Fill in defaults */
+        memset(&info, 0, sizeof(info));
+	info.authority = 0;
+
+	if (p15card->opts.use_fast_decoder)   {
+		r = sc_pkcs15_fast_decode_cdf_entry(obj, &info, buf, buflen);
+		if (r != SC_ERROR_NOT_SUPPORTED)   {
+			LOG_TEST_RET(ctx, r, "ASN.1 decoding failed");
+			goto decoded;
+		}
+	}
+
 	sc_copy_asn1_entry(c_asn1_cred_ident, asn1_cred_ident);
 	sc_copy_asn1_entry(c_asn1_com_cert_attr, asn1_com_cert_attr);
 	sc_copy_asn1_entry(c_asn1_x509_cert_attr, asn1_x509_cert_attr);
@@ -268,10 +408,6 @@ sc_pkcs15_decode_cdf_entry(struct sc_pkcs15_card *p15card, struct sc_pkcs15_obje
 	sc_format_asn1_entry(asn1_type_cert_attr + 0, asn1_x509_cert_attr, NULL, 0);
 	sc_format_asn1_entry(asn1_cert + 0, &cert_obj, NULL, 0);
 
-        /* Fill in defaults */
-        memset(&info, 0, sizeof(info));
-	info.authority = 0;
-
 	r = sc_asn1_decode(ctx, asn1_cert, *buf, *buflen, buf, buflen);
 	/* In case of error, trash the cert value (direct coding) */
 	if (r < 0 && der->value)
@@ -280,6 +416,7 @@ sc_pkcs15_decode_cdf_entry(struct sc_pkcs15_card *p15card, struct sc_pkcs15_obje
 		return r;
 	LOG_TEST_RET(ctx, r, "ASN.1 decoding failed");
 
+decoded:
 	if (!p15card->app || !p15card->app->ddo.aid.len)   {
 		r = sc_pkcs15_make_absolute_path(&p15card->file_app->path, &info.path);
 		LOG_TEST_RET(ctx, r, "Cannot make absolute path");
@@ -290,7 +427,7 @@ sc_pkcs15_decode_cdf_entry(struct sc_pkcs15_card *p15card, struct sc_pkcs15_obje
 	sc_log(ctx, "Certificate path '%s'", sc_print_path(&info.path));
 
 	obj->type = SC_PKCS15_TYPE_CERT_X509;
-	obj->data = malloc(sizeof(info));
+	obj->data = sc_pkcs15_alloc_object_data(obj, sizeof(info));
 	if (obj->data == NULL)
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 	memcpy(obj->data, &info, sizeof(info));
@@ -344,21 +481,33 @@ sc_pkcs15_free_certificate(struct sc_pkcs15_cert *cert)
 
 	if (cert->key)
 		sc_pkcs15_free_pubkey(cert->key);
-	free(cert->subject);
-	free(cert->issuer);
-	free(cert->serial);
-	free(cert->data.value);
+	if (!sc_pkcs15_buf_contains(cert->buf, cert->subject))
+		free(cert->subject);
+	if (!sc_pkcs15_buf_contains(cert->buf, cert->issuer))
+		free(cert->issuer);
+	if (!sc_pkcs15_buf_contains(cert->buf, cert->serial))
+		free(cert->serial);
+	if (!sc_pkcs15_buf_contains(cert->buf, cert->data.value))
+		free(cert->data.value);
 	free(cert->crl);
+	sc_pkcs15_buf_unref(cert->buf);
 	free(cert);
 }
 
 
+void
+sc_pkcs15_clear_cert_info(sc_pkcs15_cert_info_t *cert)
+{
+	if (cert && cert->value.value)
+		free(cert->value.value);
+}
+
+
 void
 sc_pkcs15_free_cert_info(sc_pkcs15_cert_info_t *cert)
 {
 	if (!cert)
 		return;
-	if (cert->value.value)
-		free(cert->value.value);
+	sc_pkcs15_clear_cert_info(cert);
 	free(cert);
 }
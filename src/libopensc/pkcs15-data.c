@@ -128,7 +128,7 @@ int sc_pkcs15_decode_dodf_entry(struct sc_pkcs15_card *p15card,
 	}
 
 	obj->type = SC_PKCS15_TYPE_DATA_OBJECT;
-	obj->data = malloc(sizeof(info));
+	obj->data = sc_pkcs15_alloc_object_data(obj, sizeof(info));
 	if (obj->data == NULL)
 		SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_OUT_OF_MEMORY);
 	memcpy(obj->data, &info, sizeof(info));
@@ -177,10 +177,14 @@ void sc_pkcs15_free_data_object(struct sc_pkcs15_data *data_object)
 	free(data_object);
 }
 
-void sc_pkcs15_free_data_info(struct sc_pkcs15_data_info *info)
+void sc_pkcs15_clear_data_info(struct sc_pkcs15_data_info *info)
 {
 	if (info && info->data.value && info->data.len)
 		free(info->data.value);
+}
 
+void sc_pkcs15_free_data_info(struct sc_pkcs15_data_info *info)
+{
+	sc_pkcs15_clear_data_info(info);
 	free(info);
 }
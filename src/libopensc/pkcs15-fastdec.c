@@ -0,0 +1,697 @@
+/*
+ * pkcs15-fastdec.c: Table driven decoder for PKCS #15 directory entries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "internal.h"
+#include "asn1.h"
+#include "pkcs15.h"
+
+/*
+ * The xDF entry decoders in pkcs15-prkey.c, pkcs15-pubkey.c, pkcs15-cert.c
+ * and pkcs15-pin.c set up a dozen sc_asn1_entry templates for every entry
+ * before handing them to the generic ASN.1 decoder.  The tables below
+ * describe the same layouts once, read-only, and are walked in a single
+ * pass over the DER data.
+ *
+ * Only the layouts found on practically every card are covered: RSA and
+ * EC private keys, RSA public keys and X.509 certificates referenced by
+ * path, and PIN objects.  Everything else, as well as any encoding the
+ * generic decoder would treat in a special way, makes these functions
+ * return SC_ERROR_NOT_SUPPORTED with the object left untouched, and the
+ * caller falls back to the generic decoder.  The result of a successful
+ * decoding is identical to what the generic decoder produces.
+ */
+
+enum {
+	FD_END = 0,
+	FD_STRUCT,	/* decode contents with 'sub', relative to 'offset' */
+	FD_SKIP,	/* element is recognised but not stored */
+	FD_BOOLEAN,
+	FD_INTEGER,
+	FD_BIT_FIELD,
+	FD_ID,
+	FD_UTF8,	/* zero terminated, into a buffer of 'size' octets */
+	FD_OCTETS,	/* truncated to 'size' octets */
+	FD_DER,		/* malloc'ed copy into a struct sc_pkcs15_der */
+	FD_PATH
+};
+
+#define FD_OPTIONAL	0x01
+
+struct fd_field {
+	unsigned char tag;	/* identifier octet */
+	unsigned char type;
+	unsigned char flags;
+	unsigned short size;
+	size_t offset;
+	const struct fd_field *sub;
+};
+
+struct fd_scratch {
+	struct sc_pkcs15_object obj;
+	union {
+		struct sc_pkcs15_prkey_info prkey;
+		struct sc_pkcs15_pubkey_info pubkey;
+		struct sc_pkcs15_cert_info cert;
+		struct sc_pkcs15_auth_info auth;
+	} u;
+	/* sink for values the generic decoder checks but throws away */
+	int discard;
+};
+
+#define OBJ(f)		offsetof(struct fd_scratch, obj.f)
+#define PRK(f)		offsetof(struct fd_scratch, u.prkey.f)
+#define PUK(f)		offsetof(struct fd_scratch, u.pubkey.f)
+#define CRT(f)		offsetof(struct fd_scratch, u.cert.f)
+#define AUTH(f)		offsetof(struct fd_scratch, u.auth.f)
+#define DISCARD		offsetof(struct fd_scratch, discard)
+#define RULE(f)		offsetof(struct sc_pkcs15_accessrule, f)
+
+#define FD_LAST		{ 0, FD_END, 0, 0, 0, NULL }
+
+/* CommonObjectAttributes */
+static const struct fd_field fd_ac_rule[] = {
+	{ 0x03, FD_BIT_FIELD, FD_OPTIONAL, 0, RULE(access_mode), NULL },
+	{ 0x04, FD_ID, FD_OPTIONAL, 0, RULE(auth_id), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_ac_rules[SC_PKCS15_MAX_ACCESS_RULES + 1] = {
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[0]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[1]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[2]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[3]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[4]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[5]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[6]), fd_ac_rule },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, OBJ(access_rules[7]), fd_ac_rule },
+	FD_LAST
+};
+
+static const struct fd_field fd_com_obj_attr[] = {
+	{ 0x0C, FD_UTF8, FD_OPTIONAL, SC_PKCS15_MAX_LABEL_SIZE, OBJ(label), NULL },
+	{ 0x03, FD_BIT_FIELD, FD_OPTIONAL, 0, OBJ(flags), NULL },
+	{ 0x04, FD_ID, FD_OPTIONAL, 0, OBJ(auth_id), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, OBJ(user_consent), NULL },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, 0, fd_ac_rules },
+	FD_LAST
+};
+
+/* Private keys */
+static const struct fd_field fd_prk_alg_refs[SC_MAX_SUPPORTED_ALGORITHMS + 1] = {
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[0]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[1]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[2]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[3]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[4]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[5]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[6]), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(algo_refs[7]), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_prk_com_key_attr[] = {
+	{ 0x04, FD_ID, 0, 0, PRK(id), NULL },
+	{ 0x03, FD_BIT_FIELD, 0, 0, PRK(usage), NULL },
+	{ 0x01, FD_BOOLEAN, FD_OPTIONAL, 0, PRK(native), NULL },
+	{ 0x03, FD_BIT_FIELD, FD_OPTIONAL, 0, PRK(access_flags), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(key_reference), NULL },
+	{ 0xA1, FD_STRUCT, FD_OPTIONAL, 0, 0, fd_prk_alg_refs },
+	FD_LAST
+};
+
+static const struct fd_field fd_prk_com_prkey_attr[] = {
+	{ 0x30, FD_DER, FD_OPTIONAL, 0, PRK(subject), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_prk_rsakey_attr[] = {
+	{ 0x30, FD_PATH, 0, 0, PRK(path), NULL },
+	{ 0x02, FD_INTEGER, 0, 0, PRK(modulus_length), NULL },
+	{ 0x02, FD_SKIP, FD_OPTIONAL, 0, 0, NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_prk_rsa_type_attr[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_prk_rsakey_attr },
+	FD_LAST
+};
+
+static const struct fd_field fd_prk_ecckey_attr[] = {
+	{ 0x30, FD_PATH, 0, 0, PRK(path), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PRK(field_length), NULL },
+	{ 0x02, FD_SKIP, FD_OPTIONAL, 0, 0, NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_prk_ecc_type_attr[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_prk_ecckey_attr },
+	FD_LAST
+};
+
+static const struct fd_field fd_prkey_rsa[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_com_obj_attr },
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_prk_com_key_attr },
+	{ 0xA0, FD_STRUCT, FD_OPTIONAL, 0, 0, fd_prk_com_prkey_attr },
+	{ 0xA1, FD_STRUCT, 0, 0, 0, fd_prk_rsa_type_attr },
+	FD_LAST
+};
+
+static const struct fd_field fd_prkey_ecc[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_com_obj_attr },
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_prk_com_key_attr },
+	{ 0xA0, FD_STRUCT, FD_OPTIONAL, 0, 0, fd_prk_com_prkey_attr },
+	{ 0xA1, FD_STRUCT, 0, 0, 0, fd_prk_ecc_type_attr },
+	FD_LAST
+};
+
+/* Public keys */
+static const struct fd_field fd_puk_com_key_attr[] = {
+	{ 0x04, FD_ID, 0, 0, PUK(id), NULL },
+	{ 0x03, FD_BIT_FIELD, 0, 0, PUK(usage), NULL },
+	{ 0x01, FD_BOOLEAN, FD_OPTIONAL, 0, PUK(native), NULL },
+	{ 0x03, FD_BIT_FIELD, FD_OPTIONAL, 0, PUK(access_flags), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, PUK(key_reference), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_puk_com_pubkey_attr[] = {
+	{ 0x30, FD_DER, FD_OPTIONAL, 0, PUK(subject), NULL },
+	FD_LAST
+};
+
+/* the 'direct' alternative of the value is left to the generic decoder */
+static const struct fd_field fd_puk_rsakey_attr[] = {
+	{ 0x30, FD_PATH, 0, 0, PUK(path), NULL },
+	{ 0x02, FD_INTEGER, 0, 0, PUK(modulus_length), NULL },
+	{ 0x02, FD_SKIP, FD_OPTIONAL, 0, 0, NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_puk_rsa_type_attr[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_puk_rsakey_attr },
+	FD_LAST
+};
+
+static const struct fd_field fd_pubkey_rsa[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_com_obj_attr },
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_puk_com_key_attr },
+	{ 0xA0, FD_STRUCT, FD_OPTIONAL, 0, 0, fd_puk_com_pubkey_attr },
+	{ 0xA1, FD_STRUCT, 0, 0, 0, fd_puk_rsa_type_attr },
+	FD_LAST
+};
+
+/* Certificates */
+static const struct fd_field fd_crt_cred_ident[] = {
+	{ 0x02, FD_INTEGER, 0, 0, DISCARD, NULL },
+	{ 0x04, FD_SKIP, 0, 0, 0, NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_crt_com_cert_attr[] = {
+	{ 0x04, FD_ID, 0, 0, CRT(id), NULL },
+	{ 0x01, FD_BOOLEAN, FD_OPTIONAL, 0, CRT(authority), NULL },
+	{ 0x30, FD_STRUCT, FD_OPTIONAL, 0, 0, fd_crt_cred_ident },
+	FD_LAST
+};
+
+static const struct fd_field fd_crt_x509_cert_attr[] = {
+	{ 0x30, FD_PATH, 0, 0, CRT(path), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_crt_type_cert_attr[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_crt_x509_cert_attr },
+	FD_LAST
+};
+
+static const struct fd_field fd_cert_x509[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_com_obj_attr },
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_crt_com_cert_attr },
+	{ 0xA0, FD_SKIP, FD_OPTIONAL, 0, 0, NULL },
+	{ 0xA1, FD_STRUCT, 0, 0, 0, fd_crt_type_cert_attr },
+	FD_LAST
+};
+
+/* PIN objects */
+static const struct fd_field fd_auth_com_ao_attr[] = {
+	{ 0x04, FD_ID, 0, 0, AUTH(auth_id), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_auth_pin_attr[] = {
+	{ 0x03, FD_BIT_FIELD, 0, 0, AUTH(attrs.pin.flags), NULL },
+	{ 0x0A, FD_INTEGER, 0, 0, AUTH(attrs.pin.type), NULL },
+	{ 0x02, FD_INTEGER, 0, 0, AUTH(attrs.pin.min_length), NULL },
+	{ 0x02, FD_INTEGER, 0, 0, AUTH(attrs.pin.stored_length), NULL },
+	{ 0x02, FD_INTEGER, FD_OPTIONAL, 0, AUTH(attrs.pin.max_length), NULL },
+	{ 0x80, FD_INTEGER, FD_OPTIONAL, 0, AUTH(attrs.pin.reference), NULL },
+	{ 0x04, FD_OCTETS, FD_OPTIONAL, 1, AUTH(attrs.pin.pad_char), NULL },
+	{ 0x18, FD_SKIP, FD_OPTIONAL, 0, 0, NULL },
+	{ 0x30, FD_PATH, FD_OPTIONAL, 0, AUTH(path), NULL },
+	FD_LAST
+};
+
+static const struct fd_field fd_auth_type_pin_attr[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_auth_pin_attr },
+	FD_LAST
+};
+
+static const struct fd_field fd_auth_pin[] = {
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_com_obj_attr },
+	{ 0x30, FD_STRUCT, 0, 0, 0, fd_auth_com_ao_attr },
+	{ 0xA0, FD_SKIP, FD_OPTIONAL, 0, 0, NULL },
+	{ 0xA1, FD_STRUCT, 0, 0, 0, fd_auth_type_pin_attr },
+	FD_LAST
+};
+
+
+
+
+/*
+ * DER tokenizer.  The header of the element at the current position is
+ * parsed once and kept until the element is consumed, however many table
+ * fields are compared against it.  Like sc_asn1_skip_tag(), an element that
+ * does not fit into the remaining data matches no field.
+ */
+struct fd_reader {
+	const u8 *p;
+	size_t left;
+	int valid;		/* the fields below describe the element at 'p' */
+	unsigned char id;	/* identifier octet, 0 if no field can match */
+	const u8 *obj;
+	size_t objlen;
+};
+
+static void fd_reader_init(struct fd_reader *rd, const u8 *in, size_t len)
+{
+	rd->p = in;
+	rd->left = len;
+	rd->valid = 0;
+}
+
+static int fd_peek(struct fd_reader *rd)
+{
+	const u8 *p = rd->p;
+	size_t left = rd->left, hdrlen = 2, len, i;
+
+	if (rd->valid)
+		return 0;
+	rd->valid = 1;
+	rd->id = 0;
+	if (left < 2)
+		return 0;
+	/* sc_asn1_read_tag() reports end-of-content octets as an element
+	 * without a tag, which the generic decoder does not cope with */
+	if (p[0] == 0x00 || p[0] == 0xFF)
+		return SC_ERROR_NOT_SUPPORTED;
+	/* the tables only use low tag numbers */
+	if ((p[0] & SC_ASN1_TAG_PRIMITIVE) == SC_ASN1_TAG_PRIMITIVE)
+		return 0;
+
+	len = p[1] & 0x7F;
+	if (p[1] & 0x80) {
+		if (len > 4 || len > left - 1)
+			return 0;
+		/* sc_asn1_read_tag() reads one octet beyond the data here */
+		if (len == left - 1)
+			return SC_ERROR_NOT_SUPPORTED;
+		hdrlen += len;
+		for (i = 2, len = 0; i < hdrlen; i++)
+			len = (len << 8) | p[i];
+	}
+	if (len > left - hdrlen)
+		return 0;
+
+	rd->id = p[0];
+	rd->obj = p + hdrlen;
+	rd->objlen = len;
+	return 0;
+}
+
+/* Returns 1 and consumes the current element if its identifier octet is
+ * 'tag', 0 if it is not */
+static int fd_match(struct fd_reader *rd, unsigned char tag,
+		const u8 **obj, size_t *objlen)
+{
+	int r;
+
+	r = fd_peek(rd);
+	if (r < 0)
+		return r;
+	if (rd->id == 0 || rd->id != tag)
+		return 0;
+
+	*obj = rd->obj;
+	*objlen = rd->objlen;
+	rd->left -= (rd->obj - rd->p) + rd->objlen;
+	rd->p = rd->obj + rd->objlen;
+	rd->valid = 0;
+	return 1;
+}
+
+static int fd_integer(const u8 *obj, size_t objlen, int *out)
+{
+	/* sc_asn1_decode_integer() looks at the first octet even if there
+	 * is none */
+	if (objlen == 0 || sc_asn1_decode_integer(obj, objlen, out))
+		return SC_ERROR_NOT_SUPPORTED;
+	return 0;
+}
+
+/* Same result as decode_bit_field() in asn1.c */
+static int fd_bit_field(const u8 *obj, size_t objlen, unsigned int *out)
+{
+	unsigned int field = 0, octet;
+	unsigned int zero_bits;
+	size_t i;
+
+	if (objlen < 1 || objlen - 1 > sizeof(field))
+		return SC_ERROR_NOT_SUPPORTED;
+	zero_bits = obj[0] & 0x07;
+	if (objlen == 1 && zero_bits)
+		return SC_ERROR_NOT_SUPPORTED;
+
+	for (i = 1; i < objlen; i++) {
+		octet = obj[i];
+		if (i == objlen - 1)
+			octet &= 0xFF << zero_bits;
+		/* first bit in the bit string is the LSB */
+		octet = ((octet & 0xF0) >> 4) | ((octet & 0x0F) << 4);
+		octet = ((octet & 0xCC) >> 2) | ((octet & 0x33) << 2);
+		octet = ((octet & 0xAA) >> 1) | ((octet & 0x55) << 1);
+		field |= octet << (8 * (i - 1));
+	}
+	memcpy(out, &field, sizeof(field));
+	return 0;
+}
+
+/* Same result as asn1_decode_path() in asn1.c */
+static int fd_path(const u8 *in, size_t len, struct sc_path *path)
+{
+	struct fd_reader rd, ext;
+	const u8 *obj, *eobj;
+	size_t objlen, eobjlen;
+	u8 path_value[SC_MAX_PATH_SIZE], aid_value[SC_MAX_AID_SIZE];
+	size_t path_len = sizeof(path_value), aid_len = sizeof(aid_value);
+	int idx = 0, count = 0, have_path, have_idx, have_count, have_ext, r;
+
+	memset(path, 0, sizeof(*path));
+	/* neither 'path' nor 'pathExtended' can be present */
+	if (len < 2 || in[0] == 0x00 || in[0] == 0xFF)
+		return SC_ERROR_NOT_SUPPORTED;
+
+	fd_reader_init(&rd, in, len);
+	have_path = fd_match(&rd, SC_ASN1_TAG_OCTET_STRING, &obj, &objlen);
+	if (have_path < 0)
+		return have_path;
+	if (have_path) {
+		path_len = objlen < path_len ? objlen : path_len;
+		memcpy(path_value, obj, path_len);
+	}
+
+	have_idx = fd_match(&rd, SC_ASN1_TAG_INTEGER, &obj, &objlen);
+	if (have_idx < 0)
+		return have_idx;
+	if (have_idx && fd_integer(obj, objlen, &idx))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	have_count = fd_match(&rd, SC_ASN1_TAG_CONTEXT | 0, &obj, &objlen);
+	if (have_count < 0)
+		return have_count;
+	if (have_count && fd_integer(obj, objlen, &count))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	have_ext = fd_match(&rd, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 1, &obj, &objlen);
+	if (have_ext < 0)
+		return have_ext;
+	if (have_ext) {
+		if (objlen < 2 || obj[0] == 0x00 || obj[0] == 0xFF)
+			return SC_ERROR_NOT_SUPPORTED;
+		fd_reader_init(&ext, obj, objlen);
+		r = fd_match(&ext, SC_ASN1_TAG_APPLICATION | 0x0F, &eobj, &eobjlen);
+		if (r != 1)
+			return SC_ERROR_NOT_SUPPORTED;
+		aid_len = eobjlen < aid_len ? eobjlen : aid_len;
+		memcpy(aid_value, eobj, aid_len);
+		r = fd_match(&ext, SC_ASN1_TAG_OCTET_STRING, &eobj, &eobjlen);
+		if (r != 1)
+			return SC_ERROR_NOT_SUPPORTED;
+		/* both paths share one length, as in asn1_decode_path() */
+		path_len = eobjlen < path_len ? eobjlen : path_len;
+		memcpy(path_value, eobj, path_len);
+
+		memcpy(path->aid.value, aid_value, aid_len);
+		path->aid.len = aid_len;
+	}
+	else if (!have_path) {
+		return SC_ERROR_NOT_SUPPORTED;
+	}
+	memcpy(path->value, path_value, path_len);
+	path->len = path_len;
+
+	if (path->len == 2)
+		path->type = SC_PATH_TYPE_FILE_ID;
+	else if (path->aid.len && path->len > 2)
+		path->type = SC_PATH_TYPE_FROM_CURRENT;
+	else
+		path->type = SC_PATH_TYPE_PATH;
+
+	if (have_idx && have_count) {
+		path->index = idx;
+		path->count = count;
+	}
+	else {
+		path->index = 0;
+		path->count = -1;
+	}
+	return 0;
+}
+
+static int fd_decode(u8 *base, const struct fd_field *field, const u8 *in, size_t len);
+
+static int fd_decode_field(u8 *base, const struct fd_field *field,
+		const u8 *obj, size_t objlen)
+{
+	void *ptr = base + field->offset;
+	struct sc_pkcs15_id *id;
+	struct sc_pkcs15_der *der;
+	size_t c;
+
+	switch (field->type) {
+	case FD_STRUCT:
+		return fd_decode(ptr, field->sub, obj, objlen);
+	case FD_SKIP:
+		return 0;
+	case FD_BOOLEAN:
+		if (objlen != 1)
+			return SC_ERROR_NOT_SUPPORTED;
+		*(int *) ptr = obj[0] ? 1 : 0;
+		return 0;
+	case FD_INTEGER:
+		/* written as int whatever the field type, like the generic decoder */
+		return fd_integer(obj, objlen, (int *) ptr);
+	case FD_BIT_FIELD:
+		return fd_bit_field(obj, objlen, (unsigned int *) ptr);
+	case FD_ID:
+		id = (struct sc_pkcs15_id *) ptr;
+		c = objlen > sizeof(id->value) ? sizeof(id->value) : objlen;
+		memcpy(id->value, obj, c);
+		id->len = c;
+		return 0;
+	case FD_UTF8:
+		if (objlen + 1 > field->size)
+			return SC_ERROR_NOT_SUPPORTED;
+		memcpy(ptr, obj, objlen);
+		((u8 *) ptr)[objlen] = '\0';
+		return 0;
+	case FD_OCTETS:
+		memcpy(ptr, obj, objlen > field->size ? field->size : objlen);
+		return 0;
+	case FD_DER:
+		der = (struct sc_pkcs15_der *) ptr;
+		der->value = malloc(objlen);
+		if (der->value == NULL)
+			return SC_ERROR_OUT_OF_MEMORY;
+		memcpy(der->value, obj, objlen);
+		der->len = objlen;
+		return 0;
+	case FD_PATH:
+		return fd_path(obj, objlen, (struct sc_path *) ptr);
+	}
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+/* Walks the fields in order with the semantics of asn1_decode(): absent
+ * optional fields are skipped and trailing elements are ignored */
+static int fd_decode(u8 *base, const struct fd_field *field, const u8 *in, size_t len)
+{
+	struct fd_reader rd;
+	const u8 *obj;
+	size_t objlen;
+	int r;
+
+	if (len < 2) {
+		for (; field->type != FD_END; field++)
+			if (!(field->flags & FD_OPTIONAL))
+				return SC_ERROR_NOT_SUPPORTED;
+		return 0;
+	}
+	if (in[0] == 0x00 || in[0] == 0xFF)
+		return SC_ERROR_NOT_SUPPORTED;
+
+	fd_reader_init(&rd, in, len);
+	for (; field->type != FD_END; field++) {
+		r = fd_match(&rd, field->tag, &obj, &objlen);
+		if (r < 0)
+			return r;
+		if (r == 0) {
+			if (field->flags & FD_OPTIONAL)
+				continue;
+			return SC_ERROR_NOT_SUPPORTED;
+		}
+		r = fd_decode_field(base, field, obj, objlen);
+		if (r < 0)
+			return r;
+	}
+	return 0;
+}
+
+static int fd_decode_entry(struct fd_scratch *s, const struct fd_field *object,
+		const u8 **buf, size_t *buflen)
+{
+	struct fd_reader rd;
+	const u8 *obj;
+	size_t objlen;
+	int r;
+
+	fd_reader_init(&rd, *buf, *buflen);
+	r = fd_match(&rd, **buf, &obj, &objlen);
+	if (r != 1)
+		return SC_ERROR_NOT_SUPPORTED;
+	r = fd_decode((u8 *) s, object, obj, objlen);
+	if (r < 0)
+		return r;
+
+	*buf = rd.p;
+	*buflen = rd.left;
+	return 0;
+}
+
+int sc_pkcs15_fast_decode_prkdf_entry(struct sc_pkcs15_object *obj,
+		struct sc_pkcs15_prkey_info *info, const u8 **buf, size_t *buflen)
+{
+	struct fd_scratch s;
+	const struct fd_field *object;
+	unsigned int type;
+	int r;
+
+	if (*buflen < 2)
+		return SC_ERROR_NOT_SUPPORTED;
+	switch (**buf) {
+	case SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED:
+		object = fd_prkey_rsa;
+		type = SC_PKCS15_TYPE_PRKEY_RSA;
+		break;
+	case SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 0:
+		object = fd_prkey_ecc;
+		type = SC_PKCS15_TYPE_PRKEY_EC;
+		break;
+	default:
+		return SC_ERROR_NOT_SUPPORTED;
+	}
+
+	s.obj = *obj;
+	s.u.prkey = *info;
+	r = fd_decode_entry(&s, object, buf, buflen);
+	if (r < 0) {
+		if (s.u.prkey.subject.value != info->subject.value)
+			free(s.u.prkey.subject.value);
+		return r;
+	}
+	s.obj.type = type;
+	*obj = s.obj;
+	*info = s.u.prkey;
+	return 0;
+}
+
+int sc_pkcs15_fast_decode_pukdf_entry(struct sc_pkcs15_object *obj,
+		struct sc_pkcs15_pubkey_info *info, const u8 **buf, size_t *buflen)
+{
+	struct fd_scratch s;
+	int r;
+
+	if (*buflen < 2 || **buf != (SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	s.obj = *obj;
+	s.u.pubkey = *info;
+	r = fd_decode_entry(&s, fd_pubkey_rsa, buf, buflen);
+	if (r < 0) {
+		if (s.u.pubkey.subject.value != info->subject.value)
+			free(s.u.pubkey.subject.value);
+		return r;
+	}
+	s.obj.type = SC_PKCS15_TYPE_PUBKEY_RSA;
+	*obj = s.obj;
+	*info = s.u.pubkey;
+	return 0;
+}
+
+int sc_pkcs15_fast_decode_cdf_entry(struct sc_pkcs15_object *obj,
+		struct sc_pkcs15_cert_info *info, const u8 **buf, size_t *buflen)
+{
+	struct fd_scratch s;
+	int r;
+
+	if (*buflen < 2 || **buf != (SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	s.obj = *obj;
+	s.u.cert = *info;
+	r = fd_decode_entry(&s, fd_cert_x509, buf, buflen);
+	if (r < 0)
+		return r;
+	*obj = s.obj;
+	*info = s.u.cert;
+	return 0;
+}
+
+int sc_pkcs15_fast_decode_aodf_entry(struct sc_pkcs15_object *obj,
+		struct sc_pkcs15_auth_info *info, const u8 **buf, size_t *buflen)
+{
+	struct fd_scratch s;
+	int r;
+
+	if (*buflen < 2 || **buf != (SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	s.obj = *obj;
+	s.u.auth = *info;
+	r = fd_decode_entry(&s, fd_auth_pin, buf, buflen);
+	if (r < 0)
+		return r;
+	*obj = s.obj;
+	*info = s.u.auth;
+	return 0;
+}
@@ -79,7 +79,7 @@ int sc_pkcs15_decode_aodf_entry(struct sc_pkcs15_card *p15card,
 {
 	sc_context_t *ctx = p15card->card->ctx;
 	struct sc_pkcs15_auth_info info;
-	int r;
+	int r, auth_type;
 	size_t flags_len = sizeof(info.attrs.pin.flags);
 	size_t derived_len = sizeof(info.attrs.authkey.derived);
 	size_t padchar_len = 1;
@@ -93,6 +93,20 @@ int sc_pkcs15_decode_aodf_entry(struct sc_pkcs15_card *p15card,
 
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_ASN1);
 
+	/* Fill in defaults */
+	memset(&info, 0, sizeof(info));
+	info.tries_left = -1;
+
+	if (p15card->opts.use_fast_decoder)   {
+		r = sc_pkcs15_fast_decode_aodf_entry(obj, &info, buf, buflen);
+		if (r != SC_ERROR_NOT_SUPPORTED)   {
+			SC_TEST_RET(ctx, SC_LOG_DEBUG_NORMAL, r, "ASN.1 decoding failed");
+			/* only PIN objects are handled by the fast decoder */
+			auth_type = 0;
+			goto decoded;
+		}
+	}
+
 	sc_copy_asn1_entry(c_asn1_auth_type, asn1_auth_type);
 	sc_copy_asn1_entry(c_asn1_auth_type_choice, asn1_auth_type_choice);
 
@@ -128,16 +142,17 @@ int sc_pkcs15_decode_aodf_entry(struct sc_pkcs15_card *p15card,
 
 	sc_format_asn1_entry(asn1_com_ao_attr + 0, &info.auth_id, NULL, 0);
 
-	/* Fill in defaults */
-	memset(&info, 0, sizeof(info));
-	info.tries_left = -1;
-
 	r = sc_asn1_decode(ctx, asn1_auth_type, *buf, *buflen, buf, buflen);
 	if (r == SC_ERROR_ASN1_END_OF_CONTENTS)
 		return r;
 	SC_TEST_RET(ctx, SC_LOG_DEBUG_NORMAL, r, "ASN.1 decoding failed");
 
-	if (asn1_auth_type_choice[0].flags & SC_ASN1_PRESENT)   {
+	for (auth_type = 0; auth_type < 3; auth_type++)
+		if (asn1_auth_type_choice[auth_type].flags & SC_ASN1_PRESENT)
+			break;
+
+decoded:
+	if (auth_type == 0)   {
 		sc_log(ctx, "AuthType: PIN");
 		obj->type = SC_PKCS15_TYPE_AUTH_PIN;
 		info.auth_type = SC_PKCS15_PIN_AUTH_TYPE_PIN;
@@ -174,10 +189,10 @@ int sc_pkcs15_decode_aodf_entry(struct sc_pkcs15_card *p15card,
 		}
 		sc_debug(ctx, SC_LOG_DEBUG_ASN1, "decoded PIN(ref:%X,path:%s)", info.attrs.pin.reference, sc_print_path(&info.path));
 	}
-	else if (asn1_auth_type_choice[1].flags & SC_ASN1_PRESENT)   {
+	else if (auth_type == 1)   {
 		SC_TEST_RET(ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_NOT_SUPPORTED, "BIO authentication object not yet supported");
 	}
-	else if (asn1_auth_type_choice[2].flags & SC_ASN1_PRESENT)   {
+	else if (auth_type == 2)   {
 		sc_log(ctx, "AuthType: AuthKey");
 		obj->type = SC_PKCS15_TYPE_AUTH_AUTHKEY;
 		info.auth_type = SC_PKCS15_PIN_AUTH_TYPE_AUTH_KEY;
@@ -189,7 +204,7 @@ int sc_pkcs15_decode_aodf_entry(struct sc_pkcs15_card *p15card,
 		SC_TEST_RET(ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_NOT_SUPPORTED, "unknown authentication type");
 	}
 
-	obj->data = malloc(sizeof(info));
+	obj->data = sc_pkcs15_alloc_object_data(obj, sizeof(info));
 	if (obj->data == NULL)
 		SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_OUT_OF_MEMORY);
 	memcpy(obj->data, &info, sizeof(info));
@@ -273,6 +288,87 @@ static int _validate_pin(struct sc_pkcs15_card *p15card,
 	return SC_SUCCESS;
 }
 
+/* Whether the PIN protects an object that requires user consent */
+static int _pin_user_consent(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_auth_info *auth_info)
+{
+	struct sc_pkcs15_object *obj;
+
+	if (p15card->opts.pin_cache_ignore_user_consent)
+		return 0;
+
+	for (obj = p15card->obj_list; obj != NULL; obj = obj->next) {
+		/* Compare 'sc_pkcs15_object.auth_id' with 'sc_pkcs15_pin_info.auth_id'.
+		 * In accordance with PKCS#15 "6.1.8 CommonObjectAttributes" and
+		 * "6.1.16 CommonAuthenticationObjectAttributes" with the exception that
+		 * "CommonObjectAttributes.accessControlRules" are not taken into account. */
+		if (sc_pkcs15_compare_id(&obj->auth_id, &auth_info->auth_id)
+				&& obj->user_consent > 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* The cached value of the PIN is the one given, compared in constant time */
+static int _pin_is_cached(const struct sc_pkcs15_object *pin_obj,
+		const u8 *pincode, size_t pinlen)
+{
+	unsigned char diff = 0;
+	size_t i;
+
+	if (!pincode || !pinlen || !pin_obj->content.value
+			|| pin_obj->content.len != pinlen)
+		return 0;
+	for (i = 0; i < pinlen; i++)
+		diff |= pin_obj->content.value[i] ^ pincode[i];
+	return diff == 0;
+}
+
+/* State of a PIN, with ask_card the card is asked even if it is recorded */
+static int get_pin_state(struct sc_pkcs15_card *p15card,
+			 struct sc_pkcs15_object *pin_obj, int ask_card)
+{
+	struct sc_pkcs15_auth_info *auth_info = (struct sc_pkcs15_auth_info *)pin_obj->data;
+	struct sc_card *card = p15card->card;
+	struct sc_pin_cmd_data data;
+	int r;
+
+	if (auth_info->auth_type != SC_PKCS15_PIN_AUTH_TYPE_PIN)
+		return SC_PIN_STATE_UNKNOWN;
+
+	if (sc_lock(card) != SC_SUCCESS)
+		return SC_PIN_STATE_UNKNOWN;
+
+	r = SC_PIN_STATE_UNKNOWN;
+	/* the path in the pin object is optional */
+	if (auth_info->path.len == 0 || sc_select_file(card, &auth_info->path, NULL) == SC_SUCCESS) {
+		if (!ask_card) {
+			r = sc_pin_get_state(card, auth_info->auth_method, auth_info->attrs.pin.reference);
+		}
+		else {
+			memset(&data, 0, sizeof(data));
+			data.cmd = SC_PIN_CMD_GET_INFO;
+			data.pin_type = auth_info->auth_method;
+			data.pin_reference = auth_info->attrs.pin.reference;
+			if (sc_pin_cmd(card, &data, NULL) == SC_SUCCESS)
+				r = data.pin1.logged_in;
+		}
+	}
+
+	sc_unlock(card);
+	return r;
+}
+
+/*
+ * Ask the card whether a PIN is verified, without presenting it.
+ * Returns one of SC_PIN_STATE_*.
+ */
+int sc_pkcs15_get_pin_state(struct sc_pkcs15_card *p15card,
+			 struct sc_pkcs15_object *pin_obj)
+{
+	return get_pin_state(p15card, pin_obj, 0);
+}
+
 /*
  * Verify a PIN.
  *
@@ -362,6 +458,17 @@ int sc_pkcs15_verify_pin(struct sc_pkcs15_card *p15card,
 			goto out;
 	}
 
+	/* Presenting the PIN the card already accepted is a waste of time, but
+	 * only the cached one is known to be right. PINs of objects that need
+	 * user consent are presented every time. */
+	if (_pin_is_cached(pin_obj, pincode, pinlen)
+			&& !_pin_user_consent(p15card, auth_info)
+			&& sc_pin_get_state(card, data.pin_type, data.pin_reference) == SC_PIN_STATE_LOGGED_IN) {
+		sc_log(ctx, "PIN(%s) already verified", pin_obj->label);
+		r = SC_SUCCESS;
+		goto out;
+	}
+
 	r = sc_pin_cmd(card, &data, &auth_info->tries_left);
 	sc_log(ctx, "PIN cmd result %i", r);
 	if (r == SC_SUCCESS)
@@ -591,7 +698,6 @@ void sc_pkcs15_pincache_add(struct sc_pkcs15_card *p15card, struct sc_pkcs15_obj
 {
 	struct sc_context *ctx = p15card->card->ctx;
 	struct sc_pkcs15_auth_info *auth_info = (struct sc_pkcs15_auth_info *)pin_obj->data;
-	struct sc_pkcs15_object *obj = NULL;
 	int r;
 
 	LOG_FUNC_CALLED(ctx);
@@ -606,25 +712,9 @@ void sc_pkcs15_pincache_add(struct sc_pkcs15_card *p15card, struct sc_pkcs15_obj
 	}
 
 	/* If the PIN protects an object with user consent, don't cache it */
-
-	obj = p15card->obj_list;
-	while (obj != NULL) {
-		/* Compare 'sc_pkcs15_object.auth_id' with 'sc_pkcs15_pin_info.auth_id'.
-		 * In accordance with PKCS#15 "6.1.8 CommonObjectAttributes" and
-		 * "6.1.16 CommonAuthenticationObjectAttributes" with the exception that
-		 * "CommonObjectAttributes.accessControlRules" are not taken into account. */
-
-		if (sc_pkcs15_compare_id(&obj->auth_id, &auth_info->auth_id)) {
-			/* Caching is refused, if the protected object requires user consent */
-		    if (!p15card->opts.pin_cache_ignore_user_consent) {
-			if (obj->user_consent > 0) {
-				sc_log(ctx, "caching refused (user consent)");
-				return;
-			}
-		    }
-		}
-
-		obj = obj->next;
+	if (_pin_user_consent(p15card, auth_info)) {
+		sc_log(ctx, "caching refused (user consent)");
+		return;
 	}
 
 	r = sc_pkcs15_allocate_object_content(ctx, pin_obj, pin, pinlen);
@@ -672,6 +762,15 @@ int sc_pkcs15_pincache_revalidate(struct sc_pkcs15_card *p15card, const sc_pkcs1
 	if (!pin_obj->content.value || !pin_obj->content.len)
 		return SC_ERROR_SECURITY_STATUS_NOT_SATISFIED;
 
+	/* The operation was refused with the PIN verified, presenting it again
+	 * will not help. Objects with user consent want it every time though.
+	 * The recorded state is what just proved wrong, so ask the card. */
+	if (!obj->user_consent
+			&& get_pin_state(p15card, pin_obj, 1) == SC_PIN_STATE_LOGGED_IN) {
+		sc_log(ctx, "PIN(%s) is verified, not presenting it again", pin_obj->label);
+		return SC_ERROR_SECURITY_STATUS_NOT_SATISFIED;
+	}
+
 	pin_obj->usage_counter++;
 	r = sc_pkcs15_verify_pin(p15card, pin_obj, pin_obj->content.value, pin_obj->content.len);
 	if (r != SC_SUCCESS) {
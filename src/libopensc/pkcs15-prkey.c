@@ -188,6 +188,20 @@ int sc_pkcs15_decode_prkdf_entry(struct sc_pkcs15_card *p15card,
 	struct sc_asn1_pkcs15_object gostr3410_prkey_obj = {obj, asn1_com_key_attr, asn1_com_prkey_attr, asn1_prk_gostr3410_attr};
 	struct sc_asn1_pkcs15_object ecc_prkey_obj = { obj, asn1_com_key_attr, asn1_com_prkey_attr, asn1_prk_ecc_attr };
 
+	/* Fill in defaults */
+	memset(&info, 0, sizeof(info));
+	info.key_reference = -1;
+	info.native = 1;
+	memset(gostr3410_params, 0, sizeof(gostr3410_params));
+
+	if (p15card->opts.use_fast_decoder)   {
+		r = sc_pkcs15_fast_decode_prkdf_entry(obj, &info, buf, buflen);
+		if (r != SC_ERROR_NOT_SUPPORTED)   {
+			LOG_TEST_RET(ctx, r, "PrKey DF ASN.1 decoding failed");
+			goto decoded;
+		}
+	}
+
 	sc_copy_asn1_entry(c_asn1_prkey, asn1_prkey);
 	sc_copy_asn1_entry(c_asn1_supported_algorithms, asn1_supported_algorithms);
 
@@ -243,12 +257,6 @@ int sc_pkcs15_decode_prkdf_entry(struct sc_pkcs15_card *p15card,
 
 	sc_format_asn1_entry(asn1_com_prkey_attr + 0, &info.subject.value, &info.subject.len, 0);
 
-	/* Fill in defaults */
-	memset(&info, 0, sizeof(info));
-	info.key_reference = -1;
-	info.native = 1;
-	memset(gostr3410_params, 0, sizeof(gostr3410_params));
-
 	r = sc_asn1_decode_choice(ctx, asn1_prkey, *buf, *buflen, buf, buflen);
 	if (r == SC_ERROR_ASN1_END_OF_CONTENTS)
 		return r;
@@ -285,6 +293,7 @@ int sc_pkcs15_decode_prkdf_entry(struct sc_pkcs15_card *p15card,
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ASN1_OBJECT);
 	}
 
+decoded:
 	if (!p15card->app || !p15card->app->ddo.aid.len)   {
 		sc_log(ctx, "Original PrivKey path '%s'", sc_print_path(&info.path));
 		r = sc_pkcs15_make_absolute_path(&p15card->file_app->path, &info.path);
@@ -331,7 +340,7 @@ int sc_pkcs15_decode_prkdf_entry(struct sc_pkcs15_card *p15card,
 			sc_log(ctx, "Warning: No auth ID found");
 	}
 
-	obj->data = malloc(sizeof(info));
+	obj->data = sc_pkcs15_alloc_object_data(obj, sizeof(info));
 	if (obj->data == NULL) {
 		sc_pkcs15_free_key_params(&info.params);
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
@@ -589,7 +598,7 @@ sc_pkcs15_free_prkey(struct sc_pkcs15_prkey *key)
 }
 
 
-void sc_pkcs15_free_prkey_info(sc_pkcs15_prkey_info_t *key)
+void sc_pkcs15_clear_prkey_info(sc_pkcs15_prkey_info_t *key)
 {
 	if (key->subject.value)
 		free(key->subject.value);
@@ -597,7 +606,11 @@ void sc_pkcs15_free_prkey_info(sc_pkcs15_prkey_info_t *key)
 		free(key->cmap_record.guid);
 
 	sc_pkcs15_free_key_params(&key->params);
+}
 
+void sc_pkcs15_free_prkey_info(sc_pkcs15_prkey_info_t *key)
+{
+	sc_pkcs15_clear_prkey_info(key);
 	free(key);
 }
 
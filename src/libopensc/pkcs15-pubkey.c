@@ -234,6 +234,20 @@ int sc_pkcs15_decode_pukdf_entry(struct sc_pkcs15_card *p15card,
 	struct sc_asn1_pkcs15_object gostr3410key_obj =  { obj, asn1_com_key_attr,
 			asn1_com_pubkey_attr, asn1_gostr3410_type_attr };
 
+	/* Fill in defaults */
+	memset(&info, 0, sizeof(info));
+	info.key_reference = -1;
+	info.native = 1;
+	memset(gostr3410_params, 0, sizeof(gostr3410_params));
+
+	if (p15card->opts.use_fast_decoder)   {
+		r = sc_pkcs15_fast_decode_pukdf_entry(obj, &info, buf, buflen);
+		if (r != SC_ERROR_NOT_SUPPORTED)   {
+			LOG_TEST_RET(ctx, r, "ASN.1 decoding failed");
+			goto decoded;
+		}
+	}
+
 	sc_copy_asn1_entry(c_asn1_pubkey, asn1_pubkey);
 	sc_copy_asn1_entry(c_asn1_pubkey_choice, asn1_pubkey_choice);
 	sc_copy_asn1_entry(c_asn1_rsa_type_attr, asn1_rsa_type_attr);
@@ -292,12 +306,6 @@ int sc_pkcs15_decode_pukdf_entry(struct sc_pkcs15_card *p15card,
 
 	sc_format_asn1_entry(asn1_pubkey + 0, asn1_pubkey_choice, NULL, 0);
 
-	/* Fill in defaults */
-	memset(&info, 0, sizeof(info));
-	info.key_reference = -1;
-	info.native = 1;
-	memset(gostr3410_params, 0, sizeof(gostr3410_params));
-
 	r = sc_asn1_decode(ctx, asn1_pubkey, *buf, *buflen, buf, buflen);
 	if (r == SC_ERROR_ASN1_END_OF_CONTENTS)
 		return r;
@@ -326,6 +334,7 @@ int sc_pkcs15_decode_pukdf_entry(struct sc_pkcs15_card *p15card,
 		obj->type = SC_PKCS15_TYPE_PUBKEY_DSA;
 	}
 
+decoded:
 	if (!p15card->app || !p15card->app->ddo.aid.len)   {
 		r = sc_pkcs15_make_absolute_path(&p15card->file_app->path, &info.path);
 		if (r < 0) {
@@ -344,7 +353,7 @@ int sc_pkcs15_decode_pukdf_entry(struct sc_pkcs15_card *p15card,
 	if (info.key_reference < -1)
 		info.key_reference += 256;
 
-	obj->data = malloc(sizeof(info));
+	obj->data = sc_pkcs15_alloc_object_data(obj, sizeof(info));
 	if (obj->data == NULL) {
 		sc_pkcs15_free_key_params(&info.params);
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
@@ -1034,9 +1043,10 @@ sc_pkcs15_erase_pubkey(struct sc_pkcs15_pubkey *key)
 	}
 	switch (key->algorithm) {
 	case SC_ALGORITHM_RSA:
-		if (key->u.rsa.modulus.data)
+		/* values parsed from a certificate may point into its buffer */
+		if (!sc_pkcs15_buf_contains(key->buf, key->u.rsa.modulus.data))
 			free(key->u.rsa.modulus.data);
-		if (key->u.rsa.exponent.data)
+		if (!sc_pkcs15_buf_contains(key->buf, key->u.rsa.exponent.data))
 			free(key->u.rsa.exponent.data);
 		break;
 	case SC_ALGORITHM_DSA:
@@ -1062,6 +1072,7 @@ sc_pkcs15_erase_pubkey(struct sc_pkcs15_pubkey *key)
 			free(key->u.ec.ecpointQ.value);
 		break;
 	}
+	sc_pkcs15_buf_unref(key->buf);
 	sc_mem_clear(key, sizeof(*key));
 }
 
@@ -1077,11 +1088,18 @@ sc_pkcs15_free_pubkey(struct sc_pkcs15_pubkey *key)
 
 
 void
-sc_pkcs15_free_pubkey_info(sc_pkcs15_pubkey_info_t *info)
+sc_pkcs15_clear_pubkey_info(sc_pkcs15_pubkey_info_t *info)
 {
 	if (info->subject.value)
 		free(info->subject.value);
 	sc_pkcs15_free_key_params(&info->params);
+}
+
+
+void
+sc_pkcs15_free_pubkey_info(sc_pkcs15_pubkey_info_t *info)
+{
+	sc_pkcs15_clear_pubkey_info(info);
 	free(info);
 }
 
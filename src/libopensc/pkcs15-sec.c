@@ -31,9 +31,11 @@
 #include "internal.h"
 #include "pkcs15.h"
 
+/* Set the file reference of the key in senv and select the key file,
+ * unless 'selected' says it has been selected before. */
 static int select_key_file(struct sc_pkcs15_card *p15card,
 			   const struct sc_pkcs15_prkey_info *prkey,
-			   sc_security_env_t *senv)
+			   sc_security_env_t *senv, int selected)
 {
 	sc_context_t *ctx = p15card->card->ctx;
 	sc_path_t path, file_id;
@@ -71,6 +73,8 @@ static int select_key_file(struct sc_pkcs15_card *p15card,
 	else   {
 		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ARGUMENTS, "invalid private key path");
 	}
+	if (selected)
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
 
 	r = sc_select_file(p15card->card, &path, NULL);
 	LOG_TEST_RET(ctx, r, "sc_select_file() failed");
@@ -146,7 +150,7 @@ int sc_pkcs15_decipher(struct sc_pkcs15_card *p15card,
 	LOG_TEST_RET(ctx, r, "sc_lock() failed");
 
 	if (prkey->path.len != 0 || prkey->path.aid.len != 0) {
-		r = select_key_file(p15card, prkey, &senv);
+		r = select_key_file(p15card, prkey, &senv, 0);
 		if (r < 0) {
 			sc_unlock(p15card->card);
 			LOG_TEST_RET(ctx, r,"Unable to select private key file");
@@ -250,7 +254,7 @@ int sc_pkcs15_derive(struct sc_pkcs15_card *p15card,
 	LOG_TEST_RET(ctx, r, "sc_lock() failed");
 
 	if (prkey->path.len != 0 || prkey->path.aid.len != 0)   {
-		r = select_key_file(p15card, prkey, &senv);
+		r = select_key_file(p15card, prkey, &senv, 0);
 		if (r < 0) {
 			sc_unlock(p15card->card);
 			LOG_TEST_RET(ctx, r,"Unable to select private key file");
@@ -293,10 +297,12 @@ out:
 #define USAGE_ANY_DECIPHER      (SC_PKCS15_PRKEY_USAGE_DECRYPT|\
                                  SC_PKCS15_PRKEY_USAGE_UNWRAP)
 
-int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
+/* Called with the card locked; the key file is selected unless
+ * *key_selected is set, which it is afterwards. */
+static int compute_signature(struct sc_pkcs15_card *p15card,
 				const struct sc_pkcs15_object *obj,
 				unsigned long flags, const u8 *in, size_t inlen,
-				u8 *out, size_t outlen)
+				u8 *out, size_t outlen, int *key_selected)
 {
 	sc_context_t *ctx = p15card->card->ctx;
 	int r;
@@ -473,32 +479,129 @@ int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
 		senv.flags |= SC_SEC_ENV_KEY_REF_PRESENT;
 	}
 
-	r = sc_lock(p15card->card);
-	LOG_TEST_RET(ctx, r, "sc_lock() failed");
-
 	sc_log(ctx, "Private key path '%s'", sc_print_path(&prkey->path));
 	if (prkey->path.len != 0 || prkey->path.aid.len != 0) {
-		r = select_key_file(p15card, prkey, &senv);
-		if (r < 0) {
-			sc_unlock(p15card->card);
-			LOG_TEST_RET(ctx, r,"Unable to select private key file");
-		}
+		r = select_key_file(p15card, prkey, &senv, *key_selected);
+		LOG_TEST_RET(ctx, r,"Unable to select private key file");
 	}
+	*key_selected = 1;
 
+	/* unchanged environments are not sent again, see sc_set_security_env() */
 	r = sc_set_security_env(p15card->card, &senv, 0);
-	if (r < 0) {
-		sc_unlock(p15card->card);
-		LOG_TEST_RET(ctx, r, "sc_set_security_env() failed");
-	}
+	LOG_TEST_RET(ctx, r, "sc_set_security_env() failed");
 
 	r = sc_compute_signature(p15card->card, tmp, inlen, out, outlen);
 	if (r == SC_ERROR_SECURITY_STATUS_NOT_SATISFIED)
-		if (sc_pkcs15_pincache_revalidate(p15card, obj) == SC_SUCCESS)
+		if (sc_pkcs15_pincache_revalidate(p15card, obj) == SC_SUCCESS) {
+			/* the PIN file may have been selected in between */
+			*key_selected = 0;
 			r = sc_compute_signature(p15card->card, tmp, inlen, out, outlen);
+		}
 
 	sc_mem_clear(buf, sizeof(buf));
-	sc_unlock(p15card->card);
 	LOG_TEST_RET(ctx, r, "sc_compute_signature() failed");
 
 	LOG_FUNC_RETURN(ctx, r);
 }
+
+int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
+				const struct sc_pkcs15_object *obj,
+				unsigned long flags, const u8 *in, size_t inlen,
+				u8 *out, size_t outlen)
+{
+	sc_context_t *ctx = p15card->card->ctx;
+	int r, key_selected = 0;
+
+	LOG_FUNC_CALLED(ctx);
+	r = sc_lock(p15card->card);
+	LOG_TEST_RET(ctx, r, "sc_lock() failed");
+	r = compute_signature(p15card, obj, flags, in, inlen, out, outlen, &key_selected);
+	sc_unlock(p15card->card);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+int sc_pkcs15_compute_signatures(struct sc_pkcs15_card *p15card,
+				const struct sc_pkcs15_object *obj,
+				unsigned long flags, size_t count,
+				const u8 * const *in, const size_t *inlen,
+				u8 * const *out, size_t *outlen)
+{
+	sc_context_t *ctx = p15card->card->ctx;
+	size_t i;
+	int r, key_selected = 0;
+
+	LOG_FUNC_CALLED(ctx);
+	if (count == 0 || in == NULL || inlen == NULL || out == NULL || outlen == NULL)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+	sc_log(ctx, "%lu signatures", (unsigned long) count);
+
+	r = sc_lock(p15card->card);
+	LOG_TEST_RET(ctx, r, "sc_lock() failed");
+	for (i = 0; i < count; i++) {
+		r = compute_signature(p15card, obj, flags, in[i], inlen[i],
+				out[i], outlen[i], &key_selected);
+		if (r < 0)
+			break;
+		outlen[i] = r;
+	}
+	/* tell the caller where to go on from */
+	for (; i < count; i++)
+		outlen[i] = 0;
+	sc_unlock(p15card->card);
+	LOG_TEST_RET(ctx, r, "Batch signature failed");
+
+	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+}
+
+static int async_decipher(struct sc_card *card, struct sc_async_op *op)
+{
+	return sc_pkcs15_decipher(op->u.crypto.p15card, op->u.crypto.obj,
+			op->u.crypto.flags, op->u.crypto.in, op->u.crypto.inlen,
+			op->u.crypto.out, op->u.crypto.outlen);
+}
+
+static int async_compute_signature(struct sc_card *card, struct sc_async_op *op)
+{
+	return sc_pkcs15_compute_signature(op->u.crypto.p15card, op->u.crypto.obj,
+			op->u.crypto.flags, op->u.crypto.in, op->u.crypto.inlen,
+			op->u.crypto.out, op->u.crypto.outlen);
+}
+
+static int async_crypto_submit(struct sc_pkcs15_card *p15card, struct sc_async_op *op,
+		sc_async_func_t func, const struct sc_pkcs15_object *obj,
+		unsigned long flags, const u8 *in, size_t inlen, u8 *out, size_t outlen,
+		sc_async_callback_t callback, void *arg)
+{
+	if (p15card == NULL || op == NULL || obj == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	memset(op, 0, sizeof(*op));
+	op->func = func;
+	op->callback = callback;
+	op->arg = arg;
+	op->u.crypto.p15card = p15card;
+	op->u.crypto.obj = obj;
+	op->u.crypto.flags = flags;
+	op->u.crypto.in = in;
+	op->u.crypto.inlen = inlen;
+	op->u.crypto.out = out;
+	op->u.crypto.outlen = outlen;
+	return sc_async_submit(p15card->card, op);
+}
+
+int sc_pkcs15_async_decipher(struct sc_pkcs15_card *p15card, struct sc_async_op *op,
+		const struct sc_pkcs15_object *obj, unsigned long flags,
+		const u8 *in, size_t inlen, u8 *out, size_t outlen,
+		sc_async_callback_t callback, void *arg)
+{
+	return async_crypto_submit(p15card, op, async_decipher, obj, flags,
+			in, inlen, out, outlen, callback, arg);
+}
+
+int sc_pkcs15_async_compute_signature(struct sc_pkcs15_card *p15card, struct sc_async_op *op,
+		const struct sc_pkcs15_object *obj, unsigned long flags,
+		const u8 *in, size_t inlen, u8 *out, size_t outlen,
+		sc_async_callback_t callback, void *arg)
+{
+	return async_crypto_submit(p15card, op, async_compute_signature, obj, flags,
+			in, inlen, out, outlen, callback, arg);
+}
@@ -25,6 +25,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #include "common/libscdl.h"
 #include "internal.h"
@@ -72,31 +75,46 @@ extern int sc_pkcs15emu_dnie_init_ex(sc_pkcs15_card_t *,
 extern int sc_pkcs15emu_pkiapplet_init_ex(sc_pkcs15_card_t *,
 					sc_pkcs15emu_opt_t *);
 
+/*
+ * Cheap checks telling which emulators may take a card, so that only those
+ * run their own, possibly APDU based, detection. An emulator is a candidate
+ * if the card is handled by one of the listed card drivers or if its type
+ * is in the given range. Emulators without any of these are always tried.
+ */
 static struct {
 	const char *		name;
 	int			(*handler)(sc_pkcs15_card_t *, sc_pkcs15emu_opt_t *);
+	const char *		drivers;	/* short names, space separated */
+	int			type_min, type_max;
 } builtin_emulators[] = {
-	{ "westcos",	sc_pkcs15emu_westcos_init_ex	},
-	{ "openpgp",	sc_pkcs15emu_openpgp_init_ex	},
-	{ "infocamere",	sc_pkcs15emu_infocamere_init_ex	},
-	{ "starcert",	sc_pkcs15emu_starcert_init_ex	},
-	{ "tcos",	sc_pkcs15emu_tcos_init_ex	},
-	{ "esteid",	sc_pkcs15emu_esteid_init_ex	},
-	{ "itacns",	sc_pkcs15emu_itacns_init_ex	},
-	{ "postecert",	sc_pkcs15emu_postecert_init_ex  },
-	{ "PIV-II",     sc_pkcs15emu_piv_init_ex        },
-	{ "gemsafeGPK",	sc_pkcs15emu_gemsafeGPK_init_ex	},
-	{ "gemsafeV1",	sc_pkcs15emu_gemsafeV1_init_ex	},
-	{ "actalis",	sc_pkcs15emu_actalis_init_ex	},
-	{ "atrust-acos",sc_pkcs15emu_atrust_acos_init_ex},
-	{ "tccardos",	sc_pkcs15emu_tccardos_init_ex	},
-	{ "entersafe",  sc_pkcs15emu_entersafe_init_ex  },
-	{ "pteid",	sc_pkcs15emu_pteid_init_ex	},
-	{ "oberthur",   sc_pkcs15emu_oberthur_init_ex	},
-	{ "sc-hsm",   sc_pkcs15emu_sc_hsm_init_ex	},
-	{ "dnie",       sc_pkcs15emu_dnie_init_ex   },
-	{ "pkiapplet",       sc_pkcs15emu_pkiapplet_init_ex   },
-	{ NULL, NULL }
+	{ "westcos",	sc_pkcs15emu_westcos_init_ex,	"westcos", 0, 0 },
+	{ "openpgp",	sc_pkcs15emu_openpgp_init_ex,	"openpgp",
+			SC_CARD_TYPE_OPENPGP_V1, SC_CARD_TYPE_OPENPGP_V2 },
+	{ "infocamere",	sc_pkcs15emu_infocamere_init_ex,	"starcos cardos", 0, 0 },
+	{ "starcert",	sc_pkcs15emu_starcert_init_ex,	"starcos", 0, 0 },
+	{ "tcos",	sc_pkcs15emu_tcos_init_ex,	"tcos",
+			SC_CARD_TYPE_TCOS_V2, SC_CARD_TYPE_TCOS_V3 },
+	{ "esteid",	sc_pkcs15emu_esteid_init_ex,	"mcrd",
+			SC_CARD_TYPE_MCRD_ESTEID_V10, SC_CARD_TYPE_MCRD_ESTEID_V30 },
+	{ "itacns",	sc_pkcs15emu_itacns_init_ex,	"itacns",
+			SC_CARD_TYPE_CARDOS_CIE_V1, SC_CARD_TYPE_CARDOS_CIE_V1 },
+	{ "postecert",	sc_pkcs15emu_postecert_init_ex,	"cardos", 0, 0 },
+	{ "PIV-II",     sc_pkcs15emu_piv_init_ex,	"piv",
+			SC_CARD_TYPE_PIV_II_GENERIC, SC_CARD_TYPE_PIV_II_GENERIC + 999 },
+	{ "gemsafeGPK",	sc_pkcs15emu_gemsafeGPK_init_ex,	"gpk", 0, 0 },
+	{ "gemsafeV1",	sc_pkcs15emu_gemsafeV1_init_ex,	"gemsafeV1", 0, 0 },
+	{ "actalis",	sc_pkcs15emu_actalis_init_ex,	"cardos", 0, 0 },
+	{ "atrust-acos",sc_pkcs15emu_atrust_acos_init_ex,	"atrust-acos", 0, 0 },
+	{ "tccardos",	sc_pkcs15emu_tccardos_init_ex,	"cardos", 0, 0 },
+	{ "entersafe",  sc_pkcs15emu_entersafe_init_ex,	"entersafe", 0, 0 },
+	{ "pteid",	sc_pkcs15emu_pteid_init_ex,	"ias gemsafeV1", 0, 0 },
+	{ "oberthur",   sc_pkcs15emu_oberthur_init_ex,	"oberthur",
+			SC_CARD_TYPE_OBERTHUR_64K, SC_CARD_TYPE_OBERTHUR_64K },
+	{ "sc-hsm",   sc_pkcs15emu_sc_hsm_init_ex,	"sc-hsm",
+			SC_CARD_TYPE_SC_HSM, SC_CARD_TYPE_SC_HSM },
+	{ "dnie",       sc_pkcs15emu_dnie_init_ex,	"dnie", 0, 0 },
+	{ "pkiapplet",       sc_pkcs15emu_pkiapplet_init_ex,	"pkiapplet", 0, 0 },
+	{ NULL, NULL, NULL, 0, 0 }
 };
 
 static int parse_emu_block(sc_pkcs15_card_t *, scconf_block *);
@@ -132,16 +150,105 @@ int sc_pkcs15_is_emulation_only(sc_card_t *card)
 	}
 }
 
+static int emulator_is_candidate(sc_card_t *card, int i)
+{
+	const char *p;
+	size_t len;
+
+	if (builtin_emulators[i].drivers == NULL && builtin_emulators[i].type_min == 0)
+		return 1;
+	if (builtin_emulators[i].type_min != 0 && card->type >= builtin_emulators[i].type_min
+			&& card->type <= builtin_emulators[i].type_max)
+		return 1;
+	if (builtin_emulators[i].drivers == NULL || card->driver == NULL)
+		return 0;
+
+	len = strlen(card->driver->short_name);
+	for (p = builtin_emulators[i].drivers; *p; p += strcspn(p, " ")) {
+		p += strspn(p, " ");
+		if (!strncmp(p, card->driver->short_name, len) && (p[len] == ' ' || p[len] == '\0'))
+			return 1;
+	}
+	return 0;
+}
+
+/* Microseconds for the timing in the debug log, wrapping around */
+static unsigned long usec_now(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+#elif defined(_WIN32)
+	return GetTickCount() * 1000UL;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Runs the builtin emulators in table order, or in the order of 'list' if
+ * given: first the candidates, then with 'probe_all' the others.
+ */
+static int bind_builtin(sc_pkcs15_card_t *p15card, const scconf_list *list, int probe_all)
+{
+	sc_context_t		*ctx = p15card->card->ctx;
+	sc_pkcs15emu_opt_t	opts;
+	const scconf_list	*item;
+	int			order[sizeof(builtin_emulators) / sizeof(builtin_emulators[0])];
+	unsigned long		start, total, usec;
+	size_t			n = 0, j, k;
+	int			i, pass, tried = 0, r = SC_ERROR_WRONG_CARD;
+
+	for (item = list; item; item = item->next) {
+		for (i = 0; builtin_emulators[i].name; i++)
+			if (!strcmp(builtin_emulators[i].name, item->data))
+				break;
+		for (k = 0; k < n && order[k] != i; k++)
+			;
+		if (builtin_emulators[i].name && k == n)
+			order[n++] = i;
+	}
+	for (i = 0; list == NULL && builtin_emulators[i].name; i++)
+		order[n++] = i;
+
+	memset(&opts, 0, sizeof(opts));
+	total = usec_now();
+	for (pass = 0; pass < (probe_all ? 2 : 1); pass++) {
+		for (j = 0; j < n; j++) {
+			i = order[j];
+			if (emulator_is_candidate(p15card->card, i) == pass)
+				continue;
+
+			sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", builtin_emulators[i].name);
+			start = usec_now();
+			r = builtin_emulators[i].handler(p15card, &opts);
+			usec = usec_now() - start;
+			tried++;
+			sc_log(ctx, "emulator %s%s: %s, %lu.%03lu ms", builtin_emulators[i].name,
+					pass ? " (not a candidate)" : "",
+					r == SC_SUCCESS ? "bound" : sc_strerror(r), usec / 1000, usec % 1000);
+			if (r == SC_SUCCESS)
+				goto out;
+		}
+	}
+	r = SC_ERROR_WRONG_CARD;
+out:
+	usec = usec_now() - total;
+	sc_log(ctx, "%d of %lu builtin emulators tried in %lu.%03lu ms",
+			tried, (unsigned long) n, usec / 1000, usec % 1000);
+	return r;
+}
+
 int
 sc_pkcs15_bind_synthetic(sc_pkcs15_card_t *p15card)
 {
 	sc_context_t		*ctx = p15card->card->ctx;
 	scconf_block		*conf_block, **blocks, *blk;
-	sc_pkcs15emu_opt_t	opts;
 	int			i, r = SC_ERROR_WRONG_CARD;
 
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_VERBOSE);
-	memset(&opts, 0, sizeof(opts));
 	conf_block = NULL;
 
 	conf_block = sc_get_conf_block(ctx, "framework", "pkcs15", 1);
@@ -149,46 +256,29 @@ sc_pkcs15_bind_synthetic(sc_pkcs15_card_t *p15card)
 	if (!conf_block) {
 		/* no conf file found => try bultin drivers  */
 		sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "no conf file (or section), trying all builtin emulators\n");
-		for (i = 0; builtin_emulators[i].name; i++) {
-			sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", builtin_emulators[i].name);
-			r = builtin_emulators[i].handler(p15card, &opts);
-			if (r == SC_SUCCESS)
-				/* we got a hit */
-				goto out;
-		}
+		r = bind_builtin(p15card, NULL, 0);
+		if (r == SC_SUCCESS)
+			goto out;
 	} else {
 		/* we have a conf file => let's use it */
-		int builtin_enabled; 
-		const scconf_list *list, *item;
+		int builtin_enabled, probe_all;
+		const scconf_list *list;
 
 		builtin_enabled = scconf_get_bool(conf_block, "enable_builtin_emulation", 1);
+		probe_all = scconf_get_bool(conf_block, "probe_all_emulators", 0);
 		list = scconf_find_list(conf_block, "builtin_emulators"); /* FIXME: rename to enabled_emulators */
 
 		if (builtin_enabled && list) {
 			/* get the list of enabled emulation drivers */
-			for (item = list; item; item = item->next) {
-				/* go through the list of builtin drivers */
-				const char *name = item->data;
-
-				sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", name);
-				for (i = 0; builtin_emulators[i].name; i++)
-					if (!strcmp(builtin_emulators[i].name, name)) {
-						r = builtin_emulators[i].handler(p15card, &opts);
-						if (r == SC_SUCCESS)
-							/* we got a hit */
-							goto out;
-					}
-			}
+			r = bind_builtin(p15card, list, probe_all);
+			if (r == SC_SUCCESS)
+				goto out;
 		}
 		else if (builtin_enabled) {
 			sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "no emulator list in config file, trying all builtin emulators\n");
-			for (i = 0; builtin_emulators[i].name; i++) {
-				sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", builtin_emulators[i].name);
-				r = builtin_emulators[i].handler(p15card, &opts);
-				if (r == SC_SUCCESS)
-					/* we got a hit */
-					goto out;
-			}
+			r = bind_builtin(p15card, NULL, probe_all);
+			if (r == SC_SUCCESS)
+				goto out;
 		}
 
 		/* search for 'emulate foo { ... }' entries in the conf file */
@@ -423,12 +513,6 @@ int sc_pkcs15emu_object_add(sc_pkcs15_card_t *p15card, unsigned int type,
 	unsigned int	df_type;
 	size_t		data_len;
 
-	obj = calloc(1, sizeof(*obj));
-	if (!obj)
-		return SC_ERROR_OUT_OF_MEMORY;
-	memcpy(obj, in_obj, sizeof(*obj));
-	obj->type  = type;
-
 	switch (type & SC_PKCS15_TYPE_CLASS_MASK) {
 	case SC_PKCS15_TYPE_AUTH:
 		df_type  = SC_PKCS15_AODF;
@@ -453,13 +537,23 @@ int sc_pkcs15emu_object_add(sc_pkcs15_card_t *p15card, unsigned int type,
 	default:
 		sc_debug(p15card->card->ctx, SC_LOG_DEBUG_NORMAL,
 			"Unknown PKCS15 object type %d\n", type);
-		free(obj);
 		return SC_ERROR_INVALID_ARGUMENTS;
 	}
 
-	obj->data = calloc(1, data_len);
+	if (p15card->arena)
+		obj = sc_arena_alloc(p15card->arena, sizeof(*obj));
+	else
+		obj = calloc(1, sizeof(*obj));
+	if (!obj)
+		return SC_ERROR_OUT_OF_MEMORY;
+	memcpy(obj, in_obj, sizeof(*obj));
+	obj->type  = type;
+	obj->arena = p15card->arena;
+
+	obj->data = sc_pkcs15_alloc_object_data(obj, data_len);
 	if (obj->data == NULL) {
-		free(obj);
+		if (!obj->arena)
+			free(obj);
 		return SC_ERROR_OUT_OF_MEMORY;
 	}
 	memcpy(obj->data, data, data_len);
@@ -723,6 +723,9 @@ sc_pkcs15_card_new(void)
 
 	sc_init_oid(&p15card->tokeninfo->profile_indication.oid);
 
+	/* without an arena the objects are malloc'ed one by one */
+	p15card->arena = sc_arena_new(0);
+
 	p15card->magic = SC_PKCS15_CARD_MAGIC;
 	return p15card;
 }
@@ -792,6 +795,8 @@ sc_pkcs15_card_free(struct sc_pkcs15_card *p15card)
 	sc_pkcs15_remove_dfs(p15card);
 	sc_pkcs15_free_unusedspace(p15card);
 	p15card->unusedspace_read = 0;
+	sc_arena_free(p15card->arena);
+	p15card->arena = NULL;
 
 	if (p15card->file_app != NULL)
 		sc_file_free(p15card->file_app);
@@ -824,6 +829,7 @@ sc_pkcs15_card_clear(struct sc_pkcs15_card *p15card)
 
 	sc_pkcs15_remove_objects(p15card);
 	sc_pkcs15_remove_dfs(p15card);
+	sc_arena_reset(p15card->arena);
 
 	p15card->df_list = NULL;
 	if (p15card->file_app != NULL) {
@@ -968,6 +974,10 @@ sc_pkcs15_get_application_by_type(struct sc_card * card, char *app_type)
 }
 
 
+static int read_file(struct sc_pkcs15_card *, const struct sc_path *,
+		unsigned char **, size_t *, int);
+static void prefetch_dfs(struct sc_pkcs15_card *);
+
 static int
 sc_pkcs15_bind_internal(struct sc_pkcs15_card *p15card, struct sc_aid *aid)
 {
@@ -1035,63 +1045,8 @@ sc_pkcs15_bind_internal(struct sc_pkcs15_card *p15card, struct sc_aid *aid)
 		goto end;
 	}
 
-	if (p15card->file_odf == NULL) {
-		/* check if an ODF is present; we don't know yet whether we have a pkcs15 card */
-		sc_format_path("5031", &tmppath);
-		err = sc_pkcs15_make_absolute_path(&p15card->file_app->path, &tmppath);
-		if (err != SC_SUCCESS)   {
-			sc_log(ctx, "Cannot make absolute path to EF(ODF); error:%i", err);
-			goto end;
-		}
-		sc_log(ctx, "absolute path to EF(ODF) %s", sc_print_path(&tmppath));
-		err = sc_select_file(card, &tmppath, &p15card->file_odf);
-	}
-	else {
-		tmppath = p15card->file_odf->path;
-		sc_file_free(p15card->file_odf);
-		p15card->file_odf = NULL;
-		err = sc_select_file(card, &tmppath, &p15card->file_odf);
-	}
-
-	if (err != SC_SUCCESS) {
-		sc_log(ctx, "EF(ODF) not found in '%s'", sc_print_path(&tmppath));
-		goto end;
-	}
-
-	len = p15card->file_odf->size;
-	if (!len) {
-		sc_log(ctx, "EF(ODF) is empty");
-		goto end;
-	}
-	buf = malloc(len);
-	if(buf == NULL)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
-
-	err = sc_read_binary(card, 0, buf, len, 0);
-	if (err < 0)   {
-		sc_log(ctx, "read EF(ODF) file error: %s", sc_strerror(err));
-		goto end;
-	}
-	else if (err < 2) {
-		err = SC_ERROR_PKCS15_APP_NOT_FOUND;
-		sc_log(ctx, "Invalid content of EF(ODF): %s", sc_strerror(err));
-		goto end;
-	}
-	len = err;
-
-	if (parse_odf(buf, len, p15card)) {
-		err = SC_ERROR_PKCS15_APP_NOT_FOUND;
-		sc_log(ctx, "Unable to parse ODF");
-		goto end;
-	}
-	free(buf);
-	buf = NULL;
-
-	sc_log(ctx, "The following DFs were found:");
-	for (df = p15card->df_list; df; df = df->next)
-		sc_log(ctx, "  DF type %u, path %s, index %u, count %d", df->type,
-				sc_print_path(&df->path), df->path.index, df->path.count);
-
+	/* TokenInfo first: its serial number and last update time are the key
+	 * to the file cache the ODF and the DFs may come from */
 	if (p15card->file_tokeninfo == NULL) {
 		sc_format_path("5032", &tmppath);
 		err = sc_pkcs15_make_absolute_path(&p15card->file_app->path, &tmppath);
@@ -1139,6 +1094,8 @@ sc_pkcs15_bind_internal(struct sc_pkcs15_card *p15card, struct sc_aid *aid)
 		sc_log(ctx, "cannot parse TokenInfo content: %s", sc_strerror(err));
 		goto end;
 	}
+	free(buf);
+	buf = NULL;
 
 	*(p15card->tokeninfo) = tokeninfo;
 
@@ -1153,6 +1110,49 @@ sc_pkcs15_bind_internal(struct sc_pkcs15_card *p15card, struct sc_aid *aid)
 		sc_log(ctx, "p15card->tokeninfo->serial_number %s", p15card->tokeninfo->serial_number);
 	}
 
+	if (p15card->file_odf == NULL) {
+		/* check if an ODF is present */
+		sc_format_path("5031", &tmppath);
+		err = sc_pkcs15_make_absolute_path(&p15card->file_app->path, &tmppath);
+		if (err != SC_SUCCESS)   {
+			sc_log(ctx, "Cannot make absolute path to EF(ODF); error:%i", err);
+			goto end;
+		}
+		sc_log(ctx, "absolute path to EF(ODF) %s", sc_print_path(&tmppath));
+		p15card->file_odf = sc_file_new();
+		if (p15card->file_odf == NULL) {
+			err = SC_ERROR_OUT_OF_MEMORY;
+			goto end;
+		}
+		p15card->file_odf->path = tmppath;
+	}
+
+	err = read_file(p15card, &p15card->file_odf->path, &buf, &len, 1);
+	if (err != SC_SUCCESS) {
+		sc_log(ctx, "EF(ODF) not read from '%s': %s",
+				sc_print_path(&p15card->file_odf->path), sc_strerror(err));
+		goto end;
+	}
+	if (len < 2) {
+		err = SC_ERROR_PKCS15_APP_NOT_FOUND;
+		sc_log(ctx, "Invalid content of EF(ODF): %s", sc_strerror(err));
+		goto end;
+	}
+
+	if (parse_odf(buf, len, p15card)) {
+		err = SC_ERROR_PKCS15_APP_NOT_FOUND;
+		sc_log(ctx, "Unable to parse ODF");
+		goto end;
+	}
+
+	sc_log(ctx, "The following DFs were found:");
+	for (df = p15card->df_list; df; df = df->next)
+		sc_log(ctx, "  DF type %u, path %s, index %u, count %d", df->type,
+				sc_print_path(&df->path), df->path.index, df->path.count);
+
+	if (p15card->opts.prefetch_dfs)
+		prefetch_dfs(p15card);
+
 	ok = 1;
 end:
 	if(buf != NULL)
@@ -1190,6 +1190,8 @@ sc_pkcs15_bind(struct sc_card *card, struct sc_aid *aid,
 	p15card->opts.use_pin_cache = 1;
 	p15card->opts.pin_cache_counter = 10;
 	p15card->opts.pin_cache_ignore_user_consent = 0;
+	p15card->opts.use_fast_decoder = 1;
+	p15card->opts.prefetch_dfs = 0;
 
 	conf_block = sc_get_conf_block(ctx, "framework", "pkcs15", 1);
 
@@ -1199,10 +1201,13 @@ sc_pkcs15_bind(struct sc_card *card, struct sc_aid *aid,
 		p15card->opts.pin_cache_counter = scconf_get_int(conf_block, "pin_cache_counter", p15card->opts.pin_cache_counter);
 		p15card->opts.pin_cache_ignore_user_consent =  scconf_get_bool(conf_block, "pin_cache_ignore_user_consent",
 				p15card->opts.pin_cache_ignore_user_consent);
+		p15card->opts.use_fast_decoder = scconf_get_bool(conf_block, "use_fast_decoder", p15card->opts.use_fast_decoder);
+		p15card->opts.prefetch_dfs = scconf_get_bool(conf_block, "prefetch_dfs", p15card->opts.prefetch_dfs);
 	}
-	sc_log(ctx, "PKCS#15 options: use_file_cache=%d use_pin_cache=%d pin_cache_counter=%d pin_cache_ignore_user_consent=%d",
+	sc_log(ctx, "PKCS#15 options: use_file_cache=%d use_pin_cache=%d pin_cache_counter=%d pin_cache_ignore_user_consent=%d use_fast_decoder=%d prefetch_dfs=%d",
 	         p15card->opts.use_file_cache, p15card->opts.use_pin_cache,
-		 p15card->opts.pin_cache_counter, p15card->opts.pin_cache_ignore_user_consent);
+		 p15card->opts.pin_cache_counter, p15card->opts.pin_cache_ignore_user_consent,
+		 p15card->opts.use_fast_decoder, p15card->opts.prefetch_dfs);
 
 	r = sc_lock(card);
 	if (r) {
@@ -1864,11 +1869,50 @@ sc_pkcs15_remove_objects(struct sc_pkcs15_card *p15card)
 }
 
 
+void *
+sc_pkcs15_alloc_object_data(struct sc_pkcs15_object *obj, size_t size)
+{
+	if (obj->arena)
+		return sc_arena_alloc(obj->arena, size);
+	return calloc(1, size);
+}
+
+
+/* Objects carved from the card arena: release what they refer to,
+ * the memory itself goes with the arena */
+static void
+sc_pkcs15_clear_object(struct sc_pkcs15_object *obj)
+{
+	if (obj->data)   {
+		switch (obj->type & SC_PKCS15_TYPE_CLASS_MASK) {
+		case SC_PKCS15_TYPE_PRKEY:
+			sc_pkcs15_clear_prkey_info((sc_pkcs15_prkey_info_t *)obj->data);
+			break;
+		case SC_PKCS15_TYPE_PUBKEY:
+			sc_pkcs15_clear_pubkey_info((sc_pkcs15_pubkey_info_t *)obj->data);
+			break;
+		case SC_PKCS15_TYPE_CERT:
+			sc_pkcs15_clear_cert_info((sc_pkcs15_cert_info_t *)obj->data);
+			break;
+		case SC_PKCS15_TYPE_DATA_OBJECT:
+			sc_pkcs15_clear_data_info((sc_pkcs15_data_info_t *)obj->data);
+			break;
+		}
+	}
+
+	sc_pkcs15_free_object_content(obj);
+}
+
+
 void
 sc_pkcs15_free_object(struct sc_pkcs15_object *obj)
 {
 	if (!obj)
 		return;
+	if (obj->arena)   {
+		sc_pkcs15_clear_object(obj);
+		return;
+	}
 	switch (obj->type & SC_PKCS15_TYPE_CLASS_MASK) {
 	case SC_PKCS15_TYPE_PRKEY:
 		sc_pkcs15_free_prkey_info((sc_pkcs15_prkey_info_t *)obj->data);
@@ -2003,68 +2047,62 @@ sc_pkcs15_encode_df(struct sc_context *ctx, struct sc_pkcs15_card *p15card, stru
 }
 
 
-int
-sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
-{
-	struct sc_context *ctx = p15card->card->ctx;
-	unsigned char *buf;
-	const unsigned char *p;
-	size_t bufsize;
-	int r;
-	struct sc_pkcs15_object *obj = NULL;
-	int (* func)(struct sc_pkcs15_card *, struct sc_pkcs15_object *,
-		     const u8 **nbuf, size_t *nbufsize) = NULL;
-
-	sc_log(ctx, "called; path=%s, type=%d, enum=%d", sc_print_path(&df->path), df->type, df->enumerated);
+typedef int (*df_decode_func)(struct sc_pkcs15_card *, struct sc_pkcs15_object *,
+		const u8 **, size_t *);
 
-	if (p15card->ops.parse_df)   {
-		r = p15card->ops.parse_df(p15card, df);
-		LOG_FUNC_RETURN(ctx, r);
-	}
-
-	if (df->enumerated)
-		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
-
-	switch (df->type) {
+static df_decode_func
+df_decoder(unsigned int type)
+{
+	switch (type) {
 	case SC_PKCS15_PRKDF:
-		func = sc_pkcs15_decode_prkdf_entry;
-		break;
+		return sc_pkcs15_decode_prkdf_entry;
 	case SC_PKCS15_PUKDF:
-		func = sc_pkcs15_decode_pukdf_entry;
-		break;
+		return sc_pkcs15_decode_pukdf_entry;
 	case SC_PKCS15_SKDF:
-		func = sc_pkcs15_decode_skdf_entry;
-		break;
+		return sc_pkcs15_decode_skdf_entry;
 	case SC_PKCS15_CDF:
 	case SC_PKCS15_CDF_TRUSTED:
 	case SC_PKCS15_CDF_USEFUL:
-		func = sc_pkcs15_decode_cdf_entry;
-		break;
+		return sc_pkcs15_decode_cdf_entry;
 	case SC_PKCS15_DODF:
-		func = sc_pkcs15_decode_dodf_entry;
-		break;
+		return sc_pkcs15_decode_dodf_entry;
 	case SC_PKCS15_AODF:
-		func = sc_pkcs15_decode_aodf_entry;
-		break;
+		return sc_pkcs15_decode_aodf_entry;
 	}
-	if (func == NULL) {
-		sc_log(ctx, "unknown DF type: %d", df->type);
-		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
-	}
-	r = sc_pkcs15_read_file(p15card, &df->path, &buf, &bufsize);
-	LOG_TEST_RET(ctx, r, "pkcs15 read file failed");
+	return NULL;
+}
+
+
+/* Adds the objects of a DF read into 'buf', which is released */
+static int
+parse_df_content(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df,
+		unsigned char *buf, size_t bufsize)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	const unsigned char *p;
+	int r = 0;
+	struct sc_pkcs15_object *obj = NULL;
+	df_decode_func func = df_decoder(df->type);
 
 	p = buf;
 	while (bufsize && *p != 0x00) {
 
-		obj = calloc(1, sizeof(struct sc_pkcs15_object));
+		if (p15card->arena)   {
+			obj = sc_arena_alloc(p15card->arena, sizeof(struct sc_pkcs15_object));
+			if (obj)
+				obj->arena = p15card->arena;
+		}
+		else   {
+			obj = calloc(1, sizeof(struct sc_pkcs15_object));
+		}
 		if (obj == NULL) {
 			r = SC_ERROR_OUT_OF_MEMORY;
 			goto ret;
 		}
 		r = func(p15card, obj, &p, &bufsize);
 		if (r) {
-			free(obj);
+			if (!obj->arena)
+				free(obj);
 			if (r == SC_ERROR_ASN1_END_OF_CONTENTS) {
 				r = 0;
 				break;
@@ -2076,9 +2114,7 @@ sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
 		obj->df = df;
 		r = sc_pkcs15_add_object(p15card, obj);
 		if (r) {
-			if (obj->data)
-				free(obj->data);
-			free(obj);
+			sc_pkcs15_free_object(obj);
 			sc_log(ctx, "%s: Error adding object", sc_strerror(r));
 			goto ret;
 		}
@@ -2089,10 +2125,83 @@ sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
 ret:
 	df->enumerated = 1;
 	free(buf);
+	return r;
+}
+
+
+int
+sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	unsigned char *buf;
+	size_t bufsize;
+	int r;
+
+	sc_log(ctx, "called; path=%s, type=%d, enum=%d", sc_print_path(&df->path), df->type, df->enumerated);
+
+	if (p15card->ops.parse_df)   {
+		r = p15card->ops.parse_df(p15card, df);
+		LOG_FUNC_RETURN(ctx, r);
+	}
+
+	if (df->enumerated)
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+
+	if (df_decoder(df->type) == NULL) {
+		sc_log(ctx, "unknown DF type: %d", df->type);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+	}
+	r = sc_pkcs15_read_file(p15card, &df->path, &buf, &bufsize);
+	LOG_TEST_RET(ctx, r, "pkcs15 read file failed");
+
+	r = parse_df_content(p15card, df, buf, bufsize);
 	LOG_FUNC_RETURN(ctx, r);
 }
 
 
+/* Reads all DFs listed in the ODF back to back, then parses them. A DF
+ * that cannot be read now is left to be parsed when it is needed. */
+static void
+prefetch_dfs(struct sc_pkcs15_card *p15card)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	struct sc_pkcs15_df *df;
+	struct {
+		unsigned char *buf;
+		size_t len;
+	} *data;
+	size_t count = 0, i;
+	int r;
+
+	if (p15card->ops.parse_df)
+		return;
+	for (df = p15card->df_list; df; df = df->next)
+		count++;
+	data = calloc(count, sizeof(*data));
+	if (data == NULL)
+		return;
+
+	for (df = p15card->df_list, i = 0; df; df = df->next, i++) {
+		if (df->enumerated || df_decoder(df->type) == NULL)
+			continue;
+		r = read_file(p15card, &df->path, &data[i].buf, &data[i].len, 1);
+		if (r != SC_SUCCESS) {
+			sc_log(ctx, "cannot prefetch DF %s: %s", sc_print_path(&df->path), sc_strerror(r));
+			data[i].buf = NULL;
+		}
+	}
+
+	for (df = p15card->df_list, i = 0; df; df = df->next, i++) {
+		if (data[i].buf == NULL)
+			continue;
+		r = parse_df_content(p15card, df, data[i].buf, data[i].len);
+		if (r != SC_SUCCESS)
+			sc_log(ctx, "cannot parse DF %s: %s", sc_print_path(&df->path), sc_strerror(r));
+	}
+	free(data);
+}
+
+
 int
 sc_pkcs15_add_unusedspace(struct sc_pkcs15_card *p15card, const struct sc_path *path,
 		const struct sc_pkcs15_id *auth_id)
@@ -2292,9 +2401,56 @@ sc_pkcs15_parse_unusedspace(const unsigned char *buf, size_t buflen, struct sc_p
 }
 
 
+struct sc_pkcs15_buf *
+sc_pkcs15_buf_new(u8 *value, size_t len)
+{
+	struct sc_pkcs15_buf *buf;
+
+	buf = calloc(1, sizeof(struct sc_pkcs15_buf));
+	if (buf == NULL)
+		return NULL;
+	buf->refcount = 1;
+	buf->value = value;
+	buf->len = len;
+	return buf;
+}
+
+
+struct sc_pkcs15_buf *
+sc_pkcs15_buf_ref(struct sc_pkcs15_buf *buf)
+{
+	if (buf)
+		buf->refcount++;
+	return buf;
+}
+
+
+void
+sc_pkcs15_buf_unref(struct sc_pkcs15_buf *buf)
+{
+	if (buf == NULL || --buf->refcount)
+		return;
+	free(buf->value);
+	free(buf);
+}
+
+
 int
-sc_pkcs15_read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
-		unsigned char **buf, size_t *buflen)
+sc_pkcs15_buf_contains(const struct sc_pkcs15_buf *buf, const void *ptr)
+{
+	const u8 *p = ptr;
+
+	if (buf == NULL || buf->value == NULL || p == NULL)
+		return 0;
+	return p >= buf->value && p < buf->value + buf->len;
+}
+
+
+/* With 'store', what is read from the card is also kept in the file cache,
+ * if it is enabled */
+static int
+read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
+		unsigned char **buf, size_t *buflen, int store)
 {
 	struct sc_context *ctx = p15card->card->ctx;
 	struct sc_file *file = NULL;
@@ -2385,6 +2541,9 @@ sc_pkcs15_read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_pat
 		sc_unlock(p15card->card);
 
 		sc_file_free(file);
+
+		if (store && p15card->opts.use_file_cache && in_path->count < 0)
+			sc_pkcs15_cache_file(p15card, in_path, data, len);
 	}
 	*buf = data;
 	*buflen = len;
@@ -2398,6 +2557,14 @@ fail_unlock:
 }
 
 
+int
+sc_pkcs15_read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
+		unsigned char **buf, size_t *buflen)
+{
+	return read_file(p15card, in_path, buf, buflen, 0);
+}
+
+
 int
 sc_pkcs15_compare_id(const struct sc_pkcs15_id *id1, const struct sc_pkcs15_id *id2)
 {
@@ -2482,10 +2649,8 @@ sc_pkcs15_make_absolute_path(const struct sc_path *parent, struct sc_path *child
 
 void sc_pkcs15_free_object_content(struct sc_pkcs15_object *obj)
 {
-	if (obj->content.value && obj->content.len)   {
-		sc_mem_clear(obj->content.value, obj->content.len);
-		free(obj->content.value);
-	}
+	if (obj->content.value && obj->content.len)
+		sc_mem_free_secure(obj->content.value, obj->content.len);
 	obj->content.value = NULL;
 	obj->content.len = 0;
 }
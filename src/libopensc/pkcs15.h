@@ -240,6 +240,14 @@ struct sc_pkcs15_prkey_gostr3410 {
 	sc_pkcs15_bignum_t d;
 };
 
+/* Reference counted copy of a file read from the token. Decoded
+ * values may point into it instead of holding their own copy. */
+struct sc_pkcs15_buf {
+	unsigned int refcount;
+	u8 *value;
+	size_t len;
+};
+
 struct sc_pkcs15_pubkey {
 	int algorithm;
 	struct sc_algorithm_id * alg_id;
@@ -251,6 +259,9 @@ struct sc_pkcs15_pubkey {
 		struct sc_pkcs15_pubkey_ec ec;
 		struct sc_pkcs15_pubkey_gostr3410 gostr3410;
 	} u;
+
+	/* Buffer the key values point into, if any */
+	struct sc_pkcs15_buf *buf;
 };
 typedef struct sc_pkcs15_pubkey sc_pkcs15_pubkey_t;
 
@@ -295,6 +306,9 @@ struct sc_pkcs15_cert {
 
 	/* DER encoded raw cert */
 	struct sc_pkcs15_der data;
+
+	/* Buffer 'data', 'serial', 'issuer' and 'subject' point into, if any */
+	struct sc_pkcs15_buf *buf;
 };
 typedef struct sc_pkcs15_cert sc_pkcs15_cert_t;
 
@@ -554,6 +568,9 @@ struct sc_pkcs15_object {
 	struct sc_pkcs15_object *next, *prev; /* used only internally */
 
 	struct sc_pkcs15_der content;
+
+	/* owner of the object and its type specific data, NULL if malloc'ed */
+	sc_arena_t *arena;
 };
 typedef struct sc_pkcs15_object sc_pkcs15_object_t;
 
@@ -652,6 +669,8 @@ typedef struct sc_pkcs15_card {
 		int use_pin_cache;
 		int pin_cache_counter;
 		int pin_cache_ignore_user_consent;
+		int use_fast_decoder;
+		int prefetch_dfs;
 	} opts;
 
 	unsigned int magic;
@@ -661,6 +680,8 @@ typedef struct sc_pkcs15_card {
 
 	struct sc_pkcs15_operations ops;
 
+	/* objects parsed from the DFs, released in bulk on unbind */
+	sc_arena_t *arena;
 } sc_pkcs15_card_t;
 
 /* flags suitable for sc_pkcs15_tokeninfo_t */
@@ -710,6 +731,28 @@ int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
 				const struct sc_pkcs15_object *prkey_obj,
 				unsigned long alg_flags, const u8 *in,
 				size_t inlen, u8 *out, size_t outlen);
+/* Sign count inputs with one key in one card transaction, selecting the
+ * key file and setting the security environment once. outlen[i] is the
+ * size of out[i] and is set to the length of its signature. If an input
+ * fails, outlen is set to 0 from that input on; the ones before it are
+ * signed. */
+int sc_pkcs15_compute_signatures(struct sc_pkcs15_card *p15card,
+				const struct sc_pkcs15_object *prkey_obj,
+				unsigned long alg_flags, size_t count,
+				const u8 * const *in, const size_t *inlen,
+				u8 * const *out, size_t *outlen);
+
+/* Queue sc_pkcs15_decipher() or sc_pkcs15_compute_signature() on the card's
+ * worker, see sc_async_start(). op->result is what the function returned;
+ * in and out must stay valid until the callback has been run. */
+int sc_pkcs15_async_decipher(struct sc_pkcs15_card *p15card, struct sc_async_op *op,
+		const struct sc_pkcs15_object *prkey_obj, unsigned long flags,
+		const u8 *in, size_t inlen, u8 *out, size_t outlen,
+		sc_async_callback_t callback, void *arg);
+int sc_pkcs15_async_compute_signature(struct sc_pkcs15_card *p15card, struct sc_async_op *op,
+		const struct sc_pkcs15_object *prkey_obj, unsigned long alg_flags,
+		const u8 *in, size_t inlen, u8 *out, size_t outlen,
+		sc_async_callback_t callback, void *arg);
 
 int sc_pkcs15_read_pubkey(struct sc_pkcs15_card *,
 		const struct sc_pkcs15_object *, struct sc_pkcs15_pubkey **);
@@ -733,7 +776,7 @@ int sc_pkcs15_decode_pubkey(struct sc_context *,
 		struct sc_pkcs15_pubkey *, const u8 *, size_t);
 int sc_pkcs15_encode_pubkey(struct sc_context *,
 		struct sc_pkcs15_pubkey *, u8 **, size_t *);
-int sc_pkcs15_encode_pubkey_as_spki(struct sc_context *,
+int sc_pkcs15_encode_pubkey_as_spki(struct sc_context *,
 		struct sc_pkcs15_pubkey *, u8 **, size_t *);
 void sc_pkcs15_erase_pubkey(struct sc_pkcs15_pubkey *);
 void sc_pkcs15_free_pubkey(struct sc_pkcs15_pubkey *);
@@ -800,6 +843,8 @@ int sc_pkcs15_find_skey_by_id(struct sc_pkcs15_card *card,
 int sc_pkcs15_verify_pin(struct sc_pkcs15_card *card,
 			 struct sc_pkcs15_object *pin_obj,
 			 const u8 *pincode, size_t pinlen);
+int sc_pkcs15_get_pin_state(struct sc_pkcs15_card *card,
+			 struct sc_pkcs15_object *pin_obj);
 int sc_pkcs15_change_pin(struct sc_pkcs15_card *card,
 			 struct sc_pkcs15_object *pin_obj,
 			 const u8 *oldpincode, size_t oldpinlen,
@@ -885,6 +930,22 @@ int sc_pkcs15_decode_skdf_entry(struct sc_pkcs15_card *p15card,
 				 struct sc_pkcs15_object *obj,
 				 const u8 **buf, size_t *bufsize);
 
+/* Table driven decoders for the common xDF entry layouts, used by the
+ * functions above.  SC_ERROR_NOT_SUPPORTED means the entry has to go
+ * through the generic decoder; 'obj' and 'info' are left untouched then. */
+int sc_pkcs15_fast_decode_prkdf_entry(struct sc_pkcs15_object *obj,
+				 struct sc_pkcs15_prkey_info *info,
+				 const u8 **buf, size_t *bufsize);
+int sc_pkcs15_fast_decode_pukdf_entry(struct sc_pkcs15_object *obj,
+				 struct sc_pkcs15_pubkey_info *info,
+				 const u8 **buf, size_t *bufsize);
+int sc_pkcs15_fast_decode_cdf_entry(struct sc_pkcs15_object *obj,
+				 struct sc_pkcs15_cert_info *info,
+				 const u8 **buf, size_t *bufsize);
+int sc_pkcs15_fast_decode_aodf_entry(struct sc_pkcs15_object *obj,
+				 struct sc_pkcs15_auth_info *info,
+				 const u8 **buf, size_t *bufsize);
+
 int sc_pkcs15_decode_enveloped_data(struct sc_context *ctx,
 				    struct sc_pkcs15_enveloped_data *result,
 				    const u8 *buf, size_t buflen);
@@ -917,11 +978,26 @@ void sc_pkcs15_free_data_info(sc_pkcs15_data_info_t *data);
 void sc_pkcs15_free_auth_info(sc_pkcs15_auth_info_t *auth_info);
 void sc_pkcs15_free_object(struct sc_pkcs15_object *obj);
 
+/* Release the data an info structure refers to, but not the structure */
+void sc_pkcs15_clear_prkey_info(sc_pkcs15_prkey_info_t *key);
+void sc_pkcs15_clear_pubkey_info(sc_pkcs15_pubkey_info_t *key);
+void sc_pkcs15_clear_cert_info(sc_pkcs15_cert_info_t *cert);
+void sc_pkcs15_clear_data_info(sc_pkcs15_data_info_t *data);
+/* Allocate the type specific data of an object, from the object's arena if any */
+void *sc_pkcs15_alloc_object_data(struct sc_pkcs15_object *obj, size_t size);
+
 /* Generic file i/o */
 int sc_pkcs15_read_file(struct sc_pkcs15_card *p15card,
 			const struct sc_path *path,
 			u8 **buf, size_t *buflen);
 
+/* Reference counted file buffers; sc_pkcs15_buf_new takes ownership of 'value' */
+struct sc_pkcs15_buf *sc_pkcs15_buf_new(u8 *value, size_t len);
+struct sc_pkcs15_buf *sc_pkcs15_buf_ref(struct sc_pkcs15_buf *buf);
+void sc_pkcs15_buf_unref(struct sc_pkcs15_buf *buf);
+/* Returns 1 if 'ptr' points into the buffer */
+int sc_pkcs15_buf_contains(const struct sc_pkcs15_buf *buf, const void *ptr);
+
 /* Caching functions */
 int sc_pkcs15_read_cached_file(struct sc_pkcs15_card *p15card,
                                const struct sc_path *path,
@@ -276,18 +276,18 @@ openct_reader_internal_transmit(sc_reader_t *reader,
 
 static int openct_reader_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 {
-	size_t       ssize, rsize, rbuflen = 0;
+	size_t       ssize = 0, rsize, rbuflen;
 	u8           *sbuf = NULL, *rbuf = NULL;
 	int          r;
 
 	rsize = rbuflen = apdu->resplen + 2;
-	rbuf     = malloc(rbuflen);
-	if (rbuf == NULL) {
-		r = SC_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
+	if (rbuflen > SC_READER_IO_BUFFER_SIZE)
+		rsize = rbuflen = SC_READER_IO_BUFFER_SIZE;
+	r = _sc_reader_io_buffers(reader, &sbuf, &rbuf);
+	if (r != SC_SUCCESS)
+		return r;
 	/* encode and log the APDU */
-	r = sc_apdu_get_octets(reader->ctx, apdu, &sbuf, &ssize, SC_PROTO_RAW);
+	r = sc_apdu_put_octets(reader->ctx, apdu, sbuf, SC_READER_IO_BUFFER_SIZE, &ssize, SC_PROTO_RAW);
 	if (r != SC_SUCCESS)
 		goto out;
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, sbuf, ssize, 1);
@@ -301,16 +301,13 @@ static int openct_reader_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, rbuf, rsize, 0);
 	/* set response */
 	r = sc_apdu_set_resp(reader->ctx, apdu, rbuf, rsize);
+	/* only the received bytes need to be wiped */
+	if (rsize < rbuflen)
+		rbuflen = rsize;
 out:
-	if (sbuf != NULL) {
-		sc_mem_clear(sbuf, ssize);
-		free(sbuf);
-	}
-	if (rbuf != NULL) {
-		sc_mem_clear(rbuf, rbuflen);
-		free(rbuf);
-	}
-	
+	sc_mem_clear(sbuf, ssize);
+	sc_mem_clear(rbuf, rbuflen);
+
 	return r;
 }
 
@@ -31,6 +31,13 @@
 #include <winsock2.h>
 #else
 #include <arpa/inet.h>
+#include <sys/time.h>
+#endif
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#include <pthread.h>
+/* transactions may be kept open after unlock, see pcsc_unlock() */
+#define PCSC_LINGER
 #endif
 
 #include "common/libscdl.h"
@@ -57,6 +64,7 @@ struct pcsc_global_private_data {
 	DWORD disconnect_action;
 	DWORD transaction_end_action;
 	DWORD reconnect_action;
+	int transaction_linger;
 	const char *provider_library;
 	void *dlhandle;
 	SCardEstablishContext_t SCardEstablishContext;
@@ -74,6 +82,13 @@ struct pcsc_global_private_data {
 	SCardTransmit_t SCardTransmit;
 	SCardListReaders_t SCardListReaders;
 	SCardGetAttrib_t SCardGetAttrib;
+
+	/* The readers are only listed again when the PnP notification pseudo
+	 * reader or pcsc_wait_for_event() says they changed */
+	SCARD_READERSTATE pnp_state;
+	int pnp_unsupported;
+	int readers_listed;
+	int readers_changed;
 };
 
 struct pcsc_private_data {
@@ -95,8 +110,31 @@ struct pcsc_private_data {
 	DWORD get_tlv_properties;
 
 	int locked;
+
+#ifdef PCSC_LINGER
+	/* Transaction kept open after the last unlock. It is ended by
+	 * the linger thread once the deadline has passed. */
+	pthread_mutex_t linger_mutex;
+	pthread_cond_t linger_cond;
+	pthread_t linger_thread;
+	int linger_thread_running;
+	int linger_stop;
+	int lingering;
+	struct timespec linger_deadline;
+#endif
 };
 
+#ifdef PCSC_LINGER
+/* The linger thread ends a lingering transaction with linger_mutex held.
+ * Calls on the card handle that may run while a transaction lingers take
+ * the mutex as well, PC/SC handles must not be used by two threads at once. */
+#define PCSC_LINGER_LOCK(priv)		pthread_mutex_lock(&(priv)->linger_mutex)
+#define PCSC_LINGER_UNLOCK(priv)	pthread_mutex_unlock(&(priv)->linger_mutex)
+#else
+#define PCSC_LINGER_LOCK(priv)
+#define PCSC_LINGER_UNLOCK(priv)
+#endif
+
 static int pcsc_detect_card_presence(sc_reader_t *reader);
 
 static DWORD pcsc_reset_action(const char *str)
@@ -190,6 +228,7 @@ static int pcsc_internal_transmit(sc_reader_t *reader,
 	dwSendLength = sendsize;
 	dwRecvLength = *recvsize;
 
+	PCSC_LINGER_LOCK(priv);
 	if (!control) {
 		rv = priv->gpriv->SCardTransmit(card, &sSendPci, sendbuf, dwSendLength,
 				   &sRecvPci, recvbuf, &dwRecvLength);
@@ -203,6 +242,7 @@ static int pcsc_internal_transmit(sc_reader_t *reader,
 				  recvbuf, dwRecvLength, &dwRecvLength);
 		}
 	}
+	PCSC_LINGER_UNLOCK(priv);
 
 	if (rv != SCARD_S_SUCCESS) {
 		PCSC_TRACE(reader, "SCardTransmit/Control failed", rv);
@@ -226,7 +266,7 @@ static int pcsc_internal_transmit(sc_reader_t *reader,
 
 static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 {
-	size_t       ssize, rsize, rbuflen = 0;
+	size_t       ssize = 0, rsize, rbuflen;
 	u8           *sbuf = NULL, *rbuf = NULL;
 	int          r;
 
@@ -236,13 +276,14 @@ static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	 * The buffer for the returned data needs to be at least 2 bytes
 	 * larger than the expected data length to store SW1 and SW2. */
 	rsize = rbuflen = apdu->resplen <= 256 ? 258 : apdu->resplen + 2;
-	rbuf     = malloc(rbuflen);
-	if (rbuf == NULL) {
-		r = SC_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
+	/* no response can be larger than the reader buffer */
+	if (rbuflen > SC_READER_IO_BUFFER_SIZE)
+		rsize = rbuflen = SC_READER_IO_BUFFER_SIZE;
+	r = _sc_reader_io_buffers(reader, &sbuf, &rbuf);
+	if (r != SC_SUCCESS)
+		return r;
 	/* encode and log the APDU */
-	r = sc_apdu_get_octets(reader->ctx, apdu, &sbuf, &ssize, reader->active_protocol);
+	r = sc_apdu_put_octets(reader->ctx, apdu, sbuf, SC_READER_IO_BUFFER_SIZE, &ssize, reader->active_protocol);
 	if (r != SC_SUCCESS)
 		goto out;
 	if (reader->name)
@@ -259,15 +300,12 @@ static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, rbuf, rsize, 0);
 	/* set response */
 	r = sc_apdu_set_resp(reader->ctx, apdu, rbuf, rsize);
+	/* only the received bytes need to be wiped */
+	if (rsize < rbuflen)
+		rbuflen = rsize;
 out:
-	if (sbuf != NULL) {
-		sc_mem_clear(sbuf, ssize);
-		free(sbuf);
-	}
-	if (rbuf != NULL) {
-		sc_mem_clear(rbuf, rbuflen);
-		free(rbuf);
-	}
+	sc_mem_clear(sbuf, ssize);
+	sc_mem_clear(rbuf, rbuflen);
 
 	return r;
 }
@@ -282,6 +320,9 @@ static int refresh_attributes(sc_reader_t *reader)
 
 	sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "%s check", reader->name);
 
+	if (reader->flags & SC_READER_REMOVED)
+		return SC_ERROR_READER_DETACHED;
+
 	if (priv->reader_state.szReader == NULL) {
 		priv->reader_state.szReader = reader->name;
 		priv->reader_state.dwCurrentState = SCARD_STATE_UNAWARE;
@@ -309,10 +350,11 @@ static int refresh_attributes(sc_reader_t *reader)
 
 	if (state & SCARD_STATE_UNKNOWN) {
 		/* State means "reader unknown", but we have listed it at least once.
-		 * There can be no cards in this reader.
-		 * XXX: We'll hit it again, as no readers are removed currently.
+		 * There can be no cards in this reader. The next listing marks it
+		 * removed.
 		 */
 		reader->flags &= ~(SC_READER_CARD_PRESENT);
+		priv->gpriv->readers_changed = 1;
 		return SC_ERROR_READER_DETACHED;
 	}
 
@@ -345,7 +387,9 @@ static int refresh_attributes(sc_reader_t *reader)
 				 * the handle will be invalid. */
 				DWORD readers_len = 0, cstate, prot, atr_len = SC_MAX_ATR_SIZE;
 				unsigned char atr[SC_MAX_ATR_SIZE];
+				PCSC_LINGER_LOCK(priv);
 				rv = priv->gpriv->SCardStatus(priv->pcsc_card, NULL, &readers_len, &cstate, &prot, atr, &atr_len);
+				PCSC_LINGER_UNLOCK(priv);
 				if (rv == (LONG)SCARD_W_REMOVED_CARD)
 					reader->flags |= SC_READER_CARD_CHANGED;
 			}
@@ -402,6 +446,110 @@ static int check_forced_protocol(sc_context_t *ctx, struct sc_atr *atr, DWORD *p
 }
 
 
+#ifdef PCSC_LINGER
+static void *pcsc_linger_thread(void *arg)
+{
+	sc_reader_t *reader = (sc_reader_t *) arg;
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	struct timeval now;
+	LONG rv;
+
+	pthread_mutex_lock(&priv->linger_mutex);
+	while (!priv->linger_stop) {
+		if (!priv->lingering) {
+			pthread_cond_wait(&priv->linger_cond, &priv->linger_mutex);
+			continue;
+		}
+		pthread_cond_timedwait(&priv->linger_cond, &priv->linger_mutex, &priv->linger_deadline);
+		if (!priv->lingering)
+			continue;
+		gettimeofday(&now, NULL);
+		if (now.tv_sec < priv->linger_deadline.tv_sec
+				|| (now.tv_sec == priv->linger_deadline.tv_sec
+				&& now.tv_usec * 1000 < priv->linger_deadline.tv_nsec))
+			continue;
+		/* idle for long enough, let other applications have the card */
+		rv = priv->gpriv->SCardEndTransaction(priv->pcsc_card, priv->gpriv->transaction_end_action);
+		if (rv != SCARD_S_SUCCESS)
+			PCSC_TRACE(reader, "SCardEndTransaction failed", rv);
+		priv->lingering = 0;
+		priv->locked = 0;
+	}
+	pthread_mutex_unlock(&priv->linger_mutex);
+	return NULL;
+}
+
+/* Keep the transaction open for transaction_linger milliseconds */
+static int pcsc_linger_start(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	struct timeval now;
+	long ms = priv->gpriv->transaction_linger;
+
+	if (ms <= 0)
+		return SC_ERROR_NOT_SUPPORTED;
+
+	pthread_mutex_lock(&priv->linger_mutex);
+	if (!priv->linger_thread_running) {
+		if (pthread_create(&priv->linger_thread, NULL, pcsc_linger_thread, reader) != 0) {
+			pthread_mutex_unlock(&priv->linger_mutex);
+			return SC_ERROR_INTERNAL;
+		}
+		priv->linger_thread_running = 1;
+	}
+	gettimeofday(&now, NULL);
+	priv->linger_deadline.tv_sec = now.tv_sec + ms / 1000;
+	priv->linger_deadline.tv_nsec = now.tv_usec * 1000 + (ms % 1000) * 1000000;
+	if (priv->linger_deadline.tv_nsec >= 1000000000) {
+		priv->linger_deadline.tv_sec++;
+		priv->linger_deadline.tv_nsec -= 1000000000;
+	}
+	priv->lingering = 1;
+	pthread_cond_signal(&priv->linger_cond);
+	pthread_mutex_unlock(&priv->linger_mutex);
+	return SC_SUCCESS;
+}
+
+/* Take back a lingering transaction, returns 1 if it was still open */
+static int pcsc_linger_resume(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	int lingering;
+
+	pthread_mutex_lock(&priv->linger_mutex);
+	lingering = priv->lingering;
+	priv->lingering = 0;
+	pthread_mutex_unlock(&priv->linger_mutex);
+	return lingering;
+}
+
+static void pcsc_linger_stop(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+
+	if (!priv->linger_thread_running)
+		return;
+	pthread_mutex_lock(&priv->linger_mutex);
+	priv->linger_stop = 1;
+	pthread_cond_signal(&priv->linger_cond);
+	pthread_mutex_unlock(&priv->linger_mutex);
+	pthread_join(priv->linger_thread, NULL);
+	priv->linger_thread_running = 0;
+	priv->linger_stop = 0;
+}
+
+static void pcsc_linger_init(struct pcsc_private_data *priv)
+{
+	pthread_mutex_init(&priv->linger_mutex, NULL);
+	pthread_cond_init(&priv->linger_cond, NULL);
+}
+#else
+#define pcsc_linger_init(priv)
+#define pcsc_linger_start(reader)	SC_ERROR_NOT_SUPPORTED
+#define pcsc_linger_resume(reader)	0
+#define pcsc_linger_stop(reader)
+#endif
+
 static int pcsc_reconnect(sc_reader_t * reader, DWORD action)
 {
 	DWORD active_proto = opensc_proto_to_pcsc(reader->active_protocol),
@@ -424,6 +572,7 @@ static int pcsc_reconnect(sc_reader_t * reader, DWORD action)
 		protocol = tmp;
 
 	/* reconnect always unlocks transaction */
+	pcsc_linger_resume(reader);
 	priv->locked = 0;
 
 	rv = priv->gpriv->SCardReconnect(priv->pcsc_card,
@@ -503,8 +652,11 @@ static int pcsc_disconnect(sc_reader_t * reader)
 
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
+	/* disconnecting ends a lingering transaction as well */
+	pcsc_linger_resume(reader);
 	priv->gpriv->SCardDisconnect(priv->pcsc_card, priv->gpriv->disconnect_action);
-	reader->flags = 0;
+	priv->locked = 0;
+	reader->flags &= SC_READER_REMOVED;
 	return SC_SUCCESS;
 }
 
@@ -516,6 +668,14 @@ static int pcsc_lock(sc_reader_t *reader)
 
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
+	/* the previous transaction is still ours, nobody else has
+	 * touched the card in between */
+	if (pcsc_linger_resume(reader)) {
+		reader->flags |= SC_READER_TRANSACTION_KEPT;
+		return SC_SUCCESS;
+	}
+	reader->flags &= ~SC_READER_TRANSACTION_KEPT;
+
 	rv = priv->gpriv->SCardBeginTransaction(priv->pcsc_card);
 
 	switch (rv) {
@@ -553,6 +713,11 @@ static int pcsc_unlock(sc_reader_t *reader)
 
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
+	/* keep the transaction for a while if the next operation is
+	 * likely to follow soon */
+	if (pcsc_linger_start(reader) == SC_SUCCESS)
+		return SC_SUCCESS;
+
 	rv = priv->gpriv->SCardEndTransaction(priv->pcsc_card, priv->gpriv->transaction_end_action);
 
 	priv->locked = 0;
@@ -567,6 +732,13 @@ static int pcsc_release(sc_reader_t *reader)
 {
 	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
 
+	pcsc_linger_stop(reader);
+	if (pcsc_linger_resume(reader))
+		priv->gpriv->SCardEndTransaction(priv->pcsc_card, priv->gpriv->transaction_end_action);
+#ifdef PCSC_LINGER
+	pthread_cond_destroy(&priv->linger_cond);
+	pthread_mutex_destroy(&priv->linger_mutex);
+#endif
 	free(priv);
 	return SC_SUCCESS;
 }
@@ -639,11 +811,17 @@ static int pcsc_init(sc_context_t *ctx)
 	gpriv->disconnect_action = SCARD_RESET_CARD;
 	gpriv->transaction_end_action = SCARD_LEAVE_CARD;
 	gpriv->reconnect_action = SCARD_LEAVE_CARD;
+	gpriv->transaction_linger = 0;
 	gpriv->enable_pinpad = 1;
 	gpriv->enable_pace = 1;
 	gpriv->provider_library = DEFAULT_PCSC_PROVIDER;
 	gpriv->pcsc_ctx = -1;
 	gpriv->pcsc_wait_ctx = -1;
+	gpriv->pnp_state.szReader = "\\\\?PnP?\\Notification";
+	gpriv->pnp_state.dwCurrentState = SCARD_STATE_UNAWARE;
+#ifdef __APPLE__ /* OS X 10.6.2 does not support PnP notification */
+	gpriv->pnp_unsupported = 1;
+#endif
 
 	conf_block = sc_get_conf_block(ctx, "reader_driver", "pcsc", 1);
 	if (conf_block) {
@@ -655,6 +833,8 @@ static int pcsc_init(sc_context_t *ctx)
 		    pcsc_reset_action(scconf_get_str(conf_block, "transaction_end_action", "leave"));
 		gpriv->reconnect_action =
 		    pcsc_reset_action(scconf_get_str(conf_block, "reconnect_action", "leave"));
+		gpriv->transaction_linger =
+		    scconf_get_int(conf_block, "transaction_linger", gpriv->transaction_linger);
 		gpriv->enable_pinpad =
 		    scconf_get_bool(conf_block, "enable_pinpad", gpriv->enable_pinpad);
 		gpriv->enable_pace =
@@ -662,8 +842,8 @@ static int pcsc_init(sc_context_t *ctx)
 		gpriv->provider_library =
 		    scconf_get_str(conf_block, "provider_library", gpriv->provider_library);
 	}
-	sc_log(ctx, "PC/SC options: connect_exclusive=%d disconnect_action=%d transaction_end_action=%d reconnect_action=%d enable_pinpad=%d enable_pace=%d",
-		gpriv->connect_exclusive, gpriv->disconnect_action, gpriv->transaction_end_action, gpriv->reconnect_action, gpriv->enable_pinpad, gpriv->enable_pace);
+	sc_log(ctx, "PC/SC options: connect_exclusive=%d disconnect_action=%d transaction_end_action=%d reconnect_action=%d transaction_linger=%d enable_pinpad=%d enable_pace=%d",
+		gpriv->connect_exclusive, gpriv->disconnect_action, gpriv->transaction_end_action, gpriv->reconnect_action, gpriv->transaction_linger, gpriv->enable_pinpad, gpriv->enable_pace);
 
 	gpriv->dlhandle = sc_dlopen(gpriv->provider_library);
 	if (gpriv->dlhandle == NULL) {
@@ -935,6 +1115,74 @@ static void detect_reader_features(sc_reader_t *reader, SCARDHANDLE card_handle)
 	}
 }
 
+/* Asks the PnP notification pseudo reader whether readers came or went
+ * since the last call. Returns 1 if they may have */
+static int pcsc_pnp_changed(struct pcsc_global_private_data *gpriv)
+{
+	SCARD_READERSTATE *pnp = &gpriv->pnp_state;
+	int changed;
+	LONG rv;
+
+	if (gpriv->pnp_unsupported || gpriv->pcsc_ctx == -1)
+		return 1;
+
+	rv = gpriv->SCardGetStatusChange(gpriv->pcsc_ctx, 0, pnp, 1);
+	if (rv == (LONG)SCARD_E_TIMEOUT)
+		return 0;
+	if (rv != SCARD_S_SUCCESS) {
+		/* the context may be gone, it is established again when listing */
+		pnp->dwCurrentState = SCARD_STATE_UNAWARE;
+		return 1;
+	}
+	if (pnp->dwEventState & SCARD_STATE_UNKNOWN) {
+		gpriv->pnp_unsupported = 1;
+		return 1;
+	}
+	changed = (pnp->dwEventState & SCARD_STATE_CHANGED) != 0;
+	pnp->dwCurrentState = pnp->dwEventState & ~SCARD_STATE_CHANGED;
+	return changed;
+}
+
+static int pcsc_reader_listed(const char *reader_buf, const char *name)
+{
+	const char *reader_name;
+
+	for (reader_name = reader_buf; *reader_name != '\x0'; reader_name += strlen(reader_name) + 1)
+		if (!strcmp(reader_name, name))
+			return 1;
+	return 0;
+}
+
+static void pcsc_mark_removed(sc_context_t *ctx, const char *reader_buf)
+{
+	unsigned int i;
+
+	for (i = 0; i < sc_ctx_get_reader_count(ctx); i++) {
+		sc_reader_t *reader = sc_ctx_get_reader(ctx, i);
+
+		if (reader->flags & SC_READER_REMOVED)
+			continue;
+		if (!pcsc_reader_listed(reader_buf, reader->name)) {
+			struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+
+			sc_log(ctx, "pcsc reader '%s' detached", reader->name);
+			if (reader->flags & SC_READER_CARD_PRESENT)
+				reader->flags |= SC_READER_CARD_CHANGED;
+			reader->flags &= ~(SC_READER_CARD_PRESENT|SC_READER_TRANSACTION_KEPT);
+			reader->flags |= SC_READER_REMOVED;
+			/* a lingering transaction went away with the reader */
+			if (pcsc_linger_resume(reader)) {
+				priv->gpriv->SCardEndTransaction(priv->pcsc_card, priv->gpriv->transaction_end_action);
+				priv->locked = 0;
+			}
+		}
+	}
+}
+
+/* Only readers that were attached or detached since the last call are
+ * touched. Detached readers are not freed but marked SC_READER_REMOVED, as
+ * the upper layers keep references to them, and take up again if the same
+ * reader comes back. */
 static int pcsc_detect_readers(sc_context_t *ctx)
 {
 	struct pcsc_global_private_data *gpriv = (struct pcsc_global_private_data *) ctx->reader_drv_data;
@@ -943,6 +1191,7 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 	LONG rv;
 	char *reader_buf = NULL, *reader_name;
 	const char *mszGroups = NULL;
+	unsigned int i;
 	int ret = SC_ERROR_INTERNAL;
 
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_NORMAL);
@@ -953,6 +1202,13 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		goto out;
 	}
 
+	if (!pcsc_pnp_changed(gpriv) && gpriv->readers_listed && !gpriv->readers_changed) {
+		sc_log(ctx, "No pcsc readers attached or detached");
+		ret = SC_SUCCESS;
+		goto out;
+	}
+	gpriv->readers_changed = 0;
+
 	sc_log(ctx, "Probing pcsc readers");
 
 	do {
@@ -971,6 +1227,12 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		if (rv != SCARD_S_SUCCESS) {
 			if (rv != (LONG)SCARD_E_INVALID_HANDLE) {
 				PCSC_LOG(ctx, "SCardListReaders failed", rv);
+#ifdef SCARD_E_NO_READERS_AVAILABLE
+				if (rv == (LONG)SCARD_E_NO_READERS_AVAILABLE) {
+					pcsc_mark_removed(ctx, "");
+					gpriv->readers_listed = 1;
+				}
+#endif
 				ret = pcsc_to_opensc_error(rv);
 				goto out;
 			}
@@ -1004,7 +1266,6 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 	for (reader_name = reader_buf; *reader_name != '\x0'; reader_name += strlen(reader_name) + 1) {
 		sc_reader_t *reader = NULL;
 		struct pcsc_private_data *priv = NULL;
-		unsigned int i;
 		int found = 0;
 
 		for (i=0;i < sc_ctx_get_reader_count(ctx) && !found;i++) {
@@ -1015,6 +1276,13 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 			}
 			if (!strcmp(reader2->name, reader_name)) {
 				found = 1;
+				if (reader2->flags & SC_READER_REMOVED) {
+					sc_log(ctx, "pcsc reader '%s' attached again", reader_name);
+					reader2->flags = 0;
+					/* start over with the state of the reader */
+					GET_PRIV_DATA(reader2)->reader_state.szReader = NULL;
+					refresh_attributes(reader2);
+				}
 			}
 		}
 
@@ -1035,6 +1303,7 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		}
 
 		reader->drv_data = priv;
+		pcsc_linger_init(priv);
 		reader->ops = &pcsc_ops;
 		reader->driver = &pcsc_drv;
 		if ((reader->name = strdup(reader_name)) == NULL) {
@@ -1091,6 +1360,8 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		goto out;
 	}
 
+	pcsc_mark_removed(ctx, reader_buf);
+	gpriv->readers_listed = 1;
 	ret = SC_SUCCESS;
 
 out:
@@ -1130,18 +1401,23 @@ static int pcsc_wait_for_event(sc_context_t *ctx, unsigned int event_mask, sc_re
 			SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_OUT_OF_MEMORY);
 
 		/* Find out the current status */
-		num_watch = sc_ctx_get_reader_count(ctx);
-		sc_log(ctx, "Trying to watch %d readers", num_watch);
-		for (i = 0; i < num_watch; i++) {
-			rgReaderStates[i].szReader = sc_ctx_get_reader(ctx, i)->name;
-			rgReaderStates[i].dwCurrentState = SCARD_STATE_UNAWARE;
-			rgReaderStates[i].dwEventState = SCARD_STATE_UNAWARE;
+		num_watch = 0;
+		for (i = 0; i < sc_ctx_get_reader_count(ctx); i++) {
+			sc_reader_t *reader = sc_ctx_get_reader(ctx, i);
+
+			if (reader->flags & SC_READER_REMOVED)
+				continue;
+			rgReaderStates[num_watch].szReader = reader->name;
+			rgReaderStates[num_watch].dwCurrentState = SCARD_STATE_UNAWARE;
+			rgReaderStates[num_watch].dwEventState = SCARD_STATE_UNAWARE;
+			num_watch++;
 		}
+		sc_log(ctx, "Trying to watch %d readers", num_watch);
 #ifndef __APPLE__ /* OS X 10.6.2 does not support PnP notification */
 		if (event_mask & SC_EVENT_READER_ATTACHED) {
-			rgReaderStates[i].szReader = "\\\\?PnP?\\Notification";
-			rgReaderStates[i].dwCurrentState = SCARD_STATE_UNAWARE;
-			rgReaderStates[i].dwEventState = SCARD_STATE_UNAWARE;
+			rgReaderStates[num_watch].szReader = "\\\\?PnP?\\Notification";
+			rgReaderStates[num_watch].dwCurrentState = SCARD_STATE_UNAWARE;
+			rgReaderStates[num_watch].dwEventState = SCARD_STATE_UNAWARE;
 			num_watch++;
 		}
 #endif
@@ -1209,6 +1485,8 @@ static int pcsc_wait_for_event(sc_context_t *ctx, unsigned int event_mask, sc_re
 					sc_log(ctx, "detected hotplug event");
 					*event |= SC_EVENT_READER_ATTACHED;
 					*event_reader = NULL;
+					/* list the readers on the next detection */
+					gpriv->readers_changed = 1;
 				}
 
 				if ((state & SCARD_STATE_PRESENT) && !(prev_state & SCARD_STATE_PRESENT)) {
@@ -1224,11 +1502,13 @@ static int pcsc_wait_for_event(sc_context_t *ctx, unsigned int event_mask, sc_re
 				if ((state & SCARD_STATE_UNKNOWN) && !(prev_state & SCARD_STATE_UNKNOWN)) {
 					sc_log(ctx, "reader detached event");
 					*event |= SC_EVENT_READER_DETACHED;
+					gpriv->readers_changed = 1;
 				}
 
 				if ((prev_state & SCARD_STATE_UNKNOWN) && !(state & SCARD_STATE_UNKNOWN)) {
 					sc_log(ctx, "reader re-attached event");
 					*event |= SC_EVENT_READER_ATTACHED;
+					gpriv->readers_changed = 1;
 				}
 
 				if (*event & event_mask) {
@@ -2149,6 +2429,7 @@ int cardmod_use_reader(sc_context_t *ctx, void * pcsc_context_handle, void * pcs
 		}
 
 		reader->drv_data = priv;
+		pcsc_linger_init(priv);
 		reader->ops = &cardmod_ops;
 		reader->driver = &cardmod_drv;
 		if ((reader->name = strdup(reader_name)) == NULL) {
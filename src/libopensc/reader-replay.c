@@ -0,0 +1,432 @@
+/*
+ * reader-replay.c: Reader driver replaying an APDU trace
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * With apdu_replay_file set this driver takes the place of the readers:
+ * every reader named in the trace (see trace.h) shows up with the card
+ * of its first CARD record, and the card answers each command with the
+ * response recorded for it. A command recorded more than once gets the
+ * response of its first recording after the previous answered command,
+ * so sequences like GET CHALLENGE or READ BINARY in a loop replay in
+ * order; past the end of the trace the earliest recording is used.
+ * Commands that are not in the trace get SW 6D00.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "internal.h"
+#include "trace.h"
+
+#define GET_PRIV_DATA(r) ((struct replay_private_data *) (r)->drv_data)
+
+struct replay_exchange {
+	const u8 *cmd, *resp;
+	size_t cmd_len, resp_len;
+	unsigned long duration;
+	int result;
+	/* next exchange with a command of the same hash, plus one */
+	size_t next;
+};
+
+struct replay_private_data {
+	struct replay_exchange *exchanges;
+	size_t count, size;
+
+	/* first exchange with a command of that hash, plus one */
+	size_t *buckets;
+	size_t bucket_count;
+
+	size_t cursor;
+	unsigned long hits, misses;
+};
+
+struct replay_global_private_data {
+	u8 *trace;
+	int latency;
+};
+
+static struct sc_reader_operations replay_ops;
+
+static struct sc_reader_driver replay_drv = {
+	"APDU trace replay",
+	"replay",
+	&replay_ops,
+	0, 0, NULL
+};
+
+static size_t replay_hash(const u8 *cmd, size_t len)
+{
+	size_t i, h = 2166136261U;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ cmd[i]) * 16777619U;
+	return h;
+}
+
+static struct replay_exchange *replay_find(struct replay_private_data *priv,
+		const u8 *cmd, size_t len)
+{
+	struct replay_exchange *ex, *first = NULL;
+	size_t i;
+
+	if (priv->bucket_count == 0)
+		return NULL;
+	for (i = priv->buckets[replay_hash(cmd, len) % priv->bucket_count]; i; i = ex->next) {
+		ex = &priv->exchanges[i - 1];
+		if (ex->cmd_len != len || memcmp(ex->cmd, cmd, len))
+			continue;
+		if (first == NULL)
+			first = ex;
+		if (i - 1 >= priv->cursor) {
+			priv->cursor = i;
+			return ex;
+		}
+	}
+	if (first != NULL)
+		priv->cursor = first - priv->exchanges + 1;
+	return first;
+}
+
+static void replay_sleep(unsigned long usec)
+{
+#ifdef _WIN32
+	Sleep(usec / 1000);
+#else
+	if (usec >= 1000000)
+		sleep(usec / 1000000);
+	usleep(usec % 1000000);
+#endif
+}
+
+static int replay_detect_card_presence(sc_reader_t *reader)
+{
+	return reader->flags;
+}
+
+static int replay_connect(sc_reader_t *reader)
+{
+	return SC_SUCCESS;
+}
+
+static int replay_disconnect(sc_reader_t *reader)
+{
+	return SC_SUCCESS;
+}
+
+static int replay_lock(sc_reader_t *reader)
+{
+	return SC_SUCCESS;
+}
+
+static int replay_unlock(sc_reader_t *reader)
+{
+	return SC_SUCCESS;
+}
+
+static int replay_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
+{
+	struct replay_private_data *priv = GET_PRIV_DATA(reader);
+	struct replay_global_private_data *gpriv =
+		(struct replay_global_private_data *) reader->ctx->reader_drv_data;
+	struct replay_exchange *ex;
+	static const u8 ins_not_supported[2] = { 0x6D, 0x00 };
+	const u8 *resp;
+	size_t ssize = 0, rsize;
+	u8 *sbuf = NULL, *rbuf = NULL;
+	int r;
+
+	r = _sc_reader_io_buffers(reader, &sbuf, &rbuf);
+	if (r != SC_SUCCESS)
+		return r;
+	/* encode the APDU like it was recorded */
+	r = sc_apdu_put_octets(reader->ctx, apdu, sbuf, SC_READER_IO_BUFFER_SIZE, &ssize, reader->active_protocol);
+	if (r != SC_SUCCESS)
+		goto out;
+	_sc_trace_mask(apdu, reader->active_protocol, sbuf, ssize);
+	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, sbuf, ssize, 1);
+
+	ex = replay_find(priv, sbuf, ssize);
+	if (ex == NULL) {
+		sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "command not in the trace");
+		priv->misses++;
+		resp = ins_not_supported;
+		rsize = sizeof(ins_not_supported);
+	} else {
+		priv->hits++;
+		if (gpriv->latency)
+			replay_sleep(ex->duration);
+		if (ex->result != SC_SUCCESS) {
+			r = ex->result;
+			goto out;
+		}
+		resp = ex->resp;
+		rsize = ex->resp_len;
+	}
+	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, resp, rsize, 0);
+	r = sc_apdu_set_resp(reader->ctx, apdu, resp, rsize);
+out:
+	sc_mem_clear(sbuf, ssize);
+
+	return r;
+}
+
+static int replay_release(sc_reader_t *reader)
+{
+	struct replay_private_data *priv = GET_PRIV_DATA(reader);
+
+	sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "reader '%s': %lu of %lu commands found in the trace",
+		reader->name, priv->hits, priv->hits + priv->misses);
+	free(priv->exchanges);
+	free(priv->buckets);
+	free(priv);
+	return SC_SUCCESS;
+}
+
+static sc_reader_t *replay_add_reader(sc_context_t *ctx, const char *name,
+		unsigned int protocol, const u8 *atr, size_t atr_len)
+{
+	sc_reader_t *reader;
+	struct replay_private_data *priv;
+
+	reader = sc_ctx_get_reader_by_name(ctx, name);
+	if (reader != NULL)
+		return reader->driver == &replay_drv ? reader : NULL;
+	if (atr_len > SC_MAX_ATR_SIZE)
+		return NULL;
+
+	reader = calloc(1, sizeof(sc_reader_t));
+	priv = calloc(1, sizeof(struct replay_private_data));
+	if (reader == NULL || priv == NULL || (reader->name = strdup(name)) == NULL) {
+		free(reader);
+		free(priv);
+		return NULL;
+	}
+	reader->drv_data = priv;
+	reader->ops = &replay_ops;
+	reader->driver = &replay_drv;
+	reader->flags = SC_READER_CARD_PRESENT;
+	reader->supported_protocols = reader->active_protocol = protocol;
+	memcpy(reader->atr.value, atr, atr_len);
+	reader->atr.len = atr_len;
+	_sc_add_reader(ctx, reader);
+	return reader;
+}
+
+static int replay_add_exchange(struct replay_private_data *priv, const u8 *rec, size_t len)
+{
+	struct replay_exchange *ex;
+	unsigned long result;
+	size_t cmd_len;
+
+	cmd_len = bebytes2ulong(rec + 17);
+	if (cmd_len > len - SC_TRACE_APDU_SIZE)
+		return SC_ERROR_INVALID_DATA;
+	if (priv->count == priv->size) {
+		size_t size = priv->size ? priv->size * 2 : 64;
+
+		ex = realloc(priv->exchanges, size * sizeof(*ex));
+		if (ex == NULL)
+			return SC_ERROR_OUT_OF_MEMORY;
+		priv->exchanges = ex;
+		priv->size = size;
+	}
+	ex = &priv->exchanges[priv->count++];
+	ex->duration = bebytes2ulong(rec + 8);
+	result = bebytes2ulong(rec + 12);
+	ex->result = result & 0x80000000UL ? -(int) (0xFFFFFFFFUL - result) - 1 : (int) result;
+	ex->cmd = rec + SC_TRACE_APDU_SIZE;
+	ex->cmd_len = cmd_len;
+	ex->resp = ex->cmd + cmd_len;
+	ex->resp_len = len - SC_TRACE_APDU_SIZE - cmd_len;
+	ex->next = 0;
+	return SC_SUCCESS;
+}
+
+/* chains built back to front keep the exchanges of a bucket in trace order */
+static int replay_index(struct replay_private_data *priv)
+{
+	struct replay_exchange *ex;
+	size_t i, h;
+
+	if (priv->count == 0)
+		return SC_SUCCESS;
+	priv->bucket_count = priv->count * 2 + 1;
+	priv->buckets = calloc(priv->bucket_count, sizeof(*priv->buckets));
+	if (priv->buckets == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	for (i = priv->count; i > 0; i--) {
+		ex = &priv->exchanges[i - 1];
+		h = replay_hash(ex->cmd, ex->cmd_len) % priv->bucket_count;
+		ex->next = priv->buckets[h];
+		priv->buckets[h] = i;
+	}
+	return SC_SUCCESS;
+}
+
+static int replay_load(sc_context_t *ctx, struct replay_global_private_data *gpriv,
+		const char *filename)
+{
+	sc_reader_t *reader = NULL;
+	FILE *f;
+	u8 *p, *end;
+	char *name;
+	long size;
+	size_t len, name_len, atr_len;
+	unsigned int i;
+	int r = SC_SUCCESS;
+
+	f = fopen(filename, "rb");
+	if (f == NULL) {
+		sc_log(ctx, "cannot open APDU trace %s", filename);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return SC_ERROR_INTERNAL;
+	}
+	gpriv->trace = malloc(size ? size : 1);
+	if (gpriv->trace == NULL) {
+		fclose(f);
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+	if (size && fread(gpriv->trace, size, 1, f) != 1) {
+		fclose(f);
+		return SC_ERROR_INTERNAL;
+	}
+	fclose(f);
+
+	p = gpriv->trace;
+	end = p + size;
+	while (end - p >= SC_TRACE_HDR_SIZE) {
+		len = bebytes2ulong(p + 1);
+		if (len > (size_t) (end - p) - SC_TRACE_HDR_SIZE) {
+			sc_log(ctx, "APDU trace %s is truncated", filename);
+			break;
+		}
+		switch (p[0]) {
+		case SC_TRACE_REC_SESSION:
+			if (len < SC_TRACE_SESSION_SIZE || memcmp(p + SC_TRACE_HDR_SIZE, SC_TRACE_MAGIC, 4)
+					|| bebytes2ushort(p + SC_TRACE_HDR_SIZE + 4) != SC_TRACE_VERSION) {
+				sc_log(ctx, "%s is not an APDU trace of this version", filename);
+				return SC_ERROR_INVALID_DATA;
+			}
+			reader = NULL;
+			break;
+		case SC_TRACE_REC_CARD:
+			atr_len = len >= SC_TRACE_CARD_SIZE ? p[SC_TRACE_HDR_SIZE + 4] : 0;
+			if (len < SC_TRACE_CARD_SIZE || atr_len > len - SC_TRACE_CARD_SIZE) {
+				reader = NULL;
+				break;
+			}
+			name_len = len - SC_TRACE_CARD_SIZE - atr_len;
+			name = malloc(name_len + 1);
+			if (name == NULL)
+				return SC_ERROR_OUT_OF_MEMORY;
+			memcpy(name, p + SC_TRACE_HDR_SIZE + SC_TRACE_CARD_SIZE + atr_len, name_len);
+			name[name_len] = '\0';
+			reader = replay_add_reader(ctx, name, bebytes2ulong(p + SC_TRACE_HDR_SIZE),
+					p + SC_TRACE_HDR_SIZE + SC_TRACE_CARD_SIZE, atr_len);
+			if (reader == NULL)
+				sc_log(ctx, "cannot replay reader '%s'", name);
+			free(name);
+			break;
+		case SC_TRACE_REC_APDU:
+			if (reader == NULL || len < SC_TRACE_APDU_SIZE)
+				break;
+			r = replay_add_exchange(GET_PRIV_DATA(reader), p + SC_TRACE_HDR_SIZE, len);
+			if (r == SC_ERROR_OUT_OF_MEMORY)
+				return r;
+			break;
+		}
+		p += SC_TRACE_HDR_SIZE + len;
+	}
+
+	for (i = 0; i < sc_ctx_get_reader_count(ctx); i++) {
+		reader = sc_ctx_get_reader(ctx, i);
+		if (reader->driver != &replay_drv)
+			continue;
+		r = replay_index(GET_PRIV_DATA(reader));
+		if (r != SC_SUCCESS)
+			return r;
+		sc_log(ctx, "reader '%s': %lu commands", reader->name,
+			(unsigned long) GET_PRIV_DATA(reader)->count);
+	}
+	return SC_SUCCESS;
+}
+
+static int replay_init(sc_context_t *ctx)
+{
+	struct replay_global_private_data *gpriv;
+	const char *filename = NULL;
+	int i;
+
+	gpriv = calloc(1, sizeof(struct replay_global_private_data));
+	if (gpriv == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	ctx->reader_drv_data = gpriv;
+
+	for (i = 0; ctx->conf_blocks[i] != NULL; i++) {
+		filename = scconf_get_str(ctx->conf_blocks[i], "apdu_replay_file", NULL);
+		if (filename != NULL) {
+			gpriv->latency = scconf_get_bool(ctx->conf_blocks[i], "apdu_replay_latency", 0);
+			break;
+		}
+	}
+	if (filename == NULL)
+		return SC_ERROR_INTERNAL;
+
+	return replay_load(ctx, gpriv, filename);
+}
+
+static int replay_finish(sc_context_t *ctx)
+{
+	struct replay_global_private_data *gpriv =
+		(struct replay_global_private_data *) ctx->reader_drv_data;
+
+	if (gpriv) {
+		free(gpriv->trace);
+		free(gpriv);
+	}
+	ctx->reader_drv_data = NULL;
+	return SC_SUCCESS;
+}
+
+struct sc_reader_driver *sc_get_replay_driver(void)
+{
+	replay_ops.init = replay_init;
+	replay_ops.finish = replay_finish;
+	replay_ops.detect_readers = NULL;
+	replay_ops.transmit = replay_transmit;
+	replay_ops.detect_card_presence = replay_detect_card_presence;
+	replay_ops.lock = replay_lock;
+	replay_ops.unlock = replay_unlock;
+	replay_ops.release = replay_release;
+	replay_ops.connect = replay_connect;
+	replay_ops.disconnect = replay_disconnect;
+
+	return &replay_drv;
+}
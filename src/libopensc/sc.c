@@ -28,6 +28,12 @@
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#include <pthread.h>
+#endif
 #ifdef ENABLE_OPENSSL
 #include <openssl/crypto.h>     /* for OPENSSL_cleanse */
 #endif
@@ -770,30 +776,310 @@ int _sc_parse_atr(sc_reader_t *reader)
 	return 0;
 }
 
-void *sc_mem_alloc_secure(sc_context_t *ctx, size_t len)
+/*
+ * Locked memory for sensitive data. Every context reserves one region
+ * with a guard page on either side, locks it once and hands out fixed
+ * size chunks from it; larger blocks get a locked mapping of their own.
+ * Memory is wiped when it is given back. The pools are kept in a global
+ * list so that sc_mem_free_secure() can find the owner of a block
+ * without a context.
+ */
+#define SC_SECURE_CLASSES	4
+#define SC_SECURE_CLASS_SIZE	8192
+#define SC_SECURE_MIN_CHUNK	32
+#define SC_SECURE_WORD_BITS	(8 * sizeof(unsigned long))
+#define SC_SECURE_MAP_WORDS	(SC_SECURE_CLASS_SIZE / SC_SECURE_MIN_CHUNK / SC_SECURE_WORD_BITS)
+
+static const size_t sc_secure_chunk_size[SC_SECURE_CLASSES] = { 32, 128, 512, 2048 };
+
+struct sc_secure_map {
+	unsigned char *base;	/* whole mapping, guard pages included */
+	size_t map_len;
+	unsigned char *data;	/* usable part */
+	size_t len;
+	int locked;
+};
+
+struct sc_secure_block {
+	struct sc_secure_block *next;
+	struct sc_secure_map map;
+};
+
+struct sc_secure_pool {
+	struct sc_secure_pool *next;
+	struct sc_secure_map map;
+	unsigned long used[SC_SECURE_CLASSES][SC_SECURE_MAP_WORDS];
+	struct sc_secure_block *blocks;
+	unsigned int in_use;
+	int orphaned;
+	int warned;
+};
+
+static struct sc_secure_pool *sc_secure_pools = NULL;
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+static pthread_mutex_t sc_secure_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define SC_SECURE_LOCK()	pthread_mutex_lock(&sc_secure_mutex)
+#define SC_SECURE_UNLOCK()	pthread_mutex_unlock(&sc_secure_mutex)
+#elif defined(_WIN32)
+static volatile LONG sc_secure_mutex = 0;
+#define SC_SECURE_LOCK()	while (InterlockedExchange(&sc_secure_mutex, 1)) Sleep(0)
+#define SC_SECURE_UNLOCK()	InterlockedExchange(&sc_secure_mutex, 0)
+#else
+#define SC_SECURE_LOCK()
+#define SC_SECURE_UNLOCK()
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static int sc_secure_map(struct sc_secure_map *map, size_t len)
 {
-    void *pointer;
-    int locked = 0;
+	size_t page;
+
+	memset(map, 0, sizeof(*map));
+#if defined(_WIN32)
+	{
+		SYSTEM_INFO si;
+		DWORD old;
+
+		GetSystemInfo(&si);
+		page = si.dwPageSize;
+		map->len = (len + page - 1) / page * page;
+		map->map_len = map->len + 2 * page;
+		map->base = VirtualAlloc(NULL, map->map_len, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (map->base == NULL)
+			return SC_ERROR_OUT_OF_MEMORY;
+		map->data = map->base + page;
+		VirtualProtect(map->base, page, PAGE_NOACCESS, &old);
+		VirtualProtect(map->data + map->len, page, PAGE_NOACCESS, &old);
+		map->locked = VirtualLock(map->data, map->len) != 0;
+	}
+#elif defined(HAVE_SYS_MMAN_H)
+	page = (size_t) sysconf(_SC_PAGESIZE);
+	map->len = (len + page - 1) / page * page;
+	map->map_len = map->len + 2 * page;
+	map->base = mmap(NULL, map->map_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map->base == MAP_FAILED) {
+		map->base = NULL;
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+	map->data = map->base + page;
+	mprotect(map->base, page, PROT_NONE);
+	mprotect(map->data + map->len, page, PROT_NONE);
+#ifdef MADV_DONTDUMP
+	madvise(map->data, map->len, MADV_DONTDUMP);
+#endif
+	map->locked = mlock(map->data, map->len) == 0;
+#else
+	(void) page;
+	map->base = map->data = calloc(1, len);
+	if (map->base == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	map->len = map->map_len = len;
+#endif
+	return SC_SUCCESS;
+}
 
-    pointer = calloc(len, sizeof(unsigned char));
-    if (!pointer)
-        return NULL;
-#ifdef HAVE_SYS_MMAN_H
-    /* TODO Windows support and mprotect too */
-    /* Do not swap the memory */
-    if (mlock(pointer, len) >= 0)
-        locked = 1;
+static void sc_secure_unmap(struct sc_secure_map *map)
+{
+	if (map->base == NULL)
+		return;
+	sc_mem_clear(map->data, map->len);
+#if defined(_WIN32)
+	if (map->locked)
+		VirtualUnlock(map->data, map->len);
+	VirtualFree(map->base, 0, MEM_RELEASE);
+#elif defined(HAVE_SYS_MMAN_H)
+	if (map->locked)
+		munlock(map->data, map->len);
+	munmap(map->base, map->map_len);
+#else
+	free(map->base);
 #endif
-    if (!locked) {
-        if (ctx->paranoid_memory) {
-            sc_do_log (ctx, 0, NULL, 0, NULL, "cannot lock memory, failing allocation because paranoid set");
-            free (pointer);
-            pointer = NULL;
-        } else {
-            sc_do_log (ctx, 0, NULL, 0, NULL, "cannot lock memory, sensitive data may be paged to disk");
-        }
-    }
-    return pointer;
+	map->base = map->data = NULL;
+}
+
+static struct sc_secure_pool *sc_secure_pool_new(void)
+{
+	struct sc_secure_pool *pool;
+
+	pool = calloc(1, sizeof(struct sc_secure_pool));
+	if (pool == NULL)
+		return NULL;
+	if (sc_secure_map(&pool->map, SC_SECURE_CLASSES * SC_SECURE_CLASS_SIZE) != SC_SUCCESS) {
+		free(pool);
+		return NULL;
+	}
+	pool->next = sc_secure_pools;
+	sc_secure_pools = pool;
+	return pool;
+}
+
+static void sc_secure_pool_destroy(struct sc_secure_pool *pool)
+{
+	struct sc_secure_pool **pp;
+
+	for (pp = &sc_secure_pools; *pp; pp = &(*pp)->next)
+		if (*pp == pool) {
+			*pp = pool->next;
+			break;
+		}
+	sc_secure_unmap(&pool->map);
+	free(pool);
+}
+
+static void *sc_secure_pool_alloc(struct sc_secure_pool *pool, size_t len, int *locked)
+{
+	struct sc_secure_block *block;
+	unsigned int cls, i, bit, chunks;
+
+	/* take the smallest class with a free chunk */
+	for (cls = 0; cls < SC_SECURE_CLASSES; cls++) {
+		if (len > sc_secure_chunk_size[cls])
+			continue;
+		chunks = SC_SECURE_CLASS_SIZE / sc_secure_chunk_size[cls];
+		for (i = 0; i < chunks; i++) {
+			if (pool->used[cls][i / SC_SECURE_WORD_BITS] == ~0UL) {
+				i += SC_SECURE_WORD_BITS - 1;
+				continue;
+			}
+			bit = i % SC_SECURE_WORD_BITS;
+			if (pool->used[cls][i / SC_SECURE_WORD_BITS] & (1UL << bit))
+				continue;
+			pool->used[cls][i / SC_SECURE_WORD_BITS] |= 1UL << bit;
+			pool->in_use++;
+			*locked = pool->map.locked;
+			return pool->map.data + cls * SC_SECURE_CLASS_SIZE + i * sc_secure_chunk_size[cls];
+		}
+	}
+
+	block = calloc(1, sizeof(struct sc_secure_block));
+	if (block == NULL)
+		return NULL;
+	if (sc_secure_map(&block->map, len) != SC_SUCCESS) {
+		free(block);
+		return NULL;
+	}
+	block->next = pool->blocks;
+	pool->blocks = block;
+	pool->in_use++;
+	*locked = block->map.locked;
+	return block->map.data;
+}
+
+/* Returns 1 if 'ptr' belonged to the pool */
+static int sc_secure_pool_free(struct sc_secure_pool *pool, unsigned char *ptr)
+{
+	struct sc_secure_block **bp, *block;
+	size_t offset, chunk;
+	unsigned int cls, i;
+
+	if (ptr >= pool->map.data && ptr < pool->map.data + SC_SECURE_CLASSES * SC_SECURE_CLASS_SIZE) {
+		offset = ptr - pool->map.data;
+		cls = offset / SC_SECURE_CLASS_SIZE;
+		chunk = sc_secure_chunk_size[cls];
+		i = (offset % SC_SECURE_CLASS_SIZE) / chunk;
+		sc_mem_clear(pool->map.data + cls * SC_SECURE_CLASS_SIZE + i * chunk, chunk);
+		pool->used[cls][i / SC_SECURE_WORD_BITS] &= ~(1UL << (i % SC_SECURE_WORD_BITS));
+		pool->in_use--;
+		return 1;
+	}
+
+	for (bp = &pool->blocks; *bp; bp = &(*bp)->next) {
+		block = *bp;
+		if (block->map.data != ptr)
+			continue;
+		*bp = block->next;
+		sc_secure_unmap(&block->map);
+		free(block);
+		pool->in_use--;
+		return 1;
+	}
+	return 0;
+}
+
+void *sc_mem_alloc_secure(sc_context_t *ctx, size_t len)
+{
+	struct sc_secure_pool *pool;
+	void *pointer = NULL;
+	int locked = 0, warn = 0;
+
+	if (ctx == NULL || len == 0)
+		return NULL;
+
+	SC_SECURE_LOCK();
+	pool = ctx->secure_pool;
+	if (pool == NULL)
+		pool = ctx->secure_pool = sc_secure_pool_new();
+	if (pool != NULL) {
+		pointer = sc_secure_pool_alloc(pool, len, &locked);
+		if (pointer != NULL && !locked && !pool->warned) {
+			pool->warned = 1;
+			warn = 1;
+		}
+	}
+	SC_SECURE_UNLOCK();
+
+	if (pointer == NULL) {
+		/* no pool, fall back to the heap */
+		pointer = calloc(len, sizeof(unsigned char));
+		if (pointer == NULL)
+			return NULL;
+		warn = 1;
+	}
+	if (!locked) {
+		if (ctx->paranoid_memory) {
+			sc_do_log (ctx, 0, NULL, 0, NULL, "cannot lock memory, failing allocation because paranoid set");
+			sc_mem_free_secure(pointer, len);
+			pointer = NULL;
+		} else if (warn) {
+			sc_do_log (ctx, 0, NULL, 0, NULL, "cannot lock memory, sensitive data may be paged to disk");
+		}
+	}
+	return pointer;
+}
+
+void sc_mem_free_secure(void *ptr, size_t len)
+{
+	struct sc_secure_pool *pool;
+
+	if (ptr == NULL)
+		return;
+
+	SC_SECURE_LOCK();
+	for (pool = sc_secure_pools; pool; pool = pool->next)
+		if (sc_secure_pool_free(pool, ptr))
+			break;
+	/* the last block of a released context takes the pool with it */
+	if (pool != NULL && pool->orphaned && pool->in_use == 0)
+		sc_secure_pool_destroy(pool);
+	SC_SECURE_UNLOCK();
+
+	if (pool == NULL) {
+		sc_mem_clear(ptr, len);
+		free(ptr);
+	}
+}
+
+void _sc_free_secure_pool(sc_context_t *ctx)
+{
+	struct sc_secure_pool *pool;
+
+	SC_SECURE_LOCK();
+	pool = ctx->secure_pool;
+	ctx->secure_pool = NULL;
+	if (pool != NULL) {
+		/* blocks still held (e.g. by objects outliving the context)
+		 * stay valid until they are freed */
+		if (pool->in_use)
+			pool->orphaned = 1;
+		else
+			sc_secure_pool_destroy(pool);
+	}
+	SC_SECURE_UNLOCK();
 }
 
 void sc_mem_clear(void *ptr, size_t len)
@@ -824,6 +1110,90 @@ int sc_mem_reverse(unsigned char *buf, size_t len)
 	return 0;
 }
 
+/* Chunks of a region allocator, blocks are carved sequentially */
+struct sc_arena_chunk {
+	struct sc_arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+struct sc_arena {
+	struct sc_arena_chunk *chunks;
+	size_t chunk_size;
+};
+
+#define SC_ARENA_ALIGN			(2 * sizeof(void *))
+#define SC_ARENA_ROUND(n)		(((n) + SC_ARENA_ALIGN - 1) & ~(SC_ARENA_ALIGN - 1))
+#define SC_ARENA_HDR			SC_ARENA_ROUND(sizeof(struct sc_arena_chunk))
+#define SC_ARENA_DEFAULT_CHUNK		8192
+
+sc_arena_t *sc_arena_new(size_t chunk_size)
+{
+	sc_arena_t *arena;
+
+	arena = calloc(1, sizeof(sc_arena_t));
+	if (!arena)
+		return NULL;
+	arena->chunk_size = chunk_size ? chunk_size : SC_ARENA_DEFAULT_CHUNK;
+	return arena;
+}
+
+void *sc_arena_alloc(sc_arena_t *arena, size_t size)
+{
+	struct sc_arena_chunk *chunk;
+	size_t chunk_size;
+	void *ptr;
+
+	if (!arena || !size)
+		return NULL;
+	size = SC_ARENA_ROUND(size);
+
+	chunk = arena->chunks;
+	if (!chunk || chunk->size - chunk->used < size) {
+		/* large blocks get a chunk of their own */
+		chunk_size = size > arena->chunk_size / 4 ? size : arena->chunk_size;
+		chunk = calloc(1, SC_ARENA_HDR + chunk_size);
+		if (!chunk)
+			return NULL;
+		chunk->size = chunk_size;
+		if (arena->chunks && size > arena->chunk_size / 4) {
+			/* keep carving from the current chunk */
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+		else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+
+	ptr = (unsigned char *) chunk + SC_ARENA_HDR + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+void sc_arena_reset(sc_arena_t *arena)
+{
+	struct sc_arena_chunk *chunk, *next;
+
+	if (!arena)
+		return;
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		sc_mem_clear((unsigned char *) chunk + SC_ARENA_HDR, chunk->used);
+		free(chunk);
+	}
+	arena->chunks = NULL;
+}
+
+void sc_arena_free(sc_arena_t *arena)
+{
+	if (!arena)
+		return;
+	sc_arena_reset(arena);
+	free(arena);
+}
+
 static int
 sc_remote_apdu_allocate(struct sc_remote_data *rdata,
 		struct sc_remote_apdu **new_rapdu)
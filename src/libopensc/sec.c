@@ -29,6 +29,16 @@
 
 #include "internal.h"
 
+/* A failed operation may have lost the security environment. One refused
+ * for the security status shows that the recorded PIN states are wrong,
+ * e.g. because the card dropped them after the previous operation. */
+static void sec_operation_failed(sc_card_t *card, int r)
+{
+	card->cache.sec_env_valid = 0;
+	if (r == SC_ERROR_SECURITY_STATUS_NOT_SATISFIED)
+		card->cache.pin_state_count = 0;
+}
+
 int sc_decipher(sc_card_t *card,
 		const u8 * crgram, size_t crgram_len, u8 * out, size_t outlen)
 {
@@ -39,6 +49,8 @@ int sc_decipher(sc_card_t *card,
 	if (card->ops->decipher == NULL)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_SUPPORTED);
 	r = card->ops->decipher(card, crgram, crgram_len, out, outlen);
+	if (r < 0)
+		sec_operation_failed(card, r);
         SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
 
@@ -53,6 +65,8 @@ int sc_compute_signature(sc_card_t *card,
 	if (card->ops->compute_signature == NULL)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_SUPPORTED);
 	r = card->ops->compute_signature(card, data, datalen, out, outlen);
+	if (r < 0)
+		sec_operation_failed(card, r);
         SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
 
@@ -66,7 +80,34 @@ int sc_set_security_env(sc_card_t *card,
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_NORMAL);
 	if (card->ops->set_security_env == NULL)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_SUPPORTED);
+
+	/* locking drops the remembered environment if somebody else
+	 * had the card in between */
+	r = sc_lock(card);
+	if (r != SC_SUCCESS)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
+	if (!(card->caps & SC_CARD_CAP_NO_SEC_ENV_CACHE)
+			&& card->cache.sec_env_valid
+			&& card->cache.sec_env_num == se_num
+			&& !memcmp(&card->cache.sec_env, env, sizeof(*env))) {
+		sc_log(card->ctx, "security environment already set");
+		sc_unlock(card);
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_SUCCESS);
+	}
+
+	card->cache.sec_env_valid = 0;
+	card->cache.sec_env_setting = 1;
 	r = card->ops->set_security_env(card, env, se_num);
+	card->cache.sec_env_setting = 0;
+	if (r == SC_SUCCESS) {
+		card->cache.sec_env = *env;
+		card->cache.sec_env_num = se_num;
+		card->cache.sec_env_valid = 1;
+	}
+	else {
+		sec_operation_failed(card, r);
+	}
+	sc_unlock(card);
         SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
 
@@ -78,6 +119,7 @@ int sc_restore_security_env(sc_card_t *card, int se_num)
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_NORMAL);
 	if (card->ops->restore_security_env == NULL)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_SUPPORTED);
+	card->cache.sec_env_valid = 0;
 	r = card->ops->restore_security_env(card, se_num);
 	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
@@ -99,9 +141,14 @@ int sc_verify(sc_card_t *card, unsigned int type, int ref,
 
 int sc_logout(sc_card_t *card)
 {
+	int r;
+
 	if (card->ops->logout == NULL)
 		return SC_ERROR_NOT_SUPPORTED;
-	return card->ops->logout(card);
+	r = card->ops->logout(card);
+	if (r == SC_SUCCESS)
+		card->cache.pin_state_count = 0;
+	return r;
 }
 
 int sc_change_reference_data(sc_card_t *card, unsigned int type,
@@ -141,6 +188,106 @@ int sc_reset_retry_counter(sc_card_t *card, unsigned int type, int ref,
 	return sc_pin_cmd(card, &data, NULL);
 }
 
+/*
+ * Authentication state of the PINs. A DF specific reference can mean a
+ * different PIN in every DF, so the state goes with the current path.
+ */
+static struct sc_card_pin_state *pin_state_find(sc_card_t *card,
+		unsigned int type, int reference)
+{
+	struct sc_card_pin_state *state;
+	size_t i;
+
+	for (i = 0; i < card->cache.pin_state_count; i++) {
+		state = &card->cache.pin_state[i];
+		if (state->type == type && state->reference == reference
+				&& sc_compare_path(&state->path, &card->cache.current_path))
+			return state;
+	}
+	return NULL;
+}
+
+static void pin_state_set(sc_card_t *card, unsigned int type, int reference,
+		int logged_in)
+{
+	struct sc_card_pin_state *state;
+	size_t n;
+
+	state = pin_state_find(card, type, reference);
+	if (state == NULL && logged_in == SC_PIN_STATE_UNKNOWN)
+		return;
+	if (state == NULL) {
+		n = card->cache.pin_state_count;
+		if (n == SC_MAX_CARD_PIN_STATES)
+			return;
+		state = &card->cache.pin_state[n];
+		state->type = type;
+		state->reference = reference;
+		state->path = card->cache.current_path;
+		card->cache.pin_state_count++;
+	}
+	state->logged_in = logged_in;
+}
+
+static void pin_state_update(sc_card_t *card, const struct sc_pin_cmd_data *data,
+		int r)
+{
+	int state;
+
+	switch (data->cmd) {
+	case SC_PIN_CMD_VERIFY:
+		if (r == SC_SUCCESS)
+			state = SC_PIN_STATE_LOGGED_IN;
+		else if (r == SC_ERROR_PIN_CODE_INCORRECT || r == SC_ERROR_AUTH_METHOD_BLOCKED)
+			state = SC_PIN_STATE_LOGGED_OUT;
+		else
+			state = SC_PIN_STATE_UNKNOWN;
+		break;
+	case SC_PIN_CMD_GET_INFO:
+		if (r != SC_SUCCESS)
+			return;
+		state = data->pin1.logged_in;
+		break;
+	default:
+		/* whether a change or unblock leaves the PIN verified
+		 * depends on the card */
+		state = SC_PIN_STATE_UNKNOWN;
+		break;
+	}
+	pin_state_set(card, data->pin_type, data->pin_reference, state);
+}
+
+int sc_pin_get_state(sc_card_t *card, unsigned int type, int reference)
+{
+	struct sc_pin_cmd_data data;
+	struct sc_card_pin_state *state;
+	int r;
+
+	if (card == NULL)
+		return SC_PIN_STATE_UNKNOWN;
+
+	r = sc_lock(card);
+	if (r != SC_SUCCESS)
+		return SC_PIN_STATE_UNKNOWN;
+
+	state = pin_state_find(card, type, reference);
+	if (state != NULL && state->logged_in != SC_PIN_STATE_UNKNOWN) {
+		r = state->logged_in;
+		sc_log(card->ctx, "PIN %i state %i (recorded)", reference, r);
+	} else {
+		memset(&data, 0, sizeof(data));
+		data.cmd = SC_PIN_CMD_GET_INFO;
+		data.pin_type = type;
+		data.pin_reference = reference;
+		r = sc_pin_cmd(card, &data, NULL);
+		r = r == SC_SUCCESS ? data.pin1.logged_in : SC_PIN_STATE_UNKNOWN;
+		sc_log(card->ctx, "PIN %i state %i (card)", reference, r);
+	}
+
+	sc_unlock(card);
+	return r;
+}
+
 /*
  * This is the new style pin command, which takes care of all PIN
  * operations.
@@ -155,6 +302,8 @@ int sc_pin_cmd(sc_card_t *card, struct sc_pin_cmd_data *data,
 
 	assert(card != NULL);
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_NORMAL);
+	if (data->cmd == SC_PIN_CMD_GET_INFO)
+		data->pin1.logged_in = SC_PIN_STATE_UNKNOWN;
 	if (card->ops->pin_cmd) {
 		r = card->ops->pin_cmd(card, data, tries_left);
 	} else if (!(data->flags & SC_PIN_CMD_USE_PINPAD)) {
@@ -201,6 +350,7 @@ int sc_pin_cmd(sc_card_t *card, struct sc_pin_cmd_data *data,
 		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "Use of pin pad not supported by card driver");
 		r = SC_ERROR_NOT_SUPPORTED;
 	}
+	pin_state_update(card, data, r);
 	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
 
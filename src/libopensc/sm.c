@@ -138,7 +138,7 @@ sc_sm_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 	if (rv == SC_ERROR_SM_NOT_APPLIED)   {
 		/* SM wrap of this APDU is ignored by card driver.
 		 * Send plain APDU to the reader driver */
-		rv = card->reader->ops->transmit(card->reader, apdu);
+		rv = _sc_trace_transmit(card, apdu);
 		LOG_FUNC_RETURN(ctx, rv);
 	}
 	LOG_TEST_RET(ctx, rv, "get SM APDU error");
@@ -151,7 +151,7 @@ sc_sm_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 	}
 
 	/* send APDU to the reader driver */
-	rv = card->reader->ops->transmit(card->reader, sm_apdu);
+	rv = _sc_trace_transmit(card, sm_apdu);
 	LOG_TEST_RET(ctx, rv, "unable to transmit APDU");
 
 	/* decode SM answer and free temporary SM related data */
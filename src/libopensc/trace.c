@@ -0,0 +1,263 @@
+/*
+ * trace.c: APDU trace capture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "internal.h"
+#include "trace.h"
+
+struct sc_trace {
+	FILE *file;
+	void *mutex;
+	unsigned long start_sec, start_usec;
+	int failed, reported;
+
+	/* reader and card of the last APDU record */
+	const struct sc_reader *reader;
+	struct sc_atr atr;
+	unsigned int protocol;
+};
+
+/* monotonic time where available */
+static void trace_clock(unsigned long *sec, unsigned long *usec)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	if (QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&count)) {
+		*sec = (unsigned long) (count.QuadPart / freq.QuadPart);
+		*usec = (unsigned long) (count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+		return;
+	}
+	*sec = GetTickCount() / 1000;
+	*usec = GetTickCount() % 1000 * 1000;
+#else
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		*sec = ts.tv_sec;
+		*usec = ts.tv_nsec / 1000;
+		return;
+	}
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		*sec = tv.tv_sec;
+		*usec = tv.tv_usec;
+	}
+#else
+	*sec = time(NULL);
+	*usec = 0;
+#endif
+#endif
+}
+
+static void trace_write(struct sc_trace *trace, const void *data, size_t len)
+{
+	if (len && fwrite(data, len, 1, trace->file) != 1)
+		trace->failed = 1;
+}
+
+static void trace_header(struct sc_trace *trace, int type, size_t len)
+{
+	u8 hdr[SC_TRACE_HDR_SIZE];
+
+	hdr[0] = (u8) type;
+	ulong2bebytes(hdr + 1, len);
+	trace_write(trace, hdr, sizeof(hdr));
+}
+
+static void trace_card(struct sc_trace *trace, const struct sc_reader *reader)
+{
+	u8 rec[SC_TRACE_CARD_SIZE];
+	size_t name_len = reader->name ? strlen(reader->name) : 0;
+
+	ulong2bebytes(rec, reader->active_protocol);
+	rec[4] = (u8) reader->atr.len;
+	trace_header(trace, SC_TRACE_REC_CARD, sizeof(rec) + reader->atr.len + name_len);
+	trace_write(trace, rec, sizeof(rec));
+	trace_write(trace, reader->atr.value, reader->atr.len);
+	trace_write(trace, reader->name, name_len);
+
+	trace->reader = reader;
+	trace->atr = reader->atr;
+	trace->protocol = reader->active_protocol;
+}
+
+int _sc_trace_mask(const struct sc_apdu *apdu, unsigned int proto, u8 *cmd, size_t len)
+{
+	size_t offset = 5;
+
+	if (apdu->control || apdu->lc == 0 || apdu->data == NULL)
+		return 0;
+	/* VERIFY, CHANGE REFERENCE DATA, RESET RETRY COUNTER */
+	if (apdu->ins != 0x20 && apdu->ins != 0x24 && apdu->ins != 0x2C)
+		return 0;
+	if ((apdu->cse & SC_APDU_EXT) && proto != SC_PROTO_T0)
+		offset = 7;
+	if (offset + apdu->lc > len)
+		return 0;
+	memset(cmd + offset, 0, apdu->lc);
+	return 1;
+}
+
+int _sc_trace_open(sc_context_t *ctx, const char *filename)
+{
+	struct sc_trace *trace;
+	u8 rec[SC_TRACE_SESSION_SIZE];
+	int r;
+
+	if (ctx->trace != NULL)
+		return SC_SUCCESS;
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	trace->file = fopen(filename, "ab");
+	if (trace->file == NULL) {
+		free(trace);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+	r = sc_mutex_create(ctx, &trace->mutex);
+	if (r != SC_SUCCESS) {
+		fclose(trace->file);
+		free(trace);
+		return r;
+	}
+	trace_clock(&trace->start_sec, &trace->start_usec);
+
+	memcpy(rec, SC_TRACE_MAGIC, 4);
+	ushort2bebytes(rec + 4, SC_TRACE_VERSION);
+	ushort2bebytes(rec + 6, 0);
+#ifdef _WIN32
+	ulong2bebytes(rec + 8, GetCurrentProcessId());
+#else
+	ulong2bebytes(rec + 8, getpid());
+#endif
+	trace_header(trace, SC_TRACE_REC_SESSION, sizeof(rec) + strlen(ctx->app_name));
+	trace_write(trace, rec, sizeof(rec));
+	trace_write(trace, ctx->app_name, strlen(ctx->app_name));
+	fflush(trace->file);
+
+	ctx->trace = trace;
+	return SC_SUCCESS;
+}
+
+void _sc_trace_close(sc_context_t *ctx)
+{
+	struct sc_trace *trace = ctx->trace;
+
+	if (trace == NULL)
+		return;
+	ctx->trace = NULL;
+	if (trace->mutex != NULL)
+		sc_mutex_destroy(ctx, trace->mutex);
+	fclose(trace->file);
+	free(trace);
+}
+
+int _sc_trace_transmit(struct sc_card *card, struct sc_apdu *apdu)
+{
+	struct sc_context *ctx = card->ctx;
+	struct sc_reader *reader = card->reader;
+	struct sc_trace *trace = ctx->trace;
+	unsigned long sec, usec, end_sec, end_usec;
+	u8 rec[SC_TRACE_APDU_SIZE], sw[2], flags = 0;
+	u8 *cmd = NULL;
+	size_t cmd_len = 0, resp_len = 0;
+	int r;
+
+	if (trace == NULL)
+		return reader->ops->transmit(reader, apdu);
+
+	/* the command as the reader driver encodes it */
+	if (sc_apdu_get_octets(ctx, apdu, &cmd, &cmd_len, reader->active_protocol) != SC_SUCCESS) {
+		cmd = NULL;
+		cmd_len = 0;
+	}
+	if (cmd != NULL && _sc_trace_mask(apdu, reader->active_protocol, cmd, cmd_len))
+		flags |= SC_TRACE_APDU_MASKED;
+	if (apdu->control)
+		flags |= SC_TRACE_APDU_CONTROL;
+
+	trace_clock(&sec, &usec);
+	r = reader->ops->transmit(reader, apdu);
+	trace_clock(&end_sec, &end_usec);
+
+	if (r == SC_SUCCESS) {
+		sw[0] = (u8) apdu->sw1;
+		sw[1] = (u8) apdu->sw2;
+		resp_len = apdu->resplen + sizeof(sw);
+	}
+
+	sc_mutex_lock(ctx, trace->mutex);
+	if (trace->reader != reader || trace->protocol != reader->active_protocol
+			|| trace->atr.len != reader->atr.len
+			|| memcmp(trace->atr.value, reader->atr.value, reader->atr.len))
+		trace_card(trace, reader);
+
+	/* the time of the exchange since the start of the session */
+	end_usec = (end_sec - sec) * 1000000UL + end_usec - usec;
+	if (usec < trace->start_usec) {
+		usec += 1000000UL;
+		sec--;
+	}
+	ulong2bebytes(rec, sec - trace->start_sec);
+	ulong2bebytes(rec + 4, usec - trace->start_usec);
+	ulong2bebytes(rec + 8, end_usec);
+	ulong2bebytes(rec + 12, (unsigned long) r);
+	rec[16] = flags;
+	ulong2bebytes(rec + 17, cmd_len);
+	trace_header(trace, SC_TRACE_REC_APDU, sizeof(rec) + cmd_len + resp_len);
+	trace_write(trace, rec, sizeof(rec));
+	trace_write(trace, cmd, cmd_len);
+	if (resp_len) {
+		trace_write(trace, apdu->resp, apdu->resplen);
+		trace_write(trace, sw, sizeof(sw));
+	}
+	if (fflush(trace->file) != 0)
+		trace->failed = 1;
+	if (trace->failed && !trace->reported) {
+		sc_log(ctx, "cannot write APDU trace, the trace is incomplete");
+		trace->reported = 1;
+	}
+	sc_mutex_unlock(ctx, trace->mutex);
+
+	if (cmd != NULL) {
+		sc_mem_clear(cmd, cmd_len);
+		free(cmd);
+	}
+	return r;
+}
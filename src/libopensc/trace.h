@@ -0,0 +1,66 @@
+/*
+ * trace.h: APDU trace file format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _OPENSC_TRACE_H
+#define _OPENSC_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An APDU trace (apdu_trace_file) is a sequence of records, each a
+ * one byte type and the big endian length of the payload that follows
+ * in four bytes. All integers are big endian, so traces can be replayed
+ * on any host.
+ *
+ * SESSION	magic[4] version[2] reserved[2] pid[4] application name
+ * CARD		protocol[4] atr_len[1] atr reader name
+ * APDU		sec[4] usec[4] duration[4] result[4] flags[1] cmd_len[4]
+ *		cmd resp
+ *
+ * Every process appending to the trace starts with a SESSION record.
+ * A CARD record names the reader and card of the APDU records after it.
+ * sec and usec are the start of the exchange since the session started,
+ * taken from a monotonic clock; duration is the time in microseconds
+ * spent in the reader driver. result is the return value of the reader
+ * driver as a two's complement number, resp the response including
+ * SW1 SW2 if result is zero. The data of VERIFY, CHANGE REFERENCE DATA
+ * and RESET RETRY COUNTER is zeroed, with SC_TRACE_APDU_MASKED set.
+ */
+#define SC_TRACE_MAGIC			"OSCT"
+#define SC_TRACE_VERSION		1
+
+#define SC_TRACE_REC_SESSION		1
+#define SC_TRACE_REC_CARD		2
+#define SC_TRACE_REC_APDU		3
+
+#define SC_TRACE_HDR_SIZE		5
+#define SC_TRACE_SESSION_SIZE		12
+#define SC_TRACE_CARD_SIZE		5
+#define SC_TRACE_APDU_SIZE		21
+
+/* APDU flags */
+#define SC_TRACE_APDU_CONTROL		0x01	/* reader control command */
+#define SC_TRACE_APDU_MASKED		0x02	/* command data zeroed */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
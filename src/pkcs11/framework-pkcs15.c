@@ -61,6 +61,8 @@ struct pkcs15_fw_data {
 	unsigned int			locked;
 	unsigned char user_puk[64];
 	unsigned int user_puk_len;
+	/* the objects above are carved from here and released on unbind */
+	sc_arena_t *			arena;
 };
 
 struct pkcs15_any_object {
@@ -287,6 +289,10 @@ pkcs15_bind(struct sc_pkcs11_card *p11card, struct sc_app_info *app_info)
 
 	if (!(fw_data = calloc(1, sizeof(*fw_data))))
 		return CKR_HOST_MEMORY;
+	if (!(fw_data->arena = sc_arena_new(0))) {
+		free(fw_data);
+		return CKR_HOST_MEMORY;
+	}
 	p11card->fws_data[idx] = fw_data;
 
 	rc = sc_pkcs15_bind(p11card->card, aid, &fw_data->p15_card);
@@ -325,6 +331,15 @@ pkcs15_unbind(struct sc_pkcs11_card *p11card)
 			else
 				__pkcs15_release_object(obj);
 		}
+	}
+
+	/* Public objects can be moved between applications,
+	 * release the arenas once all objects are released */
+	for (idx=0; idx<SC_PKCS11_FRAMEWORK_DATA_MAX_NUM; idx++)   {
+		struct pkcs15_fw_data *fw_data = (struct pkcs15_fw_data *) p11card->fws_data[idx];
+
+		if (!fw_data)
+			break;
 
 		unlock_card(fw_data);
 
@@ -332,6 +347,7 @@ pkcs15_unbind(struct sc_pkcs11_card *p11card)
 			rv = sc_pkcs15_unbind(fw_data->p15_card);
 		fw_data->p15_card = NULL;
 
+		sc_arena_free(fw_data->arena);
 		free(fw_data);
 		p11card->fws_data[idx] = NULL;
 	}
@@ -423,7 +439,7 @@ __pkcs15_create_object(struct pkcs15_fw_data *fw_data,
 	if (fw_data->num_objects >= MAX_OBJECTS)
 		return SC_ERROR_TOO_MANY_OBJECTS;
 
-	if (!(obj = calloc(1, size)))
+	if (!(obj = sc_arena_alloc(fw_data->arena, size)))
 		return SC_ERROR_OUT_OF_MEMORY;
 
 	fw_data->objects[fw_data->num_objects++] = obj;
@@ -443,8 +459,8 @@ __pkcs15_release_object(struct pkcs15_any_object *obj)
 	if (--(obj->refcount) != 0)
 		return obj->refcount;
 
+	/* the memory is released with the arena of the application */
 	sc_mem_clear(obj, obj->size);
-	free(obj);
 
 	return 0;
 }
@@ -568,32 +584,24 @@ __pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_obj
 		struct pkcs15_any_object **cert_object)
 {
 	struct sc_pkcs15_cert_info *p15_info = NULL;
-	struct sc_pkcs15_cert *p15_cert = NULL;
 	struct pkcs15_cert_object *object = NULL;
 	struct pkcs15_pubkey_object *obj2 = NULL;
 	int rv;
 
 	p15_info = (struct sc_pkcs15_cert_info *) cert->data;
 
-	if (cert->flags & SC_PKCS15_CO_FLAG_PRIVATE)  {	/* is the cert private? */
-		p15_cert = NULL;			/* will read cert when needed */
-	}
-	else    {
-		rv = sc_pkcs15_read_certificate(fw_data->p15_card, p15_info, &p15_cert);
-		if (rv < 0)
-			return rv;
-	}
-
-	/* Certificate object */
+	/* Certificate object.
+	 * The certificate body is read by check_cert_data_read() when an
+	 * attribute that needs it is requested, the CDF entry has the rest. */
 	rv = __pkcs15_create_object(fw_data, (struct pkcs15_any_object **) &object,
 			cert, &pkcs15_cert_ops, sizeof(struct pkcs15_cert_object));
 	if (rv < 0)
 		return rv;
 
 	object->cert_info = p15_info;
-	object->cert_data = p15_cert;
+	object->cert_data = NULL;
 
-	/* Corresponding public key */
+	/* Corresponding public key, its data is extracted from the certificate once read */
 	rv = public_key_created(fw_data, &p15_info->id, (struct pkcs15_any_object **) &obj2);
 	if (rv != SC_SUCCESS)
 		rv = __pkcs15_create_object(fw_data, (struct pkcs15_any_object **) &obj2,
@@ -601,14 +609,6 @@ __pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_obj
 	if (rv < 0)
 		return rv;
 
-	if (p15_cert) {
-		 /* make a copy of public key from the cert */
-		if (!obj2->pub_data)
-			rv = sc_pkcs15_pubkey_from_cert(context, &p15_cert->data, &obj2->pub_data);
-		if (rv < 0)
-			return rv;
-	}
-
 	obj2->pub_genfrom = object;
 	object->cert_pubkey = obj2;
 
@@ -854,8 +854,9 @@ pkcs15_bind_related_objects(struct pkcs15_fw_data *fw_data)
 }
 
 
-/* We deferred reading of the cert until needed, as it may be
- * a private object, so we must wait till login to read  */
+/* We deferred reading of the cert until needed: it may be a private
+ * object that can only be read after login, and reading every
+ * certificate while the slot is built is slow on tokens with many */
 static int
 check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *cert)
 {
@@ -872,9 +873,12 @@ check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *
 		return rv;
 
 	obj2 = cert->cert_pubkey;
-	/* make a copy of public key from the cert data */
-	if (!obj2->pub_data)
-		rv = sc_pkcs15_pubkey_from_cert(context, &cert->cert_data->data, &obj2->pub_data);
+	/* take over the public key decoded along with the certificate,
+	 * its values still point into the certificate data */
+	if (!obj2->pub_data)   {
+		obj2->pub_data = cert->cert_data->key;
+		cert->cert_data->key = NULL;
+	}
 
 	/* now that we have the cert and pub key, lets see if we can bind anything else */
 	pkcs15_bind_related_objects(fw_data);
@@ -3302,7 +3306,8 @@ struct sc_pkcs11_object_ops pkcs15_cert_ops = {
 	NULL,	/* unwrap_key */
 	NULL,	/* decrypt */
 	NULL,	/* derive */
-	NULL	/* can_do */
+	NULL,	/* can_do */
+	NULL	/* sign_batch */
 };
 
 /*
@@ -3509,89 +3514,115 @@ pkcs15_prkey_get_attribute(struct sc_pkcs11_session *session,
 }
 
 
+/* Map a signature mechanism to the algorithm flags of sc_pkcs15_compute_signature() */
 static CK_RV
-pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
-			CK_MECHANISM_PTR pMechanism, CK_BYTE_PTR pData,
-			CK_ULONG ulDataLen, CK_BYTE_PTR pSignature,
-			CK_ULONG_PTR pulDataLen)
+pkcs15_prkey_sign_flags(CK_MECHANISM_TYPE mechanism, int *flags)
 {
-	struct pkcs15_prkey_object *prkey = (struct pkcs15_prkey_object *) obj;
-	struct sc_pkcs11_card *p11card = session->slot->card;
-	struct pkcs15_fw_data *fw_data = NULL;
-	int rv, flags = 0, prkey_has_path = 0;
-	unsigned sign_flags = SC_PKCS15_PRKEY_USAGE_SIGN | SC_PKCS15_PRKEY_USAGE_SIGNRECOVER
-			| SC_PKCS15_PRKEY_USAGE_NONREPUDIATION;
-
-	sc_log(context, "Initiating signing operation, mechanism 0x%x.",pMechanism->mechanism);
-	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[session->slot->fw_data_idx];
-	if (!fw_data)
-		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_Sign");
-
-	/* See which of the alternative keys supports signing */
-	while (prkey && !(prkey->prv_info->usage & sign_flags))
-		prkey = prkey->prv_next;
-
-	if (prkey == NULL)
-		return CKR_KEY_FUNCTION_NOT_PERMITTED;
-
-	if (prkey->prv_info->path.len || prkey->prv_info->path.aid.len)
-		prkey_has_path = 1;
-
-	switch (pMechanism->mechanism) {
+	switch (mechanism) {
 	case CKM_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_NONE;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_NONE;
 		break;
 	case CKM_MD5_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_MD5;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_MD5;
 		break;
 	case CKM_SHA1_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA1;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA1;
 		break;
 	case CKM_SHA256_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA256;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA256;
 		break;
 	case CKM_SHA384_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA384;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA384;
 		break;
 	case CKM_SHA512_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA512;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA512;
 		break;
 	case CKM_RIPEMD160_RSA_PKCS:
-		flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_RIPEMD160;
+		*flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_RIPEMD160;
 		break;
 	case CKM_RSA_X_509:
-		flags = SC_ALGORITHM_RSA_RAW;
+		*flags = SC_ALGORITHM_RSA_RAW;
 		break;
 	case CKM_GOSTR3410:
-		flags = SC_ALGORITHM_GOSTR3410_HASH_NONE;
+		*flags = SC_ALGORITHM_GOSTR3410_HASH_NONE;
 		break;
 	case CKM_GOSTR3410_WITH_GOSTR3411:
-		flags = SC_ALGORITHM_GOSTR3410_HASH_GOSTR3411;
+		*flags = SC_ALGORITHM_GOSTR3410_HASH_GOSTR3411;
 		break;
 	case CKM_ECDSA:
-		flags = SC_ALGORITHM_ECDSA_HASH_NONE;
+		*flags = SC_ALGORITHM_ECDSA_HASH_NONE;
 		break;
 	case CKM_ECDSA_SHA1:
-		flags = SC_ALGORITHM_ECDSA_HASH_SHA1;
+		*flags = SC_ALGORITHM_ECDSA_HASH_SHA1;
 		break;
 #if 0
 	case CKM_ECDSA_SHA224:
-		flags = SC_ALGORITHM_ECDSA_HASH_SHA224;
+		*flags = SC_ALGORITHM_ECDSA_HASH_SHA224;
 		break;
 	case CKM_ECDSA_SHA256:
-		flags = SC_ALGORITHM_ECDSA_HASH_SHA256;
+		*flags = SC_ALGORITHM_ECDSA_HASH_SHA256;
 		break;
 	case CKM_ECDSA_SHA384:
-		flags = SC_ALGORITHM_ECDSA_HASH_SHA384;
+		*flags = SC_ALGORITHM_ECDSA_HASH_SHA384;
 		break;
 	case CKM_ECDSA_SHA512:
-		flags = SC_ALGORITHM_ECDSA_HASH_SHA512;
+		*flags = SC_ALGORITHM_ECDSA_HASH_SHA512;
 		break;
 #endif
 	default:
-		sc_log(context, "DEE - need EC for %d",pMechanism->mechanism);
+		sc_log(context, "DEE - need EC for %d",mechanism);
 		return CKR_MECHANISM_INVALID;
 	}
+	return CKR_OK;
+}
+
+
+/* What pkcs15_prkey_sign() and pkcs15_prkey_sign_batch() need: the key
+ * among the alternatives of 'obj' that can sign, the algorithm flags, and
+ * whether the key has a path of its own */
+static CK_RV
+pkcs15_prkey_sign_prepare(struct sc_pkcs11_session *session, void *obj,
+		CK_MECHANISM_TYPE mechanism, struct pkcs15_fw_data **fw_data,
+		struct pkcs15_prkey_object **prkey, int *flags, int *prkey_has_path)
+{
+	struct sc_pkcs11_card *p11card = session->slot->card;
+	unsigned sign_flags = SC_PKCS15_PRKEY_USAGE_SIGN | SC_PKCS15_PRKEY_USAGE_SIGNRECOVER
+			| SC_PKCS15_PRKEY_USAGE_NONREPUDIATION;
+
+	*fw_data = (struct pkcs15_fw_data *) p11card->fws_data[session->slot->fw_data_idx];
+	if (!*fw_data)
+		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_Sign");
+
+	/* See which of the alternative keys supports signing */
+	*prkey = (struct pkcs15_prkey_object *) obj;
+	while (*prkey && !((*prkey)->prv_info->usage & sign_flags))
+		*prkey = (*prkey)->prv_next;
+
+	if (*prkey == NULL)
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
+	*prkey_has_path = (*prkey)->prv_info->path.len || (*prkey)->prv_info->path.aid.len;
+
+	return pkcs15_prkey_sign_flags(mechanism, flags);
+}
+
+
+static CK_RV
+pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
+			CK_MECHANISM_PTR pMechanism, CK_BYTE_PTR pData,
+			CK_ULONG ulDataLen, CK_BYTE_PTR pSignature,
+			CK_ULONG_PTR pulDataLen)
+{
+	struct pkcs15_prkey_object *prkey = NULL;
+	struct sc_pkcs11_card *p11card = session->slot->card;
+	struct pkcs15_fw_data *fw_data = NULL;
+	int rv, flags = 0, prkey_has_path = 0;
+
+	sc_log(context, "Initiating signing operation, mechanism 0x%x.",pMechanism->mechanism);
+	rv = pkcs15_prkey_sign_prepare(session, obj, pMechanism->mechanism,
+			&fw_data, &prkey, &flags, &prkey_has_path);
+	if (rv != CKR_OK)
+		return rv;
 
 	rv = sc_lock(p11card->card);
 	if (rv < 0)
@@ -3625,6 +3656,74 @@ pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
 }
 
 
+static CK_RV
+pkcs15_prkey_sign_batch(struct sc_pkcs11_session *session, void *obj,
+			CK_MECHANISM_PTR pMechanism, CK_ULONG ulCount,
+			CK_BYTE_PTR *ppData, CK_ULONG_PTR pulDataLen,
+			CK_BYTE_PTR *ppSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	struct pkcs15_prkey_object *prkey = NULL;
+	struct sc_pkcs11_card *p11card = session->slot->card;
+	struct pkcs15_fw_data *fw_data = NULL;
+	size_t *inlen = NULL, *outlen = NULL;
+	CK_ULONG i;
+	int rv, flags = 0, prkey_has_path = 0;
+
+	sc_log(context, "Initiating batch of %lu signatures, mechanism 0x%lx.",
+			ulCount, pMechanism->mechanism);
+	rv = pkcs15_prkey_sign_prepare(session, obj, pMechanism->mechanism,
+			&fw_data, &prkey, &flags, &prkey_has_path);
+	if (rv != CKR_OK)
+		return rv;
+
+	inlen = calloc(ulCount, sizeof(*inlen));
+	outlen = calloc(ulCount, sizeof(*outlen));
+	if (inlen == NULL || outlen == NULL) {
+		free(inlen);
+		free(outlen);
+		return CKR_HOST_MEMORY;
+	}
+	for (i = 0; i < ulCount; i++) {
+		inlen[i] = pulDataLen[i];
+		outlen[i] = pulSignatureLen[i];
+	}
+
+	rv = sc_lock(p11card->card);
+	if (rv < 0)
+		goto out;
+
+	rv = sc_pkcs15_compute_signatures(fw_data->p15_card, prkey->prv_p15obj, flags,
+			ulCount, (const u8 * const *) ppData, inlen, (u8 * const *) ppSignature, outlen);
+	if (rv < 0 && !sc_pkcs11_conf.lock_login && !prkey_has_path) {
+		/* As in pkcs15_prkey_sign(). The inputs signed before the
+		 * failure keep their signatures, the batch goes on from the
+		 * one that failed. */
+		CK_ULONG j;
+
+		for (i = 0; i < ulCount && outlen[i] != 0; i++)
+			;
+		for (j = i; j < ulCount; j++)
+			outlen[j] = pulSignatureLen[j];
+		if (i < ulCount && reselect_app_df(fw_data->p15_card) == SC_SUCCESS)
+			rv = sc_pkcs15_compute_signatures(fw_data->p15_card, prkey->prv_p15obj, flags,
+					ulCount - i, (const u8 * const *) ppData + i, inlen + i,
+					(u8 * const *) ppSignature + i, outlen + i);
+	}
+
+	sc_unlock(p11card->card);
+
+	sc_log(context, "Batch signature complete. Result %d.", rv);
+
+	if (rv == SC_SUCCESS)
+		for (i = 0; i < ulCount; i++)
+			pulSignatureLen[i] = outlen[i];
+out:
+	free(inlen);
+	free(outlen);
+	return sc_to_cryptoki_error(rv, "C_Sign");
+}
+
+
 static CK_RV
 pkcs15_prkey_decrypt(struct sc_pkcs11_session *session, void *obj,
 		CK_MECHANISM_PTR pMechanism,
@@ -3830,7 +3929,8 @@ struct sc_pkcs11_object_ops pkcs15_prkey_ops = {
 	NULL,	/* unwrap */
 	pkcs15_prkey_decrypt,
         pkcs15_prkey_derive,
-        pkcs15_prkey_can_do
+        pkcs15_prkey_can_do,
+	pkcs15_prkey_sign_batch
 };
 
 /*
@@ -3882,6 +3982,7 @@ pkcs15_pubkey_get_attribute(struct sc_pkcs11_session *session, void *object, CK_
 		case CKA_PUBLIC_EXPONENT:
 		case CKA_EC_PARAMS:
 		case CKA_EC_POINT:
+		case CKA_KEY_TYPE:
 			if (pubkey->pub_data == NULL)
 				/* FIXME: check the return value? */
 				check_cert_data_read(fw_data, cert);
@@ -4039,7 +4140,8 @@ struct sc_pkcs11_object_ops pkcs15_pubkey_ops = {
 	NULL,	/* unwrap_key */
 	NULL,	/* decrypt */
 	NULL,	/* derive */
-	NULL	/* can_do */
+	NULL,	/* can_do */
+	NULL	/* sign_batch */
 };
 
 
@@ -4200,7 +4302,8 @@ struct sc_pkcs11_object_ops pkcs15_dobj_ops = {
 	NULL,	/* unwrap_key */
 	NULL,	/* decrypt */
 	NULL,	/* derive */
-	NULL	/* can_do */
+	NULL,	/* can_do */
+	NULL	/* sign_batch */
 };
 
 
@@ -4366,7 +4469,8 @@ struct sc_pkcs11_object_ops pkcs15_skey_ops = {
 	NULL,	/* unwrap_key */
 	NULL,	/* decrypt */
 	NULL,	/* derive */
-	NULL	/* can_do */
+	NULL,	/* can_do */
+	NULL	/* sign_batch */
 };
 
 /*
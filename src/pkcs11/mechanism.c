@@ -29,6 +29,74 @@ struct signature_data {
 	unsigned int		buffer_len;
 };
 
+static CK_RV signature_size(struct sc_pkcs11_session *, struct sc_pkcs11_object *,
+		CK_ULONG_PTR);
+
+/*
+ * Mechanism types created by sc_pkcs11_new_fw_mechanism() and
+ * sc_pkcs11_register_sign_and_hash_mechanism() are never changed after
+ * registration. Identical ones are shared by all cards and only released
+ * by C_Finalize(), so that inserting the same token again allocates
+ * nothing.
+ */
+static sc_pkcs11_mechanism_type_t **shared_mechanisms = NULL;
+static unsigned int nshared_mechanisms = 0;
+
+static sc_pkcs11_mechanism_type_t *
+find_shared_mechanism(CK_MECHANISM_TYPE mech, CK_MECHANISM_INFO_PTR pInfo,
+		CK_KEY_TYPE key_type, const struct hash_signature_info *info)
+{
+	sc_pkcs11_mechanism_type_t *mt;
+	const struct hash_signature_info *mt_info;
+	unsigned int n;
+
+	for (n = 0; n < nshared_mechanisms; n++) {
+		mt = shared_mechanisms[n];
+		if (mt->mech != mech || mt->key_type != key_type
+				|| memcmp(&mt->mech_info, pInfo, sizeof(*pInfo)))
+			continue;
+		mt_info = (const struct hash_signature_info *) mt->mech_data;
+		if (info == NULL && mt_info == NULL)
+			return mt;
+		if (info != NULL && mt_info != NULL
+				&& mt_info->hash_type == info->hash_type
+				&& mt_info->sign_type == info->sign_type)
+			return mt;
+	}
+	return NULL;
+}
+
+static CK_RV
+add_shared_mechanism(sc_pkcs11_mechanism_type_t *mt)
+{
+	sc_pkcs11_mechanism_type_t **p;
+
+	p = (sc_pkcs11_mechanism_type_t **) realloc(shared_mechanisms,
+			(nshared_mechanisms + 1) * sizeof(*p));
+	if (p == NULL)
+		return CKR_HOST_MEMORY;
+	shared_mechanisms = p;
+	shared_mechanisms[nshared_mechanisms++] = mt;
+	return CKR_OK;
+}
+
+/*
+ * Release the shared mechanism types, once no card uses them
+ */
+void
+sc_pkcs11_free_mechanisms(void)
+{
+	unsigned int n;
+
+	for (n = 0; n < nshared_mechanisms; n++) {
+		free((void *) shared_mechanisms[n]->mech_data);
+		free(shared_mechanisms[n]);
+	}
+	free(shared_mechanisms);
+	shared_mechanisms = NULL;
+	nshared_mechanisms = 0;
+}
+
 /*
  * Register a mechanism
  */
@@ -46,6 +114,9 @@ sc_pkcs11_register_mechanism(struct sc_pkcs11_card *p11card,
 	if (p == NULL)
 		return CKR_HOST_MEMORY;
 	p11card->mechanisms = p;
+	if (mt->mech < SC_PKCS11_MECH_INDEX_SIZE && !p11card->mech_index[mt->mech]
+			&& p11card->nmechanisms < 0xFF)
+		p11card->mech_index[mt->mech] = p11card->nmechanisms + 1;
 	p[p11card->nmechanisms++] = mt;
 	p[p11card->nmechanisms] = NULL;
 	return CKR_OK;
@@ -58,9 +129,16 @@ sc_pkcs11_mechanism_type_t *
 sc_pkcs11_find_mechanism(struct sc_pkcs11_card *p11card, CK_MECHANISM_TYPE mech, unsigned int flags)
 {
 	sc_pkcs11_mechanism_type_t *mt;
-	unsigned int n;
-
-	for (n = 0; n < p11card->nmechanisms; n++) {
+	unsigned int n = 0;
+
+	/* The index holds the first registration of a mechanism; if that one
+	 * lacks the flags, continue with the ones registered after it */
+	if (mech < SC_PKCS11_MECH_INDEX_SIZE) {
+		if (!p11card->mech_index[mech] && p11card->nmechanisms < 0xFF)
+			return NULL;
+		n = p11card->mech_index[mech] ? p11card->mech_index[mech] - 1 : 0;
+	}
+	for (; n < p11card->nmechanisms; n++) {
 		mt = p11card->mechanisms[n];
 		if (mt && mt->mech == mech && ((mt->mech_info.flags & flags) == flags))
 			return mt;
@@ -334,6 +412,63 @@ done:
 	LOG_FUNC_RETURN(context, rv);
 }
 
+/*
+ * Sign several inputs without a signing context,
+ * for mechanisms that do no hashing
+ */
+CK_RV
+sc_pkcs11_sign_batch(struct sc_pkcs11_session *session, CK_MECHANISM_PTR pMechanism,
+		struct sc_pkcs11_object *key, CK_MECHANISM_TYPE key_type, CK_ULONG ulCount,
+		CK_BYTE_PTR *ppData, CK_ULONG_PTR pulDataLen,
+		CK_BYTE_PTR *ppSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	struct sc_pkcs11_card *p11card;
+	sc_pkcs11_mechanism_type_t *mt;
+	CK_ULONG length, i;
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	if (!session || !session->slot || !(p11card = session->slot->card))
+		LOG_FUNC_RETURN(context, CKR_ARGUMENTS_BAD);
+
+	sc_log(context, "mechanism 0x%lX, key-type 0x%lX, %lu inputs",
+			pMechanism->mechanism, key_type, ulCount);
+	/* the inputs are digests or raw data, nothing is hashed */
+	switch (pMechanism->mechanism) {
+	case CKM_RSA_PKCS:
+	case CKM_RSA_X_509:
+	case CKM_GOSTR3410:
+	case CKM_ECDSA:
+		break;
+	default:
+		LOG_FUNC_RETURN(context, CKR_MECHANISM_INVALID);
+	}
+	mt = sc_pkcs11_find_mechanism(p11card, pMechanism->mechanism, CKF_SIGN);
+	if (mt == NULL)
+		LOG_FUNC_RETURN(context, CKR_MECHANISM_INVALID);
+	if (mt->key_type != key_type)
+		LOG_FUNC_RETURN(context, CKR_KEY_TYPE_INCONSISTENT);
+	if (key->ops->sign_batch == NULL)
+		LOG_FUNC_RETURN(context, CKR_FUNCTION_NOT_SUPPORTED);
+
+	/* same as C_Sign(): report the length without signing anything */
+	rv = signature_size(session, key, &length);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, rv);
+	for (i = 0; i < ulCount; i++)
+		if (ppSignature == NULL || pulSignatureLen[i] < length)
+			break;
+	if (i < ulCount) {
+		for (i = 0; i < ulCount; i++)
+			pulSignatureLen[i] = length;
+		LOG_FUNC_RETURN(context, ppSignature ? CKR_BUFFER_TOO_SMALL : CKR_OK);
+	}
+
+	rv = key->ops->sign_batch(session, key, pMechanism, ulCount,
+			ppData, pulDataLen, ppSignature, pulSignatureLen);
+	LOG_FUNC_RETURN(context, rv);
+}
+
 /*
  * Initialize a signature operation
  */
@@ -445,37 +580,36 @@ sc_pkcs11_signature_final(sc_pkcs11_operation_t *operation,
 }
 
 static CK_RV
-sc_pkcs11_signature_size(sc_pkcs11_operation_t *operation, CK_ULONG_PTR pLength)
+signature_size(struct sc_pkcs11_session *session, struct sc_pkcs11_object *key,
+		CK_ULONG_PTR pLength)
 {
-	struct sc_pkcs11_object *key;
 	CK_ATTRIBUTE attr = { CKA_MODULUS_BITS, pLength, sizeof(*pLength) };
 	CK_KEY_TYPE key_type;
 	CK_ATTRIBUTE attr_key_type = { CKA_KEY_TYPE, &key_type, sizeof(key_type) };
 	CK_RV rv;
 
-	key = ((struct signature_data *) operation->priv_data)->key;
 	/*
 	 * EC and GOSTR do not have CKA_MODULUS_BITS attribute.
 	 * But other code in framework treats them as if they do.
 	 * So should do switch(key_type)
 	 * and then get what ever attributes are needed.
 	 */
-	rv = key->ops->get_attribute(operation->session, key, &attr_key_type);
+	rv = key->ops->get_attribute(session, key, &attr_key_type);
 	if (rv == CKR_OK) {
 		switch(key_type) {
 			case CKK_RSA:
-				rv = key->ops->get_attribute(operation->session, key, &attr);
+				rv = key->ops->get_attribute(session, key, &attr);
 				/* convert bits to bytes */
 				if (rv == CKR_OK)
 					*pLength = (*pLength + 7) / 8;
 				break;
 			case CKK_EC:
 				/* TODO: -DEE we should use something other then CKA_MODULUS_BITS... */
-				rv = key->ops->get_attribute(operation->session, key, &attr);
+				rv = key->ops->get_attribute(session, key, &attr);
 				*pLength = ((*pLength + 7)/8) * 2 ; /* 2*nLen in bytes */
 				break;
 			case CKK_GOSTR3410:
-				rv = key->ops->get_attribute(operation->session, key, &attr);
+				rv = key->ops->get_attribute(session, key, &attr);
 				if (rv == CKR_OK)
 					*pLength = (*pLength + 7) / 8 * 2;
 				break;
@@ -487,6 +621,15 @@ sc_pkcs11_signature_size(sc_pkcs11_operation_t *operation, CK_ULONG_PTR pLength)
 	LOG_FUNC_RETURN(context, rv);
 }
 
+static CK_RV
+sc_pkcs11_signature_size(sc_pkcs11_operation_t *operation, CK_ULONG_PTR pLength)
+{
+	struct sc_pkcs11_object *key;
+
+	key = ((struct signature_data *) operation->priv_data)->key;
+	return signature_size(operation->session, key, pLength);
+}
+
 static void
 sc_pkcs11_signature_release(sc_pkcs11_operation_t *operation)
 {
@@ -910,11 +1053,9 @@ sc_pkcs11_derive(sc_pkcs11_operation_t *operation,
  * Create new mechanism type for a mechanism supported by
  * the card
  */
-sc_pkcs11_mechanism_type_t *
-sc_pkcs11_new_fw_mechanism(CK_MECHANISM_TYPE mech,
-				CK_MECHANISM_INFO_PTR pInfo,
-				CK_KEY_TYPE key_type,
-				void *priv_data)
+static sc_pkcs11_mechanism_type_t *
+new_fw_mechanism(CK_MECHANISM_TYPE mech,
+		CK_MECHANISM_INFO_PTR pInfo, CK_KEY_TYPE key_type, void *priv_data)
 {
 	sc_pkcs11_mechanism_type_t *mt;
 
@@ -954,6 +1095,29 @@ sc_pkcs11_new_fw_mechanism(CK_MECHANISM_TYPE mech,
 	return mt;
 }
 
+sc_pkcs11_mechanism_type_t *
+sc_pkcs11_new_fw_mechanism(CK_MECHANISM_TYPE mech,
+				CK_MECHANISM_INFO_PTR pInfo,
+				CK_KEY_TYPE key_type,
+				void *priv_data)
+{
+	sc_pkcs11_mechanism_type_t *mt;
+
+	/* mechanisms with private data belong to the caller */
+	if (priv_data != NULL)
+		return new_fw_mechanism(mech, pInfo, key_type, priv_data);
+
+	mt = find_shared_mechanism(mech, pInfo, key_type, NULL);
+	if (mt != NULL)
+		return mt;
+	mt = new_fw_mechanism(mech, pInfo, key_type, NULL);
+	if (mt != NULL && add_shared_mechanism(mt) != CKR_OK) {
+		free(mt);
+		mt = NULL;
+	}
+	return mt;
+}
+
 /*
  * Register generic mechanisms
  */
@@ -977,7 +1141,7 @@ sc_pkcs11_register_sign_and_hash_mechanism(struct sc_pkcs11_card *p11card,
 		sc_pkcs11_mechanism_type_t *sign_type)
 {
 	sc_pkcs11_mechanism_type_t *hash_type, *new_type;
-	struct hash_signature_info *info;
+	struct hash_signature_info *info, lookup;
 	CK_MECHANISM_INFO mech_info = sign_type->mech_info;
 
 	if (!(hash_type = sc_pkcs11_find_mechanism(p11card, hash_mech, CKF_DIGEST)))
@@ -986,16 +1150,27 @@ sc_pkcs11_register_sign_and_hash_mechanism(struct sc_pkcs11_card *p11card,
 	/* These hash-based mechs can only be used for sign/verify */
 	mech_info.flags &= (CKF_SIGN | CKF_SIGN_RECOVER | CKF_VERIFY | CKF_VERIFY_RECOVER);
 
+	memset(&lookup, 0, sizeof(lookup));
+	lookup.sign_type = sign_type;
+	lookup.hash_type = hash_type;
+	new_type = find_shared_mechanism(mech, &mech_info, sign_type->key_type, &lookup);
+	if (new_type)
+		return sc_pkcs11_register_mechanism(p11card, new_type);
+
 	info = calloc(1, sizeof(*info));
+	if (!info)
+		return CKR_HOST_MEMORY;
 	info->mech = mech;
 	info->sign_type = sign_type;
 	info->hash_type = hash_type;
 	info->sign_mech = sign_type->mech;
 	info->hash_mech = hash_mech;
 
-	new_type = sc_pkcs11_new_fw_mechanism(mech, &mech_info, sign_type->key_type, info);
-
-	if (!new_type)
+	new_type = new_fw_mechanism(mech, &mech_info, sign_type->key_type, info);
+	if (!new_type || add_shared_mechanism(new_type) != CKR_OK) {
+		free(new_type);
+		free(info);
 		return CKR_HOST_MEMORY;
+	}
 	return sc_pkcs11_register_mechanism(p11card, new_type);
 }
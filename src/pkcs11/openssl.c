@@ -151,8 +151,8 @@ static sc_pkcs11_mechanism_type_t openssl_ripemd160_mech = {
 	NULL			/* mech_data */
 };
 
-void
-sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *card)
+static void
+openssl_load_gost_engine(void)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L && !defined(OPENSSL_NO_ENGINE)
 	void (*locking_cb)(int, int, const char *, int);
@@ -190,23 +190,51 @@ sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *card)
 	if (locking_cb)
 		CRYPTO_set_locking_callback(locking_cb);
 #endif /* OPENSSL_VERSION_NUMBER >= 0x10000000L && !defined(OPENSSL_NO_ENGINE) */
+}
+
+/*
+ * Make the GOST engine the default and look up the digests. This
+ * reconfigures OpenSSL for the whole process, so it is done once when
+ * the first card is registered rather than for every card.
+ */
+static void
+openssl_init(void)
+{
+	static int initialized = 0;
+
+	if (initialized)
+		return;
+	initialized = 1;
+
+	openssl_load_gost_engine();
 
 	openssl_sha1_mech.mech_data = EVP_sha1();
-	sc_pkcs11_register_mechanism(card, &openssl_sha1_mech);
 #if OPENSSL_VERSION_NUMBER >= 0x00908000L
 	openssl_sha256_mech.mech_data = EVP_sha256();
-	sc_pkcs11_register_mechanism(card, &openssl_sha256_mech);
 	openssl_sha384_mech.mech_data = EVP_sha384();
-	sc_pkcs11_register_mechanism(card, &openssl_sha384_mech);
 	openssl_sha512_mech.mech_data = EVP_sha512();
-	sc_pkcs11_register_mechanism(card, &openssl_sha512_mech);
 #endif
 	openssl_md5_mech.mech_data = EVP_md5();
-	sc_pkcs11_register_mechanism(card, &openssl_md5_mech);
 	openssl_ripemd160_mech.mech_data = EVP_ripemd160();
-	sc_pkcs11_register_mechanism(card, &openssl_ripemd160_mech);
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L
 	openssl_gostr3411_mech.mech_data = EVP_get_digestbynid(NID_id_GostR3411_94);
+#endif
+}
+
+void
+sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *card)
+{
+	openssl_init();
+
+	sc_pkcs11_register_mechanism(card, &openssl_sha1_mech);
+#if OPENSSL_VERSION_NUMBER >= 0x00908000L
+	sc_pkcs11_register_mechanism(card, &openssl_sha256_mech);
+	sc_pkcs11_register_mechanism(card, &openssl_sha384_mech);
+	sc_pkcs11_register_mechanism(card, &openssl_sha512_mech);
+#endif
+	sc_pkcs11_register_mechanism(card, &openssl_md5_mech);
+	sc_pkcs11_register_mechanism(card, &openssl_ripemd160_mech);
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
 	sc_pkcs11_register_mechanism(card, &openssl_gostr3411_mech);
 #endif
 }
@@ -0,0 +1,978 @@
+/*
+ * pkcs11-agent.c: PKCS#11 module forwarding all calls to opensc-agent
+ *
+ * Processes loading this module share the card connections, the bound
+ * PKCS#15 state and the login of the opensc-pkcs11 module running inside
+ * opensc-agent, instead of each binding the token on its own.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CRYPTOKI_EXPORTS
+#include "pkcs11/pkcs11.h"
+#include "common/pkcs11-agent-proto.h"
+
+extern CK_FUNCTION_LIST agent_function_list;
+
+static pthread_mutex_t agent_lock = PTHREAD_MUTEX_INITIALIZER;
+static p11_agent_buf_t agent_buf;
+static int agent_fd = -1;
+static int agent_initialized = 0;
+
+static CK_RV agent_connect(void)
+{
+	struct sockaddr_un addr;
+	CK_ULONG version, ulong_size;
+	CK_RV rv;
+	uid_t uid;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (p11_agent_socket_path(addr.sun_path, sizeof(addr.sun_path)) < 0)
+		return CKR_GENERAL_ERROR;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return CKR_GENERAL_ERROR;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return CKR_DEVICE_ERROR;
+	}
+	/* the PIN and the data to sign go only to an agent of this user */
+	if (p11_agent_peer_uid(fd, &uid) < 0 || uid != getuid()) {
+		close(fd);
+		return CKR_DEVICE_ERROR;
+	}
+
+	p11_agent_buf_reset(&agent_buf);
+	p11_agent_put_ulong(&agent_buf, P11A_HELLO);
+	p11_agent_put_ulong(&agent_buf, P11_AGENT_PROTOCOL_VERSION);
+	p11_agent_put_ulong(&agent_buf, sizeof(CK_ULONG));
+	if (p11_agent_send(fd, &agent_buf) < 0 || p11_agent_recv(fd, &agent_buf) < 0) {
+		close(fd);
+		return CKR_DEVICE_ERROR;
+	}
+	rv = p11_agent_get_ulong(&agent_buf);
+	version = p11_agent_get_ulong(&agent_buf);
+	ulong_size = p11_agent_get_ulong(&agent_buf);
+	if (agent_buf.error || rv != CKR_OK || version != P11_AGENT_PROTOCOL_VERSION
+			|| ulong_size != sizeof(CK_ULONG)) {
+		close(fd);
+		return CKR_DEVICE_ERROR;
+	}
+	agent_fd = fd;
+	return CKR_OK;
+}
+
+static void agent_disconnect(void)
+{
+	if (agent_fd >= 0)
+		close(agent_fd);
+	agent_fd = -1;
+}
+
+/* Lock the connection and start a request, on success agent_end() must follow */
+static CK_RV agent_begin(enum p11_agent_op op)
+{
+	CK_RV rv;
+
+	pthread_mutex_lock(&agent_lock);
+	if (!agent_initialized) {
+		pthread_mutex_unlock(&agent_lock);
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	}
+	if (agent_fd < 0) {
+		rv = agent_connect();
+		if (rv != CKR_OK) {
+			pthread_mutex_unlock(&agent_lock);
+			return rv;
+		}
+	}
+	p11_agent_buf_reset(&agent_buf);
+	p11_agent_put_ulong(&agent_buf, op);
+	return CKR_OK;
+}
+
+/* Send the request and return the CK_RV of the remote call */
+static CK_RV agent_transact(void)
+{
+	CK_RV rv;
+
+	if (agent_buf.error)
+		return CKR_ARGUMENTS_BAD;
+	if (p11_agent_send(agent_fd, &agent_buf) < 0 || p11_agent_recv(agent_fd, &agent_buf) < 0) {
+		/* sessions are gone with the connection, reconnect on next call */
+		agent_disconnect();
+		return CKR_DEVICE_ERROR;
+	}
+	rv = p11_agent_get_ulong(&agent_buf);
+	return agent_buf.error ? CKR_DEVICE_ERROR : rv;
+}
+
+static CK_RV agent_end(CK_RV rv)
+{
+	if (agent_buf.error && rv == CKR_OK)
+		rv = CKR_DEVICE_ERROR;
+	p11_agent_buf_reset(&agent_buf);
+	pthread_mutex_unlock(&agent_lock);
+	return rv;
+}
+
+/* Encode the size of a caller supplied output buffer */
+static void agent_put_outbuf(CK_VOID_PTR out, CK_ULONG_PTR out_len)
+{
+	p11_agent_put_ulong(&agent_buf, out ? *out_len : P11_AGENT_NULL_PTR);
+}
+
+static void agent_get_outbuf(CK_RV rv, CK_BYTE_PTR out, CK_ULONG_PTR out_len)
+{
+	const unsigned char *data;
+	CK_ULONG len, data_len;
+
+	if (rv != CKR_OK && rv != CKR_BUFFER_TOO_SMALL)
+		return;
+	len = p11_agent_get_ulong(&agent_buf);
+	p11_agent_get_bytes(&agent_buf, &data, &data_len);
+	if (agent_buf.error)
+		return;
+	if (data && out) {
+		if (data_len > *out_len) {
+			agent_buf.error = 1;
+			return;
+		}
+		memcpy(out, data, data_len);
+	}
+	*out_len = len;
+}
+
+static void agent_get_ulong_array(CK_RV rv, CK_ULONG_PTR list, CK_ULONG_PTR count)
+{
+	CK_ULONG i, n;
+
+	if (rv != CKR_OK && rv != CKR_BUFFER_TOO_SMALL)
+		return;
+	n = p11_agent_get_ulong(&agent_buf);
+	if (rv == CKR_OK && list) {
+		if (n > *count) {
+			agent_buf.error = 1;
+			return;
+		}
+		for (i = 0; i < n; i++)
+			list[i] = p11_agent_get_ulong(&agent_buf);
+	}
+	*count = n;
+}
+
+/* Session call with one input buffer and one output buffer */
+static CK_RV agent_call_data(enum p11_agent_op op, CK_SESSION_HANDLE hSession,
+		CK_BYTE_PTR in, CK_ULONG in_len, CK_BYTE_PTR out, CK_ULONG_PTR out_len)
+{
+	CK_RV rv;
+
+	if (out_len == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(op);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_bytes(&agent_buf, in, in_len);
+	agent_put_outbuf(out, out_len);
+	rv = agent_transact();
+	agent_get_outbuf(rv, out, out_len);
+	return agent_end(rv);
+}
+
+/* Session call with an output buffer only */
+static CK_RV agent_call_final(enum p11_agent_op op, CK_SESSION_HANDLE hSession,
+		CK_BYTE_PTR out, CK_ULONG_PTR out_len)
+{
+	CK_RV rv;
+
+	if (out_len == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(op);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	agent_put_outbuf(out, out_len);
+	rv = agent_transact();
+	agent_get_outbuf(rv, out, out_len);
+	return agent_end(rv);
+}
+
+/* Session call with an input buffer only */
+static CK_RV agent_call_update(enum p11_agent_op op, CK_SESSION_HANDLE hSession,
+		CK_BYTE_PTR in, CK_ULONG in_len)
+{
+	CK_RV rv;
+
+	rv = agent_begin(op);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_bytes(&agent_buf, in, in_len);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+/* Cryptographic operation initialization, hKey is ignored for digests */
+static CK_RV agent_call_init(enum p11_agent_op op, CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	CK_RV rv;
+
+	if (pMechanism == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(op);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_mechanism(&agent_buf, pMechanism);
+	p11_agent_put_ulong(&agent_buf, hKey);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_Initialize(CK_VOID_PTR pInitArgs)
+{
+	CK_C_INITIALIZE_ARGS_PTR args = (CK_C_INITIALIZE_ARGS_PTR) pInitArgs;
+	CK_RV rv;
+
+	if (args && args->pReserved != NULL)
+		return CKR_ARGUMENTS_BAD;
+
+	pthread_mutex_lock(&agent_lock);
+	if (agent_initialized) {
+		pthread_mutex_unlock(&agent_lock);
+		return CKR_CRYPTOKI_ALREADY_INITIALIZED;
+	}
+	p11_agent_buf_init(&agent_buf);
+	rv = agent_connect();
+	if (rv == CKR_OK)
+		agent_initialized = 1;
+	else
+		p11_agent_buf_free(&agent_buf);
+	pthread_mutex_unlock(&agent_lock);
+	return rv;
+}
+
+CK_RV C_Finalize(CK_VOID_PTR pReserved)
+{
+	if (pReserved != NULL)
+		return CKR_ARGUMENTS_BAD;
+
+	pthread_mutex_lock(&agent_lock);
+	if (!agent_initialized) {
+		pthread_mutex_unlock(&agent_lock);
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	}
+	/* the agent closes all sessions of a client that went away */
+	agent_disconnect();
+	p11_agent_buf_free(&agent_buf);
+	agent_initialized = 0;
+	pthread_mutex_unlock(&agent_lock);
+	return CKR_OK;
+}
+
+CK_RV C_GetInfo(CK_INFO_PTR pInfo)
+{
+	CK_RV rv;
+
+	if (pInfo == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_INFO);
+	if (rv != CKR_OK)
+		return rv;
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		p11_agent_get_fixed(&agent_buf, pInfo, sizeof(*pInfo));
+	return agent_end(rv);
+}
+
+CK_RV C_GetFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList)
+{
+	if (ppFunctionList == NULL)
+		return CKR_ARGUMENTS_BAD;
+	*ppFunctionList = &agent_function_list;
+	return CKR_OK;
+}
+
+CK_RV C_GetSlotList(CK_BBOOL tokenPresent, CK_SLOT_ID_PTR pSlotList, CK_ULONG_PTR pulCount)
+{
+	CK_RV rv;
+
+	if (pulCount == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_SLOT_LIST);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, tokenPresent);
+	agent_put_outbuf(pSlotList, pulCount);
+	rv = agent_transact();
+	agent_get_ulong_array(rv, pSlotList, pulCount);
+	return agent_end(rv);
+}
+
+CK_RV C_GetSlotInfo(CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo)
+{
+	CK_RV rv;
+
+	if (pInfo == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_SLOT_INFO);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, slotID);
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		p11_agent_get_fixed(&agent_buf, pInfo, sizeof(*pInfo));
+	return agent_end(rv);
+}
+
+CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
+{
+	CK_RV rv;
+
+	if (pInfo == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_TOKEN_INFO);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, slotID);
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		p11_agent_get_fixed(&agent_buf, pInfo, sizeof(*pInfo));
+	return agent_end(rv);
+}
+
+CK_RV C_GetMechanismList(CK_SLOT_ID slotID, CK_MECHANISM_TYPE_PTR pMechanismList, CK_ULONG_PTR pulCount)
+{
+	CK_RV rv;
+
+	if (pulCount == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_MECHANISM_LIST);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, slotID);
+	agent_put_outbuf(pMechanismList, pulCount);
+	rv = agent_transact();
+	agent_get_ulong_array(rv, pMechanismList, pulCount);
+	return agent_end(rv);
+}
+
+CK_RV C_GetMechanismInfo(CK_SLOT_ID slotID, CK_MECHANISM_TYPE type, CK_MECHANISM_INFO_PTR pInfo)
+{
+	CK_RV rv;
+
+	if (pInfo == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_MECHANISM_INFO);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, slotID);
+	p11_agent_put_ulong(&agent_buf, type);
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		p11_agent_get_fixed(&agent_buf, pInfo, sizeof(*pInfo));
+	return agent_end(rv);
+}
+
+CK_RV C_InitToken(CK_SLOT_ID slotID, CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen, CK_UTF8CHAR_PTR pLabel)
+{
+	/* token initialization is not shared through the agent */
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_InitPIN(CK_SESSION_HANDLE hSession, CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen)
+{
+	return agent_call_update(P11A_INIT_PIN, hSession, pPin, ulPinLen);
+}
+
+CK_RV C_SetPIN(CK_SESSION_HANDLE hSession, CK_UTF8CHAR_PTR pOldPin, CK_ULONG ulOldLen,
+		CK_UTF8CHAR_PTR pNewPin, CK_ULONG ulNewLen)
+{
+	CK_RV rv;
+
+	rv = agent_begin(P11A_SET_PIN);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_bytes(&agent_buf, pOldPin, ulOldLen);
+	p11_agent_put_bytes(&agent_buf, pNewPin, ulNewLen);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_OpenSession(CK_SLOT_ID slotID, CK_FLAGS flags, CK_VOID_PTR pApplication,
+		CK_NOTIFY Notify, CK_SESSION_HANDLE_PTR phSession)
+{
+	CK_RV rv;
+
+	if (phSession == NULL)
+		return CKR_ARGUMENTS_BAD;
+	/* notification callbacks are not forwarded */
+	rv = agent_begin(P11A_OPEN_SESSION);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, slotID);
+	p11_agent_put_ulong(&agent_buf, flags);
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		*phSession = p11_agent_get_ulong(&agent_buf);
+	return agent_end(rv);
+}
+
+CK_RV C_CloseSession(CK_SESSION_HANDLE hSession)
+{
+	return agent_call_update(P11A_CLOSE_SESSION, hSession, NULL, 0);
+}
+
+CK_RV C_CloseAllSessions(CK_SLOT_ID slotID)
+{
+	CK_RV rv;
+
+	rv = agent_begin(P11A_CLOSE_ALL_SESSIONS);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, slotID);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_GetSessionInfo(CK_SESSION_HANDLE hSession, CK_SESSION_INFO_PTR pInfo)
+{
+	CK_RV rv;
+
+	if (pInfo == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_SESSION_INFO);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		p11_agent_get_fixed(&agent_buf, pInfo, sizeof(*pInfo));
+	return agent_end(rv);
+}
+
+CK_RV C_GetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pOperationState,
+		CK_ULONG_PTR pulOperationStateLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_SetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pOperationState,
+		CK_ULONG ulOperationStateLen, CK_OBJECT_HANDLE hEncryptionKey,
+		CK_OBJECT_HANDLE hAuthenticationKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_Login(CK_SESSION_HANDLE hSession, CK_USER_TYPE userType, CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen)
+{
+	CK_RV rv;
+
+	rv = agent_begin(P11A_LOGIN);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_ulong(&agent_buf, userType);
+	p11_agent_put_bytes(&agent_buf, pPin, ulPinLen);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_Logout(CK_SESSION_HANDLE hSession)
+{
+	return agent_call_update(P11A_LOGOUT, hSession, NULL, 0);
+}
+
+CK_RV C_CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phObject)
+{
+	CK_RV rv;
+
+	if (phObject == NULL || (pTemplate == NULL && ulCount))
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_CREATE_OBJECT);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_template(&agent_buf, pTemplate, ulCount);
+	rv = agent_transact();
+	if (rv == CKR_OK)
+		*phObject = p11_agent_get_ulong(&agent_buf);
+	return agent_end(rv);
+}
+
+CK_RV C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phNewObject)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DestroyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject)
+{
+	CK_RV rv;
+
+	rv = agent_begin(P11A_DESTROY_OBJECT);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_ulong(&agent_buf, hObject);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_GetObjectSize(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ULONG_PTR pulSize)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_GetAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+	const unsigned char *data;
+	CK_ULONG i, len, data_len;
+	CK_RV rv;
+
+	if (pTemplate == NULL && ulCount)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GET_ATTRIBUTE_VALUE);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_ulong(&agent_buf, hObject);
+	p11_agent_put_ulong(&agent_buf, ulCount);
+	for (i = 0; i < ulCount; i++) {
+		p11_agent_put_ulong(&agent_buf, pTemplate[i].type);
+		agent_put_outbuf(pTemplate[i].pValue, &pTemplate[i].ulValueLen);
+	}
+	rv = agent_transact();
+	/* these codes still report per attribute results */
+	if (rv == CKR_OK || rv == CKR_ATTRIBUTE_SENSITIVE || rv == CKR_ATTRIBUTE_TYPE_INVALID
+			|| rv == CKR_BUFFER_TOO_SMALL) {
+		for (i = 0; i < ulCount && !agent_buf.error; i++) {
+			len = p11_agent_get_ulong(&agent_buf);
+			p11_agent_get_bytes(&agent_buf, &data, &data_len);
+			if (data && pTemplate[i].pValue) {
+				if (data_len > pTemplate[i].ulValueLen) {
+					agent_buf.error = 1;
+					break;
+				}
+				memcpy(pTemplate[i].pValue, data, data_len);
+			}
+			pTemplate[i].ulValueLen = len;
+		}
+	}
+	return agent_end(rv);
+}
+
+CK_RV C_SetAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+	CK_RV rv;
+
+	if (pTemplate == NULL && ulCount)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_SET_ATTRIBUTE_VALUE);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_ulong(&agent_buf, hObject);
+	p11_agent_put_template(&agent_buf, pTemplate, ulCount);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+	CK_RV rv;
+
+	if (pTemplate == NULL && ulCount)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_FIND_OBJECTS_INIT);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_template(&agent_buf, pTemplate, ulCount);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_FindObjects(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE_PTR phObject,
+		CK_ULONG ulMaxObjectCount, CK_ULONG_PTR pulObjectCount)
+{
+	CK_RV rv;
+
+	if (phObject == NULL || pulObjectCount == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_FIND_OBJECTS);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_ulong(&agent_buf, ulMaxObjectCount);
+	rv = agent_transact();
+	if (rv == CKR_OK) {
+		*pulObjectCount = ulMaxObjectCount;
+		agent_get_ulong_array(rv, phObject, pulObjectCount);
+	}
+	return agent_end(rv);
+}
+
+CK_RV C_FindObjectsFinal(CK_SESSION_HANDLE hSession)
+{
+	return agent_call_update(P11A_FIND_OBJECTS_FINAL, hSession, NULL, 0);
+}
+
+CK_RV C_EncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	return agent_call_init(P11A_ENCRYPT_INIT, hSession, pMechanism, hKey);
+}
+
+CK_RV C_Encrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
+{
+	return agent_call_data(P11A_ENCRYPT, hSession, pData, ulDataLen,
+			pEncryptedData, pulEncryptedDataLen);
+}
+
+CK_RV C_EncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG_PTR pulEncryptedPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_EncryptFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pLastEncryptedPart,
+		CK_ULONG_PTR pulLastEncryptedPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	return agent_call_init(P11A_DECRYPT_INIT, hSession, pMechanism, hKey);
+}
+
+CK_RV C_Decrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedData, CK_ULONG ulEncryptedDataLen,
+		CK_BYTE_PTR pData, CK_ULONG_PTR pulDataLen)
+{
+	return agent_call_data(P11A_DECRYPT, hSession, pEncryptedData, ulEncryptedDataLen,
+			pData, pulDataLen);
+}
+
+CK_RV C_DecryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedPart, CK_ULONG ulEncryptedPartLen,
+		CK_BYTE_PTR pPart, CK_ULONG_PTR pulPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DecryptFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pLastPart, CK_ULONG_PTR pulLastPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DigestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism)
+{
+	return agent_call_init(P11A_DIGEST_INIT, hSession, pMechanism, CK_INVALID_HANDLE);
+}
+
+CK_RV C_Digest(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pDigest, CK_ULONG_PTR pulDigestLen)
+{
+	return agent_call_data(P11A_DIGEST, hSession, pData, ulDataLen, pDigest, pulDigestLen);
+}
+
+CK_RV C_DigestUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen)
+{
+	return agent_call_update(P11A_DIGEST_UPDATE, hSession, pPart, ulPartLen);
+}
+
+CK_RV C_DigestKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DigestFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pDigest, CK_ULONG_PTR pulDigestLen)
+{
+	return agent_call_final(P11A_DIGEST_FINAL, hSession, pDigest, pulDigestLen);
+}
+
+CK_RV C_SignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	return agent_call_init(P11A_SIGN_INIT, hSession, pMechanism, hKey);
+}
+
+CK_RV C_Sign(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	return agent_call_data(P11A_SIGN, hSession, pData, ulDataLen, pSignature, pulSignatureLen);
+}
+
+CK_RV C_SignUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen)
+{
+	return agent_call_update(P11A_SIGN_UPDATE, hSession, pPart, ulPartLen);
+}
+
+CK_RV C_SignFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	return agent_call_final(P11A_SIGN_FINAL, hSession, pSignature, pulSignatureLen);
+}
+
+CK_RV C_SignRecoverInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_SignRecover(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_VerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	return agent_call_init(P11A_VERIFY_INIT, hSession, pMechanism, hKey);
+}
+
+CK_RV C_Verify(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen)
+{
+	CK_RV rv;
+
+	rv = agent_begin(P11A_VERIFY);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_bytes(&agent_buf, pData, ulDataLen);
+	p11_agent_put_bytes(&agent_buf, pSignature, ulSignatureLen);
+	rv = agent_transact();
+	return agent_end(rv);
+}
+
+CK_RV C_VerifyUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen)
+{
+	return agent_call_update(P11A_VERIFY_UPDATE, hSession, pPart, ulPartLen);
+}
+
+CK_RV C_VerifyFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen)
+{
+	return agent_call_update(P11A_VERIFY_FINAL, hSession, pSignature, ulSignatureLen);
+}
+
+CK_RV C_VerifyRecoverInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_VerifyRecover(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen,
+		CK_BYTE_PTR pData, CK_ULONG_PTR pulDataLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DigestEncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG_PTR pulEncryptedPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DecryptDigestUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedPart,
+		CK_ULONG ulEncryptedPartLen, CK_BYTE_PTR pPart, CK_ULONG_PTR pulPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_SignEncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG_PTR pulEncryptedPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DecryptVerifyUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedPart,
+		CK_ULONG ulEncryptedPartLen, CK_BYTE_PTR pPart, CK_ULONG_PTR pulPartLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_GenerateKeyPair(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pPublicKeyTemplate, CK_ULONG ulPublicKeyAttributeCount,
+		CK_ATTRIBUTE_PTR pPrivateKeyTemplate, CK_ULONG ulPrivateKeyAttributeCount,
+		CK_OBJECT_HANDLE_PTR phPublicKey, CK_OBJECT_HANDLE_PTR phPrivateKey)
+{
+	CK_RV rv;
+
+	if (pMechanism == NULL || phPublicKey == NULL || phPrivateKey == NULL
+			|| (pPublicKeyTemplate == NULL && ulPublicKeyAttributeCount)
+			|| (pPrivateKeyTemplate == NULL && ulPrivateKeyAttributeCount))
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_begin(P11A_GENERATE_KEY_PAIR);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_put_ulong(&agent_buf, hSession);
+	p11_agent_put_mechanism(&agent_buf, pMechanism);
+	p11_agent_put_template(&agent_buf, pPublicKeyTemplate, ulPublicKeyAttributeCount);
+	p11_agent_put_template(&agent_buf, pPrivateKeyTemplate, ulPrivateKeyAttributeCount);
+	rv = agent_transact();
+	if (rv == CKR_OK) {
+		*phPublicKey = p11_agent_get_ulong(&agent_buf);
+		*phPrivateKey = p11_agent_get_ulong(&agent_buf);
+	}
+	return agent_end(rv);
+}
+
+CK_RV C_WrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hWrappingKey,
+		CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pWrappedKey, CK_ULONG_PTR pulWrappedKeyLen)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_UnwrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hUnwrappingKey,
+		CK_BYTE_PTR pWrappedKey, CK_ULONG ulWrappedKeyLen, CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulAttributeCount, CK_OBJECT_HANDLE_PTR phKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_DeriveKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hBaseKey,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulAttributeCount, CK_OBJECT_HANDLE_PTR phKey)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV C_SeedRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSeed, CK_ULONG ulSeedLen)
+{
+	return agent_call_update(P11A_SEED_RANDOM, hSession, pSeed, ulSeedLen);
+}
+
+CK_RV C_GenerateRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR RandomData, CK_ULONG ulRandomLen)
+{
+	CK_ULONG len = ulRandomLen;
+	CK_RV rv;
+
+	if (RandomData == NULL)
+		return CKR_ARGUMENTS_BAD;
+	rv = agent_call_final(P11A_GENERATE_RANDOM, hSession, RandomData, &len);
+	if (rv == CKR_OK && len != ulRandomLen)
+		rv = CKR_DEVICE_ERROR;
+	return rv;
+}
+
+CK_RV C_GetFunctionStatus(CK_SESSION_HANDLE hSession)
+{
+	return CKR_FUNCTION_NOT_PARALLEL;
+}
+
+CK_RV C_CancelFunction(CK_SESSION_HANDLE hSession)
+{
+	return CKR_FUNCTION_NOT_PARALLEL;
+}
+
+CK_RV C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR pSlot, CK_VOID_PTR pReserved)
+{
+	/* a blocking wait would stall the agent for all clients */
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_FUNCTION_LIST agent_function_list = {
+	{ 2, 11 },
+	C_Initialize,
+	C_Finalize,
+	C_GetInfo,
+	C_GetFunctionList,
+	C_GetSlotList,
+	C_GetSlotInfo,
+	C_GetTokenInfo,
+	C_GetMechanismList,
+	C_GetMechanismInfo,
+	C_InitToken,
+	C_InitPIN,
+	C_SetPIN,
+	C_OpenSession,
+	C_CloseSession,
+	C_CloseAllSessions,
+	C_GetSessionInfo,
+	C_GetOperationState,
+	C_SetOperationState,
+	C_Login,
+	C_Logout,
+	C_CreateObject,
+	C_CopyObject,
+	C_DestroyObject,
+	C_GetObjectSize,
+	C_GetAttributeValue,
+	C_SetAttributeValue,
+	C_FindObjectsInit,
+	C_FindObjects,
+	C_FindObjectsFinal,
+	C_EncryptInit,
+	C_Encrypt,
+	C_EncryptUpdate,
+	C_EncryptFinal,
+	C_DecryptInit,
+	C_Decrypt,
+	C_DecryptUpdate,
+	C_DecryptFinal,
+	C_DigestInit,
+	C_Digest,
+	C_DigestUpdate,
+	C_DigestKey,
+	C_DigestFinal,
+	C_SignInit,
+	C_Sign,
+	C_SignUpdate,
+	C_SignFinal,
+	C_SignRecoverInit,
+	C_SignRecover,
+	C_VerifyInit,
+	C_Verify,
+	C_VerifyUpdate,
+	C_VerifyFinal,
+	C_VerifyRecoverInit,
+	C_VerifyRecover,
+	C_DigestEncryptUpdate,
+	C_DecryptDigestUpdate,
+	C_SignEncryptUpdate,
+	C_DecryptVerifyUpdate,
+	C_GenerateKey,
+	C_GenerateKeyPair,
+	C_WrapKey,
+	C_UnwrapKey,
+	C_DeriveKey,
+	C_SeedRandom,
+	C_GenerateRandom,
+	C_GetFunctionStatus,
+	C_CancelFunction,
+	C_WaitForSlotEvent
+};
@@ -41,6 +41,7 @@ pid_t initialized_pid = (pid_t)-1;
 #endif
 static int in_finalize = 0;
 extern CK_FUNCTION_LIST pkcs11_function_list;
+extern CK_OPENSC_FUNCTION_LIST pkcs11_opensc_function_list;
 
 #if defined(HAVE_PTHREAD) && defined(PKCS11_THREAD_LOCKING)
 #include <pthread.h>
@@ -307,6 +308,8 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	}
 	list_destroy(&virtual_slots);
 
+	sc_pkcs11_free_mechanisms();
+
 	sc_release_context(context);
 	context = NULL;
 
@@ -358,6 +361,15 @@ CK_RV C_GetFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList)
 	return CKR_OK;
 }
 
+CK_RV C_OpenSC_GetFunctionListExt(CK_OPENSC_FUNCTION_LIST_PTR_PTR ppFunctionList)
+{
+	if (ppFunctionList == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	*ppFunctionList = &pkcs11_opensc_function_list;
+	return CKR_OK;
+}
+
 CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token present */
 		    CK_SLOT_ID_PTR pSlotList,     /* receives the array of slot IDs */
 		    CK_ULONG_PTR   pulCount)      /* receives the number of slots */
@@ -400,6 +412,8 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 	numMatches = 0;
 	for (i=0; i<list_size(&virtual_slots); i++) {
 	        slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+		if (slot->reader && (slot->reader->flags & SC_READER_REMOVED))
+			continue;
 		/* the list of available slots contains:
 		 * - if present, virtual hotplug slot;
 		 * - any slot with token;
@@ -876,3 +890,9 @@ CK_FUNCTION_LIST pkcs11_function_list = {
 	C_CancelFunction,
 	C_WaitForSlotEvent
 };
+
+CK_OPENSC_FUNCTION_LIST pkcs11_opensc_function_list = {
+	CK_OPENSC_FUNCTION_LIST_VERSION,
+	&pkcs11_function_list,
+	C_OpenSC_SignBatch
+};
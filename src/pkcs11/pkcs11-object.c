@@ -686,6 +686,66 @@ out:
 }
 
 
+CK_RV
+C_OpenSC_SignBatch(CK_SESSION_HANDLE hSession,	/* the session's handle */
+		CK_MECHANISM_PTR pMechanism,	/* the signature mechanism */
+		CK_OBJECT_HANDLE hKey,		/* handle of the signature key */
+		CK_ULONG ulCount,		/* number of inputs */
+		CK_BYTE_PTR *ppData,		/* the data (digests) to be signed */
+		CK_ULONG_PTR pulDataLen,	/* their byte counts */
+		CK_BYTE_PTR *ppSignature,	/* receive the signatures */
+		CK_ULONG_PTR pulSignatureLen)	/* receive their byte counts */
+{
+	CK_BBOOL can_sign;
+	CK_KEY_TYPE key_type;
+	CK_ATTRIBUTE sign_attribute = { CKA_SIGN, &can_sign, sizeof(can_sign) };
+	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE, &key_type, sizeof(key_type) };
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	CK_RV rv;
+
+	if (pMechanism == NULL_PTR || ulCount == 0 || ppData == NULL_PTR
+			|| pulDataLen == NULL_PTR || pulSignatureLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_object_from_session(hSession, hKey, &session, &object);
+	if (rv != CKR_OK) {
+		if (rv == CKR_OBJECT_HANDLE_INVALID)
+			rv = CKR_KEY_HANDLE_INVALID;
+		goto out;
+	}
+
+	/* a batch does not use the signing context of the session */
+	if (session->operation[SC_PKCS11_OPERATION_SIGN] != NULL) {
+		rv = CKR_OPERATION_ACTIVE;
+		goto out;
+	}
+
+	rv = object->ops->get_attribute(session, object, &sign_attribute);
+	if (rv != CKR_OK || !can_sign) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+	rv = object->ops->get_attribute(session, object, &key_type_attr);
+	if (rv != CKR_OK) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+
+	rv = sc_pkcs11_sign_batch(session, pMechanism, object, key_type, ulCount,
+			ppData, pulDataLen, ppSignature, pulSignatureLen);
+
+out:
+	sc_log(context, "C_OpenSC_SignBatch() = %s", lookup_enum ( RV_T, rv ));
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+
 CK_RV
 C_SignUpdate(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		CK_BYTE_PTR pPart,		/* the data (digest) to be signed */
@@ -9,4 +9,36 @@
  */
 #define CKA_OPENSC_NON_REPUDIATION      (CKA_VENDOR_DEFINED | 1UL)
 
+/*
+ * Functions beyond PKCS#11, in a list returned by the exported
+ * C_OpenSC_GetFunctionListExt().
+ *
+ * C_OpenSC_SignBatch() signs ulCount inputs with one key in one card
+ * transaction, selecting the key and setting up the card only once. It
+ * takes the mechanisms that do no hashing (CKM_RSA_PKCS, CKM_RSA_X_509,
+ * CKM_ECDSA, CKM_GOSTR3410) and does not need C_SignInit(). Signature
+ * lengths are reported as by C_Sign(), for all inputs at once. If the card
+ * fails an input of a key without a path of its own, the application is
+ * selected again and the batch goes on from that input, the signatures
+ * made before it are kept. pulSignatureLen is only updated on success.
+ */
+#define CK_OPENSC_FUNCTION_LIST_VERSION	1
+
+typedef CK_RV (*CK_C_OpenSC_SignBatch)(CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey, CK_ULONG ulCount,
+		CK_BYTE_PTR *ppData, CK_ULONG_PTR pulDataLen,
+		CK_BYTE_PTR *ppSignature, CK_ULONG_PTR pulSignatureLen);
+
+typedef struct CK_OPENSC_FUNCTION_LIST {
+	CK_ULONG version;
+	CK_FUNCTION_LIST_PTR pkcs11;
+	CK_C_OpenSC_SignBatch C_OpenSC_SignBatch;
+} CK_OPENSC_FUNCTION_LIST;
+
+typedef CK_OPENSC_FUNCTION_LIST *CK_OPENSC_FUNCTION_LIST_PTR;
+typedef CK_OPENSC_FUNCTION_LIST_PTR *CK_OPENSC_FUNCTION_LIST_PTR_PTR;
+
+CK_RV C_OpenSC_GetFunctionListExt(CK_OPENSC_FUNCTION_LIST_PTR_PTR ppFunctionList);
+typedef CK_RV (*CK_C_OpenSC_GetFunctionListExt)(CK_OPENSC_FUNCTION_LIST_PTR_PTR);
+
 #endif
@@ -124,6 +124,12 @@ struct sc_pkcs11_object_ops {
 	/* Check compatibility of PKCS#15 object usage and an asked PKCS#11 mechanism. */
 	CK_RV (*can_do)(struct sc_pkcs11_session *, void *, CK_MECHANISM_TYPE, unsigned int);
 
+	/* Sign several inputs, see C_OpenSC_SignBatch() */
+	CK_RV (*sign_batch)(struct sc_pkcs11_session *, void *,
+			CK_MECHANISM_PTR, CK_ULONG ulCount,
+			CK_BYTE_PTR *ppData, CK_ULONG_PTR pulDataLen,
+			CK_BYTE_PTR *ppSignature, CK_ULONG_PTR pulSignatureLen);
+
 	/* Others to be added when implemented */
 };
 
@@ -191,6 +197,9 @@ typedef unsigned __int64   sc_timestamp_t;
 #endif
 
 #define SC_PKCS11_FRAMEWORK_DATA_MAX_NUM	4
+/* Mechanisms below this value are looked up through mech_index,
+ * which covers all non vendor defined ones used by OpenSC */
+#define SC_PKCS11_MECH_INDEX_SIZE	0x1300
 struct sc_pkcs11_card {
 	sc_reader_t *reader;
 	sc_card_t *card;
@@ -200,6 +209,8 @@ struct sc_pkcs11_card {
 	/* List of supported mechanisms */
 	struct sc_pkcs11_mechanism_type **mechanisms;
 	unsigned int nmechanisms;
+	/* 1 + position of a mechanism in the list, 0 if not supported */
+	unsigned char mech_index[SC_PKCS11_MECH_INDEX_SIZE];
 };
 
 struct sc_pkcs11_slot {
@@ -387,6 +398,11 @@ CK_RV sc_pkcs11_sign_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
 CK_RV sc_pkcs11_sign_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG);
 CK_RV sc_pkcs11_sign_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
 CK_RV sc_pkcs11_sign_size(struct sc_pkcs11_session *, CK_ULONG_PTR);
+CK_RV C_OpenSC_SignBatch(CK_SESSION_HANDLE, CK_MECHANISM_PTR, CK_OBJECT_HANDLE, CK_ULONG,
+				CK_BYTE_PTR *, CK_ULONG_PTR, CK_BYTE_PTR *, CK_ULONG_PTR);
+CK_RV sc_pkcs11_sign_batch(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
+				struct sc_pkcs11_object *, CK_MECHANISM_TYPE, CK_ULONG,
+				CK_BYTE_PTR *, CK_ULONG_PTR, CK_BYTE_PTR *, CK_ULONG_PTR);
 #ifdef ENABLE_OPENSSL
 CK_RV sc_pkcs11_verif_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
 				struct sc_pkcs11_object *, CK_MECHANISM_TYPE);
@@ -407,6 +423,7 @@ sc_pkcs11_operation_t *sc_pkcs11_new_operation(sc_pkcs11_session_t *,
 				sc_pkcs11_mechanism_type_t *);
 void sc_pkcs11_release_operation(sc_pkcs11_operation_t **);
 CK_RV sc_pkcs11_register_generic_mechanisms(struct sc_pkcs11_card *);
+void sc_pkcs11_free_mechanisms(void);
 #ifdef ENABLE_OPENSSL
 void sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *);
 #endif
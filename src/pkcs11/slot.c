@@ -160,18 +160,8 @@ CK_RV card_removed(sc_reader_t * reader)
 	if (card) {
 		card->framework->unbind(card);
 		sc_disconnect_card(card->card);
-		/* FIXME: free mechanisms
-		 * spaces allocated by the
-		 * sc_pkcs11_register_sign_and_hash_mechanism
-		 * and sc_pkcs11_new_fw_mechanism.
-		 * but see sc_pkcs11_register_generic_mechanisms
-		for (i=0; i < card->nmechanisms; ++i) {
-			// if 'mech_data' is a pointer earlier returned by the ?alloc
-			free(card->mechanisms[i]->mech_data);
-			// if 'mechanisms[i]' is a pointer earlier returned by the ?alloc
-			free(card->mechanisms[i]);
-		}
-		*/
+		/* the mechanism types are shared between cards,
+		 * see sc_pkcs11_free_mechanisms() */
 		free(card->mechanisms);
 		free(card);
 	}
@@ -330,9 +320,18 @@ card_detect_all(void)
 	/* Detect cards in all initialized readers */
 	for (i=0; i< sc_ctx_get_reader_count(context); i++) {
 		sc_reader_t *reader = sc_ctx_get_reader(context, i);
-		if (!reader_get_slot(reader))
+		struct sc_pkcs11_slot *slot = reader_get_slot(reader);
+
+		/* The slots of a detached reader stay, with the same IDs,
+		 * for when it comes back */
+		if (reader->flags & SC_READER_REMOVED) {
+			if (slot && (slot->card || (slot->slot_info.flags & CKF_TOKEN_PRESENT)))
+				card_removed(reader);
+			continue;
+		}
+		if (!slot)
 			initialize_reader(reader);
-		card_detect(sc_ctx_get_reader(context, i));
+		card_detect(reader);
 	}
 	sc_log(context, "All cards detected");
 	return CKR_OK;
@@ -453,7 +453,7 @@ sc_pkcs15init_set_p15card(struct sc_profile *profile, struct sc_pkcs15_card *p15
 
 		r = sc_profile_get_file_by_path(profile, &auth_info->path, &file);
                 if (r == SC_ERROR_FILE_NOT_FOUND)   {
-			if (!sc_select_file(p15card->card, &auth_info->path, &file))   {
+			if (!sc_get_file_info(p15card->card, &auth_info->path, &file))   {
 				char pin_name[16];
 
 				sprintf(pin_name, "pin-dir-%02X%02X", file->path.value[file->path.len - 2],
@@ -567,9 +567,9 @@ sc_pkcs15init_delete_by_path(struct sc_profile *profile, struct sc_pkcs15_card *
 	 * TODO: 'DELETE_SELF' exists. Proper solution would be to use this acl by every
 	 * card (driver and profile) that uses self delete ACL.
 	 */
-	/* Select the file itself */
+	/* Get the file's ACLs */
         path = *file_path;
-        rv = sc_select_file(p15card->card, &path, &file);
+        rv = sc_get_file_info(p15card->card, &path, &file);
         LOG_TEST_RET(ctx, rv, "cannot select file to delete");
 
 	if (sc_file_get_acl_entry(file, SC_AC_OP_DELETE_SELF))   {
@@ -586,9 +586,9 @@ sc_pkcs15init_delete_by_path(struct sc_profile *profile, struct sc_pkcs15_card *
 		sc_log(ctx, "Try to get the parent's 'DELETE' access");
 		/*file_type = file->type;*/
 		if (file_path->len >= 2) {
-			/* Select the parent DF */
+			/* Get the parent DF's ACLs */
 			path.len -= 2;
-			rv = sc_select_file(p15card->card, &path, &parent);
+			rv = sc_get_file_info(p15card->card, &path, &parent);
 			LOG_TEST_RET(ctx, rv, "Cannot select parent");
 
 			rv = sc_pkcs15init_authenticate(profile, p15card, parent, SC_AC_OP_DELETE);
@@ -2636,11 +2636,25 @@ static int
 sc_pkcs15init_update_odf(struct sc_pkcs15_card *p15card, struct sc_profile *profile)
 {
 	struct sc_context	*ctx = p15card->card->ctx;
+	struct sc_file	*file = NULL;
 	unsigned char	*buf = NULL;
 	size_t		size;
 	int		r;
 
 	LOG_FUNC_CALLED(ctx);
+	/* The binding may have read the ODF from the file cache, and left
+	 * only its path in 'file_odf'. Get the ACLs from the card then. */
+	if (!sc_file_get_acl_entry(p15card->file_odf, SC_AC_OP_UPDATE))   {
+		r = sc_select_file(p15card->card, &p15card->file_odf->path, &file);
+		if (r == SC_SUCCESS)   {
+			sc_file_free(p15card->file_odf);
+			p15card->file_odf = file;
+		}
+		else if (r != SC_ERROR_FILE_NOT_FOUND)   {
+			LOG_TEST_RET(ctx, r, "Cannot select EF(ODF)");
+		}
+	}
+
 	r = sc_pkcs15_encode_odf(ctx, p15card, &buf, &size);
 	if (r >= 0)
 		r = sc_pkcs15init_update_file(profile, p15card, p15card->file_odf, buf, size);
@@ -2668,7 +2682,7 @@ sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
 	LOG_FUNC_CALLED(ctx);
 	sc_profile_get_file_by_path(profile, &df->path, &file);
 	if (file == NULL)
-		sc_select_file(card, &df->path, &file);
+		sc_get_file_info(card, &df->path, &file);
 
 	r = sc_pkcs15_encode_df(card->ctx, p15card, df, &buf, &bufsize);
 	if (r >= 0) {
@@ -2927,7 +2941,7 @@ sc_pkcs15init_delete_object(struct sc_pkcs15_card *p15card, struct sc_profile *p
 
 	if (profile->ops->delete_object == NULL || r == SC_ERROR_NOT_SUPPORTED)  {
 		if (path.len || path.aid.len)   {
-			r = sc_select_file(p15card->card, &path, &file);
+			r = sc_get_file_info(p15card->card, &path, &file);
 			if (r != SC_ERROR_FILE_NOT_FOUND)
 				LOG_TEST_RET(ctx, r, "select object path failed");
 
@@ -3353,6 +3367,7 @@ sc_pkcs15init_authenticate(struct sc_profile *profile, struct sc_pkcs15_card *p1
 	sc_log(ctx, "path '%s', op=%u", sc_print_path(&file->path), op);
 
 	if (p15card->card->caps & SC_CARD_CAP_USE_FCI_AC) {
+		/* a real SELECT: callers go on to work in the selected file or DF */
 		r = sc_select_file(p15card->card, &file->path, &file_tmp);
 		LOG_TEST_RET(ctx, r, "Authentication failed: cannot select file.");
 
@@ -144,6 +144,7 @@ scconf_item *scconf_item_add(scconf_context * config, scconf_block * block, scco
 	parser.current_item = item;
 
 	if (type == SCCONF_ITEM_TYPE_BLOCK) {
+		scconf_index_free(config);
 		scconf_block_copy((const scconf_block *) data, &dst);
 		scconf_list_copy(dst->name, &parser.name);
 	}
@@ -198,6 +199,7 @@ scconf_block *scconf_block_add(scconf_context * config, scconf_block * block, co
 	if (!config)
 		return NULL;
 
+	scconf_index_free(config);
 	memset(&parser, 0, sizeof(scconf_parser));
 	parser.config = config;
 	parser.key = key ? strdup(key) : NULL;
@@ -376,6 +378,7 @@ int scconf_parse(scconf_context * config)
 	scconf_parser p;
 	int r = 1;
 
+	scconf_index_free(config);
 	memset(&p, 0, sizeof(p));
 	p.config = config;
 	p.block = config->root;
@@ -404,6 +407,7 @@ int scconf_parse_string(scconf_context * config, const char *string)
 	scconf_parser p;
 	int r;
 
+	scconf_index_free(config);
 	memset(&p, 0, sizeof(p));
 	p.config = config;
 	p.block = config->root;
@@ -56,6 +56,7 @@ scconf_context *scconf_new(const char *filename)
 void scconf_free(scconf_context * config)
 {
 	if (config) {
+		scconf_index_free(config);
 		scconf_block_destroy(config->root);
 		if (config->filename) {
 			free(config->filename);
@@ -126,6 +127,160 @@ scconf_block **scconf_find_blocks(const scconf_context * config, const scconf_bl
 	return blocks;
 }
 
+struct _scconf_index_entry {
+	const scconf_block *parent;
+	const char *item_name;
+	const char *key;
+	const scconf_block *block;
+	struct _scconf_index_entry *next;
+};
+
+struct _scconf_index {
+	struct _scconf_index_entry **buckets;
+	struct _scconf_index_entry *entries;
+	unsigned int mask;
+	unsigned int count;
+};
+
+static unsigned int scconf_index_hash(const scconf_block * parent, const char *item_name, const char *key)
+{
+	unsigned int h = 2166136261U;
+	size_t p = (size_t) parent;
+
+	for (; *item_name; item_name++)
+		h = (h ^ (unsigned char) tolower((unsigned char) *item_name)) * 16777619U;
+	if (key) {
+		h = (h ^ 0xFF) * 16777619U;
+		for (; *key; key++)
+			h = (h ^ (unsigned char) tolower((unsigned char) *key)) * 16777619U;
+	}
+	return h ^ (unsigned int) (p ^ (p >> 16));
+}
+
+static const scconf_block *scconf_index_lookup(const scconf_index * index, const scconf_block * parent, const char *item_name, const char *key)
+{
+	struct _scconf_index_entry *e;
+
+	e = index->buckets[scconf_index_hash(parent, item_name, key) & index->mask];
+	for (; e; e = e->next) {
+		if (e->parent != parent || strcasecmp(e->item_name, item_name))
+			continue;
+		if (!key && !e->key)
+			return e->block;
+		if (key && e->key && !strcasecmp(e->key, key))
+			return e->block;
+	}
+	return NULL;
+}
+
+static void scconf_index_insert(scconf_index * index, const scconf_block * parent, const char *item_name, const char *key, const scconf_block * block)
+{
+	struct _scconf_index_entry *e;
+	unsigned int h;
+
+	/* the first matching block wins, as with the linear search */
+	if (scconf_index_lookup(index, parent, item_name, key))
+		return;
+	h = scconf_index_hash(parent, item_name, key) & index->mask;
+	e = &index->entries[index->count++];
+	e->parent = parent;
+	e->item_name = item_name;
+	e->key = key;
+	e->block = block;
+	e->next = index->buckets[h];
+	index->buckets[h] = e;
+}
+
+static unsigned int scconf_index_count(const scconf_block * block)
+{
+	scconf_item *item;
+	unsigned int count = 0;
+
+	for (item = block->items; item; item = item->next) {
+		if (item->type == SCCONF_ITEM_TYPE_BLOCK && item->key && item->value.block)
+			count += 1 + scconf_index_count(item->value.block);
+	}
+	return count;
+}
+
+static void scconf_index_add(scconf_index * index, const scconf_block * block)
+{
+	scconf_item *item;
+
+	for (item = block->items; item; item = item->next) {
+		if (item->type != SCCONF_ITEM_TYPE_BLOCK || !item->key || !item->value.block)
+			continue;
+		scconf_index_insert(index, block, item->key, NULL, item->value.block);
+		if (item->value.block->name && item->value.block->name->data)
+			scconf_index_insert(index, block, item->key, item->value.block->name->data, item->value.block);
+		scconf_index_add(index, item->value.block);
+	}
+}
+
+int scconf_index_build(scconf_context * config)
+{
+	scconf_index *index;
+	unsigned int nblocks, size;
+
+	if (!config || !config->root)
+		return 0;
+	scconf_index_free(config);
+
+	nblocks = scconf_index_count(config->root);
+	for (size = 16; size < 2 * nblocks; size <<= 1);
+
+	index = calloc(1, sizeof(scconf_index));
+	if (!index)
+		return 0;
+	index->buckets = calloc(size, sizeof(struct _scconf_index_entry *));
+	index->entries = calloc(2 * nblocks + 1, sizeof(struct _scconf_index_entry));
+	if (!index->buckets || !index->entries) {
+		free(index->buckets);
+		free(index->entries);
+		free(index);
+		return 0;
+	}
+	index->mask = size - 1;
+	scconf_index_add(index, config->root);
+	config->index = index;
+	return 1;
+}
+
+void scconf_index_free(scconf_context * config)
+{
+	if (config && config->index) {
+		free(config->index->buckets);
+		free(config->index->entries);
+		free(config->index);
+		config->index = NULL;
+	}
+}
+
+const scconf_block *scconf_find_block_by_key(const scconf_context * config, const scconf_block * block, const char *item_name, const char *key)
+{
+	scconf_item *item;
+
+	if (!block) {
+		block = config->root;
+	}
+	if (!item_name) {
+		return NULL;
+	}
+	if (config && config->index) {
+		return scconf_index_lookup(config->index, block, item_name, key);
+	}
+	for (item = block->items; item; item = item->next) {
+		if (item->type == SCCONF_ITEM_TYPE_BLOCK &&
+		    strcasecmp(item_name, item->key) == 0) {
+			if (key && strcasecmp(key, item->value.block->name->data)) {
+				continue;
+			}
+			return item->value.block;
+		}
+	}
+	return NULL;
+}
+
 const scconf_list *scconf_find_list(const scconf_block * block, const char *option)
 {
 	scconf_item *item;
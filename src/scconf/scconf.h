@@ -80,11 +80,14 @@ struct _scconf_block {
 	scconf_item *items;
 };
 
+typedef struct _scconf_index scconf_index;
+
 typedef struct {
 	char *filename;
 	int debug;
 	scconf_block *root;
 	char *errmsg;
+	scconf_index *index;
 } scconf_context;
 
 /* Allocate scconf_context
@@ -106,6 +109,18 @@ extern int scconf_parse(scconf_context * config);
  */
 extern int scconf_parse_string(scconf_context * config, const char *string);
 
+/* Load configuration from a binary snapshot written by scconf_snapshot_write()
+ * The snapshot is only used if it was taken from a file with the same
+ * name, modification time and size as config->filename
+ * Returns 1 = ok, 0 = snapshot stale or invalid, -1 = error opening snapshot
+ */
+extern int scconf_snapshot_read(scconf_context * config, const char *snapshot);
+
+/* Write a binary snapshot of the parsed configuration
+ * Returns 0 = ok, else = errno
+ */
+extern int scconf_snapshot_write(const scconf_context * config, const char *snapshot);
+
 /* Parse entries
  */
 extern int scconf_parse_entries(const scconf_context * config, const scconf_block * block, scconf_entry * entry);
@@ -131,6 +146,23 @@ extern const scconf_block *scconf_find_block(const scconf_context * config, cons
  */
 extern scconf_block **scconf_find_blocks(const scconf_context * config, const scconf_block * block, const char *item_name, const char *key);
 
+/* Find the first block by the item_name and the blocks first name
+ * If the block is NULL, the root block is used
+ * If the key is NULL, the first block named item_name is returned
+ * Uses the block index if one has been built
+ */
+extern const scconf_block *scconf_find_block_by_key(const scconf_context * config, const scconf_block * block, const char *item_name, const char *key);
+
+/* Build a hash index of all blocks for scconf_find_block_by_key()
+ * The index is dropped when blocks are added through the config
+ * Returns 1 = ok, 0 = error
+ */
+extern int scconf_index_build(scconf_context * config);
+
+/* Free the block index
+ */
+extern void scconf_index_free(scconf_context * config);
+
 /* Get a list of values for option
  */
 extern const scconf_list *scconf_find_list(const scconf_block * block, const char *option);
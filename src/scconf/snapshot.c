@@ -0,0 +1,340 @@
+/*
+ * snapshot.c: binary snapshot of a parsed configuration
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "scconf.h"
+
+/*
+ * Layout (all integers big endian):
+ *   magic[8], mtime u64, size u64, filename str, root block
+ * block: name list, u32 item count, items
+ * item:  u8 type, key str, comment str | block | list
+ * list:  u32 count, str * count
+ * str:   u32 length (0xFFFFFFFF for NULL), data
+ */
+static const unsigned char snapshot_magic[8] = { 'S', 'C', 'C', 'O', 'N', 'F', 0x00, 0x01 };
+
+#define SNAPSHOT_NULL_STR	0xFFFFFFFFU
+#define SNAPSHOT_MAX_DEPTH	32
+
+typedef struct {
+	const unsigned char *buf;
+	size_t len;
+	size_t pos;
+	int error;
+} snapshot_reader;
+
+static int put_u32(FILE *f, unsigned int v)
+{
+	unsigned char b[4];
+
+	b[0] = (v >> 24) & 0xFF;
+	b[1] = (v >> 16) & 0xFF;
+	b[2] = (v >> 8) & 0xFF;
+	b[3] = v & 0xFF;
+	return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static int put_u64(FILE *f, unsigned long long v)
+{
+	if (put_u32(f, (unsigned int) (v >> 32)) < 0)
+		return -1;
+	return put_u32(f, (unsigned int) (v & 0xFFFFFFFFU));
+}
+
+static int put_str(FILE *f, const char *str)
+{
+	size_t len;
+
+	if (!str)
+		return put_u32(f, SNAPSHOT_NULL_STR);
+	len = strlen(str);
+	if (put_u32(f, (unsigned int) len) < 0)
+		return -1;
+	return fwrite(str, 1, len, f) == len ? 0 : -1;
+}
+
+static int put_list(FILE *f, const scconf_list *list)
+{
+	if (put_u32(f, (unsigned int) scconf_list_array_length(list)) < 0)
+		return -1;
+	for (; list; list = list->next)
+		if (put_str(f, list->data) < 0)
+			return -1;
+	return 0;
+}
+
+static int put_block(FILE *f, const scconf_block *block)
+{
+	const scconf_item *item;
+	unsigned int count = 0;
+	unsigned char type;
+
+	if (put_list(f, block->name) < 0)
+		return -1;
+	for (item = block->items; item; item = item->next)
+		count++;
+	if (put_u32(f, count) < 0)
+		return -1;
+	for (item = block->items; item; item = item->next) {
+		type = (unsigned char) item->type;
+		if (fwrite(&type, 1, 1, f) != 1 || put_str(f, item->key) < 0)
+			return -1;
+		switch (item->type) {
+		case SCCONF_ITEM_TYPE_COMMENT:
+			if (put_str(f, item->value.comment) < 0)
+				return -1;
+			break;
+		case SCCONF_ITEM_TYPE_BLOCK:
+			if (put_block(f, item->value.block) < 0)
+				return -1;
+			break;
+		case SCCONF_ITEM_TYPE_VALUE:
+			if (put_list(f, item->value.list) < 0)
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static unsigned int get_u32(snapshot_reader *r)
+{
+	unsigned int v;
+
+	if (r->error || r->len - r->pos < 4) {
+		r->error = 1;
+		return 0;
+	}
+	v = ((unsigned int) r->buf[r->pos] << 24) | ((unsigned int) r->buf[r->pos + 1] << 16)
+		| ((unsigned int) r->buf[r->pos + 2] << 8) | (unsigned int) r->buf[r->pos + 3];
+	r->pos += 4;
+	return v;
+}
+
+static unsigned long long get_u64(snapshot_reader *r)
+{
+	unsigned long long v;
+
+	v = (unsigned long long) get_u32(r) << 32;
+	return v | get_u32(r);
+}
+
+static char *get_str(snapshot_reader *r)
+{
+	unsigned int len;
+	char *str;
+
+	len = get_u32(r);
+	if (r->error || len == SNAPSHOT_NULL_STR)
+		return NULL;
+	if (r->len - r->pos < len) {
+		r->error = 1;
+		return NULL;
+	}
+	str = malloc(len + 1);
+	if (!str) {
+		r->error = 1;
+		return NULL;
+	}
+	memcpy(str, r->buf + r->pos, len);
+	str[len] = '\0';
+	r->pos += len;
+	return str;
+}
+
+static scconf_list *get_list(snapshot_reader *r)
+{
+	scconf_list *list = NULL, **tail = &list;
+	unsigned int count;
+
+	count = get_u32(r);
+	while (!r->error && count--) {
+		*tail = calloc(1, sizeof(scconf_list));
+		if (!*tail) {
+			r->error = 1;
+			break;
+		}
+		(*tail)->data = get_str(r);
+		tail = &(*tail)->next;
+	}
+	return list;
+}
+
+static scconf_block *get_block(snapshot_reader *r, scconf_block *parent, int depth)
+{
+	scconf_block *block;
+	scconf_item *item, **tail;
+	unsigned int count;
+
+	if (depth > SNAPSHOT_MAX_DEPTH) {
+		r->error = 1;
+		return NULL;
+	}
+	block = calloc(1, sizeof(scconf_block));
+	if (!block) {
+		r->error = 1;
+		return NULL;
+	}
+	block->parent = parent;
+	block->name = get_list(r);
+	tail = &block->items;
+	count = get_u32(r);
+	while (!r->error && count--) {
+		if (r->pos >= r->len) {
+			r->error = 1;
+			break;
+		}
+		item = calloc(1, sizeof(scconf_item));
+		if (!item) {
+			r->error = 1;
+			break;
+		}
+		*tail = item;
+		tail = &item->next;
+		item->type = r->buf[r->pos++];
+		item->key = get_str(r);
+		switch (item->type) {
+		case SCCONF_ITEM_TYPE_COMMENT:
+			item->value.comment = get_str(r);
+			break;
+		case SCCONF_ITEM_TYPE_BLOCK:
+			item->value.block = get_block(r, block, depth + 1);
+			break;
+		case SCCONF_ITEM_TYPE_VALUE:
+			item->value.list = get_list(r);
+			break;
+		default:
+			/* keep the item destroyable */
+			item->type = SCCONF_ITEM_TYPE_COMMENT;
+			r->error = 1;
+			break;
+		}
+	}
+	return block;
+}
+
+int scconf_snapshot_read(scconf_context * config, const char *snapshot)
+{
+	struct stat st;
+	snapshot_reader r;
+	unsigned char *buf = NULL;
+	scconf_block *root = NULL;
+	char *filename = NULL;
+	FILE *f;
+	long len;
+	int ok = 0;
+
+	if (!config || !config->filename || !snapshot)
+		return 0;
+	if (stat(config->filename, &st) != 0)
+		return 0;
+
+	f = fopen(snapshot, "rb");
+	if (!f)
+		return -1;
+	if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= (long) sizeof(snapshot_magic)
+			|| fseek(f, 0, SEEK_SET) != 0)
+		goto out;
+	buf = malloc(len);
+	if (!buf || fread(buf, 1, len, f) != (size_t) len)
+		goto out;
+
+	memset(&r, 0, sizeof(r));
+	r.buf = buf;
+	r.len = len;
+	if (memcmp(buf, snapshot_magic, sizeof(snapshot_magic)))
+		goto out;
+	r.pos = sizeof(snapshot_magic);
+	if (get_u64(&r) != (unsigned long long) st.st_mtime
+			|| get_u64(&r) != (unsigned long long) st.st_size)
+		goto out;
+	filename = get_str(&r);
+	if (r.error || !filename || strcmp(filename, config->filename))
+		goto out;
+
+	root = get_block(&r, NULL, 0);
+	if (r.error || r.pos != r.len)
+		goto out;
+
+	scconf_index_free(config);
+	scconf_block_destroy(config->root);
+	config->root = root;
+	root = NULL;
+	ok = 1;
+out:
+	scconf_block_destroy(root);
+	free(filename);
+	free(buf);
+	fclose(f);
+	return ok;
+}
+
+int scconf_snapshot_write(const scconf_context * config, const char *snapshot)
+{
+	struct stat st;
+	char tmpname[4096];
+	FILE *f;
+	int r = 0;
+
+	if (!config || !config->filename || !config->root || !snapshot)
+		return EINVAL;
+	if (stat(config->filename, &st) != 0)
+		return errno;
+	if (snprintf(tmpname, sizeof(tmpname), "%s.%lu", snapshot, (unsigned long) getpid()) >= (int) sizeof(tmpname))
+		return ENAMETOOLONG;
+
+	f = fopen(tmpname, "wb");
+	if (!f)
+		return errno;
+	if (fwrite(snapshot_magic, 1, sizeof(snapshot_magic), f) != sizeof(snapshot_magic)
+			|| put_u64(f, (unsigned long long) st.st_mtime) < 0
+			|| put_u64(f, (unsigned long long) st.st_size) < 0
+			|| put_str(f, config->filename) < 0
+			|| put_block(f, config->root) < 0)
+		r = EIO;
+	if (fclose(f) != 0 && !r)
+		r = errno;
+	if (!r) {
+#ifdef _WIN32
+		remove(snapshot);
+#endif
+		/* replace atomically, concurrent readers see either version */
+		if (rename(tmpname, snapshot) != 0)
+			r = errno;
+	}
+	if (r)
+		remove(tmpname);
+	return r;
+}
@@ -0,0 +1,196 @@
+/*
+ * opensc-agent test: runs the agent on the p11mock module and goes
+ * through the pkcs11-agent client module, connecting, logging in,
+ * signing and disconnecting. A second client that stops in the middle
+ * of a request must not hold up the first one.
+ *
+ * Usage: agenttest [agent [module [client-module]]]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "pkcs11/pkcs11.h"
+#include "common/libpkcs11.h"
+#include "common/pkcs11-agent-proto.h"
+
+#define PIN		"123456"
+/* seconds a call through the agent may take */
+#define CALL_TIMEOUT	5
+
+static pid_t agent_pid = -1;
+static char dir[64], sock[128];
+
+static void cleanup(void)
+{
+	int status;
+
+	if (agent_pid > 0) {
+		kill(agent_pid, SIGTERM);
+		waitpid(agent_pid, &status, 0);
+		agent_pid = -1;
+	}
+	unlink(sock);
+	rmdir(dir);
+}
+
+static void fail(const char *what, CK_RV rv)
+{
+	fprintf(stderr, "FAILED: %s (0x%08lx)\n", what, rv);
+	cleanup();
+	exit(1);
+}
+
+static void check(const char *what, CK_RV rv, CK_RV expected)
+{
+	if (rv != expected)
+		fail(what, rv);
+	printf("ok: %s\n", what);
+}
+
+static void timeout(int sig)
+{
+	static const char msg[] = "FAILED: no answer from the agent\n";
+	ssize_t r;
+
+	r = write(2, msg, sizeof(msg) - 1);
+	(void) r;
+	if (agent_pid > 0)
+		kill(agent_pid, SIGKILL);
+	unlink(sock);
+	rmdir(dir);
+	_exit(1);
+}
+
+static int raw_connect(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void start_agent(const char *agent, const char *module)
+{
+	int i, fd;
+
+	agent_pid = fork();
+	if (agent_pid < 0)
+		fail("fork", 0);
+	if (agent_pid == 0) {
+		execl(agent, agent, "--foreground", "--module", module, "--socket", sock, (char *) NULL);
+		perror(agent);
+		_exit(127);
+	}
+	for (i = 0; i < 100; i++) {
+		if ((fd = raw_connect()) >= 0) {
+			close(fd);
+			return;
+		}
+		usleep(100000);
+	}
+	fail("agent did not start", 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *agent = argc > 1 ? argv[1] : "../tools/opensc-agent";
+	const char *module = argc > 2 ? argv[2] : ".libs/p11mock.so";
+	const char *client = argc > 3 ? argv[3] : "../pkcs11/.libs/pkcs11-agent.so";
+	CK_FUNCTION_LIST_PTR p11;
+	CK_SLOT_ID slots[4];
+	CK_ULONG count = 4, len, i;
+	CK_SESSION_HANDLE h;
+	CK_SESSION_INFO info;
+	CK_OBJECT_CLASS class = CKO_PRIVATE_KEY;
+	CK_ATTRIBUTE templ[] = { { CKA_CLASS, &class, sizeof(class) } };
+	CK_OBJECT_HANDLE key;
+	CK_MECHANISM mech = { CKM_RSA_X_509, NULL, 0 };
+	CK_BYTE data[32], sig[64];
+	unsigned char hdr[6] = { 0, 0, 0, 64, 0, 0 };
+	void *mod;
+	int stalled;
+
+	strcpy(dir, "/tmp/agenttest-XXXXXX");
+	if (mkdtemp(dir) == NULL)
+		fail("mkdtemp", 0);
+	snprintf(sock, sizeof(sock), "%s/%s", dir, P11_AGENT_SOCKET_NAME);
+	setenv(P11_AGENT_SOCKET_ENV, sock, 1);
+	signal(SIGALRM, timeout);
+	signal(SIGPIPE, SIG_IGN);
+
+	start_agent(agent, module);
+	mod = C_LoadModule(client, &p11);
+	if (mod == NULL)
+		fail("loading the client module", 0);
+
+	alarm(CALL_TIMEOUT);
+	check("connect", p11->C_Initialize(NULL), CKR_OK);
+	check("slot list", p11->C_GetSlotList(CK_TRUE, slots, &count), CKR_OK);
+	if (count != 1)
+		fail("slot count", count);
+	check("open session", p11->C_OpenSession(slots[0], CKF_SERIAL_SESSION, NULL, NULL, &h), CKR_OK);
+	check("sign before login", p11->C_SignInit(h, &mech, 1), CKR_USER_NOT_LOGGED_IN);
+	check("login with a wrong PIN", p11->C_Login(h, CKU_USER, (CK_UTF8CHAR_PTR) "0000", 4), CKR_PIN_INCORRECT);
+	check("login", p11->C_Login(h, CKU_USER, (CK_UTF8CHAR_PTR) PIN, strlen(PIN)), CKR_OK);
+
+	/* a client that sent only part of a request */
+	stalled = raw_connect();
+	if (stalled < 0 || write(stalled, hdr, sizeof(hdr)) != sizeof(hdr))
+		fail("stalled client", 0);
+	alarm(CALL_TIMEOUT);
+
+	check("find init", p11->C_FindObjectsInit(h, templ, 1), CKR_OK);
+	check("find", p11->C_FindObjects(h, &key, 1, &count), CKR_OK);
+	if (count != 1)
+		fail("key not found", count);
+	check("find final", p11->C_FindObjectsFinal(h), CKR_OK);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (CK_BYTE) i;
+	check("sign init", p11->C_SignInit(h, &mech, key), CKR_OK);
+	len = sizeof(sig);
+	check("sign", p11->C_Sign(h, data, sizeof(data), sig, &len), CKR_OK);
+	if (len != sizeof(data))
+		fail("signature length", len);
+	for (i = 0; i < len; i++)
+		if ((sig[i] ^ data[i]) != 0xFF)
+			fail("signature value", i);
+	printf("ok: signature\n");
+	close(stalled);
+
+	/* the agent closes the sessions of a client that went away, which
+	 * ends the login with the last one */
+	check("disconnect", p11->C_Finalize(NULL), CKR_OK);
+	check("reconnect", p11->C_Initialize(NULL), CKR_OK);
+	check("open session", p11->C_OpenSession(slots[0], CKF_SERIAL_SESSION, NULL, NULL, &h), CKR_OK);
+	check("session info", p11->C_GetSessionInfo(h, &info), CKR_OK);
+	if (info.state != CKS_RO_PUBLIC_SESSION)
+		fail("still logged in after disconnect", info.state);
+	check("sign after disconnect", p11->C_SignInit(h, &mech, key), CKR_USER_NOT_LOGGED_IN);
+	check("close session", p11->C_CloseSession(h), CKR_OK);
+	check("disconnect", p11->C_Finalize(NULL), CKR_OK);
+	alarm(0);
+
+	C_UnloadModule(mod);
+	cleanup();
+	return 0;
+}
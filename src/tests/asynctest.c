@@ -0,0 +1,107 @@
+/*
+ * Asynchronous card I/O test: queues GET CHALLENGE commands on the
+ * card's worker and collects the completions from a poll() loop, the
+ * way an application event loop would.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include "libopensc/opensc.h"
+#include "sc-test.h"
+
+#define NUM_OPS	16
+
+struct request {
+	struct sc_apdu apdu;
+	u8 rbuf[8];
+};
+
+static struct request reqs[NUM_OPS];
+static int completed, failed;
+
+static void challenge_done(struct sc_card *c, struct sc_async_op *op)
+{
+	struct request *req = (struct request *) op->arg;
+	int r = op->result;
+
+	if (r == SC_SUCCESS)
+		r = sc_check_sw(c, req->apdu.sw1, req->apdu.sw2);
+	if (r != SC_SUCCESS) {
+		fprintf(stderr, "request %d failed: %s\n",
+			(int) (req - reqs), sc_strerror(r));
+		failed++;
+	}
+	completed++;
+}
+
+int main(int argc, char *argv[])
+{
+#ifndef _WIN32
+	static struct sc_async_op ops[NUM_OPS];
+	struct pollfd pfd;
+	struct timeval tv1, tv2;
+	int i, r, loops = 0;
+
+	if (sc_test_init(&argc, argv))
+		return 1;
+
+	r = sc_async_start(card);
+	if (r != SC_SUCCESS) {
+		fprintf(stderr, "sc_async_start() failed: %s\n", sc_strerror(r));
+		sc_test_cleanup();
+		return 1;
+	}
+
+	gettimeofday(&tv1, NULL);
+	for (i = 0; i < NUM_OPS; i++) {
+		sc_format_apdu(card, &reqs[i].apdu, SC_APDU_CASE_2, 0x84, 0x00, 0x00);
+		reqs[i].apdu.le = sizeof(reqs[i].rbuf);
+		reqs[i].apdu.resp = reqs[i].rbuf;
+		reqs[i].apdu.resplen = sizeof(reqs[i].rbuf);
+		r = sc_async_transmit_apdu(card, &ops[i], &reqs[i].apdu, challenge_done, &reqs[i]);
+		if (r != SC_SUCCESS) {
+			fprintf(stderr, "sc_async_transmit_apdu() failed: %s\n", sc_strerror(r));
+			sc_test_cleanup();
+			return 1;
+		}
+	}
+	printf("Queued %d commands.\n", NUM_OPS);
+
+	pfd.fd = sc_async_get_fd(card);
+	pfd.events = POLLIN;
+	while (completed < NUM_OPS) {
+		loops++;
+		r = poll(&pfd, 1, 5000);
+		if (r == 0) {
+			fprintf(stderr, "Timeout, %d of %d commands completed\n", completed, NUM_OPS);
+			break;
+		}
+		if (r < 0) {
+			perror("poll");
+			break;
+		}
+		sc_async_dispatch(card);
+	}
+	gettimeofday(&tv2, NULL);
+
+	printf("%d completed, %d failed, %d wakeups, %ld ms\n", completed, failed, loops,
+		(long) ((tv2.tv_sec - tv1.tv_sec) * 1000 + (tv2.tv_usec - tv1.tv_usec) / 1000));
+
+	sc_async_stop(card);
+	sc_test_cleanup();
+	return completed == NUM_OPS && failed == 0 ? 0 : 1;
+#else
+	fprintf(stderr, "poll() is not available\n");
+	return 1;
+#endif
+}
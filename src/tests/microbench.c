@@ -0,0 +1,488 @@
+/*
+ * microbench.c: Per operation cost of libopensc internals
+ *
+ * Every benchmark runs on built-in fixtures (recorded APDUs, ATR tables,
+ * synthetic PKCS#15 directory files and configuration text), so no
+ * reader or card is needed.  Each one is repeated until it has run for
+ * at least the minimum time; the results are printed one per line as
+ * tab separated "name operations ns/op" records so they can be collected
+ * and compared between builds.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/compat_getopt.h"
+#include "libopensc/opensc.h"
+#include "libopensc/internal.h"
+#include "libopensc/pkcs15.h"
+#include "scconf/scconf.h"
+#include "p15image.h"
+
+#define DF_ENTRIES	200
+#define FIND_IDS	32
+#define CONF_BLOCKS	40
+
+/* Commands as recorded from card traces */
+static const char *apdu_fixtures[] = {
+	"00A4040C07A0000000030000",			/* SELECT AID */
+	"00A40000023F00",				/* SELECT MF */
+	"00B0000000",					/* READ BINARY */
+	"00B000E4FF",
+	"00CA006E00",					/* GET DATA */
+	"0020008108313233343536FFFF",			/* VERIFY */
+	"00240081103132333435363738393031323334353600",	/* CHANGE REFERENCE DATA */
+	"0022F1B8038301A0",				/* MSE SET */
+	"002A9E9A23302130090605" "2B0E03021A05000414"
+		"0102030405060708090A0B0C0D0E0F1011121314" "00",	/* PSO CDS */
+	"00C0000012",					/* GET RESPONSE */
+	"0084000008",					/* GET CHALLENGE */
+	"80CA9F7F00",
+};
+
+/* ATRs of a few card drivers; the last one is looked up */
+static struct sc_atr_table atr_fixtures[] = {
+	{ "3b:e2:00:ff:c1:10:31:fe:55:c8:02:9c", NULL, NULL, 1, 0, NULL },
+	{ "3b:e9:00:ff:c1:10:31:fe:55:00:64:05:00:c8:02:31:80:00:47", NULL, NULL, 2, 0, NULL },
+	{ "3b:fb:98:00:ff:c1:10:31:fe:55:00:64:05:20:47:03:31:80:00:90:00:f3", NULL, NULL, 3, 0, NULL },
+	{ "3b:f2:18:00:ff:c1:0a:31:fe:55:c8:06:8a", "ff:ff:0f:ff:00:ff:00:ff:ff:00:00:00:00", NULL, 4, 0, NULL },
+	{ "3b:d2:18:02:c1:0a:31:fe:58:c8:0d:51", NULL, NULL, 5, 0, NULL },
+	{ "3b:fa:13:00:ff:81:31:80:45:00:31:c1:73:c0:01:00:00:90:00:b1", NULL, NULL, 6, 0, NULL },
+	{ "3b:da:18:ff:81:b1:fe:75:1f:03:00:31:c5:73:c0:01:40:00:90:00:0c", NULL, NULL, 7, 0, NULL },
+	{ "3B:1F:11:00:67:80:42:46:49:53:45:10:52:66:FF:81:90:00", NULL, NULL, 8, 0, NULL },
+	{ "3b:9f:94:40:1e:00:67:00:43:46:49:53:45:10:52:66:ff:81:90:00",
+		"ff:ff:ff:ff:ff:ff:ff:00:ff:ff:ff:ff:ff:ff:ff:ff:ff:ff:ff:ff", NULL, 9, 0, NULL },
+	{ "3b:6b:00:ff:80:62:00:a2:56:46:69:6e:45:49:44", "ff:ff:00:ff:ff:ff:00:ff:ff:ff:ff:ff:ff:ff:ff", NULL, 10, 0, NULL },
+	{ "3b:7b:00:00:00:80:62:00:51:56:46:69:6e:45:49:44", "ff:ff:00:ff:ff:ff:ff:f0:ff:ff:ff:ff:ff:ff:ff:ff", NULL, 11, 0, NULL },
+	{ "3B:B7:94:00:c0:24:31:fe:65:53:50:4b:32:33:90:00:b4", NULL, NULL, 12, 0, NULL },
+	{ "3b:b7:18:00:c0:3e:31:fe:65:53:50:4b:32:34:90:00:25", NULL, NULL, 13, 0, NULL },
+	{ "3b:d5:18:00:81:31:3a:7d:80:73:c8:21:10:30", NULL, NULL, 14, 0, NULL },
+	{ "3b:f8:13:00:00:81:31:fe:45:4a:43:4f:50:76:32:34:31:b7", NULL, NULL, 15, 0, NULL },
+	{ "3b:fe:94:00:ff:80:b1:fa:45:1f:03:45:73:74:45:49:44:20:76:65:72:20:31:2e:30:43", NULL, NULL, 16, 0, NULL },
+	{ "3b:fe:18:00:00:80:31:fe:45:80:31:80:66:40:90:a4:16:2a:00:83:0f:90:00:ef", NULL, NULL, 17, 0, NULL },
+	{ "3b:6f:00:ff:00:56:72:75:54:6f:6b:6e:73:30:20:00:00:90:00", NULL, NULL, 18, 0, NULL },
+	{ "3B:98:94:40:0A:A5:03:01:01:01:AD:13:10", NULL, NULL, 19, 0, NULL },
+	{ "3B:68:00:00:29:05:01:02:01:AD:13:03", NULL, NULL, 20, 0, NULL },
+	{ NULL, NULL, NULL, 0, 0, NULL }
+};
+
+static const struct {
+	unsigned int type;
+	const char *name;
+} df_types[] = {
+	{ SC_PKCS15_PRKDF, "prkdf" },
+	{ SC_PKCS15_PUKDF, "pukdf" },
+	{ SC_PKCS15_CDF, "cdf" },
+	{ SC_PKCS15_AODF, "aodf" },
+};
+#define DF_TYPES	(sizeof(df_types) / sizeof(df_types[0]))
+
+static struct {
+	struct sc_context *ctx;
+	struct sc_pkcs15_card *p15card;
+	struct sc_card *card;
+	struct p15image images[DF_TYPES];
+	struct sc_apdu apdus[sizeof(apdu_fixtures) / sizeof(apdu_fixtures[0])];
+	u8 apdu_bytes[sizeof(apdu_fixtures) / sizeof(apdu_fixtures[0])][SC_MAX_APDU_BUFFER_SIZE];
+	size_t apdu_lens[sizeof(apdu_fixtures) / sizeof(apdu_fixtures[0])];
+	u8 digest[32];
+	u8 block01[256], block02[256];
+	u8 bin[1024];
+	char hex[3 * 256 + 1], b64[2048];
+	char *conf;
+	struct sc_pkcs15_id ids[DF_TYPES][FIND_IDS];
+	unsigned int n_ids[DF_TYPES];
+} fx;
+
+static double min_time = 0.2;
+
+static double now(void)
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/* Decodes every entry of a DF image, returns the number of entries */
+static int decode_image(unsigned int df, int fast)
+{
+	p15image_decode_func decode = p15image_decoder(df_types[df].type);
+	const u8 *p = fx.images[df].data;
+	size_t left = fx.images[df].len;
+	int n = 0;
+
+	fx.p15card->opts.use_fast_decoder = fast;
+	while (left) {
+		struct sc_pkcs15_object *o = calloc(1, sizeof(struct sc_pkcs15_object));
+
+		if (o == NULL || decode(fx.p15card, o, &p, &left)) {
+			free(o);
+			return -1;
+		}
+		sc_pkcs15_free_object(o);
+		n++;
+	}
+	return n;
+}
+
+static int bench_asn1_prkdf(void) { return decode_image(0, 0); }
+static int bench_asn1_pukdf(void) { return decode_image(1, 0); }
+static int bench_asn1_cdf(void) { return decode_image(2, 0); }
+static int bench_asn1_aodf(void) { return decode_image(3, 0); }
+static int bench_fast_prkdf(void) { return decode_image(0, 1); }
+static int bench_fast_pukdf(void) { return decode_image(1, 1); }
+static int bench_fast_cdf(void) { return decode_image(2, 1); }
+static int bench_fast_aodf(void) { return decode_image(3, 1); }
+
+static int bench_bytes2apdu(void)
+{
+	struct sc_apdu apdu;
+	size_t i;
+
+	for (i = 0; i < sizeof(apdu_fixtures) / sizeof(apdu_fixtures[0]); i++)
+		if (sc_bytes2apdu(fx.ctx, fx.apdu_bytes[i], fx.apdu_lens[i], &apdu) != SC_SUCCESS)
+			return -1;
+	return i;
+}
+
+static int bench_apdu2bytes(void)
+{
+	u8 buf[SC_MAX_APDU_BUFFER_SIZE];
+	size_t i, len;
+
+	for (i = 0; i < sizeof(apdu_fixtures) / sizeof(apdu_fixtures[0]); i++)
+		if (sc_apdu_put_octets(fx.ctx, &fx.apdus[i], buf, sizeof(buf), &len, SC_PROTO_T1) != SC_SUCCESS)
+			return -1;
+	return i;
+}
+
+static int bench_pkcs1_encode(void)
+{
+	u8 out[256];
+	size_t len = sizeof(out);
+
+	if (sc_pkcs1_encode(fx.ctx, SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA256,
+			fx.digest, sizeof(fx.digest), out, &len, sizeof(out)) != SC_SUCCESS)
+		return -1;
+	return 1;
+}
+
+static int bench_pkcs1_strip01(void)
+{
+	u8 out[256];
+	size_t len = sizeof(out);
+
+	if (sc_pkcs1_strip_01_padding(fx.ctx, fx.block01, sizeof(fx.block01), out, &len) < 0)
+		return -1;
+	return 1;
+}
+
+static int bench_pkcs1_strip02(void)
+{
+	u8 out[256];
+	size_t len = sizeof(out);
+
+	if (sc_pkcs1_strip_02_padding(fx.ctx, fx.block02, sizeof(fx.block02), out, &len) < 0)
+		return -1;
+	return 1;
+}
+
+static int bench_bin_to_hex(void)
+{
+	char hex[sizeof(fx.hex)];
+
+	if (sc_bin_to_hex(fx.bin, 256, hex, sizeof(hex), ':') != SC_SUCCESS)
+		return -1;
+	return 1;
+}
+
+static int bench_hex_to_bin(void)
+{
+	u8 bin[256];
+	size_t len = sizeof(bin);
+
+	if (sc_hex_to_bin(fx.hex, bin, &len) != SC_SUCCESS)
+		return -1;
+	return 1;
+}
+
+static int bench_base64_encode(void)
+{
+	u8 out[sizeof(fx.b64)];
+
+	if (sc_base64_encode(fx.bin, sizeof(fx.bin), out, sizeof(out), 64) != SC_SUCCESS)
+		return -1;
+	return 1;
+}
+
+static int bench_base64_decode(void)
+{
+	u8 out[sizeof(fx.bin)];
+
+	if (sc_base64_decode(fx.b64, out, sizeof(out)) < 0)
+		return -1;
+	return 1;
+}
+
+static int bench_match_atr(void)
+{
+	int type = 0;
+
+	if (_sc_match_atr(fx.card, atr_fixtures, &type) < 0 || type != 20)
+		return -1;
+	return 1;
+}
+
+static int find_all(unsigned int df)
+{
+	struct sc_pkcs15_object *obj;
+	unsigned int i;
+	int r = SC_SUCCESS;
+
+	for (i = 0; i < fx.n_ids[df] && r == SC_SUCCESS; i++) {
+		switch (df_types[df].type) {
+		case SC_PKCS15_PRKDF:
+			r = sc_pkcs15_find_prkey_by_id(fx.p15card, &fx.ids[df][i], &obj);
+			break;
+		case SC_PKCS15_PUKDF:
+			r = sc_pkcs15_find_pubkey_by_id(fx.p15card, &fx.ids[df][i], &obj);
+			break;
+		case SC_PKCS15_CDF:
+			r = sc_pkcs15_find_cert_by_id(fx.p15card, &fx.ids[df][i], &obj);
+			break;
+		case SC_PKCS15_AODF:
+			r = sc_pkcs15_find_pin_by_auth_id(fx.p15card, &fx.ids[df][i], &obj);
+			break;
+		}
+	}
+	return r == SC_SUCCESS ? (int) i : -1;
+}
+
+static int bench_find_prkey(void) { return find_all(0); }
+static int bench_find_pubkey(void) { return find_all(1); }
+static int bench_find_cert(void) { return find_all(2); }
+static int bench_find_pin(void) { return find_all(3); }
+
+static int bench_scconf_parse(void)
+{
+	scconf_context *conf;
+	int r;
+
+	conf = scconf_new(NULL);
+	if (conf == NULL)
+		return -1;
+	r = scconf_parse_string(conf, fx.conf);
+	scconf_free(conf);
+	return r == 1 ? 1 : -1;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(void);
+} benchmarks[] = {
+	{ "asn1_decode_prkdf", bench_asn1_prkdf },
+	{ "asn1_decode_pukdf", bench_asn1_pukdf },
+	{ "asn1_decode_cdf", bench_asn1_cdf },
+	{ "asn1_decode_aodf", bench_asn1_aodf },
+	{ "fast_decode_prkdf", bench_fast_prkdf },
+	{ "fast_decode_pukdf", bench_fast_pukdf },
+	{ "fast_decode_cdf", bench_fast_cdf },
+	{ "fast_decode_aodf", bench_fast_aodf },
+	{ "bytes2apdu", bench_bytes2apdu },
+	{ "apdu2bytes", bench_apdu2bytes },
+	{ "pkcs1_encode_sha256_2048", bench_pkcs1_encode },
+	{ "pkcs1_strip_01_2048", bench_pkcs1_strip01 },
+	{ "pkcs1_strip_02_2048", bench_pkcs1_strip02 },
+	{ "bin_to_hex_256", bench_bin_to_hex },
+	{ "hex_to_bin_256", bench_hex_to_bin },
+	{ "base64_encode_1024", bench_base64_encode },
+	{ "base64_decode_1024", bench_base64_decode },
+	{ "match_atr_table", bench_match_atr },
+	{ "pkcs15_find_prkey_by_id", bench_find_prkey },
+	{ "pkcs15_find_pubkey_by_id", bench_find_pubkey },
+	{ "pkcs15_find_cert_by_id", bench_find_cert },
+	{ "pkcs15_find_pin_by_auth_id", bench_find_pin },
+	{ "scconf_parse", bench_scconf_parse },
+};
+
+/* Repeats the benchmark until it has run for at least 'min_time' */
+static int measure(const char *name, int (*run)(void))
+{
+	unsigned long rounds = 1, i, ops;
+	double start, elapsed;
+	int r;
+
+	for (;;) {
+		ops = 0;
+		start = now();
+		for (i = 0; i < rounds; i++) {
+			r = run();
+			if (r < 0) {
+				fprintf(stderr, "%s: failed\n", name);
+				return 1;
+			}
+			ops += r;
+		}
+		elapsed = now() - start;
+		if (elapsed >= min_time || rounds >= 1UL << 28)
+			break;
+		rounds *= elapsed > min_time / 10 ? 2 : 10;
+	}
+	printf("%s\t%lu\t%.1f\n", name, ops, ops ? elapsed * 1e9 / ops : 0.0);
+	return 0;
+}
+
+static int setup_fixtures(void)
+{
+	struct sc_pkcs15_object *obj;
+	const u8 *p;
+	size_t i, len, left;
+	char *s;
+	int r;
+
+	for (i = 0; i < sizeof(apdu_fixtures) / sizeof(apdu_fixtures[0]); i++) {
+		len = sizeof(fx.apdu_bytes[i]);
+		if (sc_hex_to_bin(apdu_fixtures[i], fx.apdu_bytes[i], &len) != SC_SUCCESS
+				|| sc_bytes2apdu(fx.ctx, fx.apdu_bytes[i], len, &fx.apdus[i]) != SC_SUCCESS) {
+			fprintf(stderr, "bad APDU fixture %s\n", apdu_fixtures[i]);
+			return 1;
+		}
+		fx.apdu_lens[i] = len;
+	}
+
+	for (i = 0; i < sizeof(fx.digest); i++)
+		fx.digest[i] = (u8) (i * 7 + 1);
+	len = sizeof(fx.block01);
+	if (sc_pkcs1_encode(fx.ctx, SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA256,
+			fx.digest, sizeof(fx.digest), fx.block01, &len, sizeof(fx.block01)) != SC_SUCCESS)
+		return 1;
+	fx.block02[0] = 0x00;
+	fx.block02[1] = 0x02;
+	for (i = 2; i < sizeof(fx.block02) - 49; i++)
+		fx.block02[i] = (u8) (i % 255 + 1);
+	fx.block02[i] = 0x00;
+
+	for (i = 0; i < sizeof(fx.bin); i++)
+		fx.bin[i] = (u8) (i * 31 + 17);
+	if (sc_bin_to_hex(fx.bin, 256, fx.hex, sizeof(fx.hex), ':') != SC_SUCCESS)
+		return 1;
+	if (sc_base64_encode(fx.bin, sizeof(fx.bin), (u8 *) fx.b64, sizeof(fx.b64), 64) != SC_SUCCESS)
+		return 1;
+
+	fx.card = calloc(1, sizeof(struct sc_card));
+	if (fx.card == NULL)
+		return 1;
+	fx.card->ctx = fx.ctx;
+	fx.card->atr.len = sizeof(fx.card->atr.value);
+	if (sc_hex_to_bin("3B:68:00:00:29:05:01:02:01:AD:13:03", fx.card->atr.value, &fx.card->atr.len))
+		return 1;
+
+	/* the objects of all DFs go to the card for the lookups */
+	for (i = 0; i < DF_TYPES; i++) {
+		if (p15image_generate(&fx.images[i], df_types[i].type, DF_ENTRIES, 0, 1 + i))
+			return 1;
+		p = fx.images[i].data;
+		left = fx.images[i].len;
+		while (left) {
+			obj = calloc(1, sizeof(*obj));
+			if (obj == NULL)
+				return 1;
+			r = p15image_decoder(df_types[i].type)(fx.p15card, obj, &p, &left);
+			if (r == 0)
+				r = sc_pkcs15_add_object(fx.p15card, obj);
+			if (r) {
+				sc_pkcs15_free_object(obj);
+				return 1;
+			}
+			/* spread the looked up IDs over the list */
+			if (fx.n_ids[i] < FIND_IDS && (left == 0 || rand() % (DF_ENTRIES / FIND_IDS) == 0)) {
+				if (df_types[i].type == SC_PKCS15_AODF)
+					fx.ids[i][fx.n_ids[i]++] = ((struct sc_pkcs15_auth_info *) obj->data)->auth_id;
+				else if (df_types[i].type == SC_PKCS15_PRKDF)
+					fx.ids[i][fx.n_ids[i]++] = ((struct sc_pkcs15_prkey_info *) obj->data)->id;
+				else if (df_types[i].type == SC_PKCS15_PUKDF)
+					fx.ids[i][fx.n_ids[i]++] = ((struct sc_pkcs15_pubkey_info *) obj->data)->id;
+				else
+					fx.ids[i][fx.n_ids[i]++] = ((struct sc_pkcs15_cert_info *) obj->data)->id;
+			}
+		}
+	}
+
+	/* a configuration file with blocks of the usual kinds */
+	len = 1024 + CONF_BLOCKS * 256;
+	fx.conf = s = malloc(len);
+	if (s == NULL)
+		return 1;
+	s += sprintf(s, "app default {\n\tdebug = 0;\n\tcard_drivers = old, internal;\n"
+			"\treader_driver pcsc {\n\t\tconnect_exclusive = false;\n\t\tmax_send_size = 255;\n\t}\n"
+			"\tframework pkcs15 {\n\t\tuse_file_caching = true;\n"
+			"\t\tbuiltin_emulators = esteid, openpgp, starcert, infocamere;\n\t}\n");
+	for (i = 0; i < CONF_BLOCKS; i++)
+		s += sprintf(s, "\tcard_atr 3b:f2:18:00:ff:c1:0a:31:fe:55:c8:%02x {\n"
+				"\t\tatrmask = \"ff:ff:0f:ff:00:ff:00:ff:ff:00:00:ff\";\n"
+				"\t\tname = \"Card %u\";\n\t\tdriver = \"cardos\";\n"
+				"\t\tpkcs11_hotplug = yes;\n\t}\n", (unsigned int) i, (unsigned int) i);
+	sprintf(s, "}\napp opensc-pkcs11 {\n\tpkcs11 {\n\t\tmax_virtual_slots = 16;\n"
+			"\t\tslots_per_card = 4;\n\t}\n}\n");
+	return 0;
+}
+
+static const struct option options[] = {
+	{ "time", 1, NULL, 't' },
+	{ "list", 0, NULL, 'l' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	const char *filter = NULL;
+	size_t i;
+	int c, r = 0;
+
+	while ((c = getopt_long(argc, argv, "t:l", options, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'l':
+			for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+				printf("%s\n", benchmarks[i].name);
+			return 0;
+		default:
+			fprintf(stderr, "Usage: microbench [-t seconds] [-l] [name-prefix]\n");
+			return 2;
+		}
+	}
+	if (optind < argc)
+		filter = argv[optind];
+
+	if (sc_establish_context(&fx.ctx, "microbench") != SC_SUCCESS) {
+		fprintf(stderr, "Failed to establish context\n");
+		return 1;
+	}
+	fx.p15card = p15image_bind(fx.ctx);
+	if (fx.p15card == NULL || setup_fixtures()) {
+		fprintf(stderr, "Failed to set up the fixtures\n");
+		r = 1;
+		goto out;
+	}
+
+	printf("# opensc %s microbench\n# name\toperations\tns/op\n", sc_get_version());
+	for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+		if (filter && strncmp(benchmarks[i].name, filter, strlen(filter)))
+			continue;
+		r |= measure(benchmarks[i].name, benchmarks[i].run);
+	}
+
+out:
+	for (i = 0; i < DF_TYPES; i++)
+		p15image_free(&fx.images[i]);
+	free(fx.conf);
+	free(fx.card);
+	if (fx.p15card)
+		p15image_unbind(fx.p15card);
+	sc_release_context(fx.ctx);
+	return r;
+}
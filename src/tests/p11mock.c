@@ -0,0 +1,381 @@
+/*
+ * p11mock.c: Minimal PKCS#11 module for tests that need no card
+ *
+ * One slot with a token holding one private key. The user PIN is
+ * P11MOCK_PIN; a "signature" is the input with every byte inverted, so
+ * tests can check results without a public key.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#define CRYPTOKI_EXPORTS
+#include "pkcs11/pkcs11.h"
+
+#define P11MOCK_PIN	"123456"
+#define P11MOCK_SLOT	1
+#define P11MOCK_KEY	1
+#define MAX_SESSIONS	16
+
+static int initialized, logged_in;
+static struct {
+	int open;
+	int find_pending;
+	int sign_active;
+} sessions[MAX_SESSIONS + 1];
+
+static CK_RV check_session(CK_SESSION_HANDLE h)
+{
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	if (h == 0 || h > MAX_SESSIONS || !sessions[h].open)
+		return CKR_SESSION_HANDLE_INVALID;
+	return CKR_OK;
+}
+
+static void pad(CK_UTF8CHAR *dst, const char *src, size_t len)
+{
+	memset(dst, ' ', len);
+	memcpy(dst, src, strlen(src) < len ? strlen(src) : len);
+}
+
+static CK_RV mock_Initialize(CK_VOID_PTR args)
+{
+	if (initialized)
+		return CKR_CRYPTOKI_ALREADY_INITIALIZED;
+	memset(sessions, 0, sizeof(sessions));
+	initialized = 1;
+	logged_in = 0;
+	return CKR_OK;
+}
+
+static CK_RV mock_Finalize(CK_VOID_PTR reserved)
+{
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	initialized = 0;
+	return CKR_OK;
+}
+
+static CK_RV mock_GetInfo(CK_INFO_PTR info)
+{
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	memset(info, 0, sizeof(*info));
+	info->cryptokiVersion.major = 2;
+	info->cryptokiVersion.minor = 20;
+	pad(info->manufacturerID, "OpenSC Project", sizeof(info->manufacturerID));
+	pad(info->libraryDescription, "Test module", sizeof(info->libraryDescription));
+	return CKR_OK;
+}
+
+static CK_RV mock_GetSlotList(CK_BBOOL present, CK_SLOT_ID_PTR list, CK_ULONG_PTR count)
+{
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	if (list) {
+		if (*count < 1) {
+			*count = 1;
+			return CKR_BUFFER_TOO_SMALL;
+		}
+		list[0] = P11MOCK_SLOT;
+	}
+	*count = 1;
+	return CKR_OK;
+}
+
+static CK_RV mock_GetSlotInfo(CK_SLOT_ID slot, CK_SLOT_INFO_PTR info)
+{
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	if (slot != P11MOCK_SLOT)
+		return CKR_SLOT_ID_INVALID;
+	memset(info, 0, sizeof(*info));
+	pad(info->slotDescription, "Test slot", sizeof(info->slotDescription));
+	pad(info->manufacturerID, "OpenSC Project", sizeof(info->manufacturerID));
+	info->flags = CKF_TOKEN_PRESENT;
+	return CKR_OK;
+}
+
+static CK_RV mock_GetTokenInfo(CK_SLOT_ID slot, CK_TOKEN_INFO_PTR info)
+{
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	if (slot != P11MOCK_SLOT)
+		return CKR_SLOT_ID_INVALID;
+	memset(info, 0, sizeof(*info));
+	pad(info->label, "Test token", sizeof(info->label));
+	pad(info->manufacturerID, "OpenSC Project", sizeof(info->manufacturerID));
+	pad(info->model, "mock", sizeof(info->model));
+	pad(info->serialNumber, "1", sizeof(info->serialNumber));
+	info->flags = CKF_TOKEN_INITIALIZED | CKF_USER_PIN_INITIALIZED | CKF_LOGIN_REQUIRED;
+	info->ulMaxSessionCount = MAX_SESSIONS;
+	info->ulMaxPinLen = 8;
+	info->ulMinPinLen = 4;
+	return CKR_OK;
+}
+
+static CK_RV mock_OpenSession(CK_SLOT_ID slot, CK_FLAGS flags, CK_VOID_PTR app,
+		CK_NOTIFY notify, CK_SESSION_HANDLE_PTR handle)
+{
+	CK_SESSION_HANDLE h;
+
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	if (slot != P11MOCK_SLOT)
+		return CKR_SLOT_ID_INVALID;
+	if (!(flags & CKF_SERIAL_SESSION))
+		return CKR_SESSION_PARALLEL_NOT_SUPPORTED;
+	for (h = 1; h <= MAX_SESSIONS && sessions[h].open; h++)
+		;
+	if (h > MAX_SESSIONS)
+		return CKR_SESSION_COUNT;
+	memset(&sessions[h], 0, sizeof(sessions[h]));
+	sessions[h].open = 1;
+	*handle = h;
+	return CKR_OK;
+}
+
+static CK_RV mock_CloseSession(CK_SESSION_HANDLE h)
+{
+	CK_SESSION_HANDLE i;
+	CK_RV rv = check_session(h);
+
+	if (rv != CKR_OK)
+		return rv;
+	sessions[h].open = 0;
+	/* the login ends with the last session */
+	for (i = 1; i <= MAX_SESSIONS && !sessions[i].open; i++)
+		;
+	if (i > MAX_SESSIONS)
+		logged_in = 0;
+	return CKR_OK;
+}
+
+static CK_RV mock_CloseAllSessions(CK_SLOT_ID slot)
+{
+	CK_SESSION_HANDLE h;
+
+	if (!initialized)
+		return CKR_CRYPTOKI_NOT_INITIALIZED;
+	for (h = 1; h <= MAX_SESSIONS; h++)
+		sessions[h].open = 0;
+	logged_in = 0;
+	return CKR_OK;
+}
+
+static CK_RV mock_GetSessionInfo(CK_SESSION_HANDLE h, CK_SESSION_INFO_PTR info)
+{
+	CK_RV rv = check_session(h);
+
+	if (rv != CKR_OK)
+		return rv;
+	memset(info, 0, sizeof(*info));
+	info->slotID = P11MOCK_SLOT;
+	info->state = logged_in ? CKS_RO_USER_FUNCTIONS : CKS_RO_PUBLIC_SESSION;
+	info->flags = CKF_SERIAL_SESSION;
+	return CKR_OK;
+}
+
+static CK_RV mock_Login(CK_SESSION_HANDLE h, CK_USER_TYPE user, CK_UTF8CHAR_PTR pin, CK_ULONG pin_len)
+{
+	CK_RV rv = check_session(h);
+
+	if (rv != CKR_OK)
+		return rv;
+	if (user != CKU_USER)
+		return CKR_USER_TYPE_INVALID;
+	if (logged_in)
+		return CKR_USER_ALREADY_LOGGED_IN;
+	if (pin == NULL || pin_len != strlen(P11MOCK_PIN) || memcmp(pin, P11MOCK_PIN, pin_len))
+		return CKR_PIN_INCORRECT;
+	logged_in = 1;
+	return CKR_OK;
+}
+
+static CK_RV mock_Logout(CK_SESSION_HANDLE h)
+{
+	CK_RV rv = check_session(h);
+
+	if (rv != CKR_OK)
+		return rv;
+	if (!logged_in)
+		return CKR_USER_NOT_LOGGED_IN;
+	logged_in = 0;
+	return CKR_OK;
+}
+
+static CK_RV mock_GetAttributeValue(CK_SESSION_HANDLE h, CK_OBJECT_HANDLE obj,
+		CK_ATTRIBUTE_PTR templ, CK_ULONG count)
+{
+	static CK_OBJECT_CLASS class = CKO_PRIVATE_KEY;
+	static CK_BBOOL true_val = CK_TRUE;
+	static const char label[] = "Test key";
+	CK_RV rv = check_session(h), res = CKR_OK;
+	const void *value;
+	CK_ULONG i, len;
+
+	if (rv != CKR_OK)
+		return rv;
+	if (obj != P11MOCK_KEY || !logged_in)
+		return CKR_OBJECT_HANDLE_INVALID;
+	for (i = 0; i < count; i++) {
+		switch (templ[i].type) {
+		case CKA_CLASS:
+			value = &class;
+			len = sizeof(class);
+			break;
+		case CKA_SIGN:
+		case CKA_PRIVATE:
+			value = &true_val;
+			len = sizeof(true_val);
+			break;
+		case CKA_LABEL:
+			value = label;
+			len = sizeof(label) - 1;
+			break;
+		default:
+			templ[i].ulValueLen = (CK_ULONG) -1;
+			res = CKR_ATTRIBUTE_TYPE_INVALID;
+			continue;
+		}
+		if (templ[i].pValue && templ[i].ulValueLen < len) {
+			templ[i].ulValueLen = (CK_ULONG) -1;
+			res = CKR_BUFFER_TOO_SMALL;
+			continue;
+		}
+		if (templ[i].pValue)
+			memcpy(templ[i].pValue, value, len);
+		templ[i].ulValueLen = len;
+	}
+	return res;
+}
+
+static CK_RV mock_FindObjectsInit(CK_SESSION_HANDLE h, CK_ATTRIBUTE_PTR templ, CK_ULONG count)
+{
+	CK_RV rv = check_session(h);
+	CK_ULONG i;
+
+	if (rv != CKR_OK)
+		return rv;
+	/* the key is private, it is only found after login */
+	sessions[h].find_pending = logged_in;
+	for (i = 0; i < count; i++)
+		if (templ[i].type == CKA_CLASS && (templ[i].ulValueLen != sizeof(CK_OBJECT_CLASS)
+				|| *(CK_OBJECT_CLASS *) templ[i].pValue != CKO_PRIVATE_KEY))
+			sessions[h].find_pending = 0;
+	return CKR_OK;
+}
+
+static CK_RV mock_FindObjects(CK_SESSION_HANDLE h, CK_OBJECT_HANDLE_PTR list,
+		CK_ULONG max, CK_ULONG_PTR count)
+{
+	CK_RV rv = check_session(h);
+
+	if (rv != CKR_OK)
+		return rv;
+	*count = 0;
+	if (sessions[h].find_pending && max > 0) {
+		list[0] = P11MOCK_KEY;
+		*count = 1;
+		sessions[h].find_pending = 0;
+	}
+	return CKR_OK;
+}
+
+static CK_RV mock_FindObjectsFinal(CK_SESSION_HANDLE h)
+{
+	CK_RV rv = check_session(h);
+
+	if (rv == CKR_OK)
+		sessions[h].find_pending = 0;
+	return rv;
+}
+
+static CK_RV mock_SignInit(CK_SESSION_HANDLE h, CK_MECHANISM_PTR mech, CK_OBJECT_HANDLE key)
+{
+	CK_RV rv = check_session(h);
+
+	if (rv != CKR_OK)
+		return rv;
+	if (mech->mechanism != CKM_RSA_X_509)
+		return CKR_MECHANISM_INVALID;
+	if (key != P11MOCK_KEY)
+		return CKR_KEY_HANDLE_INVALID;
+	if (!logged_in)
+		return CKR_USER_NOT_LOGGED_IN;
+	sessions[h].sign_active = 1;
+	return CKR_OK;
+}
+
+static CK_RV mock_Sign(CK_SESSION_HANDLE h, CK_BYTE_PTR data, CK_ULONG data_len,
+		CK_BYTE_PTR sig, CK_ULONG_PTR sig_len)
+{
+	CK_RV rv = check_session(h);
+	CK_ULONG i;
+
+	if (rv != CKR_OK)
+		return rv;
+	if (!sessions[h].sign_active)
+		return CKR_OPERATION_NOT_INITIALIZED;
+	if (sig == NULL) {
+		*sig_len = data_len;
+		return CKR_OK;
+	}
+	if (*sig_len < data_len) {
+		*sig_len = data_len;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+	for (i = 0; i < data_len; i++)
+		sig[i] = ~data[i];
+	*sig_len = data_len;
+	sessions[h].sign_active = 0;
+	return CKR_OK;
+}
+
+static CK_FUNCTION_LIST mock_function_list;
+
+CK_RV C_GetFunctionList(CK_FUNCTION_LIST_PTR_PTR list)
+{
+	if (list == NULL)
+		return CKR_ARGUMENTS_BAD;
+	/* everything not set up here stays NULL, the tests do not call it */
+	mock_function_list.version.major = 2;
+	mock_function_list.version.minor = 20;
+	mock_function_list.C_Initialize = mock_Initialize;
+	mock_function_list.C_Finalize = mock_Finalize;
+	mock_function_list.C_GetInfo = mock_GetInfo;
+	mock_function_list.C_GetFunctionList = C_GetFunctionList;
+	mock_function_list.C_GetSlotList = mock_GetSlotList;
+	mock_function_list.C_GetSlotInfo = mock_GetSlotInfo;
+	mock_function_list.C_GetTokenInfo = mock_GetTokenInfo;
+	mock_function_list.C_OpenSession = mock_OpenSession;
+	mock_function_list.C_CloseSession = mock_CloseSession;
+	mock_function_list.C_CloseAllSessions = mock_CloseAllSessions;
+	mock_function_list.C_GetSessionInfo = mock_GetSessionInfo;
+	mock_function_list.C_Login = mock_Login;
+	mock_function_list.C_Logout = mock_Logout;
+	mock_function_list.C_GetAttributeValue = mock_GetAttributeValue;
+	mock_function_list.C_FindObjectsInit = mock_FindObjectsInit;
+	mock_function_list.C_FindObjects = mock_FindObjects;
+	mock_function_list.C_FindObjectsFinal = mock_FindObjectsFinal;
+	mock_function_list.C_SignInit = mock_SignInit;
+	mock_function_list.C_Sign = mock_Sign;
+	*list = &mock_function_list;
+	return CKR_OK;
+}
@@ -0,0 +1,260 @@
+/*
+ * p15dectest.c: Differential test of the table driven PKCS#15 entry
+ * decoder against the generic ASN.1 one
+ *
+ * Every entry of a synthetic DF image is decoded twice, with and without
+ * the fast path, and the resulting objects are compared field by field.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/compat_getopt.h"
+#include "libopensc/opensc.h"
+#include "libopensc/asn1.h"
+#include "libopensc/pkcs15.h"
+#include "p15image.h"
+
+static const struct {
+	unsigned int type;
+	const char *name;
+} df_types[] = {
+	{ SC_PKCS15_PRKDF, "PrKDF" },
+	{ SC_PKCS15_PUKDF, "PuKDF" },
+	{ SC_PKCS15_CDF, "CDF" },
+	{ SC_PKCS15_AODF, "AODF" },
+};
+
+static int verbose = 0;
+
+static int compare_der(const struct sc_pkcs15_der *a, const struct sc_pkcs15_der *b)
+{
+	if (a->len != b->len || (a->value == NULL) != (b->value == NULL))
+		return 1;
+	return a->len && memcmp(a->value, b->value, a->len);
+}
+
+static int compare_data(unsigned int type, const void *a, const void *b)
+{
+	switch (type & SC_PKCS15_TYPE_CLASS_MASK) {
+	case SC_PKCS15_TYPE_PRKEY: {
+		struct sc_pkcs15_prkey_info x = *(const struct sc_pkcs15_prkey_info *) a;
+		struct sc_pkcs15_prkey_info y = *(const struct sc_pkcs15_prkey_info *) b;
+
+		if (compare_der(&x.subject, &y.subject) || x.params.len != y.params.len
+				|| (x.params.len && memcmp(x.params.data, y.params.data, x.params.len)))
+			return 1;
+		x.subject.value = y.subject.value = NULL;
+		x.params.data = y.params.data = NULL;
+		return memcmp(&x, &y, sizeof(x));
+	}
+	case SC_PKCS15_TYPE_PUBKEY: {
+		struct sc_pkcs15_pubkey_info x = *(const struct sc_pkcs15_pubkey_info *) a;
+		struct sc_pkcs15_pubkey_info y = *(const struct sc_pkcs15_pubkey_info *) b;
+
+		if (compare_der(&x.subject, &y.subject) || compare_der(&x.direct.raw, &y.direct.raw)
+				|| compare_der(&x.direct.spki, &y.direct.spki) || x.params.len != y.params.len
+				|| (x.params.len && memcmp(x.params.data, y.params.data, x.params.len)))
+			return 1;
+		x.subject.value = y.subject.value = NULL;
+		x.direct.raw.value = y.direct.raw.value = NULL;
+		x.direct.spki.value = y.direct.spki.value = NULL;
+		x.params.data = y.params.data = NULL;
+		return memcmp(&x, &y, sizeof(x));
+	}
+	case SC_PKCS15_TYPE_CERT: {
+		struct sc_pkcs15_cert_info x = *(const struct sc_pkcs15_cert_info *) a;
+		struct sc_pkcs15_cert_info y = *(const struct sc_pkcs15_cert_info *) b;
+
+		if (compare_der(&x.value, &y.value))
+			return 1;
+		x.value.value = y.value.value = NULL;
+		return memcmp(&x, &y, sizeof(x));
+	}
+	case SC_PKCS15_TYPE_AUTH:
+		return memcmp(a, b, sizeof(struct sc_pkcs15_auth_info));
+	}
+	return 1;
+}
+
+static const char *compare_objects(const struct sc_pkcs15_object *a, const struct sc_pkcs15_object *b)
+{
+	if (a->type != b->type)
+		return "type";
+	if (memcmp(a->label, b->label, sizeof(a->label)))
+		return "label";
+	if (a->flags != b->flags)
+		return "flags";
+	if (memcmp(&a->auth_id, &b->auth_id, sizeof(a->auth_id)))
+		return "auth_id";
+	if (a->user_consent != b->user_consent)
+		return "user_consent";
+	if (memcmp(a->access_rules, b->access_rules, sizeof(a->access_rules)))
+		return "access_rules";
+	if (compare_der(&a->content, &b->content))
+		return "content";
+	if ((a->data == NULL) != (b->data == NULL) || (a->data && compare_data(a->type, a->data, b->data)))
+		return "data";
+	return NULL;
+}
+
+/* Whether the fast path takes the entry at all */
+static int fast_path_taken(unsigned int df_type, const u8 *p, size_t left)
+{
+	struct sc_pkcs15_object obj;
+	union {
+		struct sc_pkcs15_prkey_info prkey;
+		struct sc_pkcs15_pubkey_info pubkey;
+		struct sc_pkcs15_cert_info cert;
+		struct sc_pkcs15_auth_info auth;
+	} info;
+	int r = SC_ERROR_NOT_SUPPORTED;
+
+	memset(&obj, 0, sizeof(obj));
+	memset(&info, 0, sizeof(info));
+	switch (df_type) {
+	case SC_PKCS15_PRKDF:
+		r = sc_pkcs15_fast_decode_prkdf_entry(&obj, &info.prkey, &p, &left);
+		free(info.prkey.subject.value);
+		break;
+	case SC_PKCS15_PUKDF:
+		r = sc_pkcs15_fast_decode_pukdf_entry(&obj, &info.pubkey, &p, &left);
+		free(info.pubkey.subject.value);
+		break;
+	case SC_PKCS15_CDF:
+		r = sc_pkcs15_fast_decode_cdf_entry(&obj, &info.cert, &p, &left);
+		break;
+	case SC_PKCS15_AODF:
+		r = sc_pkcs15_fast_decode_aodf_entry(&obj, &info.auth, &p, &left);
+		break;
+	}
+	return r == 0;
+}
+
+static int run(struct sc_pkcs15_card *p15card, unsigned int df_type, const char *name,
+		unsigned int count, unsigned int odd, unsigned long seed)
+{
+	p15image_decode_func decode = p15image_decoder(df_type);
+	struct p15image img = { NULL, 0, 0 };
+	struct sc_pkcs15_object *fast, *generic;
+	const u8 *p, *pf, *pg, *next;
+	size_t left, lf, lg, taglen;
+	unsigned int cla, tag, entries = 0, taken = 0, failed = 0, mismatches = 0;
+	const char *what;
+	int rf, rg;
+
+	if (p15image_generate(&img, df_type, count, odd, seed)) {
+		fprintf(stderr, "%s: cannot generate image\n", name);
+		return 1;
+	}
+
+	p = img.data;
+	left = img.len;
+	while (left) {
+		fast = calloc(1, sizeof(*fast));
+		generic = calloc(1, sizeof(*generic));
+		if (fast == NULL || generic == NULL)
+			return 1;
+
+		pf = pg = p;
+		lf = lg = left;
+		p15card->opts.use_fast_decoder = 1;
+		rf = decode(p15card, fast, &pf, &lf);
+		p15card->opts.use_fast_decoder = 0;
+		rg = decode(p15card, generic, &pg, &lg);
+
+		what = NULL;
+		if (rf != rg)
+			what = "return code";
+		else if (pf != pg || lf != lg)
+			what = "consumed length";
+		else if (rg == 0)
+			what = compare_objects(fast, generic);
+		if (what) {
+			mismatches++;
+			fprintf(stderr, "%s entry %u at offset %lu: %s differs (fast %d, generic %d)\n",
+					name, entries, (unsigned long) (p - img.data), what, rf, rg);
+		}
+		if (fast_path_taken(df_type, p, left))
+			taken++;
+		if (rg)
+			failed++;
+
+		sc_pkcs15_free_object(fast);
+		sc_pkcs15_free_object(generic);
+		entries++;
+
+		/* every generated entry is a single TLV */
+		next = p;
+		if (sc_asn1_read_tag(&next, left, &cla, &tag, &taglen) != SC_SUCCESS || next == NULL)
+			break;
+		next += taglen;
+		left -= next - p;
+		p = next;
+	}
+
+	printf("%-6s entries %6u  fast path %6u  generic only %6u  failed %6u  mismatches %u\n",
+			name, entries, taken, entries - taken, failed, mismatches);
+	p15image_free(&img);
+	return mismatches ? 1 : 0;
+}
+
+static const struct option options[] = {
+	{ "entries", 1, NULL, 'n' },
+	{ "odd", 1, NULL, 'o' },
+	{ "seed", 1, NULL, 's' },
+	{ "verbose", 0, NULL, 'v' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	struct sc_context *ctx = NULL;
+	struct sc_pkcs15_card *p15card;
+	unsigned int count = 2000, odd = 30;
+	unsigned long seed = 1;
+	size_t i;
+	int c, r = 0;
+
+	while ((c = getopt_long(argc, argv, "n:o:s:v", options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'o':
+			odd = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			fprintf(stderr, "Usage: p15dectest [-n entries] [-o odd-percent] [-s seed] [-v]\n");
+			return 2;
+		}
+	}
+
+	if (sc_establish_context(&ctx, "p15dectest") != SC_SUCCESS) {
+		fprintf(stderr, "Failed to establish context\n");
+		return 1;
+	}
+	if (verbose)
+		ctx->debug = verbose;
+	p15card = p15image_bind(ctx);
+	if (p15card == NULL) {
+		sc_release_context(ctx);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(df_types) / sizeof(df_types[0]); i++)
+		r |= run(p15card, df_types[i].type, df_types[i].name, count, odd, seed + i);
+
+	p15image_unbind(p15card);
+	sc_release_context(ctx);
+	return r;
+}
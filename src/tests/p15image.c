@@ -0,0 +1,486 @@
+/*
+ * p15image.c: Synthetic PKCS#15 directory files
+ *
+ * Builds PrKDF, PuKDF, CDF and AODF images with randomly chosen optional
+ * attributes.  A configurable share of the entries uses layouts and
+ * encodings outside of the common case: other key types, direct values,
+ * oversized labels and IDs, bad lengths and truncated elements.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libopensc/opensc.h"
+#include "libopensc/asn1.h"
+#include "libopensc/pkcs15.h"
+#include "p15image.h"
+
+struct blob {
+	u8 data[2048];
+	size_t len;
+};
+
+static unsigned long rnd_state;
+static unsigned int odd_pct;
+
+static unsigned int rnd(void)
+{
+	rnd_state = rnd_state * 1103515245UL + 12345UL;
+	return (unsigned int) (rnd_state >> 16) & 0x7FFF;
+}
+
+static int chance(unsigned int pct)
+{
+	return rnd() % 100 < pct;
+}
+
+/* true for 'pct' percent of the unusual entries */
+static int odd(unsigned int pct)
+{
+	return odd_pct && chance(odd_pct) && chance(pct);
+}
+
+static void put(struct blob *b, const u8 *data, size_t len)
+{
+	if (b->len + len > sizeof(b->data))
+		len = sizeof(b->data) - b->len;
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void put_tlv(struct blob *b, unsigned int tag, const u8 *data, size_t len)
+{
+	u8 hdr[4];
+	size_t n = 0;
+
+	hdr[n++] = tag;
+	if (len < 0x80) {
+		hdr[n++] = len;
+	}
+	else if (len < 0x100) {
+		hdr[n++] = 0x81;
+		hdr[n++] = len;
+	}
+	else {
+		hdr[n++] = 0x82;
+		hdr[n++] = len >> 8;
+		hdr[n++] = len & 0xFF;
+	}
+	put(b, hdr, n);
+	put(b, data, len);
+}
+
+static void put_blob(struct blob *b, unsigned int tag, struct blob *inner)
+{
+	/* cut the contents short */
+	if (inner->len && odd(3))
+		inner->len -= 1 + rnd() % inner->len;
+	put_tlv(b, tag, inner->data, inner->len);
+}
+
+static void put_random(struct blob *b, unsigned int tag, size_t len)
+{
+	u8 data[512];
+	size_t i;
+
+	for (i = 0; i < len && i < sizeof(data); i++)
+		data[i] = 1 + rnd() % 0xFE;
+	put_tlv(b, tag, data, i);
+}
+
+static void put_int(struct blob *b, unsigned int tag, int value)
+{
+	u8 data[5];
+	size_t len = 4;
+
+	data[4] = 0;
+	data[0] = (value >> 24) & 0xFF;
+	data[1] = (value >> 16) & 0xFF;
+	data[2] = (value >> 8) & 0xFF;
+	data[3] = value & 0xFF;
+	while (len > 1 && ((data[4 - len] == 0x00 && !(data[5 - len] & 0x80))
+			|| (data[4 - len] == 0xFF && (data[5 - len] & 0x80))))
+		len--;
+	if (odd(5)) {
+		/* empty and oversized integers */
+		put_tlv(b, tag, data, rnd() % 2 ? 0 : 5);
+		return;
+	}
+	put_tlv(b, tag, data + 4 - len, len);
+}
+
+static void put_bits(struct blob *b, unsigned int tag)
+{
+	u8 data[6];
+	size_t len, i;
+
+	len = 1 + rnd() % 3;
+	data[0] = len > 1 ? rnd() % 8 : 0;
+	if (odd(10)) {
+		len = rnd() % 7;
+		data[0] = rnd() % 8;
+	}
+	for (i = 1; i < len; i++)
+		data[i] = rnd() & 0xFF;
+	put_tlv(b, tag, data, len);
+}
+
+static void put_id(struct blob *b)
+{
+	put_random(b, SC_ASN1_TAG_OCTET_STRING, odd(10) ? 300 : 1 + rnd() % 20);
+}
+
+static void put_bool(struct blob *b, unsigned int tag)
+{
+	u8 data[2] = { 0xFF, 0x00 };
+
+	data[0] = rnd() % 2 ? 0xFF : 0x00;
+	put_tlv(b, tag, data, odd(10) ? 2 : 1);
+}
+
+static void put_path(struct blob *b)
+{
+	static const u8 path[] = { 0x3F, 0x00, 0x50, 0x15, 0x43, 0x01, 0x43, 0x02,
+		0x43, 0x03, 0x43, 0x04, 0x43, 0x05, 0x43, 0x06, 0x43, 0x07, 0x43, 0x08 };
+	struct blob c, ext;
+	size_t len;
+
+	c.len = 0;
+	len = 2 * (1 + rnd() % 3);
+	if (odd(10))
+		len = sizeof(path);
+
+	if (!odd(5))
+		put_tlv(&c, SC_ASN1_TAG_OCTET_STRING, len < sizeof(path) ? path + 4 : path, len);
+	if (chance(30)) {
+		put_int(&c, SC_ASN1_TAG_INTEGER, rnd() % 512);
+		if (!odd(20))
+			put_int(&c, SC_ASN1_TAG_CONTEXT | 0, rnd() % 2048);
+	}
+	if (chance(10) || odd(10)) {
+		ext.len = 0;
+		put_random(&ext, SC_ASN1_TAG_APPLICATION | 0x0F, odd(10) ? 20 : 5 + rnd() % 12);
+		put_tlv(&ext, SC_ASN1_TAG_OCTET_STRING, path, 2 + 2 * (rnd() % 3));
+		put_blob(&c, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 1, &ext);
+	}
+	put_blob(b, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &c);
+}
+
+static void put_common_object_attributes(struct blob *b)
+{
+	struct blob c, rules, rule;
+	unsigned int n;
+	char label[300];
+	size_t len, i;
+
+	c.len = 0;
+	if (chance(80)) {
+		len = odd(10) ? 250 + rnd() % 50 : rnd() % 32;
+		for (i = 0; i < len; i++)
+			label[i] = 'A' + rnd() % 26;
+		put_tlv(&c, odd(5) ? 0x13 : 0x0C, (u8 *) label, len);
+	}
+	if (chance(70))
+		put_bits(&c, SC_ASN1_TAG_BIT_STRING);
+	if (chance(60))
+		put_id(&c);
+	if (chance(20))
+		put_int(&c, SC_ASN1_TAG_INTEGER, rnd() % 4);
+	if (chance(50)) {
+		rules.len = 0;
+		n = odd(20) ? rnd() % 12 : 1 + rnd() % 3;
+		while (n--) {
+			rule.len = 0;
+			if (chance(90))
+				put_bits(&rule, SC_ASN1_TAG_BIT_STRING);
+			if (chance(70))
+				put_id(&rule);
+			put_blob(&rules, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &rule);
+		}
+		put_blob(&c, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &rules);
+	}
+	if (odd(10))
+		put_random(&c, SC_ASN1_TAG_CONTEXT | 5, 3);
+	put_blob(b, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &c);
+}
+
+static void put_common_key_attributes(struct blob *b, int alg_refs)
+{
+	struct blob c, refs;
+	unsigned int n;
+
+	c.len = 0;
+	put_id(&c);
+	put_bits(&c, SC_ASN1_TAG_BIT_STRING);
+	if (chance(30))
+		put_bool(&c, SC_ASN1_TAG_BOOLEAN);
+	if (chance(40))
+		put_bits(&c, SC_ASN1_TAG_BIT_STRING);
+	if (chance(80))
+		put_int(&c, SC_ASN1_TAG_INTEGER, chance(10) ? -2 - (int) (rnd() % 126) : (int) (rnd() % 256));
+	if (alg_refs && chance(20)) {
+		refs.len = 0;
+		n = odd(20) ? rnd() % 11 : 1 + rnd() % 3;
+		while (n--)
+			put_int(&refs, SC_ASN1_TAG_INTEGER, rnd() % 300);
+		put_blob(&c, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 1, &refs);
+	}
+	put_blob(b, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &c);
+}
+
+static void put_subject(struct blob *b)
+{
+	struct blob c;
+
+	if (!chance(40))
+		return;
+	c.len = 0;
+	put_random(&c, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, rnd() % 60);
+	put_blob(b, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 0, &c);
+}
+
+static void put_type_attributes(struct blob *b, struct blob *attrs)
+{
+	struct blob c;
+
+	c.len = 0;
+	put_blob(&c, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, attrs);
+	put_blob(b, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 1, &c);
+}
+
+static void put_direct_value(struct blob *b)
+{
+	struct blob c;
+
+	c.len = 0;
+	put_random(&c, SC_ASN1_TAG_INTEGER, 1 + rnd() % 64);
+	put_random(&c, SC_ASN1_TAG_INTEGER, 3);
+	put_blob(b, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 0, &c);
+}
+
+static void gen_prkdf_entry(struct blob *b)
+{
+	struct blob e, a;
+	unsigned int tag = SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED;
+
+	e.len = a.len = 0;
+	put_common_object_attributes(&e);
+	put_common_key_attributes(&e, 1);
+	put_subject(&e);
+	if (odd(20)) {
+		/* DSA or GOST R 34.10 */
+		put_path(&a);
+		if (chance(50)) {
+			tag = SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 2;
+		}
+		else {
+			tag = SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 4;
+			put_int(&a, SC_ASN1_TAG_INTEGER, 1);
+			put_int(&a, SC_ASN1_TAG_INTEGER, 1);
+		}
+	}
+	else if (chance(30)) {
+		tag = SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 0;
+		put_path(&a);
+		if (chance(50))
+			put_int(&a, SC_ASN1_TAG_INTEGER, 256);
+	}
+	else {
+		put_path(&a);
+		put_int(&a, SC_ASN1_TAG_INTEGER, chance(50) ? 1024 : 2048);
+	}
+	if (chance(10))
+		put_int(&a, SC_ASN1_TAG_INTEGER, 0);
+	put_type_attributes(&e, &a);
+	put_blob(b, tag, &e);
+}
+
+static void gen_pukdf_entry(struct blob *b)
+{
+	struct blob e, a;
+	unsigned int tag = SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED;
+
+	e.len = a.len = 0;
+	put_common_object_attributes(&e);
+	put_common_key_attributes(&e, 0);
+	put_subject(&e);
+	if (odd(20)) {
+		tag = SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | (chance(50) ? 0 : 2);
+		put_path(&a);
+	}
+	else {
+		if (odd(20))
+			put_direct_value(&a);
+		else
+			put_path(&a);
+		put_int(&a, SC_ASN1_TAG_INTEGER, chance(50) ? 1024 : 2048);
+	}
+	put_type_attributes(&e, &a);
+	put_blob(b, tag, &e);
+}
+
+static void gen_cdf_entry(struct blob *b)
+{
+	struct blob e, c, a;
+
+	e.len = c.len = a.len = 0;
+	put_common_object_attributes(&e);
+
+	put_id(&c);
+	if (chance(30))
+		put_bool(&c, SC_ASN1_TAG_BOOLEAN);
+	if (chance(10)) {
+		struct blob ident;
+
+		ident.len = 0;
+		put_int(&ident, SC_ASN1_TAG_INTEGER, rnd() % 8);
+		put_random(&ident, SC_ASN1_TAG_OCTET_STRING, 20);
+		put_blob(&c, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &ident);
+	}
+	put_blob(&e, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &c);
+	if (chance(10))
+		put_random(&e, SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 0, 8);
+
+	if (odd(20))
+		put_direct_value(&a);
+	else
+		put_path(&a);
+	put_type_attributes(&e, &a);
+	put_blob(b, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &e);
+}
+
+static void gen_aodf_entry(struct blob *b)
+{
+	struct blob e, c, a;
+	unsigned int tag = SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED;
+	static const u8 pad[2] = { 0xFF, 0x00 };
+	static const char time[] = "20140101120000Z";
+
+	e.len = c.len = a.len = 0;
+	put_common_object_attributes(&e);
+	put_id(&c);
+	put_blob(&e, SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED, &c);
+
+	if (odd(20)) {
+		/* authKey */
+		tag = SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 1;
+		if (chance(50))
+			put_bool(&a, SC_ASN1_TAG_BOOLEAN);
+		put_id(&a);
+	}
+	else {
+		put_bits(&a, SC_ASN1_TAG_BIT_STRING);
+		put_int(&a, SC_ASN1_TAG_ENUMERATED, rnd() % 3);
+		put_int(&a, SC_ASN1_TAG_INTEGER, 4);
+		put_int(&a, SC_ASN1_TAG_INTEGER, chance(80) ? 8 : 0);
+		if (chance(50))
+			put_int(&a, SC_ASN1_TAG_INTEGER, 8 + rnd() % 8);
+		if (chance(90))
+			put_int(&a, SC_ASN1_TAG_CONTEXT | 0, chance(10) ? -127 : (int) (rnd() % 128));
+		if (chance(60))
+			put_tlv(&a, SC_ASN1_TAG_OCTET_STRING, pad, odd(20) ? rnd() % 3 : 1);
+		if (chance(10))
+			put_tlv(&a, SC_ASN1_TAG_GENERALIZEDTIME, (const u8 *) time, sizeof(time) - 1);
+		if (chance(70))
+			put_path(&a);
+	}
+	put_type_attributes(&e, &a);
+	put_blob(b, tag, &e);
+}
+
+int p15image_generate(struct p15image *img, unsigned int df_type,
+		unsigned int count, unsigned int odd_percent, unsigned long seed)
+{
+	struct blob entry;
+	u8 *p;
+
+	rnd_state = seed;
+	odd_pct = odd_percent;
+	img->len = 0;
+	while (count--) {
+		entry.len = 0;
+		switch (df_type) {
+		case SC_PKCS15_PRKDF:
+			gen_prkdf_entry(&entry);
+			break;
+		case SC_PKCS15_PUKDF:
+			gen_pukdf_entry(&entry);
+			break;
+		case SC_PKCS15_CDF:
+			gen_cdf_entry(&entry);
+			break;
+		case SC_PKCS15_AODF:
+			gen_aodf_entry(&entry);
+			break;
+		default:
+			return SC_ERROR_NOT_SUPPORTED;
+		}
+		if (img->len + entry.len > img->size) {
+			p = realloc(img->data, 2 * (img->size + entry.len));
+			if (p == NULL)
+				return SC_ERROR_OUT_OF_MEMORY;
+			img->data = p;
+			img->size = 2 * (img->size + entry.len);
+		}
+		memcpy(img->data + img->len, entry.data, entry.len);
+		img->len += entry.len;
+	}
+	return 0;
+}
+
+void p15image_free(struct p15image *img)
+{
+	free(img->data);
+	img->data = NULL;
+	img->len = img->size = 0;
+}
+
+struct sc_pkcs15_card *p15image_bind(struct sc_context *ctx)
+{
+	struct sc_pkcs15_card *p15card;
+	struct sc_card *card;
+
+	p15card = sc_pkcs15_card_new();
+	card = calloc(1, sizeof(struct sc_card));
+	if (p15card == NULL || card == NULL) {
+		sc_pkcs15_card_free(p15card);
+		free(card);
+		return NULL;
+	}
+	card->ctx = ctx;
+	p15card->card = card;
+	p15card->file_app = sc_file_new();
+	if (p15card->file_app == NULL) {
+		p15image_unbind(p15card);
+		return NULL;
+	}
+	sc_format_path("3F005015", &p15card->file_app->path);
+	p15card->opts.use_fast_decoder = 1;
+	return p15card;
+}
+
+void p15image_unbind(struct sc_pkcs15_card *p15card)
+{
+	struct sc_card *card = p15card->card;
+
+	sc_pkcs15_card_free(p15card);
+	free(card);
+}
+
+p15image_decode_func p15image_decoder(unsigned int df_type)
+{
+	switch (df_type) {
+	case SC_PKCS15_PRKDF:
+		return sc_pkcs15_decode_prkdf_entry;
+	case SC_PKCS15_PUKDF:
+		return sc_pkcs15_decode_pukdf_entry;
+	case SC_PKCS15_CDF:
+		return sc_pkcs15_decode_cdf_entry;
+	case SC_PKCS15_AODF:
+		return sc_pkcs15_decode_aodf_entry;
+	}
+	return NULL;
+}
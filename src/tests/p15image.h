@@ -0,0 +1,35 @@
+#ifndef _P15IMAGE_H
+#define _P15IMAGE_H
+
+#include "libopensc/pkcs15.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Synthetic PKCS#15 directory file images for the decoder tests */
+
+struct p15image {
+	u8 *data;
+	size_t len, size;
+};
+
+/* 'odd' is the percentage of entries using layouts or encodings the table
+ * driven decoder leaves to the generic one */
+int p15image_generate(struct p15image *img, unsigned int df_type,
+		unsigned int count, unsigned int odd, unsigned long seed);
+void p15image_free(struct p15image *img);
+
+/* PKCS#15 card without a reader, good enough for decoding DF entries */
+struct sc_pkcs15_card *p15image_bind(struct sc_context *ctx);
+void p15image_unbind(struct sc_pkcs15_card *p15card);
+
+typedef int (*p15image_decode_func)(struct sc_pkcs15_card *,
+		struct sc_pkcs15_object *, const u8 **, size_t *);
+p15image_decode_func p15image_decoder(unsigned int df_type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
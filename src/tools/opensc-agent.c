@@ -0,0 +1,1097 @@
+/*
+ * opensc-agent.c: Share one PKCS#11 module instance between processes
+ *
+ * The agent loads opensc-pkcs11 once, so card connections, the bound
+ * PKCS#15 state and the login are owned by a single process. Clients use
+ * the pkcs11-agent module, which forwards the C_* calls over a Unix socket.
+ * Requests are executed one at a time in the order they arrive, so the
+ * token is never contended by several processes.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pkcs11/pkcs11.h"
+#include "common/libpkcs11.h"
+#include "common/pkcs11-agent-proto.h"
+#include "util.h"
+
+#ifndef DEFAULT_PKCS11_MODULE
+#define DEFAULT_PKCS11_MODULE "opensc-pkcs11.so"
+#endif
+
+#define MAX_CLIENTS		256
+/* upper bound for output buffers requested by a client */
+#define MAX_OUTPUT		(P11_AGENT_MAX_MESSAGE / 2)
+
+static const char *app_name = "opensc-agent";
+
+static const struct option options[] = {
+	{ "module",		1, NULL,		'm' },
+	{ "socket",		1, NULL,		's' },
+	{ "foreground",		0, NULL,		'f' },
+	{ "verbose",		0, NULL,		'v' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static const char *option_help[] = {
+	"Specify the PKCS#11 module to load [" DEFAULT_PKCS11_MODULE "]",
+	"Listen on socket <arg> [$" P11_AGENT_SOCKET_ENV ", $XDG_RUNTIME_DIR/" P11_AGENT_SOCKET_NAME "]",
+	"Do not detach from the terminal",
+	"Verbose operation, log every request to stderr",
+};
+
+struct agent_session {
+	CK_SESSION_HANDLE handle;
+	CK_SLOT_ID slot;
+};
+
+struct agent_client {
+	int fd;
+	p11_agent_buf_t in;	/* request being received */
+	struct agent_session *sessions;
+	size_t nsessions;
+	size_t size;
+};
+
+typedef CK_RV (*agent_handler_t)(struct agent_client *, p11_agent_buf_t *, p11_agent_buf_t *);
+
+static CK_FUNCTION_LIST_PTR p11 = NULL;
+static struct agent_client clients[MAX_CLIENTS];
+static size_t nclients = 0;
+static int verbose = 0;
+static volatile sig_atomic_t terminate = 0;
+
+static void sig_terminate(int sig)
+{
+	terminate = 1;
+}
+
+static int session_add(struct agent_client *c, CK_SESSION_HANDLE handle, CK_SLOT_ID slot)
+{
+	struct agent_session *s;
+
+	if (c->nsessions == c->size) {
+		s = realloc(c->sessions, (c->size + 8) * sizeof(*s));
+		if (!s)
+			return -1;
+		c->sessions = s;
+		c->size += 8;
+	}
+	c->sessions[c->nsessions].handle = handle;
+	c->sessions[c->nsessions].slot = slot;
+	c->nsessions++;
+	return 0;
+}
+
+static int session_find(struct agent_client *c, CK_SESSION_HANDLE handle)
+{
+	size_t i;
+
+	for (i = 0; i < c->nsessions; i++)
+		if (c->sessions[i].handle == handle)
+			return (int) i;
+	return -1;
+}
+
+static void session_remove(struct agent_client *c, int idx)
+{
+	c->sessions[idx] = c->sessions[--c->nsessions];
+}
+
+/* Read the session handle of a request, only sessions of this client are accepted */
+static CK_RV get_session(struct agent_client *c, p11_agent_buf_t *req, CK_SESSION_HANDLE *handle)
+{
+	*handle = p11_agent_get_ulong(req);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	if (session_find(c, *handle) < 0)
+		return CKR_SESSION_HANDLE_INVALID;
+	return CKR_OK;
+}
+
+/* Allocate the output buffer the client announced, NULL for a length query */
+static CK_RV get_outbuf(p11_agent_buf_t *req, CK_BYTE_PTR *out, CK_ULONG *out_len)
+{
+	CK_ULONG len = p11_agent_get_ulong(req);
+
+	*out = NULL;
+	*out_len = 0;
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	if (len == P11_AGENT_NULL_PTR)
+		return CKR_OK;
+	if (len > MAX_OUTPUT)
+		len = MAX_OUTPUT;
+	*out = calloc(1, len ? len : 1);
+	if (!*out)
+		return CKR_HOST_MEMORY;
+	*out_len = len;
+	return CKR_OK;
+}
+
+static void put_outbuf(p11_agent_buf_t *resp, CK_RV rv, CK_BYTE_PTR out, CK_ULONG out_len)
+{
+	if (rv != CKR_OK && rv != CKR_BUFFER_TOO_SMALL)
+		return;
+	p11_agent_put_ulong(resp, out_len);
+	p11_agent_put_bytes(resp, rv == CKR_OK ? out : NULL, out_len);
+}
+
+static void free_outbuf(CK_BYTE_PTR out, CK_ULONG out_len)
+{
+	if (out) {
+		memset(out, 0, out_len);
+		free(out);
+	}
+}
+
+static CK_RV do_get_info(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_INFO info;
+	CK_RV rv;
+
+	rv = p11->C_GetInfo(&info);
+	if (rv == CKR_OK)
+		p11_agent_put_bytes(resp, &info, sizeof(info));
+	return rv;
+}
+
+static CK_RV do_ulong_list(p11_agent_buf_t *resp, CK_RV rv, CK_ULONG_PTR list, CK_ULONG count)
+{
+	CK_ULONG i;
+
+	if (rv != CKR_OK && rv != CKR_BUFFER_TOO_SMALL)
+		return rv;
+	p11_agent_put_ulong(resp, count);
+	if (rv == CKR_OK && list)
+		for (i = 0; i < count; i++)
+			p11_agent_put_ulong(resp, list[i]);
+	return rv;
+}
+
+static CK_RV get_ulong_list(p11_agent_buf_t *req, CK_ULONG_PTR *list, CK_ULONG *count)
+{
+	CK_ULONG n = p11_agent_get_ulong(req);
+
+	*list = NULL;
+	*count = 0;
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	if (n == P11_AGENT_NULL_PTR)
+		return CKR_OK;
+	if (n > MAX_OUTPUT / sizeof(CK_ULONG))
+		n = MAX_OUTPUT / sizeof(CK_ULONG);
+	*list = calloc(n + 1, sizeof(CK_ULONG));
+	if (!*list)
+		return CKR_HOST_MEMORY;
+	*count = n;
+	return CKR_OK;
+}
+
+static CK_RV do_get_slot_list(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_BBOOL present = p11_agent_get_ulong(req) ? CK_TRUE : CK_FALSE;
+	CK_SLOT_ID_PTR list;
+	CK_ULONG count;
+	CK_RV rv;
+
+	rv = get_ulong_list(req, &list, &count);
+	if (rv != CKR_OK)
+		return rv;
+	rv = p11->C_GetSlotList(present, list, &count);
+	rv = do_ulong_list(resp, rv, list, count);
+	free(list);
+	return rv;
+}
+
+static CK_RV do_get_slot_info(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SLOT_ID slot = p11_agent_get_ulong(req);
+	CK_SLOT_INFO info;
+	CK_RV rv;
+
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_GetSlotInfo(slot, &info);
+	if (rv == CKR_OK)
+		p11_agent_put_bytes(resp, &info, sizeof(info));
+	return rv;
+}
+
+static CK_RV do_get_token_info(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SLOT_ID slot = p11_agent_get_ulong(req);
+	CK_TOKEN_INFO info;
+	CK_RV rv;
+
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_GetTokenInfo(slot, &info);
+	if (rv == CKR_OK)
+		p11_agent_put_bytes(resp, &info, sizeof(info));
+	return rv;
+}
+
+static CK_RV do_get_mechanism_list(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SLOT_ID slot = p11_agent_get_ulong(req);
+	CK_MECHANISM_TYPE_PTR list;
+	CK_ULONG count;
+	CK_RV rv;
+
+	rv = get_ulong_list(req, &list, &count);
+	if (rv != CKR_OK)
+		return rv;
+	rv = p11->C_GetMechanismList(slot, list, &count);
+	rv = do_ulong_list(resp, rv, list, count);
+	free(list);
+	return rv;
+}
+
+static CK_RV do_get_mechanism_info(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SLOT_ID slot = p11_agent_get_ulong(req);
+	CK_MECHANISM_TYPE type = p11_agent_get_ulong(req);
+	CK_MECHANISM_INFO info;
+	CK_RV rv;
+
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_GetMechanismInfo(slot, type, &info);
+	if (rv == CKR_OK)
+		p11_agent_put_bytes(resp, &info, sizeof(info));
+	return rv;
+}
+
+static CK_RV do_init_pin(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	const unsigned char *pin;
+	CK_ULONG pin_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_bytes(req, &pin, &pin_len);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_InitPIN(h, (CK_UTF8CHAR_PTR) pin, pin_len);
+}
+
+static CK_RV do_set_pin(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	const unsigned char *old_pin, *new_pin;
+	CK_ULONG old_len, new_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_bytes(req, &old_pin, &old_len);
+	p11_agent_get_bytes(req, &new_pin, &new_len);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_SetPIN(h, (CK_UTF8CHAR_PTR) old_pin, old_len, (CK_UTF8CHAR_PTR) new_pin, new_len);
+}
+
+static CK_RV do_open_session(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SLOT_ID slot = p11_agent_get_ulong(req);
+	CK_FLAGS flags = p11_agent_get_ulong(req);
+	CK_SESSION_HANDLE h;
+	CK_RV rv;
+
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_OpenSession(slot, flags, NULL, NULL, &h);
+	if (rv != CKR_OK)
+		return rv;
+	if (session_add(c, h, slot) < 0) {
+		p11->C_CloseSession(h);
+		return CKR_HOST_MEMORY;
+	}
+	p11_agent_put_ulong(resp, h);
+	return CKR_OK;
+}
+
+static CK_RV do_close_session(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	/* ignore the data argument of the generic encoding */
+	session_remove(c, session_find(c, h));
+	return p11->C_CloseSession(h);
+}
+
+static CK_RV do_close_all_sessions(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SLOT_ID slot = p11_agent_get_ulong(req);
+	size_t i;
+
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	/* only the sessions of this client, other clients keep theirs */
+	for (i = c->nsessions; i > 0; i--) {
+		if (c->sessions[i - 1].slot != slot)
+			continue;
+		p11->C_CloseSession(c->sessions[i - 1].handle);
+		session_remove(c, (int) (i - 1));
+	}
+	return CKR_OK;
+}
+
+static CK_RV do_get_session_info(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_SESSION_INFO info;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	rv = p11->C_GetSessionInfo(h, &info);
+	if (rv == CKR_OK)
+		p11_agent_put_bytes(resp, &info, sizeof(info));
+	return rv;
+}
+
+static CK_RV do_login(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_USER_TYPE user;
+	const unsigned char *pin;
+	CK_ULONG pin_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	user = p11_agent_get_ulong(req);
+	p11_agent_get_bytes(req, &pin, &pin_len);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_Login(h, user, (CK_UTF8CHAR_PTR) pin, pin_len);
+}
+
+static CK_RV do_logout(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	return p11->C_Logout(h);
+}
+
+static CK_RV do_create_object(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_OBJECT_HANDLE obj;
+	CK_ATTRIBUTE_PTR templ;
+	CK_ULONG count;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	templ = p11_agent_get_template(req, &count);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_CreateObject(h, templ, count, &obj);
+	if (rv == CKR_OK)
+		p11_agent_put_ulong(resp, obj);
+	free(templ);
+	return rv;
+}
+
+static CK_RV do_destroy_object(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_OBJECT_HANDLE obj;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	obj = p11_agent_get_ulong(req);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_DestroyObject(h, obj);
+}
+
+static CK_RV do_get_attribute_value(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_OBJECT_HANDLE obj;
+	CK_ATTRIBUTE_PTR templ = NULL;
+	CK_ULONG i, count, len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	obj = p11_agent_get_ulong(req);
+	count = p11_agent_get_ulong(req);
+	if (req->error || count > (req->len - req->pos) / 16)
+		return CKR_ARGUMENTS_BAD;
+	templ = calloc(count + 1, sizeof(CK_ATTRIBUTE));
+	if (!templ)
+		return CKR_HOST_MEMORY;
+	for (i = 0; i < count && rv == CKR_OK; i++) {
+		templ[i].type = p11_agent_get_ulong(req);
+		rv = get_outbuf(req, (CK_BYTE_PTR *) &templ[i].pValue, &len);
+		templ[i].ulValueLen = len;
+	}
+	if (rv == CKR_OK)
+		rv = p11->C_GetAttributeValue(h, obj, templ, count);
+	if (rv == CKR_OK || rv == CKR_ATTRIBUTE_SENSITIVE || rv == CKR_ATTRIBUTE_TYPE_INVALID
+			|| rv == CKR_BUFFER_TOO_SMALL) {
+		for (i = 0; i < count; i++) {
+			len = templ[i].ulValueLen;
+			p11_agent_put_ulong(resp, len);
+			if (templ[i].pValue && len != (CK_ULONG) -1)
+				p11_agent_put_bytes(resp, templ[i].pValue, len);
+			else
+				p11_agent_put_bytes(resp, NULL, 0);
+		}
+	}
+	for (i = 0; i < count; i++)
+		free(templ[i].pValue);
+	free(templ);
+	return rv;
+}
+
+static CK_RV do_set_attribute_value(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_OBJECT_HANDLE obj;
+	CK_ATTRIBUTE_PTR templ;
+	CK_ULONG count;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	obj = p11_agent_get_ulong(req);
+	templ = p11_agent_get_template(req, &count);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_SetAttributeValue(h, obj, templ, count);
+	free(templ);
+	return rv;
+}
+
+static CK_RV do_find_objects_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_ATTRIBUTE_PTR templ;
+	CK_ULONG count;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	templ = p11_agent_get_template(req, &count);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_FindObjectsInit(h, templ, count);
+	free(templ);
+	return rv;
+}
+
+static CK_RV do_find_objects(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_OBJECT_HANDLE_PTR list;
+	CK_ULONG count;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	rv = get_ulong_list(req, &list, &count);
+	if (rv != CKR_OK)
+		return rv;
+	if (!list)
+		return CKR_ARGUMENTS_BAD;
+	rv = p11->C_FindObjects(h, list, count, &count);
+	rv = do_ulong_list(resp, rv, list, count);
+	free(list);
+	return rv;
+}
+
+static CK_RV do_find_objects_final(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	return p11->C_FindObjectsFinal(h);
+}
+
+/* C_*Init with a mechanism and a key */
+static CK_RV do_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp,
+		CK_RV (*func)(CK_SESSION_HANDLE, CK_MECHANISM_PTR, CK_OBJECT_HANDLE))
+{
+	CK_SESSION_HANDLE h;
+	CK_MECHANISM mech;
+	CK_OBJECT_HANDLE key;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_mechanism(req, &mech);
+	key = p11_agent_get_ulong(req);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return func(h, &mech, key);
+}
+
+/* single part operation with input and output data */
+static CK_RV do_data(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp,
+		CK_RV (*func)(CK_SESSION_HANDLE, CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR))
+{
+	CK_SESSION_HANDLE h;
+	const unsigned char *in;
+	CK_BYTE_PTR out;
+	CK_ULONG in_len, out_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_bytes(req, &in, &in_len);
+	rv = get_outbuf(req, &out, &out_len);
+	if (rv != CKR_OK)
+		return rv;
+	rv = func(h, (CK_BYTE_PTR) in, in_len, out, &out_len);
+	put_outbuf(resp, rv, out, out_len);
+	free_outbuf(out, out_len);
+	return rv;
+}
+
+/* multi part operation step with input data */
+static CK_RV do_update(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp,
+		CK_RV (*func)(CK_SESSION_HANDLE, CK_BYTE_PTR, CK_ULONG))
+{
+	CK_SESSION_HANDLE h;
+	const unsigned char *in;
+	CK_ULONG in_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_bytes(req, &in, &in_len);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return func(h, (CK_BYTE_PTR) in, in_len);
+}
+
+/* multi part operation end with output data */
+static CK_RV do_final(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp,
+		CK_RV (*func)(CK_SESSION_HANDLE, CK_BYTE_PTR, CK_ULONG_PTR))
+{
+	CK_SESSION_HANDLE h;
+	CK_BYTE_PTR out;
+	CK_ULONG out_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	rv = get_outbuf(req, &out, &out_len);
+	if (rv != CKR_OK)
+		return rv;
+	rv = func(h, out, &out_len);
+	put_outbuf(resp, rv, out, out_len);
+	free_outbuf(out, out_len);
+	return rv;
+}
+
+static CK_RV do_encrypt_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_init(c, req, resp, p11->C_EncryptInit);
+}
+
+static CK_RV do_encrypt(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_data(c, req, resp, p11->C_Encrypt);
+}
+
+static CK_RV do_decrypt_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_init(c, req, resp, p11->C_DecryptInit);
+}
+
+static CK_RV do_decrypt(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_data(c, req, resp, p11->C_Decrypt);
+}
+
+static CK_RV do_digest_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_MECHANISM mech;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_mechanism(req, &mech);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_DigestInit(h, &mech);
+}
+
+static CK_RV do_digest(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_data(c, req, resp, p11->C_Digest);
+}
+
+static CK_RV do_digest_update(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_update(c, req, resp, p11->C_DigestUpdate);
+}
+
+static CK_RV do_digest_final(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_final(c, req, resp, p11->C_DigestFinal);
+}
+
+static CK_RV do_sign_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_init(c, req, resp, p11->C_SignInit);
+}
+
+static CK_RV do_sign(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_data(c, req, resp, p11->C_Sign);
+}
+
+static CK_RV do_sign_update(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_update(c, req, resp, p11->C_SignUpdate);
+}
+
+static CK_RV do_sign_final(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_final(c, req, resp, p11->C_SignFinal);
+}
+
+static CK_RV do_verify_init(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_init(c, req, resp, p11->C_VerifyInit);
+}
+
+static CK_RV do_verify(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	const unsigned char *data, *sig;
+	CK_ULONG data_len, sig_len;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_bytes(req, &data, &data_len);
+	p11_agent_get_bytes(req, &sig, &sig_len);
+	if (req->error)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_Verify(h, (CK_BYTE_PTR) data, data_len, (CK_BYTE_PTR) sig, sig_len);
+}
+
+static CK_RV do_verify_update(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_update(c, req, resp, p11->C_VerifyUpdate);
+}
+
+static CK_RV do_verify_final(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_update(c, req, resp, p11->C_VerifyFinal);
+}
+
+static CK_RV do_generate_key_pair(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_SESSION_HANDLE h;
+	CK_MECHANISM mech;
+	CK_ATTRIBUTE_PTR pub = NULL, priv = NULL;
+	CK_ULONG pub_count, priv_count;
+	CK_OBJECT_HANDLE hpub, hpriv;
+	CK_RV rv;
+
+	rv = get_session(c, req, &h);
+	if (rv != CKR_OK)
+		return rv;
+	p11_agent_get_mechanism(req, &mech);
+	pub = p11_agent_get_template(req, &pub_count);
+	priv = p11_agent_get_template(req, &priv_count);
+	if (req->error) {
+		rv = CKR_ARGUMENTS_BAD;
+		goto out;
+	}
+	rv = p11->C_GenerateKeyPair(h, &mech, pub, pub_count, priv, priv_count, &hpub, &hpriv);
+	if (rv == CKR_OK) {
+		p11_agent_put_ulong(resp, hpub);
+		p11_agent_put_ulong(resp, hpriv);
+	}
+out:
+	free(pub);
+	free(priv);
+	return rv;
+}
+
+static CK_RV do_seed_random(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_update(c, req, resp, p11->C_SeedRandom);
+}
+
+static CK_RV generate_random(CK_SESSION_HANDLE h, CK_BYTE_PTR out, CK_ULONG_PTR out_len)
+{
+	if (!out)
+		return CKR_ARGUMENTS_BAD;
+	return p11->C_GenerateRandom(h, out, *out_len);
+}
+
+static CK_RV do_generate_random(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	return do_final(c, req, resp, generate_random);
+}
+
+static const agent_handler_t handlers[P11A_OP_MAX] = {
+	NULL,
+	NULL,				/* P11A_HELLO is handled on connect */
+	do_get_info,
+	do_get_slot_list,
+	do_get_slot_info,
+	do_get_token_info,
+	do_get_mechanism_list,
+	do_get_mechanism_info,
+	do_init_pin,
+	do_set_pin,
+	do_open_session,
+	do_close_session,
+	do_close_all_sessions,
+	do_get_session_info,
+	do_login,
+	do_logout,
+	do_create_object,
+	do_destroy_object,
+	do_get_attribute_value,
+	do_set_attribute_value,
+	do_find_objects_init,
+	do_find_objects,
+	do_find_objects_final,
+	do_encrypt_init,
+	do_encrypt,
+	do_decrypt_init,
+	do_decrypt,
+	do_digest_init,
+	do_digest,
+	do_digest_update,
+	do_digest_final,
+	do_sign_init,
+	do_sign,
+	do_sign_update,
+	do_sign_final,
+	do_verify_init,
+	do_verify,
+	do_verify_update,
+	do_verify_final,
+	do_generate_key_pair,
+	do_seed_random,
+	do_generate_random,
+};
+
+/* Overwrite the CK_RV placeholder at the start of a response */
+static void set_response_rv(p11_agent_buf_t *resp, CK_RV rv)
+{
+	unsigned long long v = rv;
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		resp->data[i] = v & 0xFF;
+}
+
+static int handle_request(struct agent_client *c, p11_agent_buf_t *req, p11_agent_buf_t *resp)
+{
+	CK_ULONG op;
+	CK_RV rv;
+
+	op = p11_agent_get_ulong(req);
+	p11_agent_buf_reset(resp);
+	p11_agent_put_ulong(resp, CKR_OK);
+
+	if (op == P11A_HELLO) {
+		CK_ULONG version = p11_agent_get_ulong(req);
+		CK_ULONG ulong_size = p11_agent_get_ulong(req);
+
+		if (req->error || version != P11_AGENT_PROTOCOL_VERSION || ulong_size != sizeof(CK_ULONG))
+			set_response_rv(resp, CKR_FUNCTION_FAILED);
+		p11_agent_put_ulong(resp, P11_AGENT_PROTOCOL_VERSION);
+		p11_agent_put_ulong(resp, sizeof(CK_ULONG));
+		return p11_agent_send(c->fd, resp);
+	}
+
+	if (req->error || op >= P11A_OP_MAX || handlers[op] == NULL)
+		rv = CKR_FUNCTION_NOT_SUPPORTED;
+	else
+		rv = handlers[op](c, req, resp);
+	if (resp->error) {
+		/* output did not fit in a message */
+		p11_agent_buf_reset(resp);
+		p11_agent_put_ulong(resp, CKR_DEVICE_MEMORY);
+	}
+	else {
+		set_response_rv(resp, rv);
+	}
+	if (verbose)
+		fprintf(stderr, "client %d: request %lu returned 0x%08lx\n", c->fd, op, rv);
+	return p11_agent_send(c->fd, resp);
+}
+
+static void drop_client(size_t idx)
+{
+	struct agent_client *c = &clients[idx];
+	size_t i;
+
+	/* a client that went away must not leave sessions behind */
+	for (i = 0; i < c->nsessions; i++)
+		p11->C_CloseSession(c->sessions[i].handle);
+	if (verbose)
+		fprintf(stderr, "client %d: disconnected, closed %lu sessions\n",
+				c->fd, (unsigned long) c->nsessions);
+	free(c->sessions);
+	p11_agent_buf_free(&c->in);
+	close(c->fd);
+	clients[idx] = clients[--nclients];
+	memset(&clients[nclients], 0, sizeof(clients[nclients]));
+}
+
+static int open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	char dir[sizeof(addr.sun_path)], *p;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		util_fatal("socket path too long: %s", path);
+	strcpy(addr.sun_path, path);
+
+	/* create the private directory of the default socket path */
+	strcpy(dir, path);
+	p = strrchr(dir, '/');
+	if (p && p != dir) {
+		*p = '\0';
+		if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+			util_fatal("cannot create %s: %s", dir, strerror(errno));
+	}
+	if (p11_agent_check_dir(path) < 0)
+		util_fatal("the directory of %s must belong to this user, with mode 0700", path);
+
+	/* remove a stale socket of a previous instance */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		util_fatal("socket: %s", strerror(errno));
+	umask(0077);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		util_fatal("cannot bind %s: %s", path, strerror(errno));
+	if (listen(fd, 16) < 0)
+		util_fatal("listen: %s", strerror(errno));
+	return fd;
+}
+
+static void serve(int listen_fd)
+{
+	struct pollfd fds[MAX_CLIENTS + 1];
+	p11_agent_buf_t resp;
+	size_t i, n;
+	uid_t uid;
+	int fd, r;
+
+	p11_agent_buf_init(&resp);
+
+	while (!terminate) {
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = POLLIN;
+			fds[i + 1].revents = 0;
+		}
+		n = nclients;
+		if (poll(fds, n + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			util_fatal("poll: %s", strerror(errno));
+		}
+
+		/* serve requests in client order, one at a time; a request
+		 * that is not complete yet waits without holding up the others */
+		for (i = n; i > 0; i--) {
+			struct agent_client *c = &clients[i - 1];
+
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			r = p11_agent_recv_some(c->fd, &c->in);
+			if (r == 1) {
+				r = handle_request(c, &c->in, &resp);
+				p11_agent_buf_reset(&c->in);
+			}
+			if (r < 0)
+				drop_client(i - 1);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			fd = accept(listen_fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			if (nclients == MAX_CLIENTS) {
+				close(fd);
+				continue;
+			}
+			/* PINs and data to sign are only taken from this user */
+			if (p11_agent_peer_uid(fd, &uid) < 0 || uid != getuid()) {
+				if (verbose)
+					fprintf(stderr, "client %d: refused, not of this user\n", fd);
+				close(fd);
+				continue;
+			}
+			if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+				close(fd);
+				continue;
+			}
+			memset(&clients[nclients], 0, sizeof(clients[nclients]));
+			clients[nclients++].fd = fd;
+			if (verbose)
+				fprintf(stderr, "client %d: connected\n", fd);
+		}
+	}
+
+	while (nclients > 0)
+		drop_client(nclients - 1);
+	p11_agent_buf_free(&resp);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *opt_module = DEFAULT_PKCS11_MODULE;
+	const char *opt_socket = NULL;
+	char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+	int foreground = 0, c, listen_fd;
+	void *module;
+	pid_t pid;
+	CK_RV rv;
+
+	while ((c = getopt_long(argc, argv, "m:s:fv", options, NULL)) != -1) {
+		switch (c) {
+		case 'm':
+			opt_module = optarg;
+			break;
+		case 's':
+			opt_socket = optarg;
+			break;
+		case 'f':
+			foreground = 1;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			util_print_usage_and_die(app_name, options, option_help, NULL);
+		}
+	}
+
+	if (opt_socket) {
+		if (strlen(opt_socket) >= sizeof(path))
+			util_fatal("socket path too long: %s", opt_socket);
+		strcpy(path, opt_socket);
+	}
+	else if (p11_agent_socket_path(path, sizeof(path)) < 0) {
+		util_fatal("cannot determine socket path");
+	}
+	listen_fd = open_socket(path);
+
+	if (!foreground) {
+		pid = fork();
+		if (pid < 0)
+			util_fatal("fork: %s", strerror(errno));
+		if (pid > 0) {
+			printf("%s=%s; export %s;\n", P11_AGENT_SOCKET_ENV, path, P11_AGENT_SOCKET_ENV);
+			printf("echo Agent pid %ld;\n", (long) pid);
+			exit(0);
+		}
+		setsid();
+		if (chdir("/") < 0)
+			util_fatal("chdir: %s", strerror(errno));
+	}
+
+	/* the module is loaded after fork, its threads and card handles belong to the agent */
+	module = C_LoadModule(opt_module, &p11);
+	if (module == NULL) {
+		unlink(path);
+		util_fatal("Failed to load pkcs11 module %s", opt_module);
+	}
+	rv = p11->C_Initialize(NULL);
+	if (rv != CKR_OK) {
+		unlink(path);
+		util_fatal("C_Initialize failed: 0x%08lx", rv);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, sig_terminate);
+	signal(SIGTERM, sig_terminate);
+	if (verbose)
+		fprintf(stderr, "listening on %s\n", path);
+
+	serve(listen_fd);
+
+	close(listen_fd);
+	unlink(path);
+	p11->C_Finalize(NULL);
+	C_UnloadModule(module);
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * opensc-logdump.c: Print a binary OpenSC debug log as text
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libopensc/binlog.h"
+#include "util.h"
+
+/* upper bound for a single record, messages are at most 4 KB */
+#define MAX_RECORD	(64 * 1024)
+
+static const char *app_name = "opensc-logdump";
+
+static const struct option options[] = {
+	{ "level",		1, NULL,		'l' },
+	{ "thread",		1, NULL,		't' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static const char *option_help[] = {
+	"Only print messages up to debug level <arg>",
+	"Only print messages of thread <arg>",
+};
+
+static int opt_level = -1;
+static unsigned long long opt_thread = 0;
+
+/* state of the current session */
+static char session_app[256] = "";
+static char **strings = NULL;
+static size_t nstrings = 0;
+
+static void reset_strings(void)
+{
+	size_t i;
+
+	for (i = 0; i < nstrings; i++)
+		free(strings[i]);
+	free(strings);
+	strings = NULL;
+	nstrings = 0;
+}
+
+static int set_string(unsigned int id, const char *str)
+{
+	char **p;
+
+	if (id >= nstrings) {
+		p = realloc(strings, (id + 64) * sizeof(*p));
+		if (p == NULL)
+			return -1;
+		memset(p + nstrings, 0, (id + 64 - nstrings) * sizeof(*p));
+		strings = p;
+		nstrings = id + 64;
+	}
+	free(strings[id]);
+	strings[id] = strdup(str);
+	return 0;
+}
+
+static const char *get_string(unsigned int id)
+{
+	if (id < nstrings && strings[id] != NULL)
+		return strings[id];
+	return "?";
+}
+
+/* the NUL terminated string following a record of size hdr_len */
+static const char *record_string(const unsigned char *rec, size_t hdr_len)
+{
+	const struct sc_binlog_hdr *hdr = (const struct sc_binlog_hdr *) rec;
+
+	if (hdr->len <= hdr_len || memchr(rec + hdr_len, 0, hdr->len - hdr_len) == NULL)
+		return "";
+	return (const char *) rec + hdr_len;
+}
+
+static void print_message(const struct sc_binlog_message *m, const char *msg)
+{
+	char time_string[40];
+	time_t t = (time_t) m->sec;
+	struct tm *tm;
+	size_t n;
+
+	if (opt_level >= 0 && (int) m->level > opt_level)
+		return;
+	if (opt_thread && m->thread != opt_thread)
+		return;
+
+	tm = localtime(&t);
+	if (tm == NULL || strftime(time_string, sizeof(time_string), "%H:%M:%S", tm) == 0)
+		strcpy(time_string, "??:??:??");
+	printf("0x%llx %s.%03u ", (unsigned long long) m->thread, time_string,
+			(unsigned int) (m->usec / 1000));
+	if (m->file_id)
+		printf("[%s] %s:%u:%s: ", session_app, get_string(m->file_id),
+				(unsigned int) m->line, m->func_id ? get_string(m->func_id) : "");
+	n = strlen(msg);
+	fputs(msg, stdout);
+	if (n == 0 || msg[n - 1] != '\n')
+		putchar('\n');
+}
+
+static int dump(FILE *f, const char *name)
+{
+	unsigned char *rec;
+	struct sc_binlog_hdr hdr;
+	int rv = 0;
+
+	rec = malloc(MAX_RECORD);
+	if (rec == NULL)
+		return -1;
+
+	while (fread(&hdr, sizeof(hdr), 1, f) == 1) {
+		if (hdr.len < sizeof(hdr) || hdr.len > MAX_RECORD || hdr.len % 8) {
+			fprintf(stderr, "%s: invalid record length %u\n", name, (unsigned int) hdr.len);
+			rv = -1;
+			break;
+		}
+		memcpy(rec, &hdr, sizeof(hdr));
+		if (fread(rec + sizeof(hdr), hdr.len - sizeof(hdr), 1, f) != 1 && hdr.len > sizeof(hdr)) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			rv = -1;
+			break;
+		}
+
+		switch (hdr.type) {
+		case SC_BINLOG_REC_SESSION: {
+			const struct sc_binlog_session *s = (const struct sc_binlog_session *) rec;
+
+			if (hdr.len < sizeof(*s) || s->magic != SC_BINLOG_MAGIC) {
+				fprintf(stderr, "%s: not a binary OpenSC log, or written on a host with different byte order\n", name);
+				free(rec);
+				return -1;
+			}
+			if (s->version != SC_BINLOG_VERSION)
+				fprintf(stderr, "%s: unknown log version %u\n", name, (unsigned int) s->version);
+			reset_strings();
+			strncpy(session_app, record_string(rec, sizeof(*s)), sizeof(session_app) - 1);
+			break;
+		}
+		case SC_BINLOG_REC_STRING: {
+			const struct sc_binlog_string *s = (const struct sc_binlog_string *) rec;
+
+			if (hdr.len >= sizeof(*s) && set_string(s->id, record_string(rec, sizeof(*s))) < 0) {
+				rv = -1;
+				goto out;
+			}
+			break;
+		}
+		case SC_BINLOG_REC_MESSAGE:
+			if (hdr.len >= sizeof(struct sc_binlog_message))
+				print_message((const struct sc_binlog_message *) rec,
+					record_string(rec, sizeof(struct sc_binlog_message)));
+			break;
+		case SC_BINLOG_REC_DROPPED: {
+			const struct sc_binlog_dropped *d = (const struct sc_binlog_dropped *) rec;
+
+			if (hdr.len >= sizeof(*d) && (!opt_thread || d->thread == opt_thread))
+				printf("0x%llx [%s] %llu message(s) dropped\n",
+					(unsigned long long) d->thread, session_app,
+					(unsigned long long) d->count);
+			break;
+		}
+		default:
+			/* records of later versions */
+			break;
+		}
+	}
+out:
+	free(rec);
+	return rv;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i, rv = 0;
+	FILE *f;
+
+	while ((c = getopt_long(argc, argv, "l:t:", options, NULL)) != -1) {
+		switch (c) {
+		case 'l':
+			opt_level = atoi(optarg);
+			break;
+		case 't':
+			opt_thread = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			util_print_usage_and_die(app_name, options, option_help, "[FILE]...");
+		}
+	}
+
+	if (optind == argc)
+		return dump(stdin, "stdin") < 0;
+
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "-")) {
+			rv |= dump(stdin, "stdin");
+			continue;
+		}
+		f = fopen(argv[i], "rb");
+		if (f == NULL) {
+			perror(argv[i]);
+			rv = -1;
+			continue;
+		}
+		rv |= dump(f, argv[i]);
+		fclose(f);
+	}
+	reset_strings();
+	return rv < 0;
+}
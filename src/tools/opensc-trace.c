@@ -0,0 +1,337 @@
+/*
+ * opensc-trace.c: Report on an APDU trace
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libopensc/opensc.h"
+#include "libopensc/trace.h"
+#include "util.h"
+
+/* upper bound for a record: an extended command and its response */
+#define MAX_RECORD	(256 * 1024)
+
+static const char *app_name = "opensc-trace";
+
+static const struct option options[] = {
+	{ "list",		0, NULL,		'l' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static const char *option_help[] = {
+	"Also list every exchange",
+};
+
+static int opt_list = 0;
+
+static const struct {
+	unsigned int ins;
+	const char *name;
+} ins_names[] = {
+	{ 0x0E, "ERASE BINARY" },
+	{ 0x20, "VERIFY" },
+	{ 0x22, "MANAGE SECURITY ENVIRONMENT" },
+	{ 0x24, "CHANGE REFERENCE DATA" },
+	{ 0x2A, "PERFORM SECURITY OPERATION" },
+	{ 0x2C, "RESET RETRY COUNTER" },
+	{ 0x44, "ACTIVATE FILE" },
+	{ 0x46, "GENERATE KEY PAIR" },
+	{ 0x47, "GENERATE ASYMMETRIC KEY PAIR" },
+	{ 0x70, "MANAGE CHANNEL" },
+	{ 0x82, "EXTERNAL AUTHENTICATE" },
+	{ 0x84, "GET CHALLENGE" },
+	{ 0x86, "GENERAL AUTHENTICATE" },
+	{ 0x87, "GENERAL AUTHENTICATE" },
+	{ 0x88, "INTERNAL AUTHENTICATE" },
+	{ 0xA4, "SELECT" },
+	{ 0xB0, "READ BINARY" },
+	{ 0xB2, "READ RECORD" },
+	{ 0xC0, "GET RESPONSE" },
+	{ 0xC2, "ENVELOPE" },
+	{ 0xCA, "GET DATA" },
+	{ 0xCB, "GET DATA" },
+	{ 0xD6, "UPDATE BINARY" },
+	{ 0xDA, "PUT DATA" },
+	{ 0xDB, "PUT DATA" },
+	{ 0xDC, "UPDATE RECORD" },
+	{ 0xE0, "CREATE FILE" },
+	{ 0xE4, "DELETE FILE" },
+};
+
+struct ins_stats {
+	unsigned long count, errors;
+	unsigned long min, max;
+	double total;
+	unsigned long sent, received;
+};
+
+/* one per INS, and one for reader control commands */
+static struct ins_stats stats[257];
+static unsigned long sessions, exchanges, failed;
+static double total_time;
+
+/* distinct CARD records */
+#define MAX_CARDS	32
+static struct {
+	unsigned char *rec;
+	size_t len;
+} cards[MAX_CARDS];
+static int card_count;
+
+static const char *ins_name(unsigned int ins)
+{
+	size_t i;
+
+	if (ins > 0xFF)
+		return "reader control";
+	for (i = 0; i < sizeof(ins_names) / sizeof(ins_names[0]); i++)
+		if (ins_names[i].ins == ins)
+			return ins_names[i].name;
+	return "";
+}
+
+static unsigned long get_ulong(const unsigned char *p)
+{
+	return (unsigned long) p[0] << 24 | (unsigned long) p[1] << 16
+		| (unsigned long) p[2] << 8 | p[3];
+}
+
+static void print_hex(const unsigned char *p, size_t len, size_t max)
+{
+	size_t i;
+
+	for (i = 0; i < len && i < max; i++)
+		printf("%02X", p[i]);
+	if (len > max)
+		printf("..");
+}
+
+static void print_card(const unsigned char *rec, size_t len)
+{
+	size_t atr_len = rec[4];
+
+	if (atr_len > len - SC_TRACE_CARD_SIZE)
+		return;
+	printf("reader '%.*s', protocol %lu, ATR ",
+		(int) (len - SC_TRACE_CARD_SIZE - atr_len),
+		(const char *) rec + SC_TRACE_CARD_SIZE + atr_len, get_ulong(rec));
+	print_hex(rec + SC_TRACE_CARD_SIZE, atr_len, atr_len);
+	printf("\n");
+}
+
+static void add_card(const unsigned char *rec, size_t len)
+{
+	int i;
+
+	if (opt_list)
+		print_card(rec, len);
+	for (i = 0; i < card_count; i++)
+		if (cards[i].len == len && !memcmp(cards[i].rec, rec, len))
+			return;
+	if (card_count == MAX_CARDS || (cards[card_count].rec = malloc(len)) == NULL)
+		return;
+	memcpy(cards[card_count].rec, rec, len);
+	cards[card_count++].len = len;
+}
+
+static void add_apdu(const unsigned char *rec, size_t len)
+{
+	const unsigned char *cmd = rec + SC_TRACE_APDU_SIZE, *resp;
+	unsigned long duration = get_ulong(rec + 8), result = get_ulong(rec + 12);
+	size_t cmd_len = get_ulong(rec + 17), resp_len;
+	struct ins_stats *st;
+	int error;
+
+	if (cmd_len > len - SC_TRACE_APDU_SIZE)
+		return;
+	resp = cmd + cmd_len;
+	resp_len = len - SC_TRACE_APDU_SIZE - cmd_len;
+
+	if (rec[16] & SC_TRACE_APDU_CONTROL)
+		st = &stats[256];
+	else if (cmd_len >= 2)
+		st = &stats[cmd[1]];
+	else
+		return;
+
+	error = result != 0 || resp_len < 2
+		|| (resp[resp_len - 2] != 0x90 && resp[resp_len - 2] != 0x61);
+	if (st->count == 0 || duration < st->min)
+		st->min = duration;
+	if (duration > st->max)
+		st->max = duration;
+	st->count++;
+	st->total += duration;
+	st->sent += cmd_len;
+	st->received += resp_len;
+	if (error)
+		st->errors++;
+	exchanges++;
+	if (result != 0)
+		failed++;
+	total_time += duration;
+
+	if (!opt_list)
+		return;
+	printf("%5lu.%06lu %8lu us  ", get_ulong(rec), get_ulong(rec + 4), duration);
+	print_hex(cmd, cmd_len, 24);
+	if (result != 0)
+		printf(" -> %s\n", sc_strerror(result & 0x80000000UL
+				? -(int) (0xFFFFFFFFUL - result) - 1 : (int) result));
+	else if (resp_len >= 2)
+		printf(" -> %02X%02X (%lu bytes)\n", resp[resp_len - 2], resp[resp_len - 1],
+			(unsigned long) resp_len - 2);
+	else
+		printf(" ->\n");
+}
+
+static int read_trace(FILE *f, const char *name)
+{
+	unsigned char hdr[SC_TRACE_HDR_SIZE], *rec;
+	size_t len;
+	int rv = 0;
+
+	rec = malloc(MAX_RECORD);
+	if (rec == NULL)
+		return -1;
+	while (fread(hdr, sizeof(hdr), 1, f) == 1) {
+		len = get_ulong(hdr + 1);
+		if (len > MAX_RECORD) {
+			fprintf(stderr, "%s: invalid record length %lu\n", name, (unsigned long) len);
+			rv = -1;
+			break;
+		}
+		if (len && fread(rec, len, 1, f) != 1) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			rv = -1;
+			break;
+		}
+		switch (hdr[0]) {
+		case SC_TRACE_REC_SESSION:
+			if (len < SC_TRACE_SESSION_SIZE || memcmp(rec, SC_TRACE_MAGIC, 4)) {
+				fprintf(stderr, "%s: not an APDU trace\n", name);
+				free(rec);
+				return -1;
+			}
+			if ((rec[4] << 8 | rec[5]) != SC_TRACE_VERSION)
+				fprintf(stderr, "%s: unknown trace version %u\n", name, rec[4] << 8 | rec[5]);
+			sessions++;
+			if (opt_list)
+				printf("session of '%.*s', process %lu\n",
+					(int) (len - SC_TRACE_SESSION_SIZE),
+					(const char *) rec + SC_TRACE_SESSION_SIZE, get_ulong(rec + 8));
+			break;
+		case SC_TRACE_REC_CARD:
+			if (len >= SC_TRACE_CARD_SIZE)
+				add_card(rec, len);
+			break;
+		case SC_TRACE_REC_APDU:
+			if (len >= SC_TRACE_APDU_SIZE)
+				add_apdu(rec, len);
+			break;
+		default:
+			/* records of later versions */
+			break;
+		}
+	}
+	free(rec);
+	return rv;
+}
+
+static int compare_total(const void *a, const void *b)
+{
+	const struct ins_stats *sa = &stats[*(const int *) a], *sb = &stats[*(const int *) b];
+
+	if (sa->total != sb->total)
+		return sa->total < sb->total ? 1 : -1;
+	return *(const int *) a - *(const int *) b;
+}
+
+static void print_report(void)
+{
+	int order[257], i, n = 0;
+	const struct ins_stats *st;
+
+	for (i = 0; i < 257; i++)
+		if (stats[i].count)
+			order[n++] = i;
+	qsort(order, n, sizeof(order[0]), compare_total);
+
+	if (opt_list)
+		printf("\n");
+	for (i = 0; i < card_count; i++) {
+		print_card(cards[i].rec, cards[i].len);
+		free(cards[i].rec);
+	}
+	printf("\n%lu session(s), %lu exchange(s), %lu failed, %.3f ms in the reader\n\n",
+		sessions, exchanges, failed, total_time / 1000);
+	if (n == 0)
+		return;
+	printf("INS  %-30s %7s %6s %9s %9s %9s %11s %6s %9s %9s\n", "", "count", "errors",
+		"min us", "avg us", "max us", "total ms", "time", "sent", "received");
+	for (i = 0; i < n; i++) {
+		st = &stats[order[i]];
+		if (order[i] > 0xFF)
+			printf("--   ");
+		else
+			printf("%02X   ", order[i]);
+		printf("%-30s %7lu %6lu %9lu %9.0f %9lu %11.3f %5.1f%% %9lu %9lu\n",
+			ins_name(order[i]), st->count, st->errors, st->min,
+			st->total / st->count, st->max, st->total / 1000,
+			total_time > 0 ? st->total * 100 / total_time : 0.0,
+			st->sent, st->received);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i, rv = 0;
+	FILE *f;
+
+	while ((c = getopt_long(argc, argv, "l", options, NULL)) != -1) {
+		switch (c) {
+		case 'l':
+			opt_list = 1;
+			break;
+		default:
+			util_print_usage_and_die(app_name, options, option_help, "[FILE]...");
+		}
+	}
+
+	if (optind == argc)
+		rv |= read_trace(stdin, "stdin");
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "-")) {
+			rv |= read_trace(stdin, "stdin");
+			continue;
+		}
+		f = fopen(argv[i], "rb");
+		if (f == NULL) {
+			perror(argv[i]);
+			rv = -1;
+			continue;
+		}
+		rv |= read_trace(f, argv[i]);
+		fclose(f);
+	}
+	print_report();
+	return rv < 0;
+}
@@ -50,6 +50,7 @@
 #include "util.h"
 extern void *C_LoadModule(const char *name, CK_FUNCTION_LIST_PTR_PTR);
 extern CK_RV C_UnloadModule(void *module);
+extern void *C_GetModuleSymbol(void *module, const char *name);
 
 #define NEED_SESSION_RO	0x01
 #define NEED_SESSION_RW	0x02
@@ -101,7 +102,8 @@ enum {
 	OPT_NEW_PIN,
 	OPT_LOGIN_TYPE,
 	OPT_TEST_EC,
-	OPT_DERIVE
+	OPT_DERIVE,
+	OPT_SIGN_BATCH
 };
 
 static const struct option options[] = {
@@ -113,6 +115,7 @@ static const struct option options[] = {
 	{ "list-objects",	0, NULL,		'O' },
 
 	{ "sign",		0, NULL,		's' },
+	{ "sign-batch",		1, NULL,		OPT_SIGN_BATCH },
 	{ "hash",		0, NULL,		'h' },
 	{ "derive",		0, NULL,		OPT_DERIVE },
 	{ "mechanism",		1, NULL,		'm' },
@@ -170,6 +173,7 @@ static const char *option_help[] = {
 	"Show objects on token",
 
 	"Sign some data",
+	"Sign the input in pieces of <arg> bytes with one call (OpenSC extension)",
 	"Hash some data",
 	"Derive a secret key using another key and some data",
 	"Specify mechanism (use -M for a list of supported mechanisms)",
@@ -252,6 +256,7 @@ static int		opt_login_type = -1;
 static int		opt_key_usage_sign = 0;
 static int		opt_key_usage_decrypt = 0;
 static int		opt_key_usage_nonrepudiation = 0;
+static CK_ULONG		opt_batch_size = 0;
 
 static void *module = NULL;
 static CK_FUNCTION_LIST_PTR p11 = NULL;
@@ -316,6 +321,8 @@ static void		show_cert(CK_SESSION_HANDLE, CK_OBJECT_HANDLE);
 static void		show_dobj(CK_SESSION_HANDLE sess, CK_OBJECT_HANDLE obj);
 static void		sign_data(CK_SLOT_ID,
 				CK_SESSION_HANDLE, CK_OBJECT_HANDLE);
+static void		sign_batch(CK_SLOT_ID,
+				CK_SESSION_HANDLE, CK_OBJECT_HANDLE);
 static void		hash_data(CK_SLOT_ID, CK_SESSION_HANDLE);
 static void		derive_key(CK_SLOT_ID, CK_SESSION_HANDLE, CK_OBJECT_HANDLE);
 static int		gen_keypair(CK_SESSION_HANDLE,
@@ -529,6 +536,14 @@ int main(int argc, char * argv[])
 			do_sign = 1;
 			action_count++;
 			break;
+		case OPT_SIGN_BATCH:
+			need_session |= NEED_SESSION_RW;
+			do_sign = 1;
+			opt_batch_size = (CK_ULONG) strtoul(optarg, NULL, 0);
+			if (opt_batch_size == 0)
+				util_fatal("Invalid input size for --sign-batch");
+			action_count++;
+			break;
 		case 't':
 			need_session |= NEED_SESSION_RO;
 			do_test = 1;
@@ -805,7 +820,9 @@ int main(int argc, char * argv[])
 	if (do_list_objects)
 		list_objects(session, opt_object_class);
 
-	if (do_sign)
+	if (do_sign && opt_batch_size)
+		sign_batch(opt_slot, session, object);
+	else if (do_sign)
 		sign_data(opt_slot, session, object);
 
 	if (do_hash)
@@ -1343,6 +1360,102 @@ static int unlock_pin(CK_SLOT_ID slot, CK_SESSION_HANDLE sess, int login_type)
 	return 0;
 }
 
+static void sign_batch(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
+		CK_OBJECT_HANDLE key)
+{
+	CK_C_OpenSC_GetFunctionListExt get_function_list_ext;
+	CK_OPENSC_FUNCTION_LIST_PTR ext = NULL;
+	CK_MECHANISM	mech;
+	CK_RV		rv;
+	CK_BYTE_PTR	data = NULL, sigs, *in, *out;
+	CK_ULONG_PTR	in_len, out_len;
+	CK_ULONG	count, i;
+	size_t		len = 0, size = 0;
+	int		fd, r;
+
+	if (!opt_mechanism_used)
+		if (!find_mechanism(slot, CKF_SIGN|CKF_HW, NULL, 0, &opt_mechanism))
+			util_fatal("Sign mechanism not supported\n");
+
+	printf("Using signature algorithm %s\n", p11_mechanism_to_name(opt_mechanism));
+	memset(&mech, 0, sizeof(mech));
+	mech.mechanism = opt_mechanism;
+
+	if (opt_input == NULL)
+		fd = 0;
+	else if ((fd = open(opt_input, O_RDONLY|O_BINARY)) < 0)
+		util_fatal("Cannot open %s: %m", opt_input);
+	do {
+		if (len == size) {
+			size = size ? 2 * size : 4096;
+			if ((data = realloc(data, size)) == NULL)
+				util_fatal("out of memory");
+		}
+		r = read(fd, data + len, size - len);
+		if (r < 0)
+			util_fatal("Cannot read from %s: %m", opt_input);
+		len += r;
+	} while (r > 0);
+	if (fd != 0)
+		close(fd);
+
+	if (len == 0 || len % opt_batch_size)
+		util_fatal("The input is not a multiple of %lu bytes", opt_batch_size);
+	count = len / opt_batch_size;
+
+	/* every signature gets the buffer size of sign_data() */
+	in = calloc(count, sizeof(*in));
+	out = calloc(count, sizeof(*out));
+	in_len = calloc(count, sizeof(*in_len));
+	out_len = calloc(count, sizeof(*out_len));
+	sigs = malloc(count * 512);
+	if (in == NULL || out == NULL || in_len == NULL || out_len == NULL || sigs == NULL)
+		util_fatal("out of memory");
+	for (i = 0; i < count; i++) {
+		in[i] = data + i * opt_batch_size;
+		in_len[i] = opt_batch_size;
+		out[i] = sigs + i * 512;
+		out_len[i] = 512;
+	}
+
+	get_function_list_ext = (CK_C_OpenSC_GetFunctionListExt)
+			C_GetModuleSymbol(module, "C_OpenSC_GetFunctionListExt");
+	if (get_function_list_ext != NULL && get_function_list_ext(&ext) == CKR_OK
+			&& ext->version >= 1) {
+		rv = ext->C_OpenSC_SignBatch(session, &mech, key, count,
+				in, in_len, out, out_len);
+		if (rv != CKR_OK)
+			p11_fatal("C_OpenSC_SignBatch", rv);
+	} else {
+		fprintf(stderr, "The module cannot sign in batches, signing one input at a time\n");
+		for (i = 0; i < count; i++) {
+			rv = p11->C_SignInit(session, &mech, key);
+			if (rv != CKR_OK)
+				p11_fatal("C_SignInit", rv);
+			rv = p11->C_Sign(session, in[i], in_len[i], out[i], &out_len[i]);
+			if (rv != CKR_OK)
+				p11_fatal("C_Sign", rv);
+		}
+	}
+
+	if (opt_output == NULL)
+		fd = 1;
+	else if ((fd = open(opt_output, O_CREAT|O_TRUNC|O_WRONLY|O_BINARY, S_IRUSR|S_IWUSR)) < 0)
+		util_fatal("failed to open %s: %m", opt_output);
+	for (i = 0; i < count; i++)
+		if (write(fd, out[i], out_len[i]) < 0)
+			util_fatal("Failed to write to %s: %m", opt_output);
+	if (fd != 1)
+		close(fd);
+
+	free(sigs);
+	free(out_len);
+	free(in_len);
+	free(out);
+	free(in);
+	free(data);
+}
+
 static void sign_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		CK_OBJECT_HANDLE key)
 {